@@ -10,14 +10,20 @@ LI_API void li_angel_setup(liServer *srv);
 
 /* listen to a socket (mainloop context) */
 LI_API void li_angel_listen(liServer *srv, GString *str, liAngelListenCB cb, gpointer data);
+/* same with socket options (opts may be NULL); the options are remembered in the liServerSocket if cb is NULL */
+LI_API void li_angel_listen_options(liServer *srv, GString *str, const liListenOptions *opts, liAngelListenCB cb, gpointer data);
 
 /* send log messages during startup to angel, frees the string */
 LI_API void li_angel_log(liServer *srv, GString *str);
 
 LI_API void li_angel_log_open_file(liServer *srv, liEventLoop *loop, GString *filename, liAngelLogOpen, gpointer data);
 
+/* gets the shared counter table from the angel and sets srv->shm_counters (mainloop context); only if the config
+ * has named limits or throttle pools (srv->shm_counters_wanted) and there is an angel */
+LI_API void li_angel_shm_counters(liServer *srv);
+
 /* angle_fake definitions, only for internal use */
-int li_angel_fake_listen(liServer *srv, GString *str);
+int li_angel_fake_listen(liServer *srv, GString *str, const liListenOptions *opts);
 gboolean li_angel_fake_log(liServer *srv, GString *str);
 int li_angel_fake_log_open_file(liServer *srv, GString *filename);
 
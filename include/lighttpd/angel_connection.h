@@ -102,6 +102,14 @@ LI_API gboolean li_angel_send_simple_call(
 	GString *data,
 	GError **err);
 
+/* passes the fds to the other side (and closes them locally after sending; also on errors). the receiver finds
+ * them in acon->parse.fds while its receive callback runs; it has to set the array size to 0 to keep them */
+LI_API gboolean li_angel_send_simple_call_fds(
+	liAngelConnection *acon,
+	const gchar *mod, gsize mod_len, const gchar *action, gsize action_len,
+	GString *data, GArray *fds,
+	GError **err);
+
 LI_API gboolean li_angel_send_call(
 	liAngelConnection *acon,
 	const gchar *mod, gsize mod_len, const gchar *action, gsize action_len,
@@ -2,6 +2,14 @@
 #define _LIGHTTPD_ANGEL_PLUGIN_CORE_H_
 
 #include <lighttpd/angel_base.h>
+#include <lighttpd/shm_counters.h>
+
+/* limits for the listen options the angel applies for the workers (item "listen_options") */
+typedef struct liPluginCoreListenLimits liPluginCoreListenLimits;
+struct liPluginCoreListenLimits {
+	GPtrArray *congestion; /* <gchar*> allowed TCP_CONGESTION algorithms */
+	gint64 busy_poll, rcvbuf, sndbuf; /* maximum values; 0: option not allowed */
+};
 
 typedef struct liPluginCoreParsing liPluginCoreParsing;
 struct liPluginCoreParsing {
@@ -21,10 +29,13 @@ struct liPluginCoreParsing {
 	GPtrArray *wrapper; /* <gchar*> */
 
 	gint64 rlim_core, rlim_nofile;
+	gint64 processes;
+	gint64 shared_counters;
 
 	liInstanceConf *instconf;
 
 	GPtrArray *listen_masks;
+	liPluginCoreListenLimits listen_limits;
 };
 
 typedef struct liPluginCoreConfig liPluginCoreConfig;
@@ -35,10 +46,29 @@ struct liPluginCoreConfig {
 	/* Running */
 	liInstanceConf *instconf;
 	GPtrArray *listen_masks;
+	liPluginCoreListenLimits listen_limits;
 
-	liInstance *inst;
+	guint processes;
+	GPtrArray *instances; /* one instance per worker process */
 	GHashTable *listen_sockets;
 
+	int shm_counters_fd; /* -1 if not created yet; kept open across instance replacements */
+	guint shm_counters_slots;
+	guint shm_counters_owners;
+	liShmCounters *shm_counters; /* our mapping of shm_counters_fd, to release the counts of dead instances */
+	GPtrArray *shm_owners; /* <liInstance*> by owner index in shm_counters; NULL: free */
+
+	liServer *srv;
+
+	/* "angel:" log targets, written by log_thread (started with the first log data) */
+	GThread *log_thread;
+	GAsyncQueue *log_jobs; /* core_log_job* for log_thread */
+	gint log_queued; /* bytes waiting in log_jobs, atomic access */
+	gint log_dropped; /* bytes dropped because log_thread didn't keep up, atomic access */
+	GHashTable *log_files; /* only used by log_thread: path as sent by the worker -> core_log_file */
+	GAsyncQueue *log_errors; /* GString* messages from log_thread for the angel log */
+	liEventAsync log_errors_watcher;
+
 	liEventSignal sig_hup;
 };
 
@@ -36,9 +36,13 @@ struct liInstance {
 
 	liInstance *replace, *replace_by;
 
+	guint process_ndx; /* index of the worker process (multiple processes with the same config) */
+
 	liAngelConnection *acon;
 
 	GPtrArray *resources;
+
+	GPtrArray *worker_stats; /* last statistics (GString*) reported by each worker, by worker index; entries may be NULL */
 };
 
 struct liServer {
@@ -22,6 +22,7 @@
 #include <lighttpd/filter.h>
 #include <lighttpd/filter_chunked.h>
 #include <lighttpd/radix.h>
+#include <lighttpd/shm_counters.h>
 #include <lighttpd/fetch.h>
 
 #include <lighttpd/value.h>
@@ -48,6 +49,7 @@
 #include <lighttpd/connection.h>
 
 #include <lighttpd/collect.h>
+#include <lighttpd/warm_cache.h>
 #include <lighttpd/network.h>
 #include <lighttpd/etag.h>
 #include <lighttpd/utils.h>
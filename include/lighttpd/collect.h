@@ -32,7 +32,28 @@ LI_API liCollectInfo* li_collect_start(liWorker *ctx, liCollectFuncCB func, gpoi
 LI_API liCollectInfo* li_collect_start_global(liServer *srv, liCollectFuncCB func, gpointer fdata, liCollectCB cb, gpointer cbdata);
 LI_API void li_collect_break(liCollectInfo* ci); /** this will result in complete == FALSE in the callback; call it if cbdata gets invalid */
 
+/* statistics snapshots: each worker publishes one per second (from the stats timer), readers copy them
+ * from any thread without waiting for the worker (seqlock). use them for aggregated values; the collect
+ * functions above are for detailed dumps (connection lists, ...)
+ */
+struct liWorkerSnapshot {
+	guint worker_ndx;
+	li_tstamp ts;                 /** when the snapshot was published */
+	liStatistics stats;
+	guint connections_active;
+	guint connection_count[LI_CON_STATE_LAST+1];
+	guint connections_trimmed;
+	guint64 connection_memory;    /** see li_connection_memory_usage; updated every 5 seconds after li_collect_snapshot_want_memory, for a minute */
+	guint connections_pooled, vrequests_pooled;
+};
+
+/** any context; never blocks on the worker */
+LI_API void li_collect_snapshot_read(liWorker *wrk, liWorkerSnapshot *dest);
+/** any context; the next snapshots of the worker sum up the connection memory (walks all connections) */
+LI_API void li_collect_snapshot_want_memory(liWorker *wrk);
+
 /* internal functions */
+LI_API void li_collect_snapshot_publish(liWorker *wrk, gboolean full); /* worker context; full: sum up connection memory if wanted */
 LI_API void li_collect_watcher_cb(liEventBase *watcher, int events);
 
 #endif
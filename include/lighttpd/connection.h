@@ -40,6 +40,7 @@ struct liConnectionSocketCallbacks {
 	void (*finish)(liConnection *con, gboolean aborted);
 	liThrottleState* (*throttle_out)(liConnection *con);
 	liThrottleState* (*throttle_in)(liConnection *con);
+	void (*trim)(liConnection *con); /* optional: release buffers of an idle keep-alive connection */
 };
 
 struct liConnectionSocket {
@@ -64,7 +65,7 @@ struct liConnection {
 	liStream in, out;
 	liFilterChunkedDecodeState in_chunked_decode_state;
 
-	liVRequest *mainvr;
+	liVRequest *mainvr; /* NULL while the connection is trimmed (idle keep-alive) or dead after being trimmed */
 	liHttpRequestCtx req_parser_ctx;
 
 	li_tstamp ts_started; /* when connection was started, not a (v)request */
@@ -81,6 +82,9 @@ struct liConnection {
 	/* I/O read timeout data */
 	liWaitQueueElem io_timeout_elem;
 
+	/* trim after keepalive.trim_idle seconds in keep-alive */
+	liWaitQueueElem idle_trim_elem;
+
 	liJob job_reset;
 };
 
@@ -97,6 +101,16 @@ LI_API void li_connection_update_io_wait(liConnection *con);
 /** aborts an active connection, calls all plugin cleanup handlers */
 LI_API void li_connection_error(liConnection *con); /* used in worker.c */
 
+/* detaches the socket of an idle plain tcp keep-alive connection (without shutdown) and resets the connection;
+ * returns -1 if the connection can't be handed over (ssl, pending data) */
+LI_API int li_connection_handoff(liConnection *con); /* used in worker.c */
+
+/* releases the main vrequest and buffers of an idle keep-alive connection; they are recreated on the next read */
+LI_API void li_connection_trim(liConnection *con); /* used in worker.c */
+
+/* approximate memory used by the connection (not including the socket buffers of the kernel) */
+LI_API gsize li_connection_memory_usage(liConnection *con);
+
 LI_API void li_connection_start(liConnection *con, liSocketAddress remote_addr, int s, liServerSocket *srv_sock);
 
 /* public function */
@@ -125,6 +139,9 @@ LI_API void li_connection_update_io_timeout(liConnection *con);
  */
 LI_API void li_connection_simple_tcp(liConnection **pcon, liIOStream *stream, gpointer *context, liIOStreamEvent event);
 
+/* releases the read buffer in context (from li_connection_simple_tcp); use it in the trim callback */
+LI_API void li_connection_simple_tcp_trim(liConnection *con, gpointer *context);
+
 /******************************************************/
 
 
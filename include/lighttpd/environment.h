@@ -1,12 +1,18 @@
 #ifndef _LIGHTTPD_ENVIRONMENT_H_
 #define _LIGHTTPD_ENVIRONMENT_H_
 
-#include <lighttpd/settings.h>
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
 
 typedef struct liEnvironment liEnvironment;
 
 typedef struct liEnvironmentDup liEnvironmentDup;
 
+typedef struct liEnvironmentHeaderFilter liEnvironmentHeaderFilter;
+
+typedef struct liEnvironmentPrefixCache liEnvironmentPrefixCache;
+
 struct liEnvironment {
 	GHashTable *table;
 };
@@ -36,6 +42,41 @@ LI_API void li_environment_dup_free(liEnvironmentDup *envdup);
 /* remove an entry (this is allowed - it doesn't modify anything in the original environment);
    you must not modify the returned GString */
 LI_API GString* li_environment_dup_pop(liEnvironmentDup *envdup, const gchar *key, size_t keylen);
+LI_API gboolean li_environment_dup_has(liEnvironmentDup *envdup, const gchar *key, size_t keylen);
+
+/* which request headers are passed to CGI style backends ("backend.headers" option):
+   a header is passed if it doesn't match a deny entry and matches an allow entry (or there are none).
+   names are compared case-insensitive, a trailing '*' matches any suffix */
+struct liEnvironmentHeaderFilter {
+	GPtrArray *allow, *deny; /* GString* */
+};
+
+LI_API liEnvironmentHeaderFilter* li_environment_header_filter_new(void);
+LI_API void li_environment_header_filter_free(liEnvironmentHeaderFilter *filter);
+LI_API void li_environment_header_filter_add(liEnvironmentHeaderFilter *filter, gboolean allow, const gchar *name, size_t namelen);
+/* filter can be NULL (passes everything) */
+LI_API gboolean li_environment_header_filter_pass(liEnvironmentHeaderFilter *filter, const gchar *name, size_t namelen);
+
+typedef void (*liEnvironmentAddCB)(gpointer param, const gchar *key, size_t keylen, const gchar *val, size_t valuelen);
+
+/* calls cb for each request header passing the "backend.headers" filter with its CGI name:
+   "HTTP_" + name in uppercase with all other characters than letters and digits replaced by '_'
+   ("Content-Type" becomes "CONTENT_TYPE"); the names of common headers are precomputed */
+LI_API void li_environment_cgi_headers(liVRequest *vr, liEnvironmentAddCB cb, gpointer param);
+/* CGI name of a single header; returns a static string or tmp->str */
+LI_API const gchar* li_environment_cgi_header_name(GString *tmp, const gchar *name, guint len, guint *cgi_len);
+
+/* pre-encoded variables of CGI style backends which only depend on server.tag (SERVER_SOFTWARE, ...),
+   one block per tag value. create encodes the variables named in keys (NULL terminated, must stay
+   valid) for tag; blocks are never modified and only freed with the cache */
+typedef void (*liEnvironmentPrefixCreateCB)(GByteArray *buf, GString *tag);
+
+LI_API liEnvironmentPrefixCache* li_environment_prefix_cache_new(liEnvironmentPrefixCreateCB create, const gchar * const *keys);
+LI_API void li_environment_prefix_cache_free(liEnvironmentPrefixCache *cache);
+/* threadsafe; returns the block for tag, NULL if envdup (may be NULL) overrides one of the keys */
+LI_API GByteArray* li_environment_prefix_cache_get(liEnvironmentPrefixCache *cache, liEnvironmentDup *envdup, GString *tag);
 
+/* statistics: an environment of size bytes was sent to a backend */
+LI_API void li_environment_cgi_account(liVRequest *vr, gsize size);
 
 #endif
@@ -8,9 +8,19 @@
 LI_API liTristate li_http_response_handle_cachable_etag(liVRequest *vr, GString *etag);
 LI_API liTristate li_http_response_handle_cachable_modified(liVRequest *vr, GString *last_modified);
 LI_API gboolean li_http_response_handle_cachable(liVRequest *vr);
+/* returns FALSE if an If-Range header doesn't match the response ETag / Last-Modified header (-> ignore Range) */
+LI_API gboolean li_http_response_handle_if_range(liVRequest *vr);
 
 /* mut maybe the same as etag */
 LI_API void li_etag_mutate(GString *mut, GString *etag);
 LI_API void li_etag_set_header(liVRequest *vr, struct stat *st, gboolean *cachable);
 
+/* server wide cache of content digests (etag.use "content"), keyed by (device, inode, size, mtime) */
+LI_API liContentHashCache* li_content_hash_cache_new(void);
+LI_API void li_content_hash_cache_free(liContentHashCache *chc);
+
+/* copies the quoted content digest of the file vr->physical.path (with stat info st) to dest and returns TRUE if it is known;
+ * otherwise calculating it is started in the tasklet pool and FALSE is returned */
+LI_API gboolean li_etag_content_hash(liVRequest *vr, struct stat *st, GString *dest);
+
 #endif
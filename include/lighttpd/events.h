@@ -107,7 +107,13 @@ struct liEventLoop {
 	struct ev_loop *loop;
 	liJobQueue jobqueue;
 	GQueue watchers;
-	GQueue closing_sockets;
+	/* closing sockets, see li_event_add_closing_socket */
+	GArray *closing_new; /* int fds, handled before the loop blocks again */
+	GPtrArray *closing_blocks; /* pool blocks of sockets waiting for EOF, see events.c */
+	GQueue closing_free; /* unused pool entries */
+	GQueue closing_lingering; /* sockets waiting for EOF, ordered by timeout */
+	liEventPrepare closing_prepare;
+	liEventTimer closing_timer;
 	/* whether loop should exit once all "keep_loop_alive" watchers are dead */
 	unsigned int end:1;
 };
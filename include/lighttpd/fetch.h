@@ -63,6 +63,8 @@ LI_API void li_fetch_entry_release(liFetchEntry *entry);
 
 /* "management" API */
 LI_API void li_fetch_invalidate(liFetchDatabase* db, GString *key);
+/* appends copies (GString*) of the keys of all cached positive entries to keys, least recently used first */
+LI_API void li_fetch_database_keys(liFetchDatabase* db, GPtrArray *keys);
 
 /***********************************************/
 /*              API for backends               */
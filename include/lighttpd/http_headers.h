@@ -21,6 +21,7 @@ struct liHttpHeader {
 
 struct liHttpHeaders {
 	GQueue entries;
+	GQueue spare;     /** unused entries kept by li_http_headers_reset for reuse */
 };
 
 typedef struct liHttpHeaderTokenizer liHttpHeaderTokenizer;
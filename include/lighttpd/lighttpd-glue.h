@@ -3,6 +3,8 @@
 
 /* returns the description for a given http status code and sets the len to the length of the returned string */
 LI_API gchar *li_http_status_string(guint status_code, guint *len);
+/* returns the status line without the "HTTP/1.x " prefix ("<code> <description>\r\n") from a precomputed table, or NULL if the code is not in the table (< 100 or > 599) */
+LI_API const gchar *li_http_status_line(guint status_code, guint *len);
 /* returns the liHttpMethod enum entry matching the given string */
 LI_API liHttpMethod li_http_method_from_string(const gchar *method_str, gssize len);
 /* returns the http method as a string and sets len to the length of the returned string */
@@ -1,17 +1,25 @@
 #ifndef _LIGHTTPD_MIMETYPE_H_
 #define _LIGHTTPD_MIMETYPE_H_
 
-struct liMimetypeNode {
-	guchar cmin;
-	guchar cmax;
-	gpointer *children; /* array of either liMimetypeNode* or GString* */
-	GString *mimetype;
-};
-typedef struct liMimetypeNode liMimetypeNode;
+/* compiled "mime_types" table: maps filename suffixes to mimetypes, the longest matching suffix wins.
+ *
+ * li_mimetype_table_compile builds a perfect hash ("hash and displace"), so every suffix has exactly one
+ * slot it can be in, and there is no probing. a lookup checks the suffixes of the filename longest first,
+ * hashing only those whose length and first character appear in the table (usually the extension).
+ * compiled tables are immutable and shared between identical option values (refcounted).
+ */
+typedef struct liMimetypeTable liMimetypeTable;
 
-LI_API liMimetypeNode *li_mimetype_node_new(void);
-LI_API void li_mimetype_node_free(liMimetypeNode *node);
-LI_API void li_mimetype_insert(liMimetypeNode *node, GString *suffix, GString *mimetype);
+/* takes ownership of default_mimetype */
+LI_API liMimetypeTable* li_mimetype_table_new(GString *default_mimetype);
+/* takes ownership of mimetype; a later insert for the same suffix overrides the previous one. only before compile */
+LI_API void li_mimetype_table_insert(liMimetypeTable *table, GString *suffix, GString *mimetype);
+/* finishes building the table; returns either the table or an identical already compiled one (and frees table) */
+LI_API liMimetypeTable* li_mimetype_table_compile(liMimetypeTable *table);
+LI_API void li_mimetype_table_release(liMimetypeTable *table);
+
+/* do not free the result */
+LI_API GString* li_mimetype_table_lookup(const liMimetypeTable *table, const gchar *filename, gsize len);
 
 /* looks up the mimetype for a filename by comparing suffixes. longest match is returned. do not free the result */
 LI_API GString *li_mimetype_get(liVRequest *vr, GString *filename);
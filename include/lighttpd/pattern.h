@@ -3,8 +3,8 @@
 
 /* liPattern are a parsed representation of a string that can contain various placeholders like $n, %n, %{var} or {enc:var} */
 
-/* liPattern is a GArray in disguise */
-typedef GArray liPattern;
+/* liPattern is opaque: the parts, with all literal text in one buffer, and a hint for the result length */
+typedef struct liPattern liPattern;
 
 /* a pattern callback receives an integer index range [from-to] and a data pointer (usually an array) and must return a GString* which gets inserted into the pattern result
  * "from" doesn't have to be smaller than "to" (allows reverse ranges)!
@@ -15,6 +15,9 @@ typedef void (*liPatternCB) (GString *pattern_result, guint from, guint to, gpoi
 LI_API liPattern *li_pattern_new(liServer *srv, const gchar* str);
 LI_API void li_pattern_free(liPattern *pattern);
 
+/* TRUE if the result only depends on the nth callback (no %n and no %{var} placeholders) */
+LI_API gboolean li_pattern_only_nth(liPattern *pattern);
+
 /* appends the result to "dest". use (and truncate) vr->wrk->tmp_str as "dest" if possible */
 LI_API void li_pattern_eval(liVRequest *vr, GString *dest, liPattern *pattern, liPatternCB nth_callback, gpointer nth_data, liPatternCB nth_prev_callback, gpointer nth_prev_data);
 
@@ -3,12 +3,13 @@
 
 #include <lighttpd/base.h>
 
-typedef enum { LI_ETAG_USE_INODE = 1, LI_ETAG_USE_MTIME = 2, LI_ETAG_USE_SIZE = 4 } liETagFlags;
+typedef enum { LI_ETAG_USE_INODE = 1, LI_ETAG_USE_MTIME = 2, LI_ETAG_USE_SIZE = 4, LI_ETAG_USE_CONTENT = 8 } liETagFlags;
 
 enum liCoreOptions {
 	LI_CORE_OPTION_DEBUG_REQUEST_HANDLING = 0,
 
 	LI_CORE_OPTION_STATIC_RANGE_REQUESTS,
+	LI_CORE_OPTION_STATIC_MAX_RANGES,
 
 	LI_CORE_OPTION_MAX_KEEP_ALIVE_IDLE,
 	LI_CORE_OPTION_MAX_KEEP_ALIVE_REQUESTS,
@@ -27,6 +28,8 @@ enum liCoreOptionPtrs {
 	LI_CORE_OPTION_SERVER_TAG,
 
 	LI_CORE_OPTION_MIME_TYPES,
+
+	LI_CORE_OPTION_BACKEND_HEADERS,
 };
 
 /* the core plugin always has base index 0, as it is the first plugin loaded */
@@ -33,6 +33,7 @@ struct liServerSocket {
 	liEventIO watcher;
 
 	liSocketAddress local_addr;
+	GString *listen_options; /* "key=value\n" list of non-default listen options, NULL if none */
 
 	/* Custom sockets (ssl) */
 	gpointer data;
@@ -51,6 +52,8 @@ struct liServer {
 	guint32 magic;            /** server magic version, check against LIGHTTPD_SERVER_MAGIC in plugins */
 	liServerState state, dest_state;       /** atomic access */
 	liAngelConnection *acon;
+	liShmCounters *shm_counters; /** shared between processes (see li_angel_shm_counters); may be NULL */
+	gint shm_counters_wanted;    /** set (atomic) when a named limit or throttle pool is created */
 
 	/* state machine handling */
 	GMutex *statelock;
@@ -62,13 +65,16 @@ struct liServer {
 
 	liWorker *main_worker;
 	guint worker_count;
+	guint process_ndx;       /** index of this process if the angel runs multiple processes ("processes"), 0 otherwise */
 	GArray *workers;
 #ifdef LIGHTY_OS_LINUX
 	liValue *workers_cpu_affinity;
+	GArray *numa_cpu_nodes;  /** cpu -> numa node (gint, -1: unknown); NULL unless workers are bound and there is more than one node */
 #endif
 	GArray *ts_formats;      /** array of (GString*), add with li_server_ts_format_add() */
 
 	guint loop_flags;
+	guint event_backends;     /** EVBACKEND_* flags for new worker loops ("event.backend"), 0: libev default */
 	liEventSignal
 		sig_w_INT,
 		sig_w_TERM,
@@ -115,13 +121,32 @@ struct liServer {
 	guint connection_load, max_connections;
 	gboolean connection_limit_hit; /** true if limit was hit and the sockets are disabled */
 
+	/* admission control ("overload" setup), see li_worker_overloaded; a limit of 0 disables the signal */
+	gdouble overload_loop_lag;        /** max event loop lag of a worker in seconds */
+	guint overload_backend_waiting;   /** max vrequests waiting for a backend connection (all pools) */
+	guint64 overload_memory;          /** max resident memory in bytes */
+	guint overload_retry_after;       /** Retry-After (seconds) for shed requests */
+	liRadixTree *priority_ipv4, *priority_ipv6; /** clients still accepted if max_connections is reached, NULL: none */
+	guint priority_connections;       /** connections above max_connections reserved for priority clients, 0: max_connections/16, at least 16 */
+	gdouble backend_codel_target, backend_codel_interval; /** CoDel on backend wait queues, target 0: disabled */
+	gint backend_waiting;             /** vrequests waiting for a backend connection, atomic access */
+	gint memory_overloaded;           /** set by the 1sec timer, atomic access */
+
 	/* keep alive timeout */
 	guint keep_alive_queue_timeout;
+	guint keep_alive_trim_idle; /** trim keep-alive connections after that many seconds, 0: disabled */
+
+	/* per worker pools of unused connections and vrequests; max 0: unlimited */
+	guint connection_pool_min, connection_pool_max, vrequest_pool_max;
+	gdouble pool_shrink_interval; /** free objects not needed during that many seconds */
 
 	gdouble io_timeout;
 
 	gdouble stat_cache_ttl;
 	gint tasklet_pool_threads;
+
+	liWarmCache *warm_cache;
+	liContentHashCache *content_hashes; /** etag.use "content" digests, shared by all workers */
 };
 
 
@@ -130,6 +155,8 @@ LI_API void li_server_free(liServer* srv);
 LI_API void li_server_loop_init(liServer *srv);
 
 LI_API liServerSocket* li_server_listen(liServer *srv, int fd);
+/* takes over an already accepted connection (handed over by a previous instance); FALSE if no listening socket matches */
+LI_API gboolean li_server_adopt_connection(liServer *srv, int s);
 
 /* exit asap with cleanup */
 LI_API void li_server_exit(liServer *srv);
@@ -0,0 +1,51 @@
+#ifndef _LIGHTTPD_SHM_COUNTERS_H_
+#define _LIGHTTPD_SHM_COUNTERS_H_
+
+#include <lighttpd/settings.h>
+#include <lighttpd/events.h>
+
+/*
+ * fixed size table of counters in shared memory, used to share limits between worker processes
+ * and to keep them across instance replacements (the angel creates the table and keeps it open).
+ *
+ * open addressing, lock-free (atomic operations only); keys are hashes (see li_shm_counters_key),
+ * colliding keys share a counter. stale entries (not used for some seconds) get reused; if no slot
+ * is available the operations report it, the caller has to count in process memory instead.
+ *
+ * gauge increments are also recorded per owner (one owner for each running worker process, assigned
+ * by the angel), so the angel can release the increments of a process that died without releasing them.
+ */
+
+typedef struct liShmCounters liShmCounters;
+
+/* creates a new shared memory file for (at least) slots counters and owners gauge owners; returns the fd or -1 */
+LI_API int li_shm_counters_create_fd(guint slots, guint owners, GError **err);
+
+/* maps the table; gauge increments are recorded for owner (-1: not recorded). takes ownership of fd (also on error) */
+LI_API liShmCounters* li_shm_counters_map(int fd, gint owner, GError **err);
+LI_API void li_shm_counters_free(liShmCounters *counters);
+
+/* key for data in namespace ns (name of the limit instance) */
+LI_API gsize li_shm_counters_key(const gchar *ns, gsize ns_len, gconstpointer data, gsize len);
+
+/* gauge (e.g. active connections): increments the counter if it is below limit.
+ * returns a handle for li_shm_counters_dec (>= 0), -1 if the limit is reached or -2 if the table is full
+ */
+LI_API gint li_shm_counters_inc(liShmCounters *counters, gsize key, gint limit, li_tstamp now);
+LI_API void li_shm_counters_dec(liShmCounters *counters, gint handle, li_tstamp now);
+
+/* the process of owner is gone: releases the gauge increments it still held; returns their number */
+LI_API guint li_shm_counters_release_owner(liShmCounters *counters, guint owner);
+
+/* rate (events per second): counts the event; returns 0, -1 if more than limit events happened in this second
+ * or -2 if the table is full
+ */
+LI_API gint li_shm_counters_rate(liShmCounters *counters, gsize key, gint limit, li_tstamp now);
+
+/* token bucket (rate/burst in units per second): refills the bucket at most every
+ * granularity milliseconds and takes up to want tokens; returns the number of tokens taken
+ * (want if the table is full: the caller's own bucket already limits to the process local rate)
+ */
+LI_API guint li_shm_counters_take(liShmCounters *counters, gsize key, guint rate, guint burst, guint granularity, li_tstamp now, guint want);
+
+#endif
@@ -9,8 +9,9 @@
  *
  * Entries are removed after 10 seconds (adjustable through stat_cache.ttl setup)
  *
+ * ETag and Last-Modified header values are cached in the entry (see li_stat_cache_lookup).
+ *
  * TODO:
- *     - create ETAGs
  *     - get content type from xattr
  *     - add support for inotify (linux). TTL for entries can be increased to 60s
  *
@@ -41,7 +42,9 @@
 
 struct liStatCacheEntryData {
 	GString *path;
-	GString *etag;
+	GString *etag;                    /* cached ETag value, computed for etag_flags; NULL if not computed yet */
+	GString *last_modified;           /* cached Last-Modified value; NULL if not computed yet */
+	guint etag_flags;
 	GString *content_type;
 	gboolean failed;
 	struct stat st;
@@ -99,6 +102,20 @@ LI_API liHandlerResult li_stat_cache_get_sync(liVRequest *vr, GString *path, str
 */
 LI_API liHandlerResult li_stat_cache_get_dirlist(liVRequest *vr, GString *path, liStatCacheEntry **result);
 
+/*
+ copies the cached stat info for path to st without any syscall; returns FALSE if there is no finished
+ (and not failed) entry. the info can be up to the stat cache ttl old.
+*/
+LI_API gboolean li_stat_cache_get_cached(liVRequest *vr, GString *path, struct stat *st);
+
+/*
+ returns the finished (and not failed) cache entry for path without blocking, or NULL if there is none.
+ if the cached stat info doesn't match st (inode, device, size or mtime changed) the entry is updated
+ with st and cached values derived from it (etag, last_modified) are dropped.
+ the entry is not assigned to the vrequest, so don't keep the pointer beyond the current handler call.
+*/
+LI_API liStatCacheEntry* li_stat_cache_lookup(liVRequest *vr, GString *path, struct stat *st);
+
 LI_API void li_stat_cache_entry_acquire(liVRequest *vr, liStatCacheEntry *sce);
 /* release a stat_cache_entry so it can be cleaned up */
 LI_API void li_stat_cache_entry_release(liVRequest *vr, liStatCacheEntry *sce);
@@ -17,6 +17,8 @@ LI_API void li_throttle_update(liThrottleState *state, guint used);
 LI_API liThrottlePool* li_throttle_pool_new(liServer *srv, guint rate, guint burst);
 LI_API void li_throttle_pool_acquire(liThrottlePool *pool);
 LI_API void li_throttle_pool_release(liThrottlePool *pool, liServer *srv);
+/* share the pool between processes: key in srv->shm_counters (see li_shm_counters_key), used if the server has shared counters */
+LI_API void li_throttle_pool_share(liThrottlePool *pool, gsize key);
 
 /* returns whether pool was actually added (otherwise it already was added) */
 LI_API gboolean li_throttle_add_pool(liWorker *wrk, liThrottleState *state, liThrottlePool *pool);
@@ -124,6 +124,7 @@ typedef enum {
 	LI_LOG_TYPE_FILE,
 	LI_LOG_TYPE_PIPE,
 	LI_LOG_TYPE_SYSLOG,
+	LI_LOG_TYPE_ANGEL,
 	LI_LOG_TYPE_NONE
 } liLogType;
 
@@ -265,4 +266,12 @@ typedef struct liStatCacheEntryData liStatCacheEntryData;
 typedef struct liStatCacheEntry liStatCacheEntry;
 typedef struct liStatCache liStatCache;
 
+/* etag.h */
+
+typedef struct liContentHashCache liContentHashCache;
+
+/* warm_cache.h */
+
+typedef struct liWarmCache liWarmCache;
+
 #endif
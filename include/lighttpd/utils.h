@@ -93,6 +93,45 @@ INLINE void li_g_string_free(gpointer data);
 /* src will be empty after the merge, and dest' = dest (++) src */
 LI_API void li_g_queue_merge(GQueue *dest, GQueue *src);
 
+/* seqlock: one thread writes a data block, any thread can copy it without blocking the writer.
+ * *seq is odd while the block gets written; the writer copies src into the block, readers
+ * retry until they got a consistent copy of it */
+LI_API void li_seqlock_write(gint *seq, gpointer block, gconstpointer src, gsize size);
+LI_API void li_seqlock_read(gint *seq, gpointer dest, gconstpointer block, gsize size);
+
+/* listen socket options: configured in the worker; the angel creates the socket with the options it has to
+ * apply (within the limits of its config), the worker applies the others on the received socket */
+typedef struct liListenOptions liListenOptions;
+struct liListenOptions {
+	gint backlog;          /* listen() backlog, default 1000 */
+	gint defer_accept;     /* TCP_DEFER_ACCEPT timeout in seconds, 0: disabled */
+	gint rcvbuf, sndbuf;   /* SO_RCVBUF / SO_SNDBUF, 0: system default */
+	gint notsent_lowat;    /* TCP_NOTSENT_LOWAT, 0: system default */
+	gint busy_poll;        /* SO_BUSY_POLL in microseconds, 0: disabled */
+	gint reuseport;        /* number of SO_REUSEPORT sockets in the group, 0: single socket without SO_REUSEPORT */
+	GString *congestion;   /* TCP_CONGESTION algorithm, NULL: system default */
+};
+
+LI_API void li_listen_options_init(liListenOptions *opts);
+LI_API void li_listen_options_clear(liListenOptions *opts);
+/* all values but "congestion" are non-negative integers */
+LI_API gboolean li_listen_options_set(liListenOptions *opts, const gchar *key, const gchar *value, GError **error);
+/* appends "key=value\n" for every option which differs from the default */
+LI_API void li_listen_options_to_string(const liListenOptions *opts, GString *dest);
+LI_API gboolean li_listen_options_from_string(liListenOptions *opts, const gchar *str, gsize len, GError **error);
+/* rcvbuf, sndbuf, reuseport, busy_poll and congestion (may need privileges; the angel checks them against its config).
+ * call before bind(); tcp options are skipped for other families. use opts->backlog for listen() */
+LI_API gboolean li_listen_options_apply(const liListenOptions *opts, int fd, int family, GError **error);
+/* defer_accept and notsent_lowat (any process may set them): sets them even if 0, so a reused socket gets reset.
+ * the worker applies them to the sockets it gets from the angel */
+LI_API gboolean li_listen_options_apply_unprivileged(const liListenOptions *opts, int fd, int family, GError **error);
+/* resets the options of li_listen_options_apply set in prev but not in opts to the system defaults (before
+ * li_listen_options_apply on a reused socket); rcvbuf/sndbuf can't be reset (error)
+ */
+LI_API gboolean li_listen_options_reset(const liListenOptions *prev, const liListenOptions *opts, int fd, int family, GError **error);
+/* dest gets cleared first */
+LI_API void li_listen_options_copy(liListenOptions *dest, const liListenOptions *src);
+
 /* error log helper functions */
 #define LI_REMOVE_PATH_FROM_FILE 1
 LI_API const char *li_remove_path(const char *path);
@@ -107,7 +146,7 @@ LI_API const char *li_remove_path(const char *path);
 LI_API GQuark li_sys_error_quark(void);
 
 #define LI_SET_SYS_ERROR(error, msg) \
-	_li_set_sys_error(error, msg, REMOVE_PATH(__FILE__), __LINE__);
+	_li_set_sys_error(error, msg, LI_REMOVE_PATH(__FILE__), __LINE__)
 
 LI_API gboolean _li_set_sys_error(GError **error, const gchar *msg, const gchar *file, int lineno);
 
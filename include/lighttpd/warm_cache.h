@@ -0,0 +1,53 @@
+#ifndef _LIGHTTPD_WARM_CACHE_H_
+#define _LIGHTTPD_WARM_CACHE_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * warm cache snapshots
+ *
+ * While running (every minute and when suspending) and on a graceful stop the keys (never the values) of
+ * registered caches are written to a snapshot file ("warm_cache.snapshot" setup; one file per process if the
+ * angel runs multiple processes). On the next start the keys are prefetched in the background while the
+ * server is going to the WARMUP state; the state (and therefore "ready" for the angel, which stops the
+ * instance we replace only then) is reached after all prefetches are done, or after a timeout.
+ *
+ * The stat cache is always registered (as "stat"); modules register their own caches, the names must be
+ * stable across restarts with the same config.
+ */
+
+/* called in each worker context when the worker stops: append the keys to keys (GString*, ownership is transferred) */
+typedef void (*liWarmCacheDumpCB)(liWorker *wrk, gpointer data, GPtrArray *keys);
+
+/* called in the main worker with the keys (GString*) from the snapshot; the keys are only valid during the call.
+ * use li_warm_cache_wait/li_warm_cache_done to delay the WARMUP state for background work
+ */
+typedef void (*liWarmCachePrefetchCB)(liServer *srv, gpointer data, GPtrArray *keys);
+
+typedef void (*liWarmCacheFreeCB)(liServer *srv, gpointer data);
+
+LI_API void li_warm_cache_register(liServer *srv, const gchar *name, liWarmCacheDumpCB dump_cb, liWarmCachePrefetchCB prefetch_cb, liWarmCacheFreeCB free_cb, gpointer data);
+/* registers the keys of a fetch database (acquires a reference) */
+LI_API void li_warm_cache_register_fetch_database(liServer *srv, const gchar *name, liFetchDatabase *db);
+
+/* each li_warm_cache_wait needs a li_warm_cache_done; done is threadsafe */
+LI_API void li_warm_cache_wait(liServer *srv);
+LI_API void li_warm_cache_done(liServer *srv);
+
+/* internal */
+LI_API void li_warm_cache_init(liServer *srv);
+LI_API void li_warm_cache_free(liServer *srv);
+/* takes ownership of filename */
+LI_API void li_warm_cache_set_snapshot(liServer *srv, GString *filename);
+/* transition to WARMUP: load the snapshot and start prefetching */
+LI_API void li_warm_cache_prefetch(liServer *srv);
+/* worker stops: collect keys (in the worker context) */
+LI_API void li_warm_cache_dump_worker(liWorker *wrk);
+/* after all workers are stopped (before they are freed): write snapshot */
+LI_API void li_warm_cache_save(liServer *srv);
+/* collect keys from the running workers and write the snapshot (main worker context, asynchronous) */
+LI_API void li_warm_cache_snapshot(liServer *srv);
+
+#endif
@@ -11,6 +11,7 @@
 struct lua_State;
 
 typedef struct liStatistics liStatistics;
+typedef struct liWorkerSnapshot liWorkerSnapshot; /* see collect.h */
 struct liStatistics {
 	guint64 bytes_out;        /** bytes transfered, outgoing */
 	guint64 bytes_in;         /** bytes transfered, incoming */
@@ -42,6 +43,12 @@ struct liStatistics {
 	guint64 last_requests;
 	double requests_per_sec;
 	li_tstamp last_update;
+
+	/* environments sent to CGI style backends (fastcgi, scgi) */
+	guint64 backend_envs;                 /** environments built */
+	guint64 backend_env_bytes;            /** encoded size of all environments */
+	guint64 backend_env_max;              /** largest encoded environment */
+	guint64 backend_env_headers_filtered; /** request headers not passed (backend.headers) */
 };
 
 typedef struct liWorkerTS liWorkerTS;
@@ -55,6 +62,7 @@ struct liWorker {
 
 	GThread *thread; /* managed by server.c */
 	guint ndx;       /* worker index */
+	gint numa_node;  /* numa node all cpus of the worker belong to, -1 if unknown/unbound */
 
 	liLuaState LL;
 
@@ -67,7 +75,7 @@ struct liWorker {
 	guint connections_active; /** 0..con_act-1: active connections, con_act..used-1: free connections
 	                            * use with atomic, read direct from local worker context
 	                            */
-	guint connections_active_max_5min; /** max() of active connections during the last 5 minutes */
+	guint connections_active_max_5min; /** max() of active connections since the last pool shrinking (pool_shrink_interval) */
 	GArray *connections;      /** array of (connection*), use only from local worker context */
 	li_tstamp connections_gc_ts;
 
@@ -79,6 +87,10 @@ struct liWorker {
 
 	liWaitQueue io_timeout_queue;
 
+	liWaitQueue idle_trim_queue;
+	GQueue vrequest_pool;     /** main vrequests of dead and trimmed connections, use only from local worker context */
+	guint vrequest_pool_min_5min; /** min() of the vrequest pool length since the last pool shrinking */
+
 	liWaitQueue throttle_queue;
 
 	guint connection_load;    /** incremented by server_accept_cb, decremented by worker_con_put. use atomic access */
@@ -95,16 +107,25 @@ struct liWorker {
 
 	liEventTimer stats_watcher;
 	liStatistics stats;
+	li_tstamp loop_lag;       /** how late the stats timer fired last time, use only from local worker context */
 
 	/* collect framework */
 	liEventAsync collect_watcher;
 	GAsyncQueue *collect_queue;
 
+	liWorkerSnapshot *snapshot; /** published every second by the stats timer, read with li_collect_snapshot_read */
+	gint snapshot_seq;          /** seqlock for snapshot: odd while it gets written, atomic access */
+	guint *connection_state_count; /** LI_CON_STATE_LAST+1 entries: connections (including free ones) in each state, use only from local worker context */
+	guint connections_trimmed;  /** active connections without vrequest (li_connection_trim), use only from local worker context */
+	gint connection_memory_wanted; /** atomic; set by li_collect_snapshot_want_memory, cleared when nobody asked for a while */
+
 	liTaskletPool *tasklets;
 
 	liStatCache *stat_cache;
+	GHashTable *docroot_cache; /** (GString*) key => resolved docroot, see li_worker_docroot_cache_lookup */
 
 	liBuffer *network_read_buf; /** available buffer - steal it if you need it, can be NULL. refcount must be 1, no other references. */
+	liBuffer *scratch_buf; /** small generated output (response heads, chunked framing) is written into slices of it, see li_worker_scratch_buffer; can be NULL */
 };
 
 LI_API liWorker* li_worker_new(liServer *srv, struct ev_loop *loop);
@@ -121,6 +142,23 @@ LI_API void li_worker_stopping(liWorker *context, liWorker *wrk);
 LI_API void li_worker_suspend(liWorker *context, liWorker *wrk);
 LI_API void li_worker_exit(liWorker *context, liWorker *wrk);
 
+/* returns a buffer with at least len bytes free space at buf->used, the caller owns one reference.
+ * write the data, increment buf->used and append the slice with li_chunkqueue_append_buffer2;
+ * consecutive calls return consecutive slices of the same buffer as long as it has space.
+ */
+LI_API liBuffer* li_worker_scratch_buffer(liWorker *wrk, gsize len);
+
+/* cache for resolved document roots (docroot, userdir); entries expire after the stat cache ttl, nothing is
+ * cached without stat cache. keys should start with an id from li_worker_docroot_cache_id (unique per action).
+ * lookup returns NULL if not found, the result is only valid until the next cache call.
+ */
+LI_API guint li_worker_docroot_cache_id(void);
+LI_API GString* li_worker_docroot_cache_lookup(liWorker *wrk, const GString *key);
+LI_API void li_worker_docroot_cache_insert(liWorker *wrk, const GString *key, const GString *docroot);
+
+/* whether one of the signals configured with the "overload" setup reached its limit */
+LI_API gboolean li_worker_overloaded(liWorker *wrk);
+
 LI_API void li_worker_new_con(liWorker *ctx, liWorker *wrk, liSocketAddress remote_addr, int s, liServerSocket *srv_sock);
 
 LI_API void li_worker_check_keepalive(liWorker *wrk);
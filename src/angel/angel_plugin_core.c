@@ -2,6 +2,7 @@
 #include <lighttpd/angel_plugin_core.h>
 #include <lighttpd/angel_config_parser.h>
 #include <lighttpd/ip_parsers.h>
+#include <lighttpd/shm_counters.h>
 
 #include <fnmatch.h>
 #include <fcntl.h>
@@ -20,7 +21,8 @@ struct listen_socket {
 	gint refcount;
 
 	liSocketAddress addr;
-	int fd;
+	GArray *fds; /* (int), more than one for SO_REUSEPORT groups */
+	liListenOptions opts; /* applied to the fds */
 };
 
 struct listen_ref_resource {
@@ -291,6 +293,48 @@ static gboolean core_parse_max_open_files(liServer *srv, liPlugin *p, liValue *v
 
 
 
+static gboolean core_parse_processes(liServer *srv, liPlugin *p, liValue *value, GError **err) {
+	liPluginCoreConfig *pc = p->data;
+	UNUSED(srv);
+
+	if (-1 != pc->parsing.processes) {
+		g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+			"processes: already specified");
+		return FALSE;
+	}
+
+	if (!core_parse_store_integer(value, "processes", &pc->parsing.processes, err)) return FALSE;
+
+	if (pc->parsing.processes < 1 || pc->parsing.processes > 256) {
+		g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+			"processes: expecting a number between 1 and 256");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean core_parse_shared_counters(liServer *srv, liPlugin *p, liValue *value, GError **err) {
+	liPluginCoreConfig *pc = p->data;
+	UNUSED(srv);
+
+	if (-1 != pc->parsing.shared_counters) {
+		g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+			"shared_counters: already specified");
+		return FALSE;
+	}
+
+	if (!core_parse_store_integer(value, "shared_counters", &pc->parsing.shared_counters, err)) return FALSE;
+
+	if (pc->parsing.shared_counters < 64 || pc->parsing.shared_counters > (1 << 24)) {
+		g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+			"shared_counters: expecting a number between 64 and 16777216");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void core_listen_mask_free(liPluginCoreListenMask *mask) {
 	if (NULL == mask) return;
 
@@ -351,6 +395,74 @@ parameter_type_error:
 	return FALSE;
 }
 
+static void core_listen_limits_clear(liPluginCoreListenLimits *limits) {
+	guint i;
+
+	if (NULL != limits->congestion) {
+		for (i = 0; i < limits->congestion->len; i++) {
+			g_free(g_ptr_array_index(limits->congestion, i));
+		}
+		g_ptr_array_set_size(limits->congestion, 0);
+	} else {
+		limits->congestion = g_ptr_array_new();
+	}
+	limits->busy_poll = limits->rcvbuf = limits->sndbuf = 0;
+}
+
+/* listen_options [ "congestion" => ("bbr", "cubic"), "busy_poll" => 50, "rcvbuf" => 4194304, "sndbuf" => 4194304 ]; */
+static gboolean core_parse_listen_options(liServer *srv, liPlugin *p, liValue *value, GError **err) {
+	liPluginCoreConfig *pc = p->data;
+	liPluginCoreListenLimits *limits = &pc->parsing.listen_limits;
+	UNUSED(srv);
+
+	value = li_value_get_single_argument(value);
+	if (NULL == (value = li_value_to_key_value_list(value))) goto parameter_type_error;
+
+	LI_VALUE_FOREACH(entry, value)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		gint64 *target = NULL;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) goto parameter_type_error;
+
+		if (g_str_equal(entryKey->data.string->str, "congestion")) {
+			if (LI_VALUE_LIST != li_value_type(entryValue)) li_value_wrap_in_list(entryValue);
+			LI_VALUE_FOREACH(algo, entryValue)
+				if (LI_VALUE_STRING != li_value_type(algo)) {
+					g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+						"listen_options: congestion expects a string or a list of strings");
+					return FALSE;
+				}
+				g_ptr_array_add(limits->congestion, g_strdup(algo->data.string->str));
+			LI_VALUE_END_FOREACH()
+			continue;
+		}
+
+		if (g_str_equal(entryKey->data.string->str, "busy_poll")) target = &limits->busy_poll;
+		else if (g_str_equal(entryKey->data.string->str, "rcvbuf")) target = &limits->rcvbuf;
+		else if (g_str_equal(entryKey->data.string->str, "sndbuf")) target = &limits->sndbuf;
+		else {
+			g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+				"listen_options: unknown option '%s'", entryKey->data.string->str);
+			return FALSE;
+		}
+
+		if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0 || entryValue->data.number > G_MAXINT) {
+			g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+				"listen_options: %s expects a number between 0 and %i", entryKey->data.string->str, G_MAXINT);
+			return FALSE;
+		}
+		*target = entryValue->data.number;
+	LI_VALUE_END_FOREACH()
+
+	return TRUE;
+
+parameter_type_error:
+	g_set_error(err, LI_ANGEL_CONFIG_PARSER_ERROR, LI_ANGEL_CONFIG_PARSER_ERROR_PARSE,
+		"listen_options: expecting key-value list as parameter");
+	return FALSE;
+}
+
 
 static const liPluginItem core_items[] = {
 	{ "user", core_parse_user },
@@ -365,6 +477,9 @@ static const liPluginItem core_items[] = {
 	{ "max_core_file_size", core_parse_max_core_file_size },
 	{ "max_open_files", core_parse_max_open_files },
 	{ "allow_listen", core_parse_allow_listen },
+	{ "listen_options", core_parse_listen_options },
+	{ "processes", core_parse_processes },
+	{ "shared_counters", core_parse_shared_counters },
 	{ NULL, NULL }
 };
 
@@ -405,6 +520,8 @@ static void core_parse_init(liServer *srv, liPlugin *p) {
 	INIT_STR_LIST(wrapper);
 
 	pc->parsing.rlim_core = pc->parsing.rlim_nofile = -1;
+	pc->parsing.processes = -1;
+	pc->parsing.shared_counters = -1;
 
 	if (NULL != pc->parsing.instconf) {
 		li_instance_conf_release(pc->parsing.instconf);
@@ -421,6 +538,8 @@ static void core_parse_init(liServer *srv, liPlugin *p) {
 	} else {
 		pc->parsing.listen_masks = g_ptr_array_new();
 	}
+
+	core_listen_limits_clear(&pc->parsing.listen_limits);
 }
 
 static gboolean core_check(liServer *srv, liPlugin *p, GError **err) {
@@ -477,13 +596,14 @@ static gboolean core_check(liServer *srv, liPlugin *p, GError **err) {
 }
 
 
-static listen_socket* listen_new_socket(liSocketAddress *addr, int fd) {
+static listen_socket* listen_new_socket(liSocketAddress *addr, GArray *fds) {
 	listen_socket *sock = g_slice_new0(listen_socket);
 
 	sock->refcount = 0;
 
 	sock->addr = *addr;
-	sock->fd = fd;
+	sock->fds = fds;
+	li_listen_options_init(&sock->opts);
 
 	return sock;
 }
@@ -511,8 +631,14 @@ static void listen_ref_release(liServer *srv, liInstance *i, liPlugin *p, liInst
 static void _listen_socket_free(gpointer ptr) {
 	listen_socket *sock = ptr;
 
+	guint i;
+
 	li_sockaddr_clear(&sock->addr);
-	close(sock->fd);
+	for (i = 0; i < sock->fds->len; i++) {
+		close(g_array_index(sock->fds, int, i));
+	}
+	g_array_free(sock->fds, TRUE);
+	li_listen_options_clear(&sock->opts);
 
 	g_slice_free(listen_socket, sock);
 }
@@ -605,9 +731,10 @@ static gboolean listen_check_acl(liServer *srv, liPluginCoreConfig *config, liSo
 	return FALSE;
 }
 
-static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
+static int do_listen(liServer *srv, liSocketAddress *addr, GString *str, const liListenOptions *opts) {
 	int s, v;
 	GString *ipv6_str;
+	GError *err = NULL;
 
 	switch (addr->addr->plain.sa_family) {
 	case AF_INET:
@@ -621,6 +748,12 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 			ERROR(srv, "Couldn't setsockopt(SO_REUSEADDR): %s", g_strerror(errno));
 			return -1;
 		}
+		if (!li_listen_options_apply(opts, s, AF_INET, &err)) {
+			close(s);
+			ERROR(srv, "Couldn't apply listen options for '%s': %s", str->str, err->message);
+			g_error_free(err);
+			return -1;
+		}
 		if (-1 == bind(s, &addr->addr->plain, addr->len)) {
 			close(s);
 			ERROR(srv, "Couldn't bind socket to '%s': %s", str->str, g_strerror(errno));
@@ -630,7 +763,7 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 		v = 1000;
 		setsockopt(s, SOL_TCP, TCP_FASTOPEN, &v, sizeof(v));
 #endif
-		if (-1 == listen(s, 1000)) {
+		if (-1 == listen(s, opts->backlog)) {
 			close(s);
 			ERROR(srv, "Couldn't listen on '%s': %s", str->str, g_strerror(errno));
 			return -1;
@@ -660,6 +793,13 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 			g_string_free(ipv6_str, TRUE);
 			return -1;
 		}
+		if (!li_listen_options_apply(opts, s, AF_INET6, &err)) {
+			close(s);
+			ERROR(srv, "Couldn't apply listen options for '%s': %s", ipv6_str->str, err->message);
+			g_error_free(err);
+			g_string_free(ipv6_str, TRUE);
+			return -1;
+		}
 		if (-1 == bind(s, &addr->addr->plain, addr->len)) {
 			close(s);
 			ERROR(srv, "Couldn't bind socket to '%s': %s", ipv6_str->str, g_strerror(errno));
@@ -670,7 +810,7 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 		v = 1000;
 		setsockopt(s, SOL_TCP, TCP_FASTOPEN, &v, sizeof(v));
 #endif
-		if (-1 == listen(s, 1000)) {
+		if (-1 == listen(s, opts->backlog)) {
 			close(s);
 			ERROR(srv, "Couldn't listen on '%s': %s", ipv6_str->str, g_strerror(errno));
 			g_string_free(ipv6_str, TRUE);
@@ -695,12 +835,18 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 			ERROR(srv, "Couldn't open socket: %s", g_strerror(errno));
 			return -1;
 		}
+		if (!li_listen_options_apply(opts, s, AF_UNIX, &err)) {
+			close(s);
+			ERROR(srv, "Couldn't apply listen options for '%s': %s", str->str, err->message);
+			g_error_free(err);
+			return -1;
+		}
 		if (-1 == bind(s, &addr->addr->plain, addr->len)) {
 			close(s);
 			ERROR(srv, "Couldn't bind socket to '%s': %s", str->str, g_strerror(errno));
 			return -1;
 		}
-		if (-1 == listen(s, 1000)) {
+		if (-1 == listen(s, opts->backlog)) {
 			close(s);
 			ERROR(srv, "Couldn't listen on '%s': %s", str->str, g_strerror(errno));
 			return -1;
@@ -715,26 +861,113 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 	return -1;
 }
 
+/* the angel applies these options with its privileges: only what the angel config allows.
+ * returns an error message, or NULL if the options are allowed */
+static GString* listen_check_options(liPluginCoreConfig *config, GString *str, const liListenOptions *opts) {
+	const liPluginCoreListenLimits *limits = &config->listen_limits;
+	GString *error = NULL;
+	guint i;
+
+	if (opts->busy_poll > limits->busy_poll) {
+		error = g_string_sized_new(0);
+		g_string_printf(error, "Listen option busy_poll=%i for '%s' not allowed (angel item listen_options: maximum %i)", opts->busy_poll, str->str, (gint) limits->busy_poll);
+	} else if (opts->rcvbuf > limits->rcvbuf) {
+		error = g_string_sized_new(0);
+		g_string_printf(error, "Listen option rcvbuf=%i for '%s' not allowed (angel item listen_options: maximum %i)", opts->rcvbuf, str->str, (gint) limits->rcvbuf);
+	} else if (opts->sndbuf > limits->sndbuf) {
+		error = g_string_sized_new(0);
+		g_string_printf(error, "Listen option sndbuf=%i for '%s' not allowed (angel item listen_options: maximum %i)", opts->sndbuf, str->str, (gint) limits->sndbuf);
+	} else if (NULL != opts->congestion) {
+		for (i = 0; i < limits->congestion->len; i++) {
+			if (g_str_equal(opts->congestion->str, g_ptr_array_index(limits->congestion, i))) break;
+		}
+		if (i == limits->congestion->len) {
+			error = g_string_sized_new(0);
+			g_string_printf(error, "Listen option congestion=%s for '%s' not allowed (angel item listen_options)", opts->congestion->str, str->str);
+		}
+	}
+
+	return error;
+}
+
+static void core_send_error(liServer *srv, liInstance *i, gint32 id, GString *error) {
+	GError *err = NULL;
+
+	if (!li_angel_send_result(i->acon, id, error, NULL, NULL, &err)) {
+		ERROR(srv, "Couldn't send result: %s", err->message);
+		g_error_free(err);
+	}
+}
+
+/* (re)applies the options to an already listening socket, i.e. after reloading the config */
+static void listen_update_socket(liServer *srv, listen_socket *sock, GString *str, const liListenOptions *opts) {
+	GError *err = NULL;
+	guint j;
+
+	if ((0 == opts->reuseport ? 1 : (guint) opts->reuseport) != sock->fds->len) {
+		WARNING(srv, "Can't change the reuseport group size of '%s' without closing it first", str->str);
+	}
+
+	for (j = 0; j < sock->fds->len; j++) {
+		int fd = g_array_index(sock->fds, int, j);
+
+		/* options removed from the config */
+		if (!li_listen_options_reset(&sock->opts, opts, fd, sock->addr.addr->plain.sa_family, &err)) {
+			WARNING(srv, "Couldn't reset listen options for '%s': %s", str->str, err->message);
+			g_error_free(err);
+			err = NULL;
+		}
+		if (!li_listen_options_apply(opts, fd, sock->addr.addr->plain.sa_family, &err)) {
+			WARNING(srv, "Couldn't apply listen options for '%s': %s", str->str, err->message);
+			g_error_free(err);
+			err = NULL;
+		}
+		/* updates the backlog */
+		if (-1 == listen(fd, opts->backlog)) {
+			WARNING(srv, "Couldn't listen on '%s': %s", str->str, g_strerror(errno));
+		}
+	}
+
+	li_listen_options_copy(&sock->opts, opts);
+}
+
 static void core_listen(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
 	GError *err = NULL;
 	gint fd;
+	guint j, count;
 	GArray *fds;
 	liPluginCoreConfig *config = (liPluginCoreConfig*) p->data;
 	liSocketAddress addr;
 	listen_socket *sock;
+	liListenOptions opts;
+	gsize addr_len;
+	GString *opts_error;
 
 	/* DEBUG(srv, "core_listen(%i) '%s'", id, data->str); */
 
 	if (-1 == id) return; /* ignore simple calls */
 
+	/* "<address>" ["\0" "<key>=<value>\n"...] */
+	li_listen_options_init(&opts);
+	addr_len = strlen(data->str);
+	if (addr_len < data->len) {
+		if (!li_listen_options_from_string(&opts, data->str + addr_len + 1, data->len - addr_len - 1, &err)) {
+			GString *error = g_string_sized_new(0);
+			g_string_printf(error, "Invalid listen options for '%s': %s", data->str, err->message);
+			g_error_free(err);
+			li_listen_options_clear(&opts);
+			core_send_error(srv, i, id, error);
+			return;
+		}
+		g_string_truncate(data, addr_len);
+	}
+
 	addr = li_sockaddr_from_string(data, 80);
 	if (!addr.addr) {
 		GString *error = g_string_sized_new(0);
 		g_string_printf(error, "Invalid socket address: '%s'", data->str);
-		if (!li_angel_send_result(i->acon, id, error, NULL, NULL, &err)) {
-			ERROR(srv, "Couldn't send result: %s", err->message);
-			g_error_free(err);
-		}
+		li_listen_options_clear(&opts);
+		core_send_error(srv, i, id, error);
 		return;
 	}
 
@@ -742,56 +975,179 @@ static void core_listen(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GS
 		GString *error = g_string_sized_new(0);
 		li_sockaddr_clear(&addr);
 		g_string_printf(error, "Socket address not allowed: '%s'", data->str);
-		if (!li_angel_send_result(i->acon, id, error, NULL, NULL, &err)) {
-			ERROR(srv, "Couldn't send result: %s", err->message);
-			g_error_free(err);
-		}
+		li_listen_options_clear(&opts);
+		core_send_error(srv, i, id, error);
+		return;
+	}
+
+	if (NULL != (opts_error = listen_check_options(config, data, &opts))) {
+		li_sockaddr_clear(&addr);
+		li_listen_options_clear(&opts);
+		core_send_error(srv, i, id, opts_error);
 		return;
 	}
 
 	if (NULL == (sock = g_hash_table_lookup(config->listen_sockets, &addr))) {
-		fd = do_listen(srv, &addr, data);
+		count = (0 == opts.reuseport) ? 1 : (guint) opts.reuseport;
+		fds = g_array_sized_new(FALSE, FALSE, sizeof(int), count);
 
-		if (-1 == fd) {
-			GString *error = g_string_sized_new(0);
-			li_sockaddr_clear(&addr);
-			g_string_printf(error, "Couldn't listen to '%s'", data->str);
-			if (!li_angel_send_result(i->acon, id, error, NULL, NULL, &err)) {
-				ERROR(srv, "Couldn't send result: %s", err->message);
-				g_error_free(err);
+		for (j = 0; j < count; j++) {
+			fd = do_listen(srv, &addr, data, &opts);
+
+			if (-1 == fd) {
+				GString *error = g_string_sized_new(0);
+				li_sockaddr_clear(&addr);
+				for (j = 0; j < fds->len; j++) {
+					close(g_array_index(fds, int, j));
+				}
+				g_array_free(fds, TRUE);
+				g_string_printf(error, "Couldn't listen to '%s'", data->str);
+				li_listen_options_clear(&opts);
+				core_send_error(srv, i, id, error);
+				return;
 			}
-			return;
+
+			li_fd_init(fd);
+			g_array_append_val(fds, fd);
 		}
 
-		li_fd_init(fd);
-		sock = listen_new_socket(&addr, fd);
+		sock = listen_new_socket(&addr, fds);
+		li_listen_options_copy(&sock->opts, &opts);
 		g_hash_table_insert(config->listen_sockets, &sock->addr, sock);
 	} else {
 		li_sockaddr_clear(&addr);
+		listen_update_socket(srv, sock, data, &opts);
 	}
 
+	li_listen_options_clear(&opts);
+
 	listen_socket_add(i, p, sock);
 
-	fd = dup(sock->fd);
+	fds = g_array_sized_new(FALSE, FALSE, sizeof(int), sock->fds->len);
+	for (j = 0; j < sock->fds->len; j++) {
+		/* with multiple processes each process gets its share of a SO_REUSEPORT group;
+		 * a single socket is shared by all processes */
+		if (config->processes > 1 && sock->fds->len > 1) {
+			if (sock->fds->len >= config->processes) {
+				if (j % config->processes != i->process_ndx) continue;
+			} else if (j != i->process_ndx % sock->fds->len) {
+				continue;
+			}
+		}
+
+		fd = dup(g_array_index(sock->fds, int, j));
 
-	if (-1 == fd) {
-		/* socket ref will be released when instance is released */
-		GString *error = g_string_sized_new(0);
-		g_string_printf(error, "Couldn't duplicate fd");
-		if (!li_angel_send_result(i->acon, id, error, NULL, NULL, &err)) {
-			ERROR(srv, "Couldn't send result: %s", err->message);
-			g_error_free(err);
+		if (-1 == fd) {
+			/* socket ref will be released when instance is released */
+			GString *error = g_string_sized_new(0);
+			for (j = 0; j < fds->len; j++) {
+				close(g_array_index(fds, int, j));
+			}
+			g_array_free(fds, TRUE);
+			g_string_printf(error, "Couldn't duplicate fd");
+			core_send_error(srv, i, id, error);
+			return;
+		}
+
+		g_array_append_val(fds, fd);
+	}
+
+	if (!li_angel_send_result(i->acon, id, NULL, NULL, fds, &err)) {
+		ERROR(srv, "Couldn't send result: %s", err->message);
+		g_error_free(err);
+		return;
+	}
+}
+
+static void core_shm_counters_close(liPluginCoreConfig *config) {
+	if (-1 == config->shm_counters_fd) return;
+
+	close(config->shm_counters_fd);
+	config->shm_counters_fd = -1;
+	li_shm_counters_free(config->shm_counters);
+	config->shm_counters = NULL;
+	/* owners of the old table are not released in the new one */
+	g_ptr_array_set_size(config->shm_owners, 0);
+}
+
+/* returns the owner index of the instance in the shared counters (assigns a free one); -1 if none is left */
+static gint core_shm_counters_owner(liServer *srv, liPluginCoreConfig *config, liInstance *i) {
+	guint ndx;
+
+	g_ptr_array_set_size(config->shm_owners, config->shm_counters_owners);
+	for (ndx = 0; ndx < config->shm_owners->len; ndx++) {
+		if (i == g_ptr_array_index(config->shm_owners, ndx)) return ndx;
+	}
+	for (ndx = 0; ndx < config->shm_owners->len; ndx++) {
+		if (NULL == g_ptr_array_index(config->shm_owners, ndx)) {
+			g_ptr_array_index(config->shm_owners, ndx) = i;
+			return ndx;
 		}
+	}
+
+	WARNING(srv, "shared counters: no owner left for process %u, its connections are not released if it crashes", i->process_ndx);
+	return -1;
+}
+
+/* the instance process is gone: give its connections back */
+static void core_instance_reached_state(liServer *srv, liPlugin *p, liInstance *i, liInstanceState s) {
+	liPluginCoreConfig *config = (liPluginCoreConfig*) p->data;
+	guint ndx, released;
+
+	if (LI_INSTANCE_DOWN != s && LI_INSTANCE_FINISHED != s) return;
+
+	for (ndx = 0; ndx < config->shm_owners->len; ndx++) {
+		if (i != g_ptr_array_index(config->shm_owners, ndx)) continue;
+
+		g_ptr_array_index(config->shm_owners, ndx) = NULL;
+		if (NULL != config->shm_counters && 0 != (released = li_shm_counters_release_owner(config->shm_counters, ndx))) {
+			WARNING(srv, "shared counters: released %u connections of process %u", released, i->process_ndx);
+		}
+		break;
+	}
+}
+
+/* the table is created once and passed to all instances, so counters survive instance replacements */
+static void core_shm_counters(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
+	liPluginCoreConfig *config = (liPluginCoreConfig*) p->data;
+	GError *err = NULL;
+	GArray *fds;
+	GString *owner;
+	int fd;
+	UNUSED(data);
+
+	if (-1 == id) return; /* ignore simple calls */
+
+	if (-1 == config->shm_counters_fd) {
+		if (-1 == (config->shm_counters_fd = li_shm_counters_create_fd(config->shm_counters_slots, config->shm_counters_owners, &err))
+		    || -1 == (fd = dup(config->shm_counters_fd))
+		    || NULL == (config->shm_counters = li_shm_counters_map(fd, -1, &err))) {
+			GString *error = (NULL != err) ? g_string_new(err->message) : g_string_new(g_strerror(errno));
+			ERROR(srv, "%s", error->str);
+			if (NULL != err) g_error_free(err);
+			if (-1 != config->shm_counters_fd) close(config->shm_counters_fd);
+			config->shm_counters_fd = -1;
+			core_send_error(srv, i, id, error);
+			return;
+		}
+	}
+
+	if (-1 == (fd = dup(config->shm_counters_fd))) {
+		GString *error = g_string_sized_new(0);
+		g_string_printf(error, "Couldn't duplicate fd: %s", g_strerror(errno));
+		core_send_error(srv, i, id, error);
 		return;
 	}
 
 	fds = g_array_new(FALSE, FALSE, sizeof(int));
 	g_array_append_val(fds, fd);
 
-	if (!li_angel_send_result(i->acon, id, NULL, NULL, fds, &err)) {
+	owner = g_string_sized_new(15);
+	g_string_printf(owner, "%i", core_shm_counters_owner(srv, config, i));
+
+	if (!li_angel_send_result(i->acon, id, NULL, owner, fds, &err)) {
 		ERROR(srv, "Couldn't send result: %s", err->message);
 		g_error_free(err);
-		return;
 	}
 }
 
@@ -811,6 +1167,295 @@ static void core_reached_state(liServer *srv, liPlugin *p, liInstance *i, gint32
 	}
 }
 
+/* idle keep-alive connections of a suspending instance: pass them on to the instance replacing it */
+static void core_handoff(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
+	GError *err = NULL;
+	GArray *received = i->acon->parse.fds, *fds;
+	liInstance *newi = i->replace_by;
+	UNUSED(p);
+	UNUSED(id);
+	UNUSED(data);
+
+	if (0 == received->len) return;
+
+	if (NULL == newi || NULL == newi->acon || (LI_INSTANCE_WARMUP != newi->s_cur && LI_INSTANCE_RUNNING != newi->s_cur)) {
+		/* nobody to take them; the angel connection closes the fds */
+		return;
+	}
+
+	fds = g_array_sized_new(FALSE, FALSE, sizeof(int), received->len);
+	g_array_append_vals(fds, received->data, received->len);
+	g_array_set_size(received, 0);
+
+	DEBUG(srv, "handing over %u idle connections to new instance", fds->len);
+
+	if (!li_angel_send_simple_call_fds(newi->acon, CONST_STR_LEN("core"), CONST_STR_LEN("adopt"), NULL, fds, &err)) {
+		ERROR(srv, "Couldn't hand over connections: %s", err->message);
+		g_error_free(err);
+	}
+}
+
+/* log files are only created in this directory (the directory and its parents must not be writable
+ * by the worker user) */
+#define CORE_LOG_PATH_PREFIX "/var/log/lighttpd2/"
+
+/* path must be simplified */
+static gboolean core_log_path_allowed(GString *path) {
+	return g_str_has_prefix(path->str, CORE_LOG_PATH_PREFIX);
+}
+
+static int core_log_open(GString *path) {
+	/* files can be read by everyone. if you don't like that, restrict access on the directory */
+	/* if you need group write access for a specific group, use chmod g+s on the directory */
+	/* "maybe-todo": add options for mode/owner/group */
+	return open(path->str, O_RDWR | O_CREAT | O_APPEND, 0664);
+}
+
+/* "angel:" log targets are written by a separate thread, so a slow target (NFS, a full pipe)
+ * can't block the angel (and the calls of all instances) */
+
+/* drop new log data while more than this is waiting for the writer thread */
+#define CORE_LOG_QUEUE_MAX (16*1024*1024)
+
+typedef struct core_log_job core_log_job;
+struct core_log_job {
+	enum {
+		CORE_LOG_JOB_WRITE,
+		CORE_LOG_JOB_REOPEN,
+		CORE_LOG_JOB_STOP
+	} type;
+	GString *path, *lines; /* only for CORE_LOG_JOB_WRITE */
+};
+
+typedef struct core_log_file core_log_file;
+struct core_log_file {
+	GString *path; /* as sent by the worker */
+	int fd; /* -1 if the file couldn't be opened; don't retry until the files get reopened */
+};
+
+static void core_log_file_free(gpointer data) {
+	core_log_file *lf = data;
+
+	if (-1 != lf->fd) close(lf->fd);
+	g_string_free(lf->path, TRUE);
+	g_slice_free(core_log_file, lf);
+}
+
+/* writer thread: the angel log isn't threadsafe, hand the message to the main loop */
+static void core_log_thread_error(liPluginCoreConfig *config, const gchar *fmt, ...) G_GNUC_PRINTF(2, 3);
+static void core_log_thread_error(liPluginCoreConfig *config, const gchar *fmt, ...) {
+	GString *msg = g_string_sized_new(0);
+	va_list ap;
+
+	va_start(ap, fmt);
+	g_string_append_vprintf(msg, fmt, ap);
+	va_end(ap);
+
+	g_async_queue_push(config->log_errors, msg);
+	li_event_async_send(&config->log_errors_watcher);
+}
+
+/* writer thread */
+static core_log_file* core_log_file_get(liPluginCoreConfig *config, GString *path) {
+	core_log_file *lf;
+
+	if (NULL != (lf = g_hash_table_lookup(config->log_files, path))) return lf;
+
+	lf = g_slice_new0(core_log_file);
+	lf->path = g_string_new_len(GSTR_LEN(path));
+	lf->fd = -1;
+
+	{
+		GString *filename = g_string_new_len(GSTR_LEN(path));
+		li_path_simplify(filename);
+		if (strlen(filename->str) != filename->len || !core_log_path_allowed(filename)) {
+			core_log_thread_error(config, "Couldn't open log file '%s': path not allowed", filename->str);
+		} else if (-1 == (lf->fd = core_log_open(filename))) {
+			core_log_thread_error(config, "Couldn't open log file '%s': %s", filename->str, g_strerror(errno));
+		} else {
+			li_fd_close_on_exec(lf->fd);
+		}
+		g_string_free(filename, TRUE);
+	}
+
+	g_hash_table_insert(config->log_files, lf->path, lf);
+
+	return lf;
+}
+
+static gpointer core_log_thread(gpointer data) {
+	liPluginCoreConfig *config = data;
+
+	for (;;) {
+		core_log_job *job = g_async_queue_pop(config->log_jobs);
+
+		switch (job->type) {
+		case CORE_LOG_JOB_WRITE: {
+				core_log_file *lf = core_log_file_get(config, job->path);
+				const gchar *lines = job->lines->str;
+				gsize len = job->lines->len;
+
+				g_atomic_int_add(&config->log_queued, - (gint) len);
+
+				while (-1 != lf->fd && len > 0) {
+					ssize_t r = write(lf->fd, lines, len);
+					if (-1 == r) {
+						if (EINTR == errno) continue;
+						core_log_thread_error(config, "Couldn't write to log file '%s': %s", lf->path->str, g_strerror(errno));
+						break;
+					}
+					lines += r;
+					len -= r;
+				}
+
+				g_string_free(job->path, TRUE);
+				g_string_free(job->lines, TRUE);
+			}
+			break;
+		case CORE_LOG_JOB_REOPEN:
+			/* closes all log files, they get reopened with the next log line */
+			g_hash_table_remove_all(config->log_files);
+			break;
+		case CORE_LOG_JOB_STOP:
+			g_slice_free(core_log_job, job);
+			return NULL;
+		}
+
+		g_slice_free(core_log_job, job);
+	}
+}
+
+static void core_log_errors_cb(liEventBase *watcher, int events) {
+	liPluginCoreConfig *config = LI_CONTAINER_OF(li_event_async_from(watcher), liPluginCoreConfig, log_errors_watcher);
+	liServer *srv = config->srv;
+	GString *msg;
+	gint dropped;
+	UNUSED(events);
+
+	while (NULL != (msg = g_async_queue_try_pop(config->log_errors))) {
+		ERROR(srv, "%s", msg->str);
+		g_string_free(msg, TRUE);
+	}
+
+	if (0 != (dropped = g_atomic_int_exchange_and_add(&config->log_dropped, 0))) {
+		g_atomic_int_add(&config->log_dropped, -dropped);
+		ERROR(srv, "Log files are too slow: dropped %i bytes of log data", dropped);
+	}
+}
+
+static void core_log_push(liPluginCoreConfig *config, core_log_job *job) {
+	if (NULL == config->log_thread) {
+		GError *err = NULL;
+
+		if (NULL == (config->log_thread = g_thread_create(core_log_thread, config, TRUE, &err))) {
+			ERROR(config->srv, "Couldn't create log thread: %s", err->message);
+			g_error_free(err);
+			if (NULL != job->path) g_string_free(job->path, TRUE);
+			if (NULL != job->lines) g_string_free(job->lines, TRUE);
+			g_slice_free(core_log_job, job);
+			return;
+		}
+	}
+
+	g_async_queue_push(config->log_jobs, job);
+}
+
+/* log lines for "angel:" targets, batched by the log thread of the worker:
+ * a sequence of (gint32 path length, path, gint32 data length, data) groups */
+static void core_log(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
+	liPluginCoreConfig *config = (liPluginCoreConfig*) p->data;
+	gsize pos = 0;
+	UNUSED(i);
+	UNUSED(id);
+
+	while (pos < data->len) {
+		gint32 path_len, data_len;
+		const gchar *path, *lines;
+		core_log_job *job;
+
+		if (data->len - pos < sizeof(gint32)) goto invalid;
+		memcpy(&path_len, data->str + pos, sizeof(gint32));
+		pos += sizeof(gint32);
+		if (path_len < 0 || (gsize) path_len > data->len - pos) goto invalid;
+		path = data->str + pos;
+		pos += path_len;
+
+		if (data->len - pos < sizeof(gint32)) goto invalid;
+		memcpy(&data_len, data->str + pos, sizeof(gint32));
+		pos += sizeof(gint32);
+		if (data_len < 0 || (gsize) data_len > data->len - pos) goto invalid;
+		lines = data->str + pos;
+		pos += data_len;
+
+		if (0 == data_len) continue;
+
+		if (g_atomic_int_get(&config->log_queued) > CORE_LOG_QUEUE_MAX) {
+			if (0 == g_atomic_int_exchange_and_add(&config->log_dropped, data_len)) {
+				li_event_async_send(&config->log_errors_watcher); /* report it */
+			}
+			continue;
+		}
+		g_atomic_int_add(&config->log_queued, data_len);
+
+		job = g_slice_new0(core_log_job);
+		job->type = CORE_LOG_JOB_WRITE;
+		job->path = g_string_new_len(path, path_len);
+		job->lines = g_string_new_len(lines, data_len);
+		core_log_push(config, job);
+	}
+
+	return;
+
+invalid:
+	ERROR(srv, "%s", "received invalid log data");
+}
+
+/* closes all log files written by the angel, they get reopened with the next log line */
+static void core_log_reopen(liPluginCoreConfig *config) {
+	core_log_job *job;
+
+	if (NULL == config->log_thread) return;
+
+	job = g_slice_new0(core_log_job);
+	job->type = CORE_LOG_JOB_REOPEN;
+	core_log_push(config, job);
+}
+
+/* waits until the writer thread wrote all queued log data */
+static void core_log_thread_stop(liPluginCoreConfig *config) {
+	core_log_job *job;
+
+	if (NULL == config->log_thread) return;
+
+	job = g_slice_new0(core_log_job);
+	job->type = CORE_LOG_JOB_STOP;
+	g_async_queue_push(config->log_jobs, job);
+	g_thread_join(config->log_thread);
+	config->log_thread = NULL;
+}
+
+/* statistics pushed by the workers (no result): gint32 worker index followed by text */
+static void core_stats(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
+	gint32 ndx;
+	UNUSED(p);
+	UNUSED(id);
+
+	if (data->len < sizeof(gint32)) goto invalid;
+	memcpy(&ndx, data->str, sizeof(gint32));
+	if (ndx < 0 || ndx > 1024) goto invalid;
+
+	if ((guint) ndx >= i->worker_stats->len) g_ptr_array_set_size(i->worker_stats, ndx + 1);
+	if (NULL == g_ptr_array_index(i->worker_stats, ndx)) {
+		g_ptr_array_index(i->worker_stats, ndx) = g_string_sized_new(data->len);
+	}
+	g_string_assign(g_ptr_array_index(i->worker_stats, ndx), data->str + sizeof(gint32));
+
+	return;
+
+invalid:
+	ERROR(srv, "%s", "received invalid statistics");
+}
+
 static void core_log_open_file(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
 	GError *err = NULL;
 	int fd = -1;
@@ -824,12 +1469,8 @@ static void core_log_open_file(liServer *srv, liPlugin *p, liInstance *i, gint32
 
 	li_path_simplify(data);
 
-	/* TODO: make path configurable */
-	if (g_str_has_prefix(data->str, "/var/log/lighttpd2/")) {
-		/* files can be read by everyone. if you don't like that, restrict access on the directory */
-		/* if you need group write access for a specific group, use chmod g+s on the directory */
-		/* "maybe-todo": add options for mode/owner/group */
-		fd = open(data->str, O_RDWR | O_CREAT | O_APPEND, 0664);
+	if (core_log_path_allowed(data)) {
+		fd = core_log_open(data);
 		if (-1 == fd) {
 			int e = errno;
 			GString *error = g_string_sized_new(0);
@@ -864,6 +1505,17 @@ static void core_log_open_file(liServer *srv, liPlugin *p, liInstance *i, gint32
 	}
 }
 
+static void core_instances_finish(liPluginCoreConfig *config) {
+	guint i;
+
+	for (i = 0; i < config->instances->len; i++) {
+		liInstance *inst = g_ptr_array_index(config->instances, i);
+		li_instance_set_state(inst, LI_INSTANCE_FINISHED);
+		li_instance_release(inst);
+	}
+	g_ptr_array_set_size(config->instances, 0);
+}
+
 static void core_free(liServer *srv, liPlugin *p) {
 	liPluginCoreConfig *config = (liPluginCoreConfig*) p->data;
 	guint i;
@@ -877,17 +1529,16 @@ static void core_free(liServer *srv, liPlugin *p) {
 	config->parsing.wrapper = NULL;
 	g_ptr_array_free(config->parsing.listen_masks, TRUE);
 	config->parsing.listen_masks = NULL;
+	g_ptr_array_free(config->parsing.listen_limits.congestion, TRUE);
+	config->parsing.listen_limits.congestion = NULL;
 
 	if (config->instconf) {
 		li_instance_conf_release(config->instconf);
 		config->instconf = NULL;
 	}
 
-	if (config->inst) {
-		li_instance_set_state(config->inst, LI_INSTANCE_FINISHED);
-		li_instance_release(config->inst);
-		config->inst = NULL;
-	}
+	core_instances_finish(config);
+	g_ptr_array_free(config->instances, TRUE);
 
 	for (i = 0; i < config->listen_masks->len; i++) {
 		core_listen_mask_free(g_ptr_array_index(config->listen_masks, i));
@@ -895,6 +1546,17 @@ static void core_free(liServer *srv, liPlugin *p) {
 	g_ptr_array_free(config->listen_masks, TRUE);
 	g_hash_table_destroy(config->listen_sockets);
 	config->listen_masks = NULL;
+	core_listen_limits_clear(&config->listen_limits);
+	g_ptr_array_free(config->listen_limits.congestion, TRUE);
+	config->listen_limits.congestion = NULL;
+	core_log_thread_stop(config);
+	g_hash_table_destroy(config->log_files);
+	g_async_queue_unref(config->log_jobs);
+	core_log_errors_cb(&config->log_errors_watcher.base, 0);
+	li_event_clear(&config->log_errors_watcher);
+	g_async_queue_unref(config->log_errors);
+	core_shm_counters_close(config);
+	g_ptr_array_free(config->shm_owners, TRUE);
 
 	g_slice_free(liPluginCoreConfig, config);
 }
@@ -909,11 +1571,7 @@ static void core_activate(liServer *srv, liPlugin *p) {
 		config->instconf = NULL;
 	}
 
-	if (NULL != config->inst) {
-		li_instance_set_state(config->inst, LI_INSTANCE_FINISHED);
-		li_instance_release(config->inst);
-		config->inst = NULL;
-	}
+	core_instances_finish(config);
 
 	for (i = 0; i < config->listen_masks->len; i++) {
 		core_listen_mask_free(g_ptr_array_index(config->listen_masks, i));
@@ -926,41 +1584,77 @@ static void core_activate(liServer *srv, liPlugin *p) {
 
 	tmp_ptrarray = config->parsing.listen_masks; config->parsing.listen_masks = config->listen_masks; config->listen_masks = tmp_ptrarray;
 
+	/* the old limits get cleared with the next core_parse_init */
+	{
+		liPluginCoreListenLimits tmp_limits = config->parsing.listen_limits;
+		config->parsing.listen_limits = config->listen_limits;
+		config->listen_limits = tmp_limits;
+	}
+
+	config->processes = (-1 != config->parsing.processes) ? (guint) config->parsing.processes : 1;
+
+	{
+		guint slots = (-1 != config->parsing.shared_counters) ? (guint) config->parsing.shared_counters : 65536;
+		/* each process can have a replacement running, and old instances may still be finishing */
+		guint owners = 4 * config->processes;
+		if (slots != config->shm_counters_slots || owners > config->shm_counters_owners) {
+			/* new instances get a new table */
+			core_shm_counters_close(config);
+			config->shm_counters_owners = owners;
+		}
+		config->shm_counters_slots = slots;
+	}
+
 	if (NULL != config->instconf) {
-		config->inst = li_server_new_instance(srv, config->instconf);
-		li_instance_set_state(config->inst, LI_INSTANCE_RUNNING);
+		for (i = 0; i < config->processes; i++) {
+			liInstance *inst = li_server_new_instance(srv, config->instconf);
+			inst->process_ndx = i;
+			g_ptr_array_add(config->instances, inst);
+			li_instance_set_state(inst, LI_INSTANCE_RUNNING);
+		}
 	}
 }
 
 static void core_instance_replaced(liServer *srv, liPlugin *p, liInstance *oldi, liInstance *newi) {
 	liPluginCoreConfig *config = (liPluginCoreConfig*) p->data;
+	guint i;
 	UNUSED(srv);
 
-	if (oldi == config->inst && LI_INSTANCE_FINISHED == oldi->s_cur) {
-		li_instance_acquire(newi);
-		config->inst = newi;
-		li_instance_release(oldi);
+	if (LI_INSTANCE_FINISHED != oldi->s_cur) return;
+
+	for (i = 0; i < config->instances->len; i++) {
+		if (oldi == g_ptr_array_index(config->instances, i)) {
+			li_instance_acquire(newi);
+			g_ptr_array_index(config->instances, i) = newi;
+			li_instance_release(oldi);
+			break;
+		}
 	}
 }
 
 static void core_handle_sig_hup(liEventBase *watcher, int events) {
 	liPluginCoreConfig *config = LI_CONTAINER_OF(li_event_signal_from(watcher), liPluginCoreConfig, sig_hup);
 	liInstance *oldi, *newi;
+	guint i;
 	UNUSED(events);
 
-	if (NULL == (oldi = config->inst)) return;
+	core_log_reopen(config);
+
+	for (i = 0; i < config->instances->len; i++) {
+		oldi = g_ptr_array_index(config->instances, i);
 
-	if (oldi->replace_by) return;
+		if (oldi->replace_by) continue;
 
-	INFO(oldi->srv, "%s", "Received SIGHUP: graceful instance restart");
-	newi = li_server_new_instance(oldi->srv, config->instconf);
-	li_instance_replace(oldi, newi);
-	li_instance_release(newi);
+		INFO(oldi->srv, "Received SIGHUP: graceful instance restart (process %u)", oldi->process_ndx);
+		newi = li_server_new_instance(oldi->srv, config->instconf);
+		newi->process_ndx = oldi->process_ndx;
+		li_instance_replace(oldi, newi);
+		li_instance_release(newi);
+	}
 }
 
 static gboolean core_init(liServer *srv, liPlugin *p) {
 	liPluginCoreConfig *config;
-	UNUSED(srv);
 	p->data = config = g_slice_new0(liPluginCoreConfig);
 	p->items = core_items;
 
@@ -969,14 +1663,30 @@ static gboolean core_init(liServer *srv, liPlugin *p) {
 	p->handle_check_config = core_check;
 	p->handle_activate_config = core_activate;
 	p->handle_instance_replaced = core_instance_replaced;
+	p->handle_instance_reached_state = core_instance_reached_state;
 
 	core_parse_init(srv, p);
 	config->listen_sockets = g_hash_table_new_full(li_hash_sockaddr, li_equal_sockaddr, NULL, _listen_socket_free);
+	config->instances = g_ptr_array_new();
+	config->shm_counters_fd = -1;
+	config->shm_counters_slots = 65536;
+	config->shm_counters_owners = 4;
+	config->shm_owners = g_ptr_array_new();
+	config->srv = srv;
+	config->log_files = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, NULL, core_log_file_free);
+	config->log_jobs = g_async_queue_new();
+	config->log_errors = g_async_queue_new();
+	li_event_async_init(&srv->loop, "angel log errors", &config->log_errors_watcher, core_log_errors_cb);
 	config->listen_masks = g_ptr_array_new();
+	core_listen_limits_clear(&config->listen_limits);
 
 	li_angel_plugin_add_angel_cb(p, "listen", core_listen);
 	li_angel_plugin_add_angel_cb(p, "reached-state", core_reached_state);
 	li_angel_plugin_add_angel_cb(p, "log-open-file", core_log_open_file);
+	li_angel_plugin_add_angel_cb(p, "handoff", core_handoff);
+	li_angel_plugin_add_angel_cb(p, "log", core_log);
+	li_angel_plugin_add_angel_cb(p, "stats", core_stats);
+	li_angel_plugin_add_angel_cb(p, "shm-counters", core_shm_counters);
 
 	li_event_signal_init(&srv->loop, "angel SIGHUP", &config->sig_hup, core_handle_sig_hup, SIGHUP);
 
@@ -109,6 +109,18 @@ static void instance_angel_close_cb(liAngelConnection *acon, GError *err) {
 	li_angel_connection_free(acon);
 }
 
+static void instance_clear_worker_stats(liInstance *i, gboolean log) {
+	guint j;
+
+	for (j = 0; j < i->worker_stats->len; j++) {
+		GString *stats = g_ptr_array_index(i->worker_stats, j);
+		if (NULL == stats) continue;
+		if (log) INFO(i->srv, "last statistics of worker %u: %s", j, stats->str);
+		g_string_free(stats, TRUE);
+	}
+	g_ptr_array_set_size(i->worker_stats, 0);
+}
+
 static void instance_child_cb(liEventBase *watcher, int events) {
 	liInstance *i = LI_CONTAINER_OF(li_event_child_from(watcher), liInstance, child_watcher);
 	liInstanceState news;
@@ -134,6 +146,7 @@ static void instance_child_cb(liEventBase *watcher, int events) {
 		} else {
 			ERROR(i->srv, "child %i died with unexpected stat_val %i", i->proc->child_pid, status);
 		}
+		instance_clear_worker_stats(i, TRUE);
 		if (i->s_cur == LI_INSTANCE_DOWN) {
 			ERROR(i->srv, "spawning child %i failed, not restarting", i->proc->child_pid);
 			news = i->s_dest = LI_INSTANCE_FINISHED; /* TODO: retry spawn later? */
@@ -171,8 +184,27 @@ static void instance_spawn(liInstance *i) {
 	li_fd_no_block(confd[1]);
 
 	i->acon = li_angel_connection_new(&i->srv->loop, confd[0], i, instance_angel_call_cb, instance_angel_close_cb);
-	i->proc = li_proc_new(i->srv, i->ic->cmd, i->ic->env, i->ic->uid, i->ic->gid,
-		i->ic->username != NULL ? i->ic->username->str : NULL, i->ic->rlim_core, i->ic->rlim_nofile, instance_spawn_setup, confd);
+
+	if (0 == i->process_ndx) {
+		i->proc = li_proc_new(i->srv, i->ic->cmd, i->ic->env, i->ic->uid, i->ic->gid,
+			i->ic->username != NULL ? i->ic->username->str : NULL, i->ic->rlim_core, i->ic->rlim_nofile, instance_spawn_setup, confd);
+	} else {
+		/* tell the worker which process it is (workers.cpu_affinity) */
+		GPtrArray *args = g_ptr_array_new();
+		gchar *ndx = g_strdup_printf("%u", i->process_ndx);
+		gchar **arg;
+
+		for (arg = i->ic->cmd; NULL != *arg; arg++) g_ptr_array_add(args, *arg);
+		g_ptr_array_add(args, "--process");
+		g_ptr_array_add(args, ndx);
+		g_ptr_array_add(args, NULL);
+
+		i->proc = li_proc_new(i->srv, (gchar**) args->pdata, i->ic->env, i->ic->uid, i->ic->gid,
+			i->ic->username != NULL ? i->ic->username->str : NULL, i->ic->rlim_core, i->ic->rlim_nofile, instance_spawn_setup, confd);
+
+		g_ptr_array_free(args, TRUE);
+		g_free(ndx);
+	}
 
 	if (!i->proc) return;
 
@@ -194,6 +226,7 @@ liInstance* li_server_new_instance(liServer *srv, liInstanceConf *ic) {
 	i->ic = ic;
 	i->s_cur = i->s_dest = LI_INSTANCE_DOWN;
 	i->resources = g_ptr_array_new();
+	i->worker_stats = g_ptr_array_new();
 
 	return i;
 }
@@ -383,6 +416,9 @@ void li_instance_release(liInstance *i) {
 
 	g_ptr_array_free(i->resources, TRUE);
 
+	instance_clear_worker_stats(i, FALSE);
+	g_ptr_array_free(i->worker_stats, TRUE);
+
 	g_slice_free(liInstance, i);
 }
 
@@ -160,7 +160,7 @@ static gboolean angel_dispatch(liAngelConnection *acon, GError **err) {
 			return FALSE;
 		}
 
-		if (acon->parse.error->len > 0 || acon->parse.fds->len > 0) {
+		if (acon->parse.error->len > 0) {
 			g_set_error(err, LI_ANGEL_CONNECTION_ERROR, LI_ANGEL_CONNECTION_INVALID_DATA,
 				"Wrong data in call");
 			close_fd_array(acon->parse.fds);
@@ -168,6 +168,8 @@ static gboolean angel_dispatch(liAngelConnection *acon, GError **err) {
 		}
 		acon->recv_call(acon, GSTR_LEN(acon->parse.mod), GSTR_LEN(acon->parse.action),
 			id, acon->parse.data);
+		/* close fds the receiver didn't take */
+		close_fd_array(acon->parse.fds);
 		break;
 	case ANGEL_CALL_SEND_CALL:
 		if (-1 == id) {
@@ -586,9 +588,22 @@ gboolean li_angel_send_simple_call(
 		const gchar *mod, gsize mod_len, const gchar *action, gsize action_len,
 		GString *data,
 		GError **err) {
+	return li_angel_send_simple_call_fds(acon, mod, mod_len, action, action_len, data, NULL, err);
+}
+
+gboolean li_angel_send_simple_call_fds(
+		liAngelConnection *acon,
+		const gchar *mod, gsize mod_len, const gchar *action, gsize action_len,
+		GString *data, GArray *fds,
+		GError **err) {
 	GString *buf = NULL;
 	gboolean queue_was_empty;
 
+	if (NULL != fds && 0 == fds->len) {
+		g_array_free(fds, TRUE);
+		fds = NULL;
+	}
+
 	if (err && *err) goto error;
 
 	if (-1 == acon->fd) {
@@ -601,12 +616,13 @@ gboolean li_angel_send_simple_call(
 		goto error;
 	}
 
-	if (!prepare_call_header(&buf, ANGEL_CALL_SEND_SIMPLE, -1, mod, mod_len, action, action_len, 0, data ? data->len : 0, 0, err)) goto error;
+	if (!prepare_call_header(&buf, ANGEL_CALL_SEND_SIMPLE, -1, mod, mod_len, action, action_len, 0, data ? data->len : 0, fds ? fds->len : 0, err)) goto error;
 
 	g_mutex_lock(acon->mutex);
 		queue_was_empty = (0 == acon->out->length);
 		send_queue_push_string(acon->out, buf);
 		if (data) send_queue_push_string(acon->out, data);
+		if (fds) send_queue_push_fds(acon->out, fds);
 	g_mutex_unlock(acon->mutex);
 
 	if (queue_was_empty)
@@ -617,6 +633,10 @@ gboolean li_angel_send_simple_call(
 error:
 	if (data) g_string_free(data, TRUE);
 	if (buf) g_string_free(buf, TRUE);
+	if (fds) {
+		close_fd_array(fds);
+		g_array_free(fds, TRUE);
+	}
 	return FALSE;
 }
 
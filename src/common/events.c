@@ -1,39 +1,36 @@
-
 #include <lighttpd/events.h>
 
-/* closing sockets - wait for proper shutdown */
+/* closing sockets - wait for proper shutdown
+ *
+ * sockets to close are collected during a loop iteration and handled together before the loop blocks
+ * again; those still waiting for EOF get a read watcher from a pool of fixed blocks (watchers must not
+ * move) and are kept in a list ordered by timeout, so a single timer handles all timeouts.
+ */
+
+/* max time to wait for EOF */
+#define CLOSING_SOCKET_TIMEOUT 10.0
+/* max reads per socket and wakeup: don't let a client keep us busy */
+#define CLOSING_SOCKET_MAX_READS 16
+/* closing_socket entries per pool block */
+#define CLOSING_SOCKET_BLOCK 256
 
 typedef struct closing_socket closing_socket;
 
 struct closing_socket {
-	liEventLoop *loop;
-	GList sockets_link;
-	int fd;
+	liEventIO watcher;
+	GList link; /* in loop->closing_lingering or loop->closing_free */
 	li_tstamp close_timeout;
 };
 
-static void close_socket_now(closing_socket *cs) {
-	close(cs->fd);
-	cs->fd = -1;
-	g_queue_unlink(&cs->loop->closing_sockets, &cs->sockets_link);
-}
-
-static void closing_socket_cb(int revents, void* arg) {
+/* empty the input buffer; returns TRUE if the socket can be closed (EOF or socket error) */
+static gboolean closing_socket_drain(int fd) {
 	static char trash[1024];
-	closing_socket *cs = (closing_socket*) arg;
 	ssize_t r;
-	liEventLoop *loop = cs->loop;
-	li_tstamp remaining = cs->close_timeout - li_event_now(loop);
+	guint i;
 
-	if (-1 == cs->fd) {
-		g_slice_free(closing_socket, cs);
-		return;
-	}
-
-	/* empty the input buffer, wait for EOF or timeout or a socket error to close it */
-	for (;!loop->end;) {
-		r = read(cs->fd, trash, sizeof(trash));
-		if (0 == r) break; /* got EOF */
+	for (i = 0; i < CLOSING_SOCKET_MAX_READS; ) {
+		r = read(fd, trash, sizeof(trash));
+		if (0 == r) return TRUE; /* got EOF */
 		if (0 > r) { /* error */
 			switch (errno) {
 			case EINTR:
@@ -43,30 +40,99 @@ static void closing_socket_cb(int revents, void* arg) {
 #if EWOULDBLOCK != EAGAIN
 			case EWOULDBLOCK:
 #endif
-				/* check timeout: */
-				if (remaining > 0 && !(revents & EV_TIMEOUT)) {
-					/* wait again */
-					ev_once(cs->loop->loop, cs->fd, EV_READ, remaining, closing_socket_cb, cs);
-					return;
-				}
-				/* timeout reached, break switch and loop */
-				break;
+				/* wait again */
+				return FALSE;
 			default:
-				/* real error (probably ECONNRESET or similar): break switch and loop */
+				/* real error (probably ECONNRESET or similar) */
 				/* no logging: there is no context anymore for the socket */
-				break;
+				return TRUE;
 			}
-			break; /* end loop */
 		}
+		i++;
 	}
 
-	close_socket_now(cs);
-	g_slice_free(closing_socket, cs);
+	return FALSE;
 }
 
-void li_event_add_closing_socket(liEventLoop *loop, int fd) {
-	closing_socket *cs;
+static void closing_socket_close(liEventLoop *loop, closing_socket *cs) {
+	close(li_event_io_fd(&cs->watcher));
+	li_event_clear(&cs->watcher);
+	g_queue_unlink(&loop->closing_lingering, &cs->link);
+	g_queue_push_head_link(&loop->closing_free, &cs->link);
+}
+
+static void closing_socket_cb(liEventBase *watcher, int events) {
+	closing_socket *cs = LI_CONTAINER_OF(li_event_io_from(watcher), closing_socket, watcher);
+	UNUSED(events);
+
+	/* still data left after CLOSING_SOCKET_MAX_READS: the watcher triggers again */
+	if (closing_socket_drain(li_event_io_fd(&cs->watcher))) {
+		closing_socket_close(li_event_get_loop(&cs->watcher), cs);
+	}
+}
+
+static void closing_sockets_prepare_cb(liEventBase *watcher, int events) {
+	liEventLoop *loop = LI_CONTAINER_OF(li_event_prepare_from(watcher), liEventLoop, closing_prepare);
+	li_tstamp timeout = li_event_now(loop) + CLOSING_SOCKET_TIMEOUT;
+	guint i;
+	UNUSED(events);
+
+	li_event_stop(&loop->closing_prepare);
+
+	for (i = 0; i < loop->closing_new->len; i++) {
+		int fd = g_array_index(loop->closing_new, int, i);
+		closing_socket *cs;
+
+		if (closing_socket_drain(fd)) {
+			close(fd);
+			continue;
+		}
+
+		if (0 == loop->closing_free.length) {
+			closing_socket *block = g_new0(closing_socket, CLOSING_SOCKET_BLOCK);
+			guint j;
+			g_ptr_array_add(loop->closing_blocks, block);
+			for (j = 0; j < CLOSING_SOCKET_BLOCK; j++) {
+				block[j].link.data = &block[j];
+				g_queue_push_tail_link(&loop->closing_free, &block[j].link);
+			}
+		}
+
+		cs = g_queue_pop_head_link(&loop->closing_free)->data;
+		cs->close_timeout = timeout;
+		g_queue_push_tail_link(&loop->closing_lingering, &cs->link);
 
+		li_event_io_init(loop, "closing socket", &cs->watcher, closing_socket_cb, fd, LI_EV_READ);
+		li_event_set_keep_loop_alive(&cs->watcher, FALSE);
+		li_event_start(&cs->watcher);
+	}
+	g_array_set_size(loop->closing_new, 0);
+
+	if (loop->closing_lingering.length > 0 && !li_event_active(&loop->closing_timer)) {
+		li_event_timer_once(&loop->closing_timer, CLOSING_SOCKET_TIMEOUT);
+	}
+}
+
+/* all sockets in closing_lingering have the same timeout: the list is ordered */
+static void closing_sockets_timer_cb(liEventBase *watcher, int events) {
+	liEventLoop *loop = LI_CONTAINER_OF(li_event_timer_from(watcher), liEventLoop, closing_timer);
+	li_tstamp now = li_event_now(loop);
+	GList *lnk;
+	UNUSED(events);
+
+	while (NULL != (lnk = loop->closing_lingering.head)) {
+		closing_socket *cs = lnk->data;
+
+		if (cs->close_timeout > now) {
+			li_event_timer_once(&loop->closing_timer, cs->close_timeout - now);
+			break;
+		}
+
+		closing_socket_close(loop, cs);
+	}
+}
+
+void li_event_add_closing_socket(liEventLoop *loop, int fd) {
 	if (-1 == fd) return;
 
 	shutdown(fd, SHUT_WR);
@@ -75,13 +141,8 @@ void li_event_add_closing_socket(liEventLoop *loop, int fd) {
 		return;
 	}
 
-	cs = g_slice_new0(closing_socket);
-	cs->loop = loop;
-	cs->fd = fd;
-	g_queue_push_tail_link(&loop->closing_sockets, &cs->sockets_link);
-	cs->close_timeout = li_event_now(loop) + 10.0;
-
-	ev_once(loop->loop, fd, EV_READ, 10.0, closing_socket_cb, cs);
+	g_array_append_val(loop->closing_new, fd);
+	if (!li_event_active(&loop->closing_prepare)) li_event_start(&loop->closing_prepare);
 }
 
 
@@ -90,8 +151,16 @@ void li_event_loop_init(liEventLoop *loop, struct ev_loop *evloop) {
 	loop->end = 0;
 	loop->loop = evloop;
 	g_queue_init(&loop->watchers);
-	g_queue_init(&loop->closing_sockets);
 	li_job_queue_init(&loop->jobqueue, loop);
+
+	loop->closing_new = g_array_new(FALSE, FALSE, sizeof(int));
+	loop->closing_blocks = g_ptr_array_new();
+	g_queue_init(&loop->closing_free);
+	g_queue_init(&loop->closing_lingering);
+	li_event_prepare_init(loop, "closing sockets", &loop->closing_prepare, closing_sockets_prepare_cb);
+	li_event_stop(&loop->closing_prepare);
+	li_event_timer_init(loop, "closing sockets linger", &loop->closing_timer, closing_sockets_timer_cb);
+	li_event_set_keep_loop_alive(&loop->closing_timer, FALSE);
 }
 
 struct ev_loop* li_event_loop_clear(liEventLoop *loop) {
@@ -99,6 +168,8 @@ struct ev_loop* li_event_loop_clear(liEventLoop *loop) {
 	GList *lnk;
 
 	li_event_loop_end(loop);
+	/* li_event_loop_end returns early if the loop already ended; never free the arrays with open fds */
+	li_event_loop_force_close_sockets(loop);
 	li_job_queue_clear(&loop->jobqueue);
 
 	while (NULL != (lnk = loop->watchers.head)) {
@@ -107,6 +178,12 @@ struct ev_loop* li_event_loop_clear(liEventLoop *loop) {
 		li_event_detach_(base);
 		LI_FORCE_ASSERT(lnk != loop->watchers.head);
 	}
+	g_array_free(loop->closing_new, TRUE);
+	loop->closing_new = NULL;
+	g_queue_init(&loop->closing_free);
+	g_ptr_array_foreach(loop->closing_blocks, (GFunc) g_free, NULL);
+	g_ptr_array_free(loop->closing_blocks, TRUE);
+	loop->closing_blocks = NULL;
 	loop->loop = NULL;
 	return evloop;
 }
@@ -129,13 +206,20 @@ void li_event_loop_exit(liEventLoop *loop) {
 }
 
 void li_event_loop_force_close_sockets(liEventLoop *loop) {
-	GList *lnk;
+	guint i;
+
+	if (NULL == loop->closing_new) return;
+
+	for (i = 0; i < loop->closing_new->len; i++) {
+		close(g_array_index(loop->closing_new, int, i));
+	}
+	g_array_set_size(loop->closing_new, 0);
+	li_event_stop(&loop->closing_prepare);
 
-	while (NULL != (lnk = loop->closing_sockets.head)) {
-		closing_socket *cs = LI_CONTAINER_OF(lnk, closing_socket, sockets_link);
-		ev_feed_fd_event(loop->loop, cs->fd, EV_READ);
-		close_socket_now(cs);
+	while (NULL != loop->closing_lingering.head) {
+		closing_socket_close(loop, loop->closing_lingering.head->data);
 	}
+	li_event_stop(&loop->closing_timer);
 }
 
 const char* li_event_loop_backend_string(liEventLoop *loop) {
@@ -214,6 +214,21 @@ out:
 	fetch_db_int_release(db);
 }
 
+void li_fetch_database_keys(liFetchDatabase* db, GPtrArray *keys) {
+	GList *lru_link;
+
+	g_mutex_lock(db->lock);
+
+	if (NULL != db->cache) {
+		for (lru_link = db->lru_queue.head; NULL != lru_link; lru_link = lru_link->next) {
+			liFetchEntryP *pentry = LI_CONTAINER_OF(lru_link, liFetchEntryP, lru_link);
+			g_ptr_array_add(keys, g_string_new_len(GSTR_LEN(pentry->public.key)));
+		}
+	}
+
+	g_mutex_unlock(db->lock);
+}
+
 /* db is already locked */
 static void cache_delete_data_cb(gpointer data) {
 	liFetchEntryP *pentry = data;
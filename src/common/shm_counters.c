@@ -0,0 +1,363 @@
+
+#include <lighttpd/shm_counters.h>
+#include <lighttpd/utils.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_COUNTERS_MAGIC ((guint32) 0x4c495343)
+#define SHM_COUNTERS_VERSION 2
+
+/* a lookup tries that many slots */
+#define SHM_COUNTERS_MAX_PROBES 32
+/* entries not used for that many seconds may be reused */
+#define SHM_COUNTERS_STALE 10
+/* value of a slot while it gets reused for another key */
+#define SHM_COUNTERS_CLAIMED G_MININT
+
+typedef enum {
+	SHM_COUNTER_GAUGE = 1,
+	SHM_COUNTER_RATE,
+	SHM_COUNTER_BUCKET
+} shm_counter_kind;
+
+typedef struct shm_counters_header shm_counters_header;
+struct shm_counters_header {
+	guint32 magic, version;
+	guint32 slots; /* power of 2 */
+	guint32 owners; /* number of per owner gauge tables following the slots */
+	guint32 reserved[12]; /* header uses a full cache line */
+};
+
+typedef struct shm_counter shm_counter;
+struct shm_counter {
+	gpointer key; /* NULL: empty */
+	gint value; /* SHM_COUNTERS_CLAIMED: slot is being reused */
+	gint window; /* RATE: second of the current count; BUCKET: last refill (msec) */
+	gint last_use; /* seconds */
+	gint kind;
+};
+
+struct liShmCounters {
+	gpointer mem;
+	gsize size;
+	guint mask;
+	shm_counter *slots;
+	guint owners;
+	gint *owner_tables; /* owners * slots: gauge increments held by each owner */
+	gint *held; /* table of our owner, NULL if not tracked */
+};
+
+static guint shm_counters_slots(guint slots) {
+	guint n;
+	for (n = 64; n < slots && n < (1u << 24); n <<= 1) ;
+	return n;
+}
+
+static gsize shm_counters_size(guint slots, guint owners) {
+	return sizeof(shm_counters_header) + (gsize) slots * sizeof(shm_counter) + (gsize) owners * slots * sizeof(gint);
+}
+
+int li_shm_counters_create_fd(guint slots, guint owners, GError **err) {
+	const gchar *dirs[] = { "/dev/shm", NULL };
+	shm_counters_header header;
+	gsize size;
+	gchar *filename;
+	int fd = -1;
+	guint i;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SHM_COUNTERS_MAGIC;
+	header.version = SHM_COUNTERS_VERSION;
+	header.slots = shm_counters_slots(slots);
+	header.owners = owners;
+	size = shm_counters_size(header.slots, owners);
+
+	dirs[1] = g_get_tmp_dir();
+	for (i = 0; i < G_N_ELEMENTS(dirs) && -1 == fd; i++) {
+		filename = g_strconcat(dirs[i], "/lighttpd2-counters-XXXXXX", NULL);
+		fd = mkstemp(filename);
+		if (-1 != fd) unlink(filename);
+		g_free(filename);
+	}
+
+	if (-1 == fd) {
+		g_set_error(err, LI_SYS_ERROR, 0, "couldn't create shared memory file: %s", g_strerror(errno));
+		return -1;
+	}
+
+	li_fd_close_on_exec(fd);
+
+	/* the file is zero filled: all slots are empty (pages of the owner tables are only allocated when used) */
+	if (-1 == ftruncate(fd, size) || (ssize_t) sizeof(header) != pwrite(fd, &header, sizeof(header), 0)) {
+		g_set_error(err, LI_SYS_ERROR, 0, "couldn't initialize shared memory file: %s", g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+liShmCounters* li_shm_counters_map(int fd, gint owner, GError **err) {
+	liShmCounters *counters;
+	shm_counters_header *header;
+	struct stat st;
+	gpointer mem;
+
+	if (-1 == fstat(fd, &st)) {
+		g_set_error(err, LI_SYS_ERROR, 0, "couldn't stat shared memory file: %s", g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((gsize) st.st_size < sizeof(shm_counters_header)) goto invalid;
+
+	mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == mem) {
+		g_set_error(err, LI_SYS_ERROR, 0, "couldn't map shared memory file: %s", g_strerror(errno));
+		return NULL;
+	}
+
+	header = mem;
+	if (SHM_COUNTERS_MAGIC != header->magic || SHM_COUNTERS_VERSION != header->version
+	    || header->slots != shm_counters_slots(header->slots)
+	    || (gsize) st.st_size < shm_counters_size(header->slots, header->owners)) {
+		munmap(mem, st.st_size);
+		g_set_error(err, LI_SYS_ERROR, 0, "%s", "invalid shared memory file");
+		return NULL;
+	}
+
+	counters = g_slice_new0(liShmCounters);
+	counters->mem = mem;
+	counters->size = st.st_size;
+	counters->mask = header->slots - 1;
+	counters->slots = (shm_counter*) (header + 1);
+	counters->owners = header->owners;
+	counters->owner_tables = (gint*) (counters->slots + header->slots);
+	if (owner >= 0 && (guint) owner < header->owners) {
+		counters->held = counters->owner_tables + (gsize) owner * header->slots;
+	}
+
+	return counters;
+
+invalid:
+	g_set_error(err, LI_SYS_ERROR, 0, "%s", "invalid shared memory file");
+	close(fd);
+	return NULL;
+}
+
+void li_shm_counters_free(liShmCounters *counters) {
+	if (NULL == counters) return;
+
+	munmap(counters->mem, counters->size);
+	g_slice_free(liShmCounters, counters);
+}
+
+/* FNV-1a, 0 is reserved for empty slots */
+gsize li_shm_counters_key(const gchar *ns, gsize ns_len, gconstpointer data, gsize len) {
+	guint64 h = G_GUINT64_CONSTANT(14695981039346656037);
+	const guchar *d = data;
+	gsize i;
+
+	for (i = 0; i < ns_len; i++) {
+		h ^= (guchar) ns[i];
+		h *= G_GUINT64_CONSTANT(1099511628211);
+	}
+	h ^= 0xff; /* separator */
+	h *= G_GUINT64_CONSTANT(1099511628211);
+	for (i = 0; i < len; i++) {
+		h ^= d[i];
+		h *= G_GUINT64_CONSTANT(1099511628211);
+	}
+
+	if (sizeof(gsize) < sizeof(h)) h ^= (h >> 32);
+	if (0 == (gsize) h) h = 1;
+
+	return (gsize) h;
+}
+
+static gboolean shm_counter_stale(shm_counter *c, gint sec) {
+	gint last_use = g_atomic_int_get(&c->last_use);
+
+	return (sec - last_use) > SHM_COUNTERS_STALE;
+}
+
+/* returns the slot for key (creating it if needed) or NULL if there is no free slot */
+static shm_counter* shm_counters_lookup(liShmCounters *counters, gsize key, shm_counter_kind kind, gint sec) {
+	gpointer pkey = GSIZE_TO_POINTER(key);
+	shm_counter *reuse = NULL;
+	guint i, idx;
+
+	for (i = 0, idx = key & counters->mask; i < SHM_COUNTERS_MAX_PROBES; i++, idx = (idx + 1) & counters->mask) {
+		shm_counter *c = &counters->slots[idx];
+		gpointer ckey = g_atomic_pointer_get(&c->key);
+
+		if (NULL == ckey) {
+			if (g_atomic_pointer_compare_and_exchange(&c->key, NULL, pkey)) {
+				g_atomic_int_set(&c->kind, kind);
+				g_atomic_int_set(&c->last_use, sec);
+				return c;
+			}
+			ckey = g_atomic_pointer_get(&c->key);
+		}
+
+		if (ckey == pkey) return c;
+
+		if (NULL == reuse && shm_counter_stale(c, sec)) reuse = c;
+	}
+
+	/* reuse a stale slot; gauges only if nobody holds a reference */
+	if (NULL != reuse) {
+		gint value = g_atomic_int_get(&reuse->value);
+
+		if (SHM_COUNTERS_CLAIMED == value) return NULL;
+		if (SHM_COUNTER_GAUGE == g_atomic_int_get(&reuse->kind) && 0 != value) return NULL;
+		if (!g_atomic_int_compare_and_exchange(&reuse->value, value, SHM_COUNTERS_CLAIMED)) return NULL;
+
+		g_atomic_pointer_set(&reuse->key, pkey);
+		g_atomic_int_set(&reuse->kind, kind);
+		g_atomic_int_set(&reuse->window, 0);
+		g_atomic_int_set(&reuse->last_use, sec);
+		g_atomic_int_set(&reuse->value, 0);
+
+		return reuse;
+	}
+
+	return NULL;
+}
+
+gint li_shm_counters_inc(liShmCounters *counters, gsize key, gint limit, li_tstamp now) {
+	gint sec = (gint) (gint64) now;
+	guint tries;
+
+	for (tries = 0; tries < 4; tries++) {
+		shm_counter *c = shm_counters_lookup(counters, key, SHM_COUNTER_GAUGE, sec);
+		gint value;
+
+		if (NULL == c) return -2;
+
+		do {
+			value = g_atomic_int_get(&c->value);
+			if (SHM_COUNTERS_CLAIMED == value) break;
+			if (value >= limit) return -1;
+		} while (!g_atomic_int_compare_and_exchange(&c->value, value, value + 1));
+		if (SHM_COUNTERS_CLAIMED == value) continue;
+
+		/* the slot could have been reused between lookup and increment */
+		if (g_atomic_pointer_get(&c->key) != GSIZE_TO_POINTER(key)) {
+			g_atomic_int_add(&c->value, -1);
+			continue;
+		}
+
+		g_atomic_int_set(&c->last_use, sec);
+		if (NULL != counters->held) g_atomic_int_inc(&counters->held[c - counters->slots]);
+		return c - counters->slots;
+	}
+
+	return -2;
+}
+
+void li_shm_counters_dec(liShmCounters *counters, gint handle, li_tstamp now) {
+	shm_counter *c;
+
+	if (handle < 0 || (guint) handle > counters->mask) return;
+
+	c = &counters->slots[handle];
+	g_atomic_int_set(&c->last_use, (gint) (gint64) now);
+	if (NULL != counters->held) g_atomic_int_add(&counters->held[handle], -1);
+	g_atomic_int_add(&c->value, -1);
+}
+
+guint li_shm_counters_release_owner(liShmCounters *counters, guint owner) {
+	gint *held;
+	guint i, released = 0;
+
+	if (owner >= counters->owners) return 0;
+
+	/* a held gauge has value > 0, so its slot can't be reused for another key meanwhile */
+	held = counters->owner_tables + (gsize) owner * (counters->mask + 1);
+	for (i = 0; i <= counters->mask; i++) {
+		gint n = g_atomic_int_get(&held[i]);
+		if (0 == n) continue;
+
+		g_atomic_int_add(&held[i], -n);
+		g_atomic_int_add(&counters->slots[i].value, -n);
+		released += n;
+	}
+
+	return released;
+}
+
+gint li_shm_counters_rate(liShmCounters *counters, gsize key, gint limit, li_tstamp now) {
+	gint sec = (gint) (gint64) now;
+	guint tries;
+
+	for (tries = 0; tries < 4; tries++) {
+		shm_counter *c = shm_counters_lookup(counters, key, SHM_COUNTER_RATE, sec);
+		gint value, window;
+
+		if (NULL == c) return -2;
+
+		g_atomic_int_set(&c->last_use, sec);
+
+		window = g_atomic_int_get(&c->window);
+		if (window != sec && g_atomic_int_compare_and_exchange(&c->window, window, sec)) {
+			/* new second: restart counting */
+			for (;;) {
+				value = g_atomic_int_get(&c->value);
+				if (SHM_COUNTERS_CLAIMED == value) break;
+				if (g_atomic_int_compare_and_exchange(&c->value, value, 1)) return 0;
+			}
+			continue;
+		}
+
+		do {
+			value = g_atomic_int_get(&c->value);
+			if (SHM_COUNTERS_CLAIMED == value) break;
+			if (value >= limit) return -1;
+		} while (!g_atomic_int_compare_and_exchange(&c->value, value, value + 1));
+		if (SHM_COUNTERS_CLAIMED != value) return 0;
+	}
+
+	return -2;
+}
+
+guint li_shm_counters_take(liShmCounters *counters, gsize key, guint rate, guint burst, guint granularity, li_tstamp now, guint want) {
+	gint sec = (gint) (gint64) now;
+	guint msec = (guint) (guint64) (now * 1000.0);
+	guint tries;
+
+	if (burst > (guint) G_MAXINT) burst = G_MAXINT;
+
+	for (tries = 0; tries < 4; tries++) {
+		shm_counter *c = shm_counters_lookup(counters, key, SHM_COUNTER_BUCKET, sec);
+		guint last;
+		gint value, take;
+
+		if (NULL == c) return want;
+
+		g_atomic_int_set(&c->last_use, sec);
+
+		last = (guint) g_atomic_int_get(&c->window);
+		if ((0 == last || msec - last >= granularity) && g_atomic_int_compare_and_exchange(&c->window, (gint) last, (gint) msec)) {
+			/* refill; a new bucket starts full */
+			guint64 fill = (0 == last) ? burst : ((guint64) rate * MIN(msec - last, 1000u)) / 1000u;
+			for (;;) {
+				value = g_atomic_int_get(&c->value);
+				if (SHM_COUNTERS_CLAIMED == value) break;
+				if (g_atomic_int_compare_and_exchange(&c->value, value, (gint) MIN((guint64) burst, (guint64) value + fill))) break;
+			}
+		}
+
+		for (;;) {
+			value = g_atomic_int_get(&c->value);
+			if (SHM_COUNTERS_CLAIMED == value) break;
+			take = MIN((guint) value, want);
+			if (0 == take) return 0;
+			if (g_atomic_int_compare_and_exchange(&c->value, value, value - take)) return take;
+		}
+	}
+
+	return want;
+}
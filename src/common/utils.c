@@ -1033,3 +1033,243 @@ void li_g_queue_merge(GQueue *dest, GQueue *src) {
 		g_queue_init(src);
 	}
 }
+
+void li_seqlock_write(gint *seq, gpointer block, gconstpointer src, gsize size) {
+	/* the atomic increments are full memory barriers */
+	g_atomic_int_inc(seq);
+	memcpy(block, src, size);
+	g_atomic_int_inc(seq);
+}
+
+void li_seqlock_read(gint *seq, gpointer dest, gconstpointer block, gsize size) {
+	for (;;) {
+		gint s = g_atomic_int_get(seq);
+
+		if (s & 1) {
+			/* the writer is copying a new block right now */
+			g_thread_yield();
+			continue;
+		}
+
+		memcpy(dest, block, size);
+
+		/* compare-and-exchange as barrier: the copy must not be reordered after the check */
+		if (g_atomic_int_compare_and_exchange(seq, s, s)) return;
+	}
+}
+
+void li_listen_options_init(liListenOptions *opts) {
+	memset(opts, 0, sizeof(*opts));
+	opts->backlog = 1000;
+}
+
+void li_listen_options_clear(liListenOptions *opts) {
+	if (NULL != opts->congestion) g_string_free(opts->congestion, TRUE);
+	li_listen_options_init(opts);
+}
+
+gboolean li_listen_options_set(liListenOptions *opts, const gchar *key, const gchar *value, GError **error) {
+	gint *target;
+	gchar *end;
+	guint64 v;
+
+	if (g_str_equal(key, "congestion")) {
+		if ('\0' == value[0]) {
+			g_set_error(error, LI_SYS_ERROR, EINVAL, "listen option 'congestion' expects a non-empty string");
+			return FALSE;
+		}
+		if (NULL == opts->congestion) opts->congestion = g_string_sized_new(15);
+		g_string_assign(opts->congestion, value);
+		return TRUE;
+	}
+
+	if (g_str_equal(key, "backlog")) target = &opts->backlog;
+	else if (g_str_equal(key, "defer_accept")) target = &opts->defer_accept;
+	else if (g_str_equal(key, "rcvbuf")) target = &opts->rcvbuf;
+	else if (g_str_equal(key, "sndbuf")) target = &opts->sndbuf;
+	else if (g_str_equal(key, "notsent_lowat")) target = &opts->notsent_lowat;
+	else if (g_str_equal(key, "busy_poll")) target = &opts->busy_poll;
+	else if (g_str_equal(key, "reuseport")) target = &opts->reuseport;
+	else {
+		g_set_error(error, LI_SYS_ERROR, EINVAL, "unknown listen option '%s'", key);
+		return FALSE;
+	}
+
+	v = g_ascii_strtoull(value, &end, 10);
+	if (end == value || '\0' != *end || v > G_MAXINT || (target == &opts->reuseport && v > 64)) {
+		g_set_error(error, LI_SYS_ERROR, EINVAL, "invalid value '%s' for listen option '%s'", value, key);
+		return FALSE;
+	}
+
+	*target = (gint) v;
+	return TRUE;
+}
+
+void li_listen_options_to_string(const liListenOptions *opts, GString *dest) {
+	if (1000 != opts->backlog) g_string_append_printf(dest, "backlog=%i\n", opts->backlog);
+	if (0 != opts->defer_accept) g_string_append_printf(dest, "defer_accept=%i\n", opts->defer_accept);
+	if (0 != opts->rcvbuf) g_string_append_printf(dest, "rcvbuf=%i\n", opts->rcvbuf);
+	if (0 != opts->sndbuf) g_string_append_printf(dest, "sndbuf=%i\n", opts->sndbuf);
+	if (0 != opts->notsent_lowat) g_string_append_printf(dest, "notsent_lowat=%i\n", opts->notsent_lowat);
+	if (0 != opts->busy_poll) g_string_append_printf(dest, "busy_poll=%i\n", opts->busy_poll);
+	if (0 != opts->reuseport) g_string_append_printf(dest, "reuseport=%i\n", opts->reuseport);
+	if (NULL != opts->congestion) g_string_append_printf(dest, "congestion=%s\n", opts->congestion->str);
+}
+
+gboolean li_listen_options_from_string(liListenOptions *opts, const gchar *str, gsize len, GError **error) {
+	gchar *buf = g_strndup(str, len);
+	gchar **lines = g_strsplit(buf, "\n", 0);
+	gboolean result = TRUE;
+	guint i;
+
+	for (i = 0; result && NULL != lines[i]; i++) {
+		gchar *eq;
+
+		if ('\0' == lines[i][0]) continue;
+
+		if (NULL == (eq = strchr(lines[i], '='))) {
+			g_set_error(error, LI_SYS_ERROR, EINVAL, "invalid listen option '%s'", lines[i]);
+			result = FALSE;
+			break;
+		}
+		*eq = '\0';
+		result = li_listen_options_set(opts, lines[i], eq + 1, error);
+	}
+
+	g_strfreev(lines);
+	g_free(buf);
+
+	return result;
+}
+
+#define LISTEN_SETSOCKOPT(level, name, value) do { \
+		int _v = (value); \
+		if (-1 == setsockopt(fd, level, name, &_v, sizeof(_v))) { \
+			LI_SET_SYS_ERROR(error, "setsockopt(" #name ")"); \
+			return FALSE; \
+		} \
+	} while (0)
+
+gboolean li_listen_options_apply(const liListenOptions *opts, int fd, int family, GError **error) {
+	gboolean tcp = (AF_INET == family);
+#ifdef HAVE_IPV6
+	tcp = tcp || (AF_INET6 == family);
+#endif
+
+	if (opts->rcvbuf > 0) LISTEN_SETSOCKOPT(SOL_SOCKET, SO_RCVBUF, opts->rcvbuf);
+	if (opts->sndbuf > 0) LISTEN_SETSOCKOPT(SOL_SOCKET, SO_SNDBUF, opts->sndbuf);
+
+	if (!tcp) return TRUE;
+
+	/* the following options are inherited by the accepted connections */
+
+	if (opts->reuseport > 0) {
+#ifdef SO_REUSEPORT
+		LISTEN_SETSOCKOPT(SOL_SOCKET, SO_REUSEPORT, 1);
+#else
+		g_set_error(error, LI_SYS_ERROR, ENOSYS, "SO_REUSEPORT not supported on this platform");
+		return FALSE;
+#endif
+	}
+
+	if (opts->busy_poll > 0) {
+#ifdef SO_BUSY_POLL
+		LISTEN_SETSOCKOPT(SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll);
+#else
+		g_set_error(error, LI_SYS_ERROR, ENOSYS, "SO_BUSY_POLL not supported on this platform");
+		return FALSE;
+#endif
+	}
+
+	if (NULL != opts->congestion) {
+#ifdef TCP_CONGESTION
+		if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, opts->congestion->str, opts->congestion->len)) {
+			LI_SET_SYS_ERROR(error, "setsockopt(TCP_CONGESTION)");
+			return FALSE;
+		}
+#else
+		g_set_error(error, LI_SYS_ERROR, ENOSYS, "TCP_CONGESTION not supported on this platform");
+		return FALSE;
+#endif
+	}
+
+	return TRUE;
+}
+
+gboolean li_listen_options_apply_unprivileged(const liListenOptions *opts, int fd, int family, GError **error) {
+	gboolean tcp = (AF_INET == family);
+#ifdef HAVE_IPV6
+	tcp = tcp || (AF_INET6 == family);
+#endif
+
+	if (!tcp) return TRUE;
+
+#ifdef TCP_DEFER_ACCEPT
+	LISTEN_SETSOCKOPT(IPPROTO_TCP, TCP_DEFER_ACCEPT, opts->defer_accept);
+#else
+	if (opts->defer_accept > 0) {
+		g_set_error(error, LI_SYS_ERROR, ENOSYS, "TCP_DEFER_ACCEPT not supported on this platform");
+		return FALSE;
+	}
+#endif
+
+#ifdef TCP_NOTSENT_LOWAT
+	/* 0: use net.ipv4.tcp_notsent_lowat */
+	LISTEN_SETSOCKOPT(IPPROTO_TCP, TCP_NOTSENT_LOWAT, opts->notsent_lowat);
+#else
+	if (opts->notsent_lowat > 0) {
+		g_set_error(error, LI_SYS_ERROR, ENOSYS, "TCP_NOTSENT_LOWAT not supported on this platform");
+		return FALSE;
+	}
+#endif
+
+	return TRUE;
+}
+
+gboolean li_listen_options_reset(const liListenOptions *prev, const liListenOptions *opts, int fd, int family, GError **error) {
+	gboolean tcp = (AF_INET == family);
+#ifdef HAVE_IPV6
+	tcp = tcp || (AF_INET6 == family);
+#endif
+
+	if (tcp) {
+#ifdef SO_BUSY_POLL
+		if (prev->busy_poll > 0 && 0 == opts->busy_poll) LISTEN_SETSOCKOPT(SOL_SOCKET, SO_BUSY_POLL, 0);
+#endif
+#ifdef TCP_CONGESTION
+		if (NULL != prev->congestion && NULL == opts->congestion) {
+			gchar *def = NULL;
+			gsize len;
+
+			/* linux: the system default algorithm */
+			if (!g_file_get_contents("/proc/sys/net/ipv4/tcp_congestion_control", &def, &len, NULL)) {
+				g_set_error(error, LI_SYS_ERROR, ENOSYS, "couldn't determine the default congestion control algorithm");
+				return FALSE;
+			}
+			g_strstrip(def);
+			if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, def, strlen(def))) {
+				g_free(def);
+				LI_SET_SYS_ERROR(error, "setsockopt(TCP_CONGESTION)");
+				return FALSE;
+			}
+			g_free(def);
+		}
+#endif
+	}
+
+	/* a set buffer size disables the autotuning of the kernel for good */
+	if ((prev->rcvbuf > 0 && 0 == opts->rcvbuf) || (prev->sndbuf > 0 && 0 == opts->sndbuf)) {
+		g_set_error(error, LI_SYS_ERROR, EINVAL, "rcvbuf/sndbuf can't be reset to the system default without closing the socket");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void li_listen_options_copy(liListenOptions *dest, const liListenOptions *src) {
+	li_listen_options_clear(dest);
+	*dest = *src;
+	if (NULL != src->congestion) dest->congestion = g_string_new_len(GSTR_LEN(src->congestion));
+}
+
+#undef LISTEN_SETSOCKOPT
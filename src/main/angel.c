@@ -45,8 +45,41 @@ struct angel_listen_cb_ctx {
 	liServer *srv;
 	liAngelListenCB cb;
 	gpointer data;
+	GString *options; /* NULL if default */
 };
 
+/* the angel only applies the options which may need privileges; set the others ourselves.
+ * they are always set, so options removed from the config get reset on sockets the angel reuses */
+static void angel_listen_apply_options(liServer *srv, int fd, GString *options) {
+	liListenOptions opts;
+	liSockAddr addr;
+	socklen_t len = sizeof(addr);
+	GError *err = NULL;
+
+	li_listen_options_init(&opts);
+
+	if (-1 == getsockname(fd, &addr.plain, &len)) {
+		ERROR(srv, "Couldn't apply listen options: getsockname failed: %s", g_strerror(errno));
+	} else if ((NULL != options && !li_listen_options_from_string(&opts, GSTR_LEN(options), &err))
+	    || !li_listen_options_apply_unprivileged(&opts, fd, addr.plain.sa_family, &err)) {
+		ERROR(srv, "Couldn't apply listen options: %s", err->message);
+		g_error_free(err);
+	}
+
+	li_listen_options_clear(&opts);
+}
+
+static void angel_listen_fd(liServer *srv, int fd, liAngelListenCB cb, gpointer data, GString *options) {
+	if (cb) {
+		cb(srv, fd, data);
+	} else {
+		liServerSocket *sock;
+		angel_listen_apply_options(srv, fd, options);
+		sock = li_server_listen(srv, fd);
+		if (NULL != options) sock->listen_options = g_string_new_len(GSTR_LEN(options));
+	}
+}
+
 static void li_angel_listen_cb(gpointer pctx, gboolean timeout, GString *error, GString *data, GArray *fds) {
 	angel_listen_cb_ctx ctx = * (angel_listen_cb_ctx*) pctx;
 	liServer *srv = ctx.srv;
@@ -57,58 +90,71 @@ static void li_angel_listen_cb(gpointer pctx, gboolean timeout, GString *error,
 
 	if (timeout) {
 		ERROR(srv, "listen failed: %s", "time out");
-		return;
-	}
-
-	if (error->len > 0) {
+	} else if (error->len > 0) {
 		ERROR(srv, "listen failed: %s", error->str);
 		/* TODO: exit? */
-		return;
-	}
-
-	if (fds && fds->len > 0) {
+	} else if (fds && fds->len > 0) {
+		/* more than one fd for SO_REUSEPORT groups */
 		for (i = 0; i < fds->len; i++) {
 			int fd = g_array_index(fds, int, i);
 			/* DEBUG(srv, "listening on fd %i", fd); */
-			if (ctx.cb) {
-				ctx.cb(srv, fd, ctx.data);
-			} else {
-				li_server_listen(srv, fd);
-			}
+			angel_listen_fd(srv, fd, ctx.cb, ctx.data, ctx.options);
 		}
 		g_array_set_size(fds, 0);
 	} else {
 		ERROR(srv, "listen failed: %s", "received no filedescriptors");
 	}
+
+	if (NULL != ctx.options) g_string_free(ctx.options, TRUE);
 }
 
 /* listen to a socket */
 void li_angel_listen(liServer *srv, GString *str, liAngelListenCB cb, gpointer data) {
+	li_angel_listen_options(srv, str, NULL, cb, data);
+}
+
+void li_angel_listen_options(liServer *srv, GString *str, const liListenOptions *opts, liAngelListenCB cb, gpointer data) {
+	GString *options = NULL;
+
+	if (NULL != opts) {
+		options = g_string_sized_new(0);
+		li_listen_options_to_string(opts, options);
+		if (0 == options->len) {
+			g_string_free(options, TRUE);
+			options = NULL;
+		}
+	}
+
 	if (srv->acon) {
 		liAngelCall *acall = li_angel_call_new(&srv->main_worker->loop, li_angel_listen_cb, 20.0);
 		angel_listen_cb_ctx *ctx = g_slice_new0(angel_listen_cb_ctx);
+		GString *payload = g_string_new_len(GSTR_LEN(str));
 		GError *err = NULL;
 
+		/* "<address>" ["\0" options] */
+		if (NULL != options) {
+			g_string_append_c(payload, '\0');
+			g_string_append_len(payload, GSTR_LEN(options));
+		}
+
 		ctx->srv = srv;
 		ctx->cb = cb;
 		ctx->data = data;
+		ctx->options = options;
 		acall->context = ctx;
-		if (!li_angel_send_call(srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("listen"), acall, g_string_new_len(GSTR_LEN(str)), &err)) {
+		if (!li_angel_send_call(srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("listen"), acall, payload, &err)) {
 			ERROR(srv, "couldn't send call: %s", err->message);
 			g_error_free(err);
 		}
 	} else {
-		int fd = li_angel_fake_listen(srv, str);
+		int fd = li_angel_fake_listen(srv, str, opts);
 		if (-1 == fd) {
 			ERROR(srv, "listen('%s') failed", str->str);
 			/* TODO: exit? */
 		} else {
-			if (cb) {
-				cb(srv, fd, data);
-			} else {
-				li_server_listen(srv, fd);
-			}
+			angel_listen_fd(srv, fd, cb, data, options);
 		}
+		if (NULL != options) g_string_free(options, TRUE);
 	}
 }
 
@@ -180,3 +226,44 @@ void li_angel_log_open_file(liServer *srv, liEventLoop *loop, GString *filename,
 		cb(srv, fd, data);
 	}
 }
+
+static void angel_shm_counters_map(liServer *srv, int fd, gint owner) {
+	GError *err = NULL;
+
+	if (NULL == (srv->shm_counters = li_shm_counters_map(fd, owner, &err))) {
+		ERROR(srv, "couldn't map shared counters (limits are not shared): %s", err->message);
+		g_error_free(err);
+	}
+}
+
+static void li_angel_shm_counters_cb(gpointer pctx, gboolean timeout, GString *error, GString *data, GArray *fds) {
+	liServer *srv = pctx;
+
+	if (timeout) {
+		ERROR(srv, "Couldn't get shared counters: %s", "timeout");
+	} else if (error->len > 0) {
+		ERROR(srv, "Couldn't get shared counters: %s", error->str);
+	} else if (NULL == fds || fds->len != 1) {
+		ERROR(srv, "Couldn't get shared counters: no or too many filedescriptors (%i)", (int) (NULL == fds ? 0 : fds->len));
+	} else {
+		/* data: our owner index (see li_shm_counters_map), -1 if the angel has none left */
+		gint owner = (NULL != data && data->len > 0) ? atoi(data->str) : -1;
+		angel_shm_counters_map(srv, g_array_index(fds, int, 0), owner);
+		g_array_set_size(fds, 0);
+	}
+}
+
+void li_angel_shm_counters(liServer *srv) {
+	liAngelCall *acall;
+	GError *err = NULL;
+
+	/* without angel there are no other processes to share with */
+	if (!srv->acon || !g_atomic_int_get(&srv->shm_counters_wanted)) return;
+
+	acall = li_angel_call_new(&srv->main_worker->loop, li_angel_shm_counters_cb, 10.0);
+	acall->context = srv;
+	if (!li_angel_send_call(srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("shm-counters"), acall, NULL, &err)) {
+		ERROR(srv, "couldn't send call: %s", err->message);
+		g_error_free(err);
+	}
+}
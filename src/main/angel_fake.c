@@ -6,10 +6,12 @@
 #include <fcntl.h>
 
 /* listen to a socket */
-int li_angel_fake_listen(liServer *srv, GString *str) {
+int li_angel_fake_listen(liServer *srv, GString *str, const liListenOptions *opts) {
 	liSocketAddress addr = li_sockaddr_from_string(str, 80);
 	liSockAddr *saddr = addr.addr;
 	GString *tmpstr;
+	liListenOptions default_opts;
+	GError *err = NULL;
 	int s, v;
 
 	if (NULL == saddr) {
@@ -17,6 +19,13 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 		return -1;
 	}
 
+	if (NULL == opts) {
+		li_listen_options_init(&default_opts);
+		opts = &default_opts;
+	} else if (opts->reuseport > 1) {
+		WARNING(srv, "reuseport groups need the angel, listening on a single socket for '%s'", str->str);
+	}
+
 	tmpstr = li_sockaddr_to_string(addr, NULL, TRUE);
 
 	switch (saddr->plain.sa_family) {
@@ -35,12 +44,18 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 			ERROR(srv, "Couldn't open socket: %s", g_strerror(errno));
 			goto error;
 		}
+		if (!li_listen_options_apply(opts, s, AF_UNIX, &err)) {
+			ERROR(srv, "Couldn't apply listen options for '%s': %s", tmpstr->str, err->message);
+			g_error_free(err);
+			close(s);
+			goto error;
+		}
 		if (-1 == bind(s, &saddr->plain, addr.len)) {
 			ERROR(srv, "Couldn't bind socket to '%s': %s", tmpstr->str, g_strerror(errno));
 			close(s);
 			goto error;
 		}
-		if (-1 == listen(s, 1000)) {
+		if (-1 == listen(s, opts->backlog)) {
 			ERROR(srv, "Couldn't listen on '%s': %s", tmpstr->str, g_strerror(errno));
 			close(s);
 			goto error;
@@ -69,6 +84,12 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 			goto error;
 		}
 #endif
+		if (!li_listen_options_apply(opts, s, saddr->plain.sa_family, &err)) {
+			ERROR(srv, "Couldn't apply listen options for '%s': %s", tmpstr->str, err->message);
+			g_error_free(err);
+			close(s);
+			goto error;
+		}
 		if (-1 == bind(s, &saddr->plain, addr.len)) {
 			ERROR(srv, "Couldn't bind socket to '%s': %s", tmpstr->str, g_strerror(errno));
 			close(s);
@@ -78,7 +99,7 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 		v = 1000;
 		setsockopt(s, SOL_TCP, TCP_FASTOPEN, &v, sizeof(v));
 #endif
-		if (-1 == listen(s, 1000)) {
+		if (-1 == listen(s, opts->backlog)) {
 			ERROR(srv, "Couldn't listen on '%s': %s", tmpstr->str, g_strerror(errno));
 			close(s);
 			goto error;
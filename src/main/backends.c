@@ -83,6 +83,12 @@ struct liBackendPool_p {
 
 	li_tstamp ts_disabled_till;
 
+	/* CoDel state for wait_queue [pool] */
+	li_tstamp codel_first_above; /* 0: the oldest waiter is below the target; otherwise the time dropping may start */
+	li_tstamp codel_drop_next;
+	guint codel_count;
+	gboolean codel_dropping;
+
 	gboolean initialized, shutdown;
 };
 
@@ -725,6 +731,62 @@ static void backend_pool_worker_idle_timeout(liWaitQueue *wq, gpointer data) {
 	li_waitqueue_update(wq);
 }
 
+/* interval / sqrt(count), without libm */
+static li_tstamp backend_codel_control_law(li_tstamp interval, guint count) {
+	gdouble r = count;
+	guint i;
+
+	if (count <= 1) return interval;
+	for (i = 0; i < 20; i++) r = (r + count / r) / 2;
+
+	return interval / r;
+}
+
+/* CoDel (controlled delay) on the global wait queue: once the oldest waiter waited longer than
+ * the target for a whole interval, fail waiters at the head of the queue (like wait_timeout would),
+ * with shorter pauses the longer the queue stays above the target.
+ */
+static void S_backend_pool_codel(liBackendPool_p *pool, liServer *srv, li_tstamp now) {
+	li_tstamp target = srv->backend_codel_target, interval = srv->backend_codel_interval;
+	liBackendWait *bwait;
+
+	if (target <= 0) return;
+
+	if (0 == pool->wait_queue.length) {
+		pool->codel_first_above = 0;
+		pool->codel_dropping = FALSE;
+		return;
+	}
+
+	bwait = LI_CONTAINER_OF(g_queue_peek_head_link(&pool->wait_queue), liBackendWait, wait_queue_link);
+	if (now - bwait->ts_started < target) {
+		pool->codel_first_above = 0;
+		pool->codel_dropping = FALSE;
+		return;
+	}
+
+	if (0 == pool->codel_first_above) {
+		pool->codel_first_above = now + interval;
+		return;
+	}
+
+	if (!pool->codel_dropping) {
+		if (now < pool->codel_first_above) return;
+		pool->codel_dropping = TRUE;
+		/* start near the previous drop rate if we were dropping recently */
+		pool->codel_count = (pool->codel_count > 2 && now - pool->codel_drop_next < 8 * interval) ? pool->codel_count - 2 : 1;
+	} else {
+		if (now < pool->codel_drop_next) return;
+		pool->codel_count++;
+	}
+
+	g_queue_pop_head_link(&pool->wait_queue);
+	bwait->failed = TRUE;
+	li_job_async(bwait->vr_ref);
+
+	pool->codel_drop_next = now + backend_codel_control_law(interval, pool->codel_count);
+}
+
 static void S_backend_pool_update_wait_queue_timer(liBackendWorkerPool *wpool) {
 	liBackendPool_p *pool = wpool->pool;
 
@@ -732,8 +794,22 @@ static void S_backend_pool_update_wait_queue_timer(liBackendWorkerPool *wpool) {
 		li_tstamp now = li_cur_ts(wpool->wrk);
 		liBackendWait *bwait = LI_CONTAINER_OF(g_queue_peek_head_link(&pool->wait_queue), liBackendWait, wait_queue_link);
 		li_tstamp repeat = bwait->ts_started + pool->public.config->wait_timeout - now;
+		li_tstamp min_repeat = 0.05;
+
+		if (wpool->wrk->srv->backend_codel_target > 0) {
+			li_tstamp codel;
+			if (pool->codel_dropping) {
+				codel = pool->codel_drop_next - now;
+			} else if (0 != pool->codel_first_above) {
+				codel = pool->codel_first_above - now;
+			} else {
+				codel = bwait->ts_started + wpool->wrk->srv->backend_codel_target - now;
+			}
+			if (codel < repeat) repeat = codel;
+			min_repeat = 0.005;
+		}
 
-		if (repeat < 0.05) repeat = 0.05;
+		if (repeat < min_repeat) repeat = min_repeat;
 
 		li_event_timer_once(&wpool->wait_queue_timer, repeat);
 	} else {
@@ -763,6 +839,8 @@ static void backend_pool_wait_queue_timeout(liEventBase *watcher, int events) {
 		}
 	}
 
+	S_backend_pool_codel(pool, wpool->wrk->srv, li_cur_ts(wpool->wrk));
+
 	S_backend_pool_update_wait_queue_timer(wpool);
 
 	g_mutex_unlock(pool->lock);
@@ -953,6 +1031,7 @@ liBackendResult li_backend_get(liVRequest *vr, liBackendPool *bpool, liBackendCo
 		bwait->vr_ref = li_vrequest_get_ref(vr);
 		bwait->ts_started = li_cur_ts(vr->wrk);
 		*pbwait = bwait;
+		g_atomic_int_inc(&vr->wrk->srv->backend_waiting);
 
 		if (pool->public.config->max_connections <= 0) {
 			g_queue_push_tail_link(&wpool->wait_queue, &bwait->wait_queue_link);
@@ -972,6 +1051,7 @@ liBackendResult li_backend_get(liVRequest *vr, liBackendPool *bpool, liBackendCo
 		bwait->failed = FALSE;
 		g_slice_free(liBackendWait, bwait);
 		*pbwait = NULL;
+		g_atomic_int_add(&vr->wrk->srv->backend_waiting, -1);
 		result = LI_BACKEND_TIMEOUT;
 		goto out;
 	}
@@ -985,6 +1065,7 @@ liBackendResult li_backend_get(liVRequest *vr, liBackendPool *bpool, liBackendCo
 		g_slice_free(liBackendWait, bwait);
 		*pbwait = NULL;
 		*pbcon = &con->public;
+		g_atomic_int_add(&vr->wrk->srv->backend_waiting, -1);
 
 		con->wait = NULL;
 		con->active = TRUE;
@@ -1021,6 +1102,8 @@ void li_backend_wait_stop(liVRequest *vr, liBackendPool *bpool, liBackendWait **
 
 	LI_FORCE_ASSERT(vr == bwait->vr);
 
+	g_atomic_int_add(&vr->wrk->srv->backend_waiting, -1);
+
 	if (bwait->failed) {
 		bwait->vr = NULL;
 		li_job_ref_release(bwait->vr_ref);
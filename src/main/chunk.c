@@ -541,12 +541,20 @@ void li_chunkqueue_append_buffer2(liChunkQueue *cq, liBuffer *buffer, gsize offs
 		return;
 	}
 	LI_FORCE_ASSERT(offset + length <= buffer->used);
-	c = chunk_new();
-	c->type = BUFFER_CHUNK;
-	c->data.buffer.buffer = buffer;
-	c->data.buffer.offset = offset;
-	c->data.buffer.length = length;
-	g_queue_push_tail_link(&cq->queue, &c->cq_link);
+	c = g_queue_peek_tail(&cq->queue);
+	if (NULL != c && c->type == BUFFER_CHUNK && c->data.buffer.buffer == buffer
+	    && c->data.buffer.offset + c->data.buffer.length == offset) {
+		/* continues the last chunk, which already holds a reference */
+		c->data.buffer.length += length;
+		li_buffer_release(buffer);
+	} else {
+		c = chunk_new();
+		c->type = BUFFER_CHUNK;
+		c->data.buffer.buffer = buffer;
+		c->data.buffer.offset = offset;
+		c->data.buffer.length = length;
+		g_queue_push_tail_link(&cq->queue, &c->cq_link);
+	}
 	cq->length += length;
 	cq->bytes_in += length;
 	cqlimit_update(cq, length);
@@ -132,3 +132,43 @@ void li_collect_watcher_cb(liEventBase *watcher, int events) {
 	}
 }
 
+
+void li_collect_snapshot_publish(liWorker *wrk, gboolean full) {
+	liWorkerSnapshot snap;
+	guint i;
+
+	/* gather outside of the write section, readers spin while it is active */
+	memset(&snap, 0, sizeof(snap));
+	snap.worker_ndx = wrk->ndx;
+	snap.ts = li_cur_ts(wrk);
+	snap.stats = wrk->stats;
+	snap.connections_active = wrk->connections_active;
+	snap.connections_pooled = wrk->connections->len - wrk->connections_active;
+	snap.vrequests_pooled = wrk->vrequest_pool.length;
+	snap.connection_memory = wrk->snapshot->connection_memory; /* only this worker writes it */
+	snap.connections_trimmed = wrk->connections_trimmed;
+
+	memcpy(snap.connection_count, wrk->connection_state_count, sizeof(snap.connection_count));
+	/* free connections are dead too */
+	snap.connection_count[LI_CON_STATE_DEAD] -= snap.connections_pooled;
+
+	/* summing up the memory walks all connections: only do it while somebody asks for it */
+	if (full && g_atomic_int_get(&wrk->connection_memory_wanted) > 0) {
+		g_atomic_int_add(&wrk->connection_memory_wanted, -1);
+		snap.connection_memory = 0;
+		for (i = 0; i < wrk->connections_active; i++) {
+			snap.connection_memory += li_connection_memory_usage(g_array_index(wrk->connections, liConnection*, i));
+		}
+	}
+
+	li_seqlock_write(&wrk->snapshot_seq, wrk->snapshot, &snap, sizeof(snap));
+}
+
+void li_collect_snapshot_want_memory(liWorker *wrk) {
+	/* keep summing up for the next minute (12 full snapshots) */
+	g_atomic_int_set(&wrk->connection_memory_wanted, 12);
+}
+
+void li_collect_snapshot_read(liWorker *wrk, liWorkerSnapshot *dest) {
+	li_seqlock_read(&wrk->snapshot_seq, dest, wrk->snapshot, sizeof(*dest));
+}
@@ -4,6 +4,15 @@
 #include <lighttpd/plugin_core.h>
 
 #define LI_CONNECTION_DEFAULT_CHUNKQUEUE_LIMIT (256*1024)
+static void connection_rehydrate(liConnection *con);
+static void connection_release_vrequest(liConnection *con);
+
+/* keeps the per worker state counts up to date (for the statistics snapshots) */
+static void connection_set_state(liConnection *con, liConnectionState state) {
+	con->wrk->connection_state_count[con->state]--;
+	con->wrk->connection_state_count[state]++;
+	con->state = state;
+}
 
 void li_connection_simple_tcp(liConnection **pcon, liIOStream *stream, gpointer *context, liIOStreamEvent event) {
 	liConnection *con;
@@ -20,6 +29,8 @@ void li_connection_simple_tcp(liConnection **pcon, liIOStream *stream, gpointer
 		if (NULL != stream->stream_in.out) {
 			transfer_in = stream->stream_in.out->bytes_in - transfer_in;
 			if (transfer_in > 0) {
+				/* new data for a trimmed connection */
+				connection_rehydrate(con);
 				li_connection_update_io_timeout(con);
 				li_vrequest_update_stats_in(con->mainvr, transfer_in);
 			}
@@ -28,7 +39,7 @@ void li_connection_simple_tcp(liConnection **pcon, liIOStream *stream, gpointer
 			transfer_out = stream->stream_out.out->bytes_out - transfer_out;
 			if (transfer_out > 0) {
 				li_connection_update_io_timeout(con);
-				li_vrequest_update_stats_out(con->mainvr, transfer_out);
+				if (NULL != con->mainvr) li_vrequest_update_stats_out(con->mainvr, transfer_out);
 			}
 		}
 	}
@@ -60,6 +71,21 @@ void li_connection_simple_tcp(liConnection **pcon, liIOStream *stream, gpointer
 	}
 }
 
+void li_connection_simple_tcp_trim(liConnection *con, gpointer *context) {
+	liBuffer *buf = *context;
+	liWorker *wrk = con->wrk;
+
+	if (NULL == buf) return;
+	*context = NULL;
+
+	if (NULL == wrk->network_read_buf && 1 == g_atomic_int_get(&buf->refcount)) {
+		/* move buffer back to worker */
+		wrk->network_read_buf = buf;
+	} else {
+		li_buffer_release(buf);
+	}
+}
+
 
 typedef struct simple_tcp_connection simple_tcp_connection;
 struct simple_tcp_connection {
@@ -68,6 +94,43 @@ struct simple_tcp_connection {
 	liConnection *con;
 };
 
+/* how far to look into buffered input for a complete pipelined request header */
+#define PIPELINE_LOOKAHEAD 4096
+
+/* TRUE if the buffered input starts with a complete request header (within PIPELINE_LOOKAHEAD bytes):
+ * the next request gets handled right away, without waiting for the client */
+static gboolean simple_tcp_next_request_ready(liChunkQueue *in) {
+	liChunkIter ci;
+	goffset todo = MIN(in->length, PIPELINE_LOOKAHEAD);
+	gboolean start = TRUE, newline = FALSE;
+
+	for (ci = li_chunkqueue_iter(in); todo > 0; li_chunkiter_next(&ci)) {
+		goffset coff = 0, clen = li_chunkiter_length(ci);
+
+		while (coff < clen && todo > 0) {
+			gchar *buf;
+			off_t we_have, i;
+
+			if (LI_HANDLER_GO_ON != li_chunkiter_read(ci, coff, todo, &buf, &we_have, NULL)) return FALSE;
+
+			for (i = 0; i < we_have; i++) {
+				if ('\n' == buf[i]) {
+					/* empty lines before the request line are ignored */
+					if (newline && !start) return TRUE;
+					newline = TRUE;
+				} else if ('\r' != buf[i]) {
+					start = newline = FALSE;
+				}
+			}
+
+			coff += we_have;
+			todo -= we_have;
+		}
+	}
+
+	return FALSE;
+}
+
 static void simple_tcp_io_cb(liIOStream *stream, liIOStreamEvent event) {
 	simple_tcp_connection *data = stream->data;
 	LI_FORCE_ASSERT(NULL != data);
@@ -78,7 +141,11 @@ static void simple_tcp_io_cb(liIOStream *stream, liIOStreamEvent event) {
 
 	if (NULL != data->con && data->con->out_has_all_data
 	    && (NULL == stream->stream_out.out || 0 == stream->stream_out.out->length)) {
-		li_stream_simple_socket_flush(stream);
+		/* no need to flush if the next pipelined request is already complete: its response follows right away
+		 * and the flush is done after the last response of the pipeline. a partial request could take a while */
+		if (!data->con->info.keep_alive || NULL == stream->stream_in.out || !simple_tcp_next_request_ready(stream->stream_in.out)) {
+			li_stream_simple_socket_flush(stream);
+		}
 		li_connection_request_done(data->con);
 	}
 
@@ -131,10 +198,17 @@ static liThrottleState* simple_tcp_throttle_in(liConnection *con) {
 	return data->sock_stream->throttle_in;
 }
 
+static void simple_tcp_trim(liConnection *con) {
+	simple_tcp_connection *data = con->con_sock.data;
+	if (NULL == data) return;
+	li_connection_simple_tcp_trim(con, &data->simple_tcp_context);
+}
+
 static const liConnectionSocketCallbacks simple_tcp_cbs = {
 	simple_tcp_finished,
 	simple_tcp_throttle_out,
-	simple_tcp_throttle_in
+	simple_tcp_throttle_in,
+	simple_tcp_trim
 };
 
 static gboolean simple_tcp_new(liConnection *con, int fd) {
@@ -195,11 +269,12 @@ static void connection_check_reset(liJob *job) {
 static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 	liConnection *con = LI_CONTAINER_OF(stream, liConnection, in);
 	liChunkQueue *raw_in, *in;
-	liVRequest *vr = con->mainvr;
+	liVRequest *vr;
 
 	switch (event) {
 	case LI_STREAM_NEW_DATA:
 		/* handle below */
+		connection_rehydrate(con);
 		break;
 	case LI_STREAM_DISCONNECTED_SOURCE:
 		connection_close(con);
@@ -214,6 +289,8 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 
 	if (NULL == stream->source) return;
 
+	vr = con->mainvr;
+
 	/* raw_in never gets closed normally - if we receive EOF from the client it means it cancelled the request */
 	raw_in = stream->source->out;
 	if (raw_in->is_closed) {
@@ -233,6 +310,8 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 	}
 
 	if (con->state == LI_CON_STATE_KEEP_ALIVE) {
+		li_waitqueue_remove(&con->wrk->idle_trim_queue, &con->idle_trim_elem);
+
 		/* stop keep alive timeout watchers */
 		if (con->keep_alive_data.link) {
 			g_queue_delete_link(&con->wrk->keep_alive_queue, con->keep_alive_data.link);
@@ -251,12 +330,12 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 		/* reset stuff from keep-alive and record timestamp */
 		li_vrequest_start(con->mainvr);
 
-		con->state = LI_CON_STATE_READ_REQUEST_HEADER;
+		connection_set_state(con, LI_CON_STATE_READ_REQUEST_HEADER);
 
 		/* put back in io timeout queue */
 		li_connection_update_io_wait(con);
 	} else if (con->state == LI_CON_STATE_REQUEST_START) {
-		con->state = LI_CON_STATE_READ_REQUEST_HEADER;
+		connection_set_state(con, LI_CON_STATE_READ_REQUEST_HEADER);
 		li_connection_update_io_wait(con);
 	}
 
@@ -279,7 +358,7 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 
 			con->info.keep_alive = FALSE;
 			vr->response.http_status = 414; /* Request-URI Too Large */
-			con->state = LI_CON_STATE_WRITE;
+			connection_set_state(con, LI_CON_STATE_WRITE);
 			li_connection_update_io_wait(con);
 			li_stream_again(&con->out);
 			return;
@@ -302,7 +381,7 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 			/* set status 400 if not already set to e.g. 413 */
 			if (vr->response.http_status == 0)
 				vr->response.http_status = 400;
-			con->state = LI_CON_STATE_WRITE;
+			connection_set_state(con, LI_CON_STATE_WRITE);
 			li_connection_update_io_wait(con);
 			li_stream_again(&con->out);
 			return;
@@ -318,7 +397,7 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 			/* set status 400 if not already set */
 			if (vr->response.http_status == 0)
 				vr->response.http_status = 400;
-			con->state = LI_CON_STATE_WRITE;
+			connection_set_state(con, LI_CON_STATE_WRITE);
 			con->info.keep_alive = FALSE;
 			li_connection_update_io_wait(con);
 			li_stream_again(&con->out);
@@ -340,7 +419,7 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 			li_stream_notify(&con->out);
 		}
 
-		con->state = LI_CON_STATE_HANDLE_MAINVR;
+		connection_set_state(con, LI_CON_STATE_HANDLE_MAINVR);
 		li_connection_update_io_wait(con);
 		li_action_enter(vr, con->srv->mainaction);
 
@@ -443,7 +522,7 @@ static void _connection_http_out_cb(liStream *stream, liStreamEvent event) {
 		}
 		if (con->out_has_all_data) {
 			if (con->state < LI_CON_STATE_WRITE) {
-				con->state = LI_CON_STATE_WRITE;
+				connection_set_state(con, LI_CON_STATE_WRITE);
 				li_connection_update_io_wait(con);
 			}
 			if (NULL != out) {
@@ -509,8 +588,11 @@ void li_connection_update_io_wait(liConnection *con) {
 void li_connection_start(liConnection *con, liSocketAddress remote_addr, int s, liServerSocket *srv_sock) {
 	LI_FORCE_ASSERT(NULL == con->con_sock.data);
 
+	/* dead connections keep no vrequest */
+	connection_rehydrate(con);
+
 	con->srv_sock = srv_sock;
-	con->state = LI_CON_STATE_REQUEST_START;
+	connection_set_state(con, LI_CON_STATE_REQUEST_START);
 	con->mainvr->ts_started = con->ts_started = li_cur_ts(con->wrk);
 
 	con->info.remote_addr = remote_addr;
@@ -565,7 +647,7 @@ void li_connection_request_done(liConnection *con) {
 	if (con->info.keep_alive &&  (LI_SERVER_RUNNING == s || LI_SERVER_WARMUP == s) && NULL != con->con_sock.data) {
 		li_connection_reset_keep_alive(con);
 	} else {
-		con->state = LI_CON_STATE_CLOSE;
+		connection_set_state(con, LI_CON_STATE_CLOSE);
 		con_iostream_shutdown(con);
 		li_connection_reset(con);
 	}
@@ -577,11 +659,11 @@ static void connection_close(liConnection *con) {
 
 	if (LI_CON_STATE_CLOSE == con->state || LI_CON_STATE_DEAD == con->state) return;
 
-	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+	if (NULL != vr && CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 		VR_DEBUG(vr, "%s", "connection closed");
 	}
 
-	con->state = LI_CON_STATE_CLOSE;
+	connection_set_state(con, LI_CON_STATE_CLOSE);
 
 	con_iostream_close(con);
 
@@ -595,11 +677,11 @@ void li_connection_error(liConnection *con) {
 
 	if (LI_CON_STATE_CLOSE == con->state || LI_CON_STATE_DEAD == con->state) return;
 
-	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+	if (NULL != vr && CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 		VR_DEBUG(vr, "%s", "connection closed (error)");
 	}
 
-	con->state = LI_CON_STATE_CLOSE;
+	connection_set_state(con, LI_CON_STATE_CLOSE);
 
 	con_iostream_close(con);
 
@@ -608,6 +690,38 @@ void li_connection_error(liConnection *con) {
 	li_connection_reset(con);
 }
 
+int li_connection_handoff(liConnection *con) {
+	simple_tcp_connection *data = con->con_sock.data;
+	liIOStream *stream;
+	int fd;
+
+	if (LI_CON_STATE_KEEP_ALIVE != con->state || &simple_tcp_cbs != con->con_sock.callbacks) return -1;
+	if (NULL == con->con_sock.raw_in || NULL == con->con_sock.raw_out) return -1;
+	if (0 != con->con_sock.raw_in->out->length || 0 != con->con_sock.raw_out->out->length) return -1;
+	if (0 != con->in.out->length) return -1;
+
+	data->con = NULL;
+	con->con_sock.data = NULL;
+	con->con_sock.callbacks = NULL;
+
+	stream = data->sock_stream;
+	data->sock_stream = NULL;
+
+	/* takes over the reference from data; no shutdown, the socket lives on in another process */
+	fd = li_iostream_reset(stream);
+
+	{
+		liStream *raw_out = con->con_sock.raw_out, *raw_in = con->con_sock.raw_in;
+		con->con_sock.raw_out = con->con_sock.raw_in = NULL;
+		li_stream_reset(raw_out); li_stream_release(raw_out);
+		li_stream_reset(raw_in); li_stream_release(raw_in);
+	}
+
+	li_connection_reset(con);
+
+	return fd;
+}
+
 static void connection_keepalive_cb(liEventBase *watcher, int events) {
 	liConnection *con = LI_CONTAINER_OF(li_event_timer_from(watcher), liConnection, keep_alive_data.watcher);
 	UNUSED(events);
@@ -650,7 +764,7 @@ static void mainvr_connection_upgrade(liVRequest *vr, liStream *backend_drain, l
 	con->response_headers_sent = TRUE;
 	con->info.keep_alive = FALSE;
 	li_response_send_headers(vr, con->out.out, NULL, TRUE);
-	con->state = LI_CON_STATE_UPGRADED;
+	connection_set_state(con, LI_CON_STATE_UPGRADED);
 	vr->response.transfer_encoding = 0;
 	li_connection_update_io_wait(con);
 
@@ -685,6 +799,7 @@ liConnection* li_connection_new(liWorker *wrk) {
 	con->srv = srv;
 
 	con->state = LI_CON_STATE_DEAD;
+	wrk->connection_state_count[LI_CON_STATE_DEAD]++;
 	con->response_headers_sent = FALSE;
 	con->expect_100_cont = FALSE;
 	con->out_has_all_data = FALSE;
@@ -699,9 +814,7 @@ liConnection* li_connection_new(liWorker *wrk) {
 
 	con->info.callbacks = &con_callbacks;
 
-	con->mainvr = li_vrequest_new(wrk, &con->info);
-
-	li_http_request_parser_init(&con->req_parser_ctx, &con->mainvr->request, NULL); /* chunkqueue is created in _start */
+	con->mainvr = NULL; /* taken from the worker pool in _start */
 
 	con->keep_alive_data.link = NULL;
 	con->keep_alive_data.timeout = 0;
@@ -709,6 +822,7 @@ liConnection* li_connection_new(liWorker *wrk) {
 	li_event_timer_init(&wrk->loop, "connection keep-alive timeout", &con->keep_alive_data.watcher, connection_keepalive_cb);
 
 	con->io_timeout_elem.data = con;
+	con->idle_trim_elem.data = con;
 
 	li_job_init(&con->job_reset, connection_check_reset);
 
@@ -717,16 +831,19 @@ liConnection* li_connection_new(liWorker *wrk) {
 
 void li_connection_reset(liConnection *con) {
 	if (LI_CON_STATE_DEAD != con->state) {
-		con->state = LI_CON_STATE_DEAD;
+		if (NULL == con->mainvr) con->wrk->connections_trimmed--;
+		connection_set_state(con, LI_CON_STATE_DEAD);
 
 		con_iostream_close(con);
 		li_stream_reset(&con->in);
 		li_stream_reset(&con->out);
 
-		li_vrequest_reset(con->mainvr, TRUE);
+		if (NULL != con->mainvr) li_vrequest_reset(con->mainvr, TRUE);
 		li_stream_release(&con->in);
 		li_stream_release(&con->out);
 
+		li_waitqueue_remove(&con->wrk->idle_trim_queue, &con->idle_trim_elem);
+
 		con->info.keep_alive = TRUE;
 		if (con->keep_alive_data.link) {
 			g_queue_delete_link(&con->wrk->keep_alive_queue, con->keep_alive_data.link);
@@ -758,9 +875,8 @@ static void li_connection_reset2(liConnection *con) {
 	li_stream_reset(&con->in);
 	li_stream_reset(&con->out);
 
-	li_vrequest_reset(con->mainvr, FALSE);
-
-	li_http_request_parser_reset(&con->req_parser_ctx);
+	/* back to the worker pool */
+	connection_release_vrequest(con);
 
 	g_string_truncate(con->info.remote_addr_str, 0);
 	li_sockaddr_clear(&con->info.remote_addr);
@@ -786,8 +902,9 @@ static void li_connection_reset2(liConnection *con) {
 	con->info.stats.bytes_out_5s_diff = G_GUINT64_CONSTANT(0);
 	con->info.stats.last_avg = 0;
 
-	/* remove from timeout queue */
+	/* remove from timeout queues */
 	li_waitqueue_remove(&con->wrk->io_timeout_queue, &con->io_timeout_elem);
+	li_waitqueue_remove(&con->wrk->idle_trim_queue, &con->idle_trim_elem);
 
 	li_job_reset(&con->job_reset);
 }
@@ -806,7 +923,7 @@ static void li_connection_reset_keep_alive(liConnection *con) {
 		{
 			con->keep_alive_data.max_idle = CORE_OPTION(LI_CORE_OPTION_MAX_KEEP_ALIVE_IDLE).number;
 			if (con->keep_alive_data.max_idle == 0) {
-				con->state = LI_CON_STATE_CLOSE;
+				connection_set_state(con, LI_CON_STATE_CLOSE);
 				con_iostream_shutdown(con);
 				li_connection_reset(con);
 				return;
@@ -830,7 +947,7 @@ static void li_connection_reset_keep_alive(liConnection *con) {
 		li_stream_again_later(&con->in);
 	}
 
-	con->state = LI_CON_STATE_KEEP_ALIVE;
+	connection_set_state(con, LI_CON_STATE_KEEP_ALIVE);
 	con->response_headers_sent = FALSE;
 	con->expect_100_cont = FALSE;
 	con->out_has_all_data = FALSE;
@@ -839,6 +956,10 @@ static void li_connection_reset_keep_alive(liConnection *con) {
 
 	li_connection_update_io_wait(con);
 
+	if (0 != con->srv->keep_alive_trim_idle && con->keep_alive_data.max_idle > con->srv->keep_alive_trim_idle) {
+		li_waitqueue_push(&con->wrk->idle_trim_queue, &con->idle_trim_elem);
+	}
+
 	li_vrequest_reset(con->mainvr, TRUE);
 	li_http_request_parser_reset(&con->req_parser_ctx);
 
@@ -862,10 +983,114 @@ static void li_connection_reset_keep_alive(liConnection *con) {
 	con->info.stats.last_avg = 0;
 }
 
+static void connection_rehydrate(liConnection *con) {
+	liVRequest *vr;
+
+	if (NULL != con->mainvr) return;
+
+	/* dead connections don't count as trimmed */
+	if (LI_CON_STATE_DEAD != con->state) con->wrk->connections_trimmed--;
+
+	if (NULL != (vr = g_queue_pop_head(&con->wrk->vrequest_pool))) {
+		vr->coninfo = &con->info;
+		if (con->wrk->vrequest_pool.length < con->wrk->vrequest_pool_min_5min) {
+			con->wrk->vrequest_pool_min_5min = con->wrk->vrequest_pool.length;
+		}
+	} else {
+		vr = li_vrequest_new(con->wrk, &con->info);
+	}
+	con->mainvr = vr;
+
+	li_http_request_parser_init(&con->req_parser_ctx, &vr->request, (NULL != con->con_sock.raw_in) ? con->con_sock.raw_in->out : NULL);
+}
+
+static void connection_release_vrequest(liConnection *con) {
+	liVRequest *vr = con->mainvr;
+	liWorker *wrk = con->wrk;
+
+	if (NULL == vr) return;
+
+	con->mainvr = NULL;
+	li_vrequest_reset(vr, FALSE);
+	vr->coninfo = NULL;
+	if (0 == wrk->srv->vrequest_pool_max || wrk->vrequest_pool.length < wrk->srv->vrequest_pool_max) {
+		g_queue_push_head(&wrk->vrequest_pool, vr);
+	} else {
+		li_vrequest_free(vr);
+	}
+
+	li_http_request_parser_clear(&con->req_parser_ctx);
+	con->req_parser_ctx.request = NULL;
+	con->req_parser_ctx.h_key = con->req_parser_ctx.h_value = NULL;
+}
+
+void li_connection_trim(liConnection *con) {
+	li_waitqueue_remove(&con->wrk->idle_trim_queue, &con->idle_trim_elem);
+
+	if (LI_CON_STATE_KEEP_ALIVE != con->state || NULL == con->mainvr) return;
+	/* don't trim if the next request is already waiting */
+	if (NULL == con->con_sock.raw_in || 0 != con->con_sock.raw_in->out->length || 0 != con->in.out->length) return;
+
+	connection_release_vrequest(con);
+	con->wrk->connections_trimmed++;
+
+	if (NULL != con->con_sock.callbacks && NULL != con->con_sock.callbacks->trim) {
+		con->con_sock.callbacks->trim(con);
+	}
+}
+
+static gsize http_headers_memory_usage(liHttpHeaders *headers) {
+	gsize mem = sizeof(liHttpHeaders);
+	GList *l;
+
+	for (l = headers->entries.head; NULL != l; l = l->next) {
+		mem += sizeof(GList) + sizeof(liHttpHeader) + ((liHttpHeader*) l->data)->data->allocated_len;
+	}
+	for (l = headers->spare.head; NULL != l; l = l->next) {
+		mem += sizeof(GList) + sizeof(liHttpHeader) + ((liHttpHeader*) l->data)->data->allocated_len;
+	}
+
+	return mem;
+}
+
+static gsize chunkqueue_memory_usage(liChunkQueue *cq) {
+	if (NULL == cq) return 0;
+	return sizeof(liChunkQueue) + cq->mem_usage;
+}
+
+gsize li_connection_memory_usage(liConnection *con) {
+	liVRequest *vr = con->mainvr;
+	gsize mem = sizeof(liConnection);
+
+	mem += con->info.remote_addr_str->allocated_len + con->info.local_addr_str->allocated_len;
+
+	mem += chunkqueue_memory_usage(con->in.out) + chunkqueue_memory_usage(con->out.out);
+	if (NULL != con->con_sock.raw_in) mem += chunkqueue_memory_usage(con->con_sock.raw_in->out);
+	if (NULL != con->con_sock.raw_out) mem += chunkqueue_memory_usage(con->con_sock.raw_out->out);
+
+	if (NULL != vr) {
+		liRequestUri *uri = &vr->request.uri;
+		liServer *srv = con->srv;
+
+		mem += sizeof(liVRequest);
+		mem += srv->option_def_values->len * sizeof(liOptionValue) + srv->optionptr_def_values->len * sizeof(liOptionPtrValue*);
+		mem += vr->plugin_ctx->len * sizeof(gpointer);
+		mem += uri->raw->allocated_len + uri->raw_path->allocated_len + uri->raw_orig_path->allocated_len
+			+ uri->scheme->allocated_len + uri->authority->allocated_len + uri->path->allocated_len
+			+ uri->query->allocated_len + uri->host->allocated_len;
+		mem += http_headers_memory_usage(vr->request.headers) + http_headers_memory_usage(vr->response.headers);
+		mem += con->req_parser_ctx.h_key->allocated_len + con->req_parser_ctx.h_value->allocated_len;
+	}
+
+	return mem;
+}
+
 void li_connection_free(liConnection *con) {
 	LI_FORCE_ASSERT(NULL == con->con_sock.data);
 	LI_FORCE_ASSERT(LI_CON_STATE_DEAD == con->state);
 
+	con->wrk->connection_state_count[LI_CON_STATE_DEAD]--;
+
 	con->response_headers_sent = FALSE;
 	con->expect_100_cont = FALSE;
 	con->out_has_all_data = FALSE;
@@ -878,8 +1103,10 @@ void li_connection_free(liConnection *con) {
 	g_string_free(con->info.local_addr_str, TRUE);
 	li_sockaddr_clear(&con->info.local_addr);
 
-	li_vrequest_free(con->mainvr);
-	li_http_request_parser_clear(&con->req_parser_ctx);
+	if (NULL != con->mainvr) {
+		li_vrequest_free(con->mainvr);
+		li_http_request_parser_clear(&con->req_parser_ctx);
+	}
 
 	con->info.keep_alive = TRUE;
 	if (con->keep_alive_data.link && con->wrk) {
@@ -890,8 +1117,9 @@ void li_connection_free(liConnection *con) {
 	con->keep_alive_data.max_idle = 0;
 	li_event_clear(&con->keep_alive_data.watcher);
 
-	/* remove from timeout queue */
+	/* remove from timeout queues */
 	li_waitqueue_remove(&con->wrk->io_timeout_queue, &con->io_timeout_elem);
+	li_waitqueue_remove(&con->wrk->idle_trim_queue, &con->idle_trim_elem);
 
 	li_job_clear(&con->job_reset);
 
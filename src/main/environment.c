@@ -1,6 +1,6 @@
 
-#include <lighttpd/environment.h>
-#include <lighttpd/utils.h>
+#include <lighttpd/base.h>
+#include <lighttpd/plugin_core.h>
 
 static void _hash_free_gstring(gpointer data) {
 	g_string_free((GString*) data, TRUE);
@@ -72,3 +72,247 @@ GString* li_environment_dup_pop(liEnvironmentDup *envdup, const gchar *key, size
 	return sval;
 }
 
+gboolean li_environment_dup_has(liEnvironmentDup *envdup, const gchar *key, size_t keylen) {
+	const GString skey = li_const_gstring(key, keylen); /* fake a constant GString */
+	return NULL != g_hash_table_lookup(envdup->table, &skey);
+}
+
+
+liEnvironmentHeaderFilter* li_environment_header_filter_new(void) {
+	liEnvironmentHeaderFilter *filter = g_slice_new0(liEnvironmentHeaderFilter);
+	filter->allow = g_ptr_array_new();
+	filter->deny = g_ptr_array_new();
+	return filter;
+}
+
+static void _header_filter_list_free(GPtrArray *list) {
+	guint i;
+	for (i = 0; i < list->len; i++) {
+		g_string_free(g_ptr_array_index(list, i), TRUE);
+	}
+	g_ptr_array_free(list, TRUE);
+}
+
+void li_environment_header_filter_free(liEnvironmentHeaderFilter *filter) {
+	if (NULL == filter) return;
+	_header_filter_list_free(filter->allow);
+	_header_filter_list_free(filter->deny);
+	g_slice_free(liEnvironmentHeaderFilter, filter);
+}
+
+void li_environment_header_filter_add(liEnvironmentHeaderFilter *filter, gboolean allow, const gchar *name, size_t namelen) {
+	g_ptr_array_add(allow ? filter->allow : filter->deny, g_string_new_len(name, namelen));
+}
+
+static gboolean _header_filter_list_match(GPtrArray *list, const gchar *name, size_t namelen) {
+	guint i;
+	for (i = 0; i < list->len; i++) {
+		GString *pattern = g_ptr_array_index(list, i);
+		if (pattern->len > 0 && '*' == pattern->str[pattern->len-1]) {
+			if (namelen >= pattern->len - 1 && 0 == g_ascii_strncasecmp(name, pattern->str, pattern->len - 1)) return TRUE;
+		} else if (namelen == pattern->len && 0 == g_ascii_strncasecmp(name, pattern->str, namelen)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+gboolean li_environment_header_filter_pass(liEnvironmentHeaderFilter *filter, const gchar *name, size_t namelen) {
+	if (NULL == filter) return TRUE;
+	if (_header_filter_list_match(filter->deny, name, namelen)) return FALSE;
+	return 0 == filter->allow->len || _header_filter_list_match(filter->allow, name, namelen);
+}
+
+typedef struct cgi_header_name cgi_header_name;
+struct cgi_header_name {
+	const gchar *name, *cgi;
+	guint len, cgi_len;
+};
+
+#define CGI_HEADER(name, cgi) { name, cgi, sizeof(name)-1, sizeof(cgi)-1 }
+/* sorted by length, then case-insensitive by name (binary search in cgi_header_name_lookup) */
+static const cgi_header_name cgi_header_names[] = {
+	CGI_HEADER("TE", "HTTP_TE"),
+	CGI_HEADER("DNT", "HTTP_DNT"),
+	CGI_HEADER("Via", "HTTP_VIA"),
+	CGI_HEADER("Host", "HTTP_HOST"),
+	CGI_HEADER("Range", "HTTP_RANGE"),
+	CGI_HEADER("Accept", "HTTP_ACCEPT"),
+	CGI_HEADER("Cookie", "HTTP_COOKIE"),
+	CGI_HEADER("Expect", "HTTP_EXPECT"),
+	CGI_HEADER("Origin", "HTTP_ORIGIN"),
+	CGI_HEADER("Pragma", "HTTP_PRAGMA"),
+	CGI_HEADER("Referer", "HTTP_REFERER"),
+	CGI_HEADER("Upgrade", "HTTP_UPGRADE"),
+	CGI_HEADER("If-Match", "HTTP_IF_MATCH"),
+	CGI_HEADER("If-Range", "HTTP_IF_RANGE"),
+	CGI_HEADER("X-Real-IP", "HTTP_X_REAL_IP"),
+	CGI_HEADER("Connection", "HTTP_CONNECTION"),
+	CGI_HEADER("Keep-Alive", "HTTP_KEEP_ALIVE"),
+	CGI_HEADER("User-Agent", "HTTP_USER_AGENT"),
+	CGI_HEADER("Content-Type", "CONTENT_TYPE"),
+	CGI_HEADER("Authorization", "HTTP_AUTHORIZATION"),
+	CGI_HEADER("Cache-Control", "HTTP_CACHE_CONTROL"),
+	CGI_HEADER("If-None-Match", "HTTP_IF_NONE_MATCH"),
+	CGI_HEADER("Accept-Charset", "HTTP_ACCEPT_CHARSET"),
+	CGI_HEADER("Content-Length", "HTTP_CONTENT_LENGTH"),
+	CGI_HEADER("Accept-Encoding", "HTTP_ACCEPT_ENCODING"),
+	CGI_HEADER("Accept-Language", "HTTP_ACCEPT_LANGUAGE"),
+	CGI_HEADER("X-Forwarded-For", "HTTP_X_FORWARDED_FOR"),
+	CGI_HEADER("X-Forwarded-Host", "HTTP_X_FORWARDED_HOST"),
+	CGI_HEADER("X-Requested-With", "HTTP_X_REQUESTED_WITH"),
+	CGI_HEADER("If-Modified-Since", "HTTP_IF_MODIFIED_SINCE"),
+	CGI_HEADER("X-Forwarded-Proto", "HTTP_X_FORWARDED_PROTO"),
+	CGI_HEADER("If-Unmodified-Since", "HTTP_IF_UNMODIFIED_SINCE"),
+	CGI_HEADER("Upgrade-Insecure-Requests", "HTTP_UPGRADE_INSECURE_REQUESTS"),
+};
+#undef CGI_HEADER
+
+static const cgi_header_name* cgi_header_name_lookup(const gchar *name, guint len) {
+	guint lo = 0, hi = G_N_ELEMENTS(cgi_header_names);
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		const cgi_header_name *h = &cgi_header_names[mid];
+		gint cmp = (h->len != len) ? ((h->len < len) ? -1 : 1) : g_ascii_strncasecmp(h->name, name, len);
+
+		if (0 == cmp) return h;
+		if (cmp < 0) lo = mid + 1; else hi = mid;
+	}
+	return NULL;
+}
+
+static void cgi_header_name_build(GString *dest, const gchar *name, guint len) {
+	guint i;
+	gchar *s;
+
+	g_string_truncate(dest, 0);
+	g_string_append_len(dest, CONST_STR_LEN("HTTP_"));
+	g_string_append_len(dest, name, len);
+
+	s = dest->str + sizeof("HTTP_")-1;
+	for (i = 0; i < len; i++) {
+		if (g_ascii_isalpha(s[i])) {
+			s[i] = g_ascii_toupper(s[i]);
+		} else if (!g_ascii_isdigit(s[i])) {
+			s[i] = '_';
+		}
+	}
+}
+
+const gchar* li_environment_cgi_header_name(GString *tmp, const gchar *name, guint len, guint *cgi_len) {
+	const cgi_header_name *hn;
+
+	if (NULL != (hn = cgi_header_name_lookup(name, len))) {
+		*cgi_len = hn->cgi_len;
+		return hn->cgi;
+	}
+
+	cgi_header_name_build(tmp, name, len);
+	*cgi_len = tmp->len;
+	return tmp->str;
+}
+
+void li_environment_cgi_headers(liVRequest *vr, liEnvironmentAddCB cb, gpointer param) {
+	liEnvironmentHeaderFilter *filter = CORE_OPTIONPTR(LI_CORE_OPTION_BACKEND_HEADERS).ptr;
+	GString *tmp = vr->wrk->tmp_str;
+	GList *i;
+
+	for (i = vr->request.headers->entries.head; NULL != i; i = i->next) {
+		liHttpHeader *h = (liHttpHeader*) i->data;
+		const gchar *val = h->data->str + h->keylen + 2;
+		gsize valuelen = h->data->len - (h->keylen + 2);
+		const gchar *key;
+		guint keylen;
+
+		if (!li_environment_header_filter_pass(filter, h->data->str, h->keylen)) {
+			vr->wrk->stats.backend_env_headers_filtered++;
+			continue;
+		}
+
+		key = li_environment_cgi_header_name(tmp, h->data->str, h->keylen, &keylen);
+		cb(param, key, keylen, val, valuelen);
+	}
+}
+
+typedef struct environment_prefix environment_prefix;
+struct environment_prefix {
+	GString *tag;
+	GByteArray *block;
+};
+
+struct liEnvironmentPrefixCache {
+	liEnvironmentPrefixCreateCB create;
+	const gchar * const *keys;
+
+	/* last (atomic access) is the lock-free fast path */
+	GMutex *lock;
+	GPtrArray *prefixes; /* environment_prefix* */
+	gpointer last; /* environment_prefix* */
+};
+
+liEnvironmentPrefixCache* li_environment_prefix_cache_new(liEnvironmentPrefixCreateCB create, const gchar * const *keys) {
+	liEnvironmentPrefixCache *cache = g_slice_new0(liEnvironmentPrefixCache);
+	cache->create = create;
+	cache->keys = keys;
+	cache->lock = g_mutex_new();
+	cache->prefixes = g_ptr_array_new();
+	return cache;
+}
+
+void li_environment_prefix_cache_free(liEnvironmentPrefixCache *cache) {
+	guint i;
+
+	if (NULL == cache) return;
+
+	for (i = 0; i < cache->prefixes->len; i++) {
+		environment_prefix *prefix = g_ptr_array_index(cache->prefixes, i);
+		g_string_free(prefix->tag, TRUE);
+		g_byte_array_free(prefix->block, TRUE);
+		g_slice_free(environment_prefix, prefix);
+	}
+	g_ptr_array_free(cache->prefixes, TRUE);
+	g_mutex_free(cache->lock);
+	g_slice_free(liEnvironmentPrefixCache, cache);
+}
+
+GByteArray* li_environment_prefix_cache_get(liEnvironmentPrefixCache *cache, liEnvironmentDup *envdup, GString *tag) {
+	environment_prefix *prefix;
+	guint i;
+
+	if (NULL != envdup) {
+		const gchar * const *key;
+		for (key = cache->keys; NULL != *key; key++) {
+			if (li_environment_dup_has(envdup, *key, strlen(*key))) return NULL;
+		}
+	}
+
+	prefix = g_atomic_pointer_get(&cache->last);
+	if (NULL != prefix && g_string_equal(prefix->tag, tag)) return prefix->block;
+
+	g_mutex_lock(cache->lock);
+	for (i = 0; i < cache->prefixes->len; i++) {
+		prefix = g_ptr_array_index(cache->prefixes, i);
+		if (g_string_equal(prefix->tag, tag)) goto found;
+	}
+
+	prefix = g_slice_new0(environment_prefix);
+	prefix->tag = g_string_new_len(GSTR_LEN(tag));
+	prefix->block = g_byte_array_sized_new(64 + tag->len);
+	cache->create(prefix->block, tag);
+	g_ptr_array_add(cache->prefixes, prefix);
+
+found:
+	g_atomic_pointer_set(&cache->last, prefix);
+	g_mutex_unlock(cache->lock);
+
+	return prefix->block;
+}
+
+void li_environment_cgi_account(liVRequest *vr, gsize size) {
+	liStatistics *stats = &vr->wrk->stats;
+
+	stats->backend_envs++;
+	stats->backend_env_bytes += size;
+	if (size > stats->backend_env_max) stats->backend_env_max = size;
+}
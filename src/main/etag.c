@@ -2,6 +2,38 @@
 #include <lighttpd/base.h>
 #include <lighttpd/plugin_core.h>
 
+#include <fcntl.h>
+
+/* weak comparison (RFC 7232, 2.3.2) of etag against a comma separated list of entity tags */
+static gboolean etag_list_match(const gchar *list, const gchar *etag) {
+	const gchar *p = list, *tag;
+	gsize etag_len, tag_len;
+
+	if (etag[0] == 'W' && etag[1] == '/') etag += 2;
+	etag_len = strlen(etag);
+
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+		if (*p == '\0') return FALSE;
+
+		if (*p == '*') return TRUE;
+
+		if (p[0] == 'W' && p[1] == '/') p += 2;
+		tag = p;
+		if (*p == '"') {
+			p++;
+			while (*p != '\0' && *p != '"') p++;
+			if (*p == '"') p++;
+		} else {
+			/* invalid entity tag, skip until next separator */
+			while (*p != '\0' && *p != ',' && *p != ' ' && *p != '\t') p++;
+		}
+		tag_len = p - tag;
+
+		if (tag_len == etag_len && 0 == memcmp(tag, etag, etag_len)) return TRUE;
+	}
+}
+
 liTristate li_http_response_handle_cachable_etag(liVRequest *vr, GString *etag) {
 	GList *l;
 	liTristate res = LI_TRIMAYBE;
@@ -21,7 +53,7 @@ liTristate li_http_response_handle_cachable_etag(liVRequest *vr, GString *etag)
 		liHttpHeader *h = (liHttpHeader*) l->data;
 		res = LI_TRIFALSE; /* if the header was given at least once, we need a match */
 		if (!setag) return res;
-		if (strstr(h->data->str + h->keylen + 2, setag)) {
+		if (etag_list_match(h->data->str + h->keylen + 2, setag)) {
 			return LI_TRITRUE;
 		}
 	}
@@ -116,6 +148,34 @@ gboolean li_http_response_handle_cachable(liVRequest *vr) {
 	return c_able == LI_TRITRUE;
 }
 
+gboolean li_http_response_handle_if_range(liVRequest *vr) {
+	liHttpHeader *h, *hresp;
+	const gchar *val, *cur;
+	gsize val_len, cur_len;
+
+	h = li_http_header_lookup(vr->request.headers, CONST_STR_LEN("If-Range"));
+	if (!h) return TRUE; /* unconditional range request */
+
+	val = LI_HEADER_VALUE(h);
+	val_len = h->data->len - (h->keylen + 2);
+
+	if (val_len > 0 && (val[0] == '"' || (val_len > 1 && val[0] == 'W' && val[1] == '/'))) {
+		/* entity tag: strong comparison, weak tags never match */
+		if (val[0] == 'W') return FALSE;
+		hresp = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("etag"));
+	} else {
+		/* HTTP-date: has to be an exact match of Last-Modified */
+		hresp = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("last-modified"));
+	}
+	if (!hresp) return FALSE;
+
+	cur = LI_HEADER_VALUE(hresp);
+	cur_len = hresp->data->len - (hresp->keylen + 2);
+	if (cur_len > 1 && cur[0] == 'W' && cur[1] == '/') return FALSE;
+
+	return (val_len == cur_len && 0 == memcmp(val, cur, val_len));
+}
+
 void li_etag_mutate(GString *mut, GString *etag) {
 	guint i;
 	guint32 h;
@@ -128,37 +188,277 @@ void li_etag_mutate(GString *mut, GString *etag) {
 	g_string_append_len(mut, CONST_STR_LEN("\""));
 }
 
+static void etag_format(GString *dest, struct stat *st, guint flags) {
+	g_string_truncate(dest, 0);
+
+	if (flags & LI_ETAG_USE_INODE) {
+		li_string_append_int(dest, st->st_ino);
+	}
+
+	if (flags & LI_ETAG_USE_SIZE) {
+		if (dest->len != 0) g_string_append_len(dest, CONST_STR_LEN("-"));
+		li_string_append_int(dest, st->st_size);
+	}
+
+	if (flags & LI_ETAG_USE_MTIME) {
+		if (dest->len != 0) g_string_append_len(dest, CONST_STR_LEN("-"));
+		li_string_append_int(dest, st->st_mtime);
+	}
+
+	li_etag_mutate(dest, dest);
+}
+
+static gboolean etag_format_last_modified(GString *dest, time_t mtime) {
+	struct tm tm;
+
+	if (!gmtime_r(&mtime, &tm)) return FALSE;
+
+	g_string_set_size(dest, 256);
+	g_string_set_size(dest, strftime(dest->str, dest->len-1,
+		"%a, %d %b %Y %H:%M:%S GMT", &tm));
+	return TRUE;
+}
+
+/* content digests don't depend on the stat cache ttl: keep them until they weren't used for a while */
+#define CONTENT_HASH_MAX_IDLE      3600.0
+#define CONTENT_HASH_SWEEP_INTERVAL  60.0
+#define CONTENT_HASH_MAX_ENTRIES  65536
+
+typedef struct content_hash_key content_hash_key;
+struct content_hash_key {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+};
+
+typedef struct content_hash_entry content_hash_entry;
+struct content_hash_entry {
+	content_hash_key key;
+	GString *hash;          /* NULL while pending */
+	li_tstamp last_used;
+};
+
+struct liContentHashCache {
+	GMutex *mutex;
+	GHashTable *entries;    /* content_hash_key* -> content_hash_entry* */
+	li_tstamp last_sweep;
+};
+
+typedef struct content_hash_job content_hash_job;
+struct content_hash_job {
+	liContentHashCache *chc;
+	content_hash_key key;
+	GString *path;
+	GString *hash;          /* NULL on failure */
+};
+
+static guint content_hash_key_hash(gconstpointer data) {
+	const content_hash_key *key = data;
+	return (guint) key->ino ^ ((guint) key->dev << 16) ^ (guint) key->size ^ ((guint) key->mtime * 31);
+}
+
+static gboolean content_hash_key_equal(gconstpointer a, gconstpointer b) {
+	const content_hash_key *ka = a, *kb = b;
+	return ka->ino == kb->ino && ka->dev == kb->dev && ka->size == kb->size && ka->mtime == kb->mtime;
+}
+
+static void content_hash_key_from_stat(content_hash_key *key, struct stat *st) {
+	memset(key, 0, sizeof(*key));
+	key->dev = st->st_dev;
+	key->ino = st->st_ino;
+	key->size = st->st_size;
+	key->mtime = st->st_mtime;
+}
+
+static void content_hash_entry_free(gpointer data) {
+	content_hash_entry *entry = data;
+	if (NULL != entry->hash) g_string_free(entry->hash, TRUE);
+	g_slice_free(content_hash_entry, entry);
+}
+
+liContentHashCache* li_content_hash_cache_new(void) {
+	liContentHashCache *chc = g_slice_new0(liContentHashCache);
+	chc->mutex = g_mutex_new();
+	chc->entries = g_hash_table_new_full(content_hash_key_hash, content_hash_key_equal, NULL, content_hash_entry_free);
+	return chc;
+}
+
+void li_content_hash_cache_free(liContentHashCache *chc) {
+	if (NULL == chc) return;
+	g_hash_table_destroy(chc->entries);
+	g_mutex_free(chc->mutex);
+	g_slice_free(liContentHashCache, chc);
+}
+
+static gboolean content_hash_sweep_cb(gpointer key, gpointer value, gpointer data) {
+	content_hash_entry *entry = value;
+	li_tstamp now = *(li_tstamp*) data;
+	UNUSED(key);
+	return NULL != entry->hash && now - entry->last_used > CONTENT_HASH_MAX_IDLE;
+}
+
+static void content_hash_run(gpointer data) {
+	content_hash_job *job = data;
+	content_hash_key key;
+	GChecksum *checksum;
+	struct stat st;
+	gchar buf[64*1024];
+	ssize_t r;
+	int fd;
+
+	while (-1 == (fd = open(job->path->str, O_RDONLY))) {
+		if (errno == EINTR) continue;
+		return;
+	}
+
+	if (-1 == fstat(fd, &st)) {
+		close(fd);
+		return;
+	}
+	content_hash_key_from_stat(&key, &st);
+	if (!content_hash_key_equal(&key, &job->key)) {
+		close(fd);
+		return;
+	}
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	for (;;) {
+		r = read(fd, buf, sizeof(buf));
+		if (r > 0) {
+			g_checksum_update(checksum, (const guchar*) buf, r);
+		} else if (r == 0) {
+			break;
+		} else if (errno != EINTR) {
+			goto out;
+		}
+	}
+
+	/* don't use the hash if the file was modified while reading it */
+	if (-1 == fstat(fd, &st)) goto out;
+	content_hash_key_from_stat(&key, &st);
+	if (!content_hash_key_equal(&key, &job->key)) goto out;
+
+	job->hash = g_string_sized_new(35);
+	g_string_append_c(job->hash, '"');
+	/* 128 bits are enough for an etag */
+	g_string_append_len(job->hash, g_checksum_get_string(checksum), 32);
+	g_string_append_c(job->hash, '"');
+
+out:
+	g_checksum_free(checksum);
+	close(fd);
+}
+
+static void content_hash_finished(gpointer data) {
+	content_hash_job *job = data;
+	liContentHashCache *chc = job->chc;
+	content_hash_entry *entry;
+
+	g_mutex_lock(chc->mutex);
+	entry = g_hash_table_lookup(chc->entries, &job->key);
+	if (NULL != entry && NULL == entry->hash) {
+		if (NULL != job->hash) {
+			entry->hash = job->hash;
+			job->hash = NULL;
+		} else {
+			/* failed: drop the pending entry so a later request tries again */
+			g_hash_table_remove(chc->entries, &job->key);
+		}
+	}
+	g_mutex_unlock(chc->mutex);
+
+	if (NULL != job->hash) g_string_free(job->hash, TRUE);
+	g_string_free(job->path, TRUE);
+	g_slice_free(content_hash_job, job);
+}
+
+gboolean li_etag_content_hash(liVRequest *vr, struct stat *st, GString *dest) {
+	liContentHashCache *chc = vr->wrk->srv->content_hashes;
+	li_tstamp now = li_cur_ts(vr->wrk);
+	content_hash_entry *entry;
+	content_hash_job *job;
+	content_hash_key key;
+
+	if (!S_ISREG(st->st_mode)) return FALSE;
+
+	content_hash_key_from_stat(&key, st);
+
+	g_mutex_lock(chc->mutex);
+
+	entry = g_hash_table_lookup(chc->entries, &key);
+	if (NULL != entry) {
+		entry->last_used = now;
+		if (NULL != entry->hash) g_string_assign(dest, entry->hash->str);
+		g_mutex_unlock(chc->mutex);
+		return NULL != entry->hash;
+	}
+
+	if (now - chc->last_sweep >= CONTENT_HASH_SWEEP_INTERVAL) {
+		chc->last_sweep = now;
+		g_hash_table_foreach_remove(chc->entries, content_hash_sweep_cb, &now);
+	}
+
+	if (g_hash_table_size(chc->entries) >= CONTENT_HASH_MAX_ENTRIES) {
+		/* full of recently used digests: send this file without etag */
+		g_mutex_unlock(chc->mutex);
+		return FALSE;
+	}
+
+	/* pending entry, so other requests (in all workers) don't start another job for the same file */
+	entry = g_slice_new0(content_hash_entry);
+	entry->key = key;
+	entry->last_used = now;
+	g_hash_table_insert(chc->entries, &entry->key, entry);
+
+	g_mutex_unlock(chc->mutex);
+
+	job = g_slice_new0(content_hash_job);
+	job->chc = chc;
+	job->key = key;
+	job->path = g_string_new_len(GSTR_LEN(vr->physical.path));
+	li_tasklet_push(vr->wrk->tasklets, content_hash_run, content_hash_finished, job);
+
+	return FALSE;
+}
+
 void li_etag_set_header(liVRequest *vr, struct stat *st, gboolean *cachable) {
 	guint flags = CORE_OPTION(LI_CORE_OPTION_ETAG_FLAGS).number;
 	GString *tmp_str = vr->wrk->tmp_str;
-	struct tm tm;
+	GString *etag, *last_modified;
 	liTristate c_able = cachable ? LI_TRIMAYBE : LI_TRIFALSE;
+	liStatCacheEntry *sce;
+
+	/* ETag and Last-Modified only depend on the stat info; reuse the values cached in the stat cache entry */
+	sce = li_stat_cache_lookup(vr, vr->physical.path, st);
 
 	if (0 == flags) {
+		etag = NULL;
+	} else if (flags & LI_ETAG_USE_CONTENT) {
+		/* NULL until the hash was calculated in the background */
+		etag = li_etag_content_hash(vr, st, tmp_str) ? tmp_str : NULL;
+	} else if (NULL != sce) {
+		if (NULL == sce->data.etag) {
+			sce->data.etag = g_string_sized_new(15);
+			etag_format(sce->data.etag, st, flags);
+		} else if (sce->data.etag_flags != flags) {
+			etag_format(sce->data.etag, st, flags);
+		}
+		sce->data.etag_flags = flags;
+		etag = sce->data.etag;
+	} else {
+		etag_format(tmp_str, st, flags);
+		etag = tmp_str;
+	}
+
+	if (NULL == etag) {
 		li_http_header_remove(vr->response.headers, CONST_STR_LEN("etag"));
 	} else {
-		g_string_truncate(tmp_str, 0);
-	
-		if (flags & LI_ETAG_USE_INODE) {
-			li_string_append_int(tmp_str, st->st_ino);
-		}
-		
-		if (flags & LI_ETAG_USE_SIZE) {
-			if (tmp_str->len != 0) g_string_append_len(tmp_str, CONST_STR_LEN("-"));
-			li_string_append_int(tmp_str, st->st_size);
-		}
-		
-		if (flags & LI_ETAG_USE_MTIME) {
-			if (tmp_str->len != 0) g_string_append_len(tmp_str, CONST_STR_LEN("-"));
-			li_string_append_int(tmp_str, st->st_mtime);
-		}
-	
-		li_etag_mutate(tmp_str, tmp_str);
-	
-		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("ETag"), GSTR_LEN(tmp_str));
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("ETag"), GSTR_LEN(etag));
 
 		if (c_able != LI_TRIFALSE) {
-			switch (li_http_response_handle_cachable_etag(vr, tmp_str)) {
+			switch (li_http_response_handle_cachable_etag(vr, etag)) {
 			case LI_TRIFALSE: c_able = LI_TRIFALSE; break;
 			case LI_TRIMAYBE: break;
 			case LI_TRITRUE : c_able = LI_TRITRUE; break;
@@ -166,14 +466,25 @@ void li_etag_set_header(liVRequest *vr, struct stat *st, gboolean *cachable) {
 		}
 	}
 
-	if (gmtime_r(&st->st_mtime, &tm)) {
-		g_string_set_size(tmp_str, 256);
-		g_string_set_size(tmp_str, strftime(tmp_str->str, tmp_str->len-1,
-			"%a, %d %b %Y %H:%M:%S GMT", &tm));
-		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Last-Modified"), GSTR_LEN(tmp_str));
+	if (NULL != sce) {
+		if (NULL == sce->data.last_modified) {
+			sce->data.last_modified = g_string_sized_new(31);
+			if (!etag_format_last_modified(sce->data.last_modified, st->st_mtime)) {
+				g_string_truncate(sce->data.last_modified, 0);
+			}
+		}
+		last_modified = (sce->data.last_modified->len > 0) ? sce->data.last_modified : NULL;
+	} else {
+		last_modified = etag_format_last_modified(tmp_str, st->st_mtime) ? tmp_str : NULL;
+	}
+
+	if (NULL == last_modified) {
+		li_http_header_remove(vr->response.headers, CONST_STR_LEN("last-modified"));
+	} else {
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Last-Modified"), GSTR_LEN(last_modified));
 
 		if (c_able != LI_TRIFALSE) {
-			switch (li_http_response_handle_cachable_modified(vr, tmp_str)) {
+			switch (li_http_response_handle_cachable_modified(vr, last_modified)) {
 			case LI_TRIFALSE: c_able = LI_TRIFALSE; break;
 			case LI_TRIMAYBE: break;
 			case LI_TRITRUE : c_able = LI_TRITRUE; break;
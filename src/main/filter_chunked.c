@@ -1,41 +1,90 @@
 
 #include <lighttpd/base.h>
 
-/* len != 0 */
-static void http_chunk_append_len(liChunkQueue *cq, size_t len) {
-	size_t i, olen = len, j;
-	GByteArray *a;
+/* blocks up to this size are copied next to their framing if they are in memory */
+#define CHUNKED_COPY_MAX 1024
 
-	a = g_byte_array_sized_new(sizeof(len) * 2 + 2);
+/* writes the hex digits of len (!= 0) to the end of buf[16], returns the number of digits */
+static guint http_chunk_len(gchar buf[16], goffset len) {
+	gchar *p = buf + 16;
 
-	for (i = 0; i < 8 && len; i++) {
+	do {
+		*--p = "0123456789abcdef"[len & 0xf];
 		len >>= 4;
-	}
+	} while (len > 0);
 
-	/* i is the number of hex digits we have */
-	g_byte_array_set_size(a, i);
+	return (buf + 16) - p;
+}
 
-	for (j = i, len = olen; j-- > 0; ) {
-		a->data[j] = (len & 0xf) + (((len & 0xf) <= 9) ? '0' : 'a' - 10);
-		len >>= 4;
+static gboolean http_chunk_in_memory(liChunkQueue *cq) {
+	GList *iter;
+
+	for (iter = g_queue_peek_head_link(&cq->queue); iter; iter = g_list_next(iter)) {
+		liChunk *c = iter->data;
+		if (FILE_CHUNK == c->type) return FALSE;
 	}
-	g_byte_array_append(a, CONST_USTR_LEN("\r\n"));
 
-	li_chunkqueue_append_bytearr(cq, a);
+	return TRUE;
 }
 
+static liBuffer* http_chunk_scratch(liVRequest *vr, gsize len) {
+	if (NULL != vr) return li_worker_scratch_buffer(vr->wrk, len);
 
+	return li_buffer_new(len);
+}
+
+/* framing goes into the per-worker scratch buffer; li_chunkqueue_append_buffer2 merges consecutive
+ * slices, so "\r\n" of a block and the size line of the next (or the last chunk) end up in one chunk,
+ * and small blocks in memory are copied between their framing.
+ */
 liHandlerResult li_filter_chunked_encode(liVRequest *vr, liChunkQueue *out, liChunkQueue *in) {
-	UNUSED(vr);
+	liBuffer *buf;
+	gchar *p;
+	gsize len;
 
 	if (in->length > 0) {
-		http_chunk_append_len(out, in->length);
-		li_chunkqueue_steal_all(out, in);
-		li_chunkqueue_append_mem(out, CONST_STR_LEN("\r\n"));
+		gchar hex[16];
+		guint hexlen = http_chunk_len(hex, in->length);
+		goffset datalen = in->length;
+		gboolean copy = (datalen <= CHUNKED_COPY_MAX) && http_chunk_in_memory(in);
+
+		len = hexlen + 2 + (copy ? datalen + 2 : 0);
+		buf = http_chunk_scratch(vr, len);
+		p = buf->addr + buf->used;
+
+		memcpy(p, hex + 16 - hexlen, hexlen);
+		memcpy(p + hexlen, "\r\n", 2);
+
+		if (copy) {
+			if (!li_chunkqueue_extract_to_memory(in, datalen, p + hexlen + 2, NULL)) copy = FALSE;
+		}
+
+		if (copy) {
+			memcpy(p + hexlen + 2 + datalen, "\r\n", 2);
+			li_chunkqueue_skip_all(in);
+		} else {
+			len = hexlen + 2;
+		}
+
+		buf->used += len;
+		li_chunkqueue_append_buffer2(out, buf, buf->used - len, len);
+
+		if (!copy) {
+			li_chunkqueue_steal_all(out, in);
+
+			buf = http_chunk_scratch(vr, 2);
+			memcpy(buf->addr + buf->used, "\r\n", 2);
+			buf->used += 2;
+			li_chunkqueue_append_buffer2(out, buf, buf->used - 2, 2);
+		}
 	}
 	if (in->is_closed) {
 		if (!out->is_closed) {
-			li_chunkqueue_append_mem(out, CONST_STR_LEN("0\r\n\r\n"));
+			len = sizeof("0\r\n\r\n") - 1;
+			buf = http_chunk_scratch(vr, len);
+			memcpy(buf->addr + buf->used, "0\r\n\r\n", len);
+			buf->used += len;
+			li_chunkqueue_append_buffer2(out, buf, buf->used - len, len);
 			out->is_closed = TRUE;
 		}
 		return LI_HANDLER_GO_ON;
@@ -71,7 +120,7 @@ gboolean li_filter_chunked_decode(liVRequest *vr, liChunkQueue *out, liChunkQueu
 
 
 	for (;;) {
-		 /* 0: start new chunklen, 1: reading chunklen, 2: found \r, 3: copying content, 4: found \r,
+		 /* 0: start new chunklen, 1: reading chunklen, 2: found \r, 3: copying content, 4: found \r, 5: chunk extension,
 		  * 10: wait for \r\n\r\n, 11: wait for \n\r\n, 12: wait for \r\n, 13: wait for \n, 14: eof,
 		  * 20: error
 		  */
@@ -89,8 +138,11 @@ gboolean li_filter_chunked_decode(liVRequest *vr, liChunkQueue *out, liChunkQueu
 				digit = c - '0';
 			} else if (c >= 'a' && c <= 'f') {
 				digit = c - 'a' + 10;
-			} else if (c >= 'A' && c >= 'F') {
+			} else if (c >= 'A' && c <= 'F') {
 				digit = c - 'A' + 10;
+			} else if (c == ';' || c == ' ' || c == '\t') {
+				/* chunk extensions (and whitespace before them) are ignored */
+				state->parse_state = (state->cur_chunklen == -1) ? 20 : 5;
 			} else if (c == '\r') {
 				if (state->cur_chunklen == -1) {
 					state->parse_state = 20;
@@ -157,6 +209,15 @@ gboolean li_filter_chunked_decode(liVRequest *vr, liChunkQueue *out, liChunkQueu
 				state->parse_state = 20;
 			}
 			break;
+		case 5: /* skip chunk extension until \r */
+			read_char(c);
+			li_chunk_parser_done(&ctx, 1);
+			if (c == '\r') {
+				state->parse_state = 2;
+			} else if (c == '\n') {
+				state->parse_state = 20;
+			}
+			break;
 		case 10: /* \r\n\r\n */
 			read_char(c);
 			li_chunk_parser_done(&ctx, 1);
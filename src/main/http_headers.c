@@ -1,6 +1,10 @@
 
 #include <lighttpd/base.h>
 
+/* recycle at most that many entries per header list; skip entries with large buffers */
+#define LI_HTTP_HEADERS_MAX_SPARE 32
+#define LI_HTTP_HEADER_MAX_SPARE_SIZE 1024
+
 static void _http_header_free(gpointer p) {
 	liHttpHeader *h = (liHttpHeader*) p;
 	g_string_free(h->data, TRUE);
@@ -46,11 +50,22 @@ cleanup:
 	g_string_truncate(h->data, j);
 }
 
-static liHttpHeader* _http_header_new(const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
-	liHttpHeader *h = g_slice_new0(liHttpHeader);
+/* returns a new list link for the header; reuses entries from headers->spare */
+static GList* _http_header_new(liHttpHeaders *headers, const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
+	GList *l = g_queue_pop_head_link(&headers->spare);
+	liHttpHeader *h;
 	gchar *s;
-	h->data = g_string_sized_new(keylen + valuelen + 2);
-	g_string_set_size(h->data, keylen + valuelen + 2);
+
+	if (NULL != l) {
+		h = (liHttpHeader*) l->data;
+		g_string_set_size(h->data, keylen + valuelen + 2);
+	} else {
+		h = g_slice_new0(liHttpHeader);
+		h->data = g_string_sized_new(keylen + valuelen + 2);
+		g_string_set_size(h->data, keylen + valuelen + 2);
+		l = g_list_alloc();
+		l->data = h;
+	}
 	h->keylen = keylen;
 	s = h->data->str;
 	memcpy(s, key, keylen);
@@ -59,7 +74,7 @@ static liHttpHeader* _http_header_new(const gchar *key, size_t keylen, const gch
 	s += 2;
 	memcpy(s, val, valuelen);
 	_http_header_sanitize(h);
-	return h;
+	return l;
 }
 
 static void _header_queue_free(gpointer data, gpointer userdata) {
@@ -70,25 +85,38 @@ static void _header_queue_free(gpointer data, gpointer userdata) {
 liHttpHeaders* li_http_headers_new(void) {
 	liHttpHeaders* headers = g_slice_new0(liHttpHeaders);
 	g_queue_init(&headers->entries);
+	g_queue_init(&headers->spare);
 	return headers;
 }
 
+/* keeps entries (up to a limit) for reuse, so keep-alive requests don't reallocate all headers */
 void li_http_headers_reset(liHttpHeaders* headers) {
-	g_queue_foreach(&headers->entries, _header_queue_free, NULL);
-	g_queue_clear(&headers->entries);
+	GList *l;
+
+	while (NULL != (l = g_queue_pop_head_link(&headers->entries))) {
+		liHttpHeader *h = (liHttpHeader*) l->data;
+
+		if (headers->spare.length < LI_HTTP_HEADERS_MAX_SPARE && h->data->allocated_len <= LI_HTTP_HEADER_MAX_SPARE_SIZE) {
+			g_queue_push_tail_link(&headers->spare, l);
+		} else {
+			_http_header_free(h);
+			g_list_free_1(l);
+		}
+	}
 }
 
 void li_http_headers_free(liHttpHeaders* headers) {
 	if (!headers) return;
 	g_queue_foreach(&headers->entries, _header_queue_free, NULL);
 	g_queue_clear(&headers->entries);
+	g_queue_foreach(&headers->spare, _header_queue_free, NULL);
+	g_queue_clear(&headers->spare);
 	g_slice_free(liHttpHeaders, headers);
 }
 
 /** just insert normal header, allow duplicates */
 void li_http_header_insert(liHttpHeaders *headers, const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
-	liHttpHeader *h = _http_header_new(key, keylen, val, valuelen);
-	g_queue_push_tail(&headers->entries, h);
+	g_queue_push_tail_link(&headers->entries, _http_header_new(headers, key, keylen, val, valuelen));
 }
 
 GList* li_http_header_find_first(liHttpHeaders *headers, const gchar *key, size_t keylen) {
@@ -77,6 +77,43 @@ gchar *li_http_status_string(guint status_code, guint *len) {
 	}
 }
 
+/* "<code> <description>\r\n" for the usual status codes, built on first use */
+#define HTTP_STATUS_LINE_MIN 100
+#define HTTP_STATUS_LINE_MAX 599
+#define HTTP_STATUS_LINE_SIZE 80
+static gchar http_status_lines[HTTP_STATUS_LINE_MAX - HTTP_STATUS_LINE_MIN + 1][HTTP_STATUS_LINE_SIZE];
+static guint8 http_status_lines_len[HTTP_STATUS_LINE_MAX - HTTP_STATUS_LINE_MIN + 1];
+static volatile gsize http_status_lines_init = 0;
+
+const gchar *li_http_status_line(guint status_code, guint *len) {
+	if (status_code < HTTP_STATUS_LINE_MIN || status_code > HTTP_STATUS_LINE_MAX) {
+		*len = 0;
+		return NULL;
+	}
+
+	if (g_once_init_enter(&http_status_lines_init)) {
+		guint code;
+
+		for (code = HTTP_STATUS_LINE_MIN; code <= HTTP_STATUS_LINE_MAX; code++) {
+			gchar *line = http_status_lines[code - HTTP_STATUS_LINE_MIN];
+			guint desc_len;
+			gchar *desc = li_http_status_string(code, &desc_len);
+
+			if (desc_len > HTTP_STATUS_LINE_SIZE - 6) desc_len = HTTP_STATUS_LINE_SIZE - 6;
+			li_http_status_to_str(code, line);
+			line[3] = ' ';
+			memcpy(line + 4, desc, desc_len);
+			memcpy(line + 4 + desc_len, "\r\n", 2);
+			http_status_lines_len[code - HTTP_STATUS_LINE_MIN] = desc_len + 6;
+		}
+
+		g_once_init_leave(&http_status_lines_init, 1);
+	}
+
+	*len = http_status_lines_len[status_code - HTTP_STATUS_LINE_MIN];
+	return http_status_lines[status_code - HTTP_STATUS_LINE_MIN];
+}
+
 gchar *li_http_method_string(liHttpMethod method, guint *len) {
 	switch (method) {
 	case LI_HTTP_METHOD_UNSET:           SET_LEN_AND_RETURN_STR("UNKNOWN");
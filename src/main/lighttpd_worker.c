@@ -35,6 +35,7 @@ int main(int argc, char *argv[]) {
 	gboolean test_config = FALSE;
 	gboolean show_version = FALSE;
 	gboolean use_angel = FALSE;
+	gint process_ndx = 0;
 
 	GOptionEntry entries[] = {
 		{ "config", 'c', 0, G_OPTION_ARG_FILENAME, &config_path, "filename/path of the config", "PATH" },
@@ -44,6 +45,7 @@ int main(int argc, char *argv[]) {
 		{ "module-resident", 0, 0, G_OPTION_ARG_NONE, &module_resident, "never unload modules (e.g. for valgrind)", NULL },
 		{ "version", 'v', 0, G_OPTION_ARG_NONE, &show_version, "show version and exit", NULL },
 		{ "angel", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &use_angel, "spawned by angel", NULL },
+		{ "process", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &process_ndx, "index of the process (angel option \"processes\")", "NDX" },
 		{ NULL, 0, 0, 0, NULL, NULL, NULL }
 	};
 
@@ -88,6 +90,7 @@ int main(int argc, char *argv[]) {
 	g_thread_init(NULL);
 
 	srv = li_server_new(module_dir, module_resident);
+	if (process_ndx > 0) srv->process_ndx = process_ndx;
 	li_server_loop_init(srv);
 
 	/* load core plugin */
@@ -134,6 +137,8 @@ int main(int argc, char *argv[]) {
 
 	/* TRACE(srv, "%s", "Test!"); */
 
+	li_angel_shm_counters(srv);
+
 	li_server_reached_state(srv, LI_SERVER_LOADING);
 	li_worker_run(srv->main_worker);
 	li_server_reached_state(srv, LI_SERVER_DOWN);
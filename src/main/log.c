@@ -61,6 +61,10 @@ static liLogTarget *log_open(liServer *srv, GString *path) {
 			case LI_LOG_TYPE_SYSLOG:
 				ERROR(srv, "%s", "syslog not supported yet");
 				break;
+			case LI_LOG_TYPE_ANGEL:
+				/* the angel writes the file; without angel write it ourself */
+				if (NULL == srv->acon) fd = li_angel_fake_log_open_file(srv, &sparam);
+				break;
 			case LI_LOG_TYPE_NONE:
 				return NULL;
 		}
@@ -84,7 +88,7 @@ static void log_close(liServer *srv, liLogTarget *log) {
 	li_radixtree_remove(srv->logs.targets, log->path->str, log->path->len * 8);
 	li_waitqueue_remove(&srv->logs.close_queue, &log->wqelem);
 
-	if (log->type == LI_LOG_TYPE_FILE || log->type == LI_LOG_TYPE_PIPE) {
+	if (log->type == LI_LOG_TYPE_FILE || log->type == LI_LOG_TYPE_PIPE || log->type == LI_LOG_TYPE_ANGEL) {
 		if (-1 != log->fd) close(log->fd);
 	}
 
@@ -309,9 +313,76 @@ static GString *log_timestamp_format(liServer *srv) {
 	return srv->logs.timestamp.cached;
 }
 
+/* log lines for "angel:" targets are collected while the queue is processed and sent in one call:
+ * a sequence of groups (gint32 path length, path, gint32 data length, data), consecutive lines
+ * for the same target share a group.
+ */
+typedef struct log_angel_batch log_angel_batch;
+struct log_angel_batch {
+	GString *buf;
+	liLogTarget *target; /* target of the last group */
+	gsize len_pos; /* position of the data length of the last group */
+};
+
+static void log_angel_flush(liServer *srv, log_angel_batch *batch) {
+	GError *err = NULL;
+
+	if (NULL == batch->buf) return;
+
+	if (!li_angel_send_simple_call(srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("log"), batch->buf, &err)) {
+		GString *str = g_string_sized_new(63);
+		g_string_printf(str, "could not send log messages to angel: %s", err->message);
+		li_log_write_stderr(srv, str->str, TRUE);
+		g_string_free(str, TRUE);
+		g_error_free(err);
+	}
+
+	batch->buf = NULL;
+	batch->target = NULL;
+}
+
+static void log_angel_append(liServer *srv, log_angel_batch *batch, liLogTarget *log, GString *msg) {
+	/* strip "angel:" */
+	const gchar *path = log->path->str + sizeof("angel:") - 1;
+	gsize path_len = log->path->len - (sizeof("angel:") - 1);
+	gsize overhead = 2 * sizeof(gint32) + path_len;
+	gint32 len;
+
+	if (path_len > LI_ANGEL_DATA_MAX_STR_LEN) {
+		li_log_write_stderr(srv, msg->str, FALSE);
+		return;
+	}
+
+	if (overhead + msg->len > ANGEL_CALL_MAX_STR_LEN) {
+		g_string_truncate(msg, ANGEL_CALL_MAX_STR_LEN - overhead);
+		msg->str[msg->len - 1] = '\n';
+	}
+
+	if (NULL != batch->buf && batch->target == log && batch->buf->len + msg->len <= ANGEL_CALL_MAX_STR_LEN) {
+		memcpy(&len, batch->buf->str + batch->len_pos, sizeof(len));
+		len += msg->len;
+		memcpy(batch->buf->str + batch->len_pos, &len, sizeof(len));
+		g_string_append_len(batch->buf, GSTR_LEN(msg));
+		return;
+	}
+
+	if (NULL != batch->buf && batch->buf->len + overhead + msg->len > ANGEL_CALL_MAX_STR_LEN) {
+		log_angel_flush(srv, batch);
+	}
+
+	if (NULL == batch->buf) batch->buf = g_string_sized_new(4096);
+
+	li_angel_data_write_cstr(batch->buf, path, path_len, NULL);
+	batch->len_pos = batch->buf->len;
+	li_angel_data_write_int32(batch->buf, msg->len, NULL);
+	g_string_append_len(batch->buf, GSTR_LEN(msg));
+	batch->target = log;
+}
+
 static void log_watcher_cb(liEventBase *watcher, int events) {
 	liServer *srv = LI_CONTAINER_OF(li_event_async_from(watcher), liServer, logs.watcher);
 	GList *queue_link, *queue_link_next;
+	log_angel_batch angel_batch = { NULL, NULL, 0 };
 
 	UNUSED(events);
 
@@ -350,6 +421,11 @@ static void log_watcher_cb(liEventBase *watcher, int events) {
 
 		log = log_open(srv, log_entry->path);
 
+		if (NULL != log && LI_LOG_TYPE_ANGEL == log->type && NULL != srv->acon) {
+			log_angel_append(srv, &angel_batch, log, msg);
+			goto next;
+		}
+
 		if (NULL == log || -1 == log->fd) {
 			li_log_write_stderr(srv, msg->str, TRUE);
 			goto next;
@@ -391,6 +467,8 @@ next:
 		queue_link = queue_link_next;
 	}
 
+	log_angel_flush(srv, &angel_batch);
+
 	if (g_atomic_int_get(&srv->logs.thread_finish) == TRUE) {
 		liWaitQueueElem *wqe;
 
@@ -418,6 +496,7 @@ liLogType li_log_type_from_path(GString *path, gchar **param) {
 	TRY_SCHEME("pipe:", LI_LOG_TYPE_PIPE);
 	TRY_SCHEME("stderr:", LI_LOG_TYPE_STDERR);
 	TRY_SCHEME("syslog:", LI_LOG_TYPE_SYSLOG);
+	TRY_SCHEME("angel:", LI_LOG_TYPE_ANGEL);
 
 	/* targets starting with a slash are absolute paths and therefor file targets */
 	if (*path->str == '/')
@@ -2,130 +2,351 @@
 #include <lighttpd/base.h>
 #include <lighttpd/plugin_core.h>
 
-#define MIME_COUNT_CHILDREN(x)	(x->cmin == 0 ? 0 : ((guint)x->cmax - x->cmin + 1))
-#define MIME_MARK_NODE(x)		((gpointer)((uintptr_t)x | 1))
-#define MIME_UNMARK_NODE(x)		((gpointer)((uintptr_t)x & (~1)))
-#define MIME_IS_NODE(x)			(1 == ((uintptr_t)x & 1))
+/* perfect hash with "hash and displace" (CHD): each suffix hashes to a bucket, and every bucket gets a
+ * displacement that moves all its suffixes to distinct free slots. there are (at least) twice as many
+ * slots as suffixes and about two suffixes per bucket, so suitable displacements are found quickly.
+ */
 
-liMimetypeNode *li_mimetype_node_new(void) {
-	return g_slice_new0(liMimetypeNode);
+/* number of displacements tried per bucket before a new seed is tried */
+#define MIME_MAX_DISPLACEMENT (1u << 16)
+/* number of seeds tried before the number of slots is doubled */
+#define MIME_MAX_SEED_TRIES 32
+
+typedef struct mimetype_slot mimetype_slot;
+struct mimetype_slot {
+	GString *suffix; /* NULL: empty slot */
+	GString *mimetype;
+	guint32 hash;
+};
+
+struct liMimetypeTable {
+	gint refcount;
+	GString *key; /* serialized entries, identifies identical tables */
+
+	GString *default_mimetype;
+
+	GHashTable *build; /* suffix -> mimetype, only until compiled */
+
+	mimetype_slot *slots;
+	guint mask;
+	guint32 seed;
+
+	guint32 *displacements;
+	guint bucket_mask;
+
+	/* bitmap of the first characters of the suffixes, 256 bits per length (0 <= length <= max_length):
+	 * most suffixes start with '.', which rules out most lengths without hashing */
+	guint32 *first_chars;
+	guint max_length;
+};
+
+/* compiled tables by key */
+static GHashTable *mimetype_tables = NULL;
+G_LOCK_DEFINE_STATIC(mimetype_tables);
+
+/* FNV-1a */
+static guint32 mimetype_hash(guint32 seed, const gchar *s, gsize len) {
+	guint32 h = 2166136261u ^ seed;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (guchar) s[i];
+		h *= 16777619u;
+	}
+
+	return h;
 }
 
-void li_mimetype_node_free(liMimetypeNode *node) {
-	guint i;
-	gpointer ptr;
+#define MIME_FIRST_CHAR_BIT(table, len, c) \
+	((table)->first_chars[(len) * 8 + ((guchar) (c) >> 5)] & (1u << ((guchar) (c) & 31)))
 
-	if (node->mimetype)
-		g_string_free(node->mimetype, TRUE);
+/* slot of a suffix hash for a given displacement (murmur3 finalizer) */
+static guint mimetype_slot_index(guint32 h, guint32 displacement, guint mask) {
+	h ^= displacement;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h & mask;
+}
+
+liMimetypeTable* li_mimetype_table_new(GString *default_mimetype) {
+	liMimetypeTable *table = g_slice_new0(liMimetypeTable);
 
-	for (i = 0; i < MIME_COUNT_CHILDREN(node); i++) {
-		ptr = node->children[i];
+	table->refcount = 1;
+	table->default_mimetype = default_mimetype;
+	table->build = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, li_g_string_free, li_g_string_free);
 
-		if (NULL == ptr)
-			continue;
+	return table;
+}
 
-		if (!MIME_IS_NODE(ptr)) {
-			g_string_free(ptr, TRUE);
-		} else {
-			li_mimetype_node_free(MIME_UNMARK_NODE(ptr));
+static void mimetype_table_free(liMimetypeTable *table) {
+	guint i;
+
+	if (NULL != table->slots) {
+		for (i = 0; i <= table->mask; i++) {
+			if (NULL == table->slots[i].suffix) continue;
+			g_string_free(table->slots[i].suffix, TRUE);
+			g_string_free(table->slots[i].mimetype, TRUE);
 		}
+		g_free(table->slots);
 	}
 
-	if (node->children)
-		g_free(node->children);
+	if (NULL != table->build) g_hash_table_destroy(table->build);
+	if (NULL != table->key) g_string_free(table->key, TRUE);
+	g_free(table->displacements);
+	g_free(table->first_chars);
+	g_string_free(table->default_mimetype, TRUE);
 
-	g_slice_free(liMimetypeNode, node);
+	g_slice_free(liMimetypeTable, table);
 }
 
-static void mimetype_insert(liMimetypeNode *node, GString *suffix, GString *mimetype, guint depth) {
-	guchar c, cdiff;
-	gpointer ptr;
-	liMimetypeNode *next_node;
-	LI_FORCE_ASSERT(!MIME_IS_NODE(mimetype));
-
-	/* start of suffix reached */
-	if (depth == suffix->len) {
-		if (node->mimetype)
-			g_string_free(node->mimetype, TRUE);
+void li_mimetype_table_insert(liMimetypeTable *table, GString *suffix, GString *mimetype) {
+	LI_FORCE_ASSERT(NULL != table->build);
 
-		node->mimetype = mimetype;
+	if (0 == suffix->len) {
+		/* empty suffix matches every filename */
+		g_string_free(table->default_mimetype, TRUE);
+		table->default_mimetype = mimetype;
 		return;
 	}
 
-	c = (guchar) suffix->str[suffix->len - depth - 1];
-	LI_FORCE_ASSERT(c != '\0');
-
-	if (NULL == node->children) {
-		node->cmin = node->cmax = c;
-		node->children = g_malloc(sizeof(gpointer));
-		node->children[0] = NULL;
-	} else if (c < node->cmin) {
-		cdiff = node->cmin - c; /* how much space we need in front */
-		node->children = g_realloc(node->children, sizeof(gpointer) * (MIME_COUNT_CHILDREN(node) + cdiff)); /* make room for more children */
-		memmove(&node->children[(guint)cdiff], node->children, sizeof(gpointer) * MIME_COUNT_CHILDREN(node)); /* move existing children to the back */
-		memset(node->children, 0, cdiff * sizeof(gpointer));
-		node->cmin = c;
-	} else if (c > node->cmax) {
-		cdiff = c - node->cmax;
-		node->children = g_realloc(node->children, sizeof(gpointer) * (MIME_COUNT_CHILDREN(node) + cdiff)); /* make room for more children */
-		memset(&node->children[MIME_COUNT_CHILDREN(node)], 0, cdiff * sizeof(gpointer));
-		node->cmax = c;
-	}
-
-	ptr = node->children[c - node->cmin];
-
-	if (NULL != ptr && MIME_IS_NODE(ptr)) {
-		/* slot contains another node */
-		next_node = MIME_UNMARK_NODE(ptr);
-	} else {
-		/* slot not used yet or contains a mimetype, split into node */
-		next_node = g_slice_new(liMimetypeNode);
-		next_node->mimetype = ptr;
-		next_node->cmax = next_node->cmin = 0;
-		next_node->children = NULL;
-		node->children[c - node->cmin] = MIME_MARK_NODE(next_node);
-	}
-
-	mimetype_insert(next_node, suffix, mimetype, depth+1);
+	g_hash_table_insert(table->build, g_string_new_len(GSTR_LEN(suffix)), mimetype);
 }
 
-void li_mimetype_insert(liMimetypeNode *node, GString *suffix, GString *mimetype) {
-	mimetype_insert(node, suffix, mimetype, 0);
+static gint mimetype_suffix_cmp(gconstpointer a, gconstpointer b) {
+	const GString *sa = *(const GString* const*) a, *sb = *(const GString* const*) b;
+	return strcmp(sa->str, sb->str);
 }
 
-GString *li_mimetype_get(liVRequest *vr, GString *filename) {
-	/* search in mime_types option for the longest suffix match */
-	GString *mimetype;
-	liMimetypeNode *node;
-	guchar *c, *s;
-	gpointer ptr;
+typedef struct mimetype_bucket mimetype_bucket;
+struct mimetype_bucket {
+	guint index;
+	GPtrArray *suffixes;
+};
 
-	if (!vr || !filename || !filename->len)
-		return NULL;
+static gint mimetype_bucket_cmp(gconstpointer a, gconstpointer b) {
+	const mimetype_bucket *ba = a, *bb = b;
+	/* largest buckets first, they are the hardest to place */
+	if (ba->suffixes->len != bb->suffixes->len) return (ba->suffixes->len > bb->suffixes->len) ? -1 : 1;
+	return (ba->index < bb->index) ? -1 : (ba->index > bb->index) ? 1 : 0;
+}
+
+/* places the suffixes of a bucket in free slots with the first displacement that doesn't collide */
+static gboolean mimetype_table_place(liMimetypeTable *table, mimetype_bucket *bucket) {
+	guint32 d;
+	guint i, j;
+
+	for (d = 0; d < MIME_MAX_DISPLACEMENT; d++) {
+		for (i = 0; i < bucket->suffixes->len; i++) {
+			GString *suffix = g_ptr_array_index(bucket->suffixes, i);
+			mimetype_slot *slot = &table->slots[mimetype_slot_index(mimetype_hash(table->seed, GSTR_LEN(suffix)), d, table->mask)];
+
+			if (NULL != slot->suffix) break;
+
+			/* claim the slot, so the other suffixes of the bucket don't get it */
+			slot->suffix = suffix;
+		}
+
+		if (i == bucket->suffixes->len) {
+			for (i = 0; i < bucket->suffixes->len; i++) {
+				GString *suffix = g_ptr_array_index(bucket->suffixes, i);
+				guint32 h = mimetype_hash(table->seed, GSTR_LEN(suffix));
+				table->slots[mimetype_slot_index(h, d, table->mask)].hash = h;
+			}
+			table->displacements[bucket->index] = d;
+			return TRUE;
+		}
+
+		/* undo */
+		for (j = 0; j < i; j++) {
+			GString *suffix = g_ptr_array_index(bucket->suffixes, j);
+			table->slots[mimetype_slot_index(mimetype_hash(table->seed, GSTR_LEN(suffix)), d, table->mask)].suffix = NULL;
+		}
+	}
+
+	return FALSE;
+}
+
+static gboolean mimetype_table_fill(liMimetypeTable *table, GPtrArray *suffixes, guint32 seed) {
+	guint i, nbuckets = table->bucket_mask + 1;
+	mimetype_bucket *buckets;
+	gboolean res = TRUE;
+
+	memset(table->slots, 0, sizeof(mimetype_slot) * (table->mask + 1));
+	memset(table->displacements, 0, sizeof(guint32) * nbuckets);
+	table->seed = seed;
+
+	buckets = g_new(mimetype_bucket, nbuckets);
+	for (i = 0; i < nbuckets; i++) {
+		buckets[i].index = i;
+		buckets[i].suffixes = g_ptr_array_new();
+	}
+	for (i = 0; i < suffixes->len; i++) {
+		GString *suffix = g_ptr_array_index(suffixes, i);
+		g_ptr_array_add(buckets[mimetype_hash(seed, GSTR_LEN(suffix)) & table->bucket_mask].suffixes, suffix);
+	}
+	qsort(buckets, nbuckets, sizeof(mimetype_bucket), mimetype_bucket_cmp);
+
+	for (i = 0; i < nbuckets && buckets[i].suffixes->len > 0; i++) {
+		if (!mimetype_table_place(table, &buckets[i])) {
+			res = FALSE;
+			break;
+		}
+	}
+
+	for (i = 0; i < nbuckets; i++) {
+		g_ptr_array_free(buckets[i].suffixes, TRUE);
+	}
+	g_free(buckets);
+
+	return res;
+}
+
+liMimetypeTable* li_mimetype_table_compile(liMimetypeTable *table) {
+	GPtrArray *suffixes;
+	GHashTableIter iter;
+	gpointer k, v;
+	guint i, size;
+	guint32 seed;
+	liMimetypeTable *shared;
+
+	LI_FORCE_ASSERT(NULL != table->build);
+
+	/* sorted suffixes: identical tables get identical keys */
+	suffixes = g_ptr_array_sized_new(g_hash_table_size(table->build));
+	g_hash_table_iter_init(&iter, table->build);
+	while (g_hash_table_iter_next(&iter, &k, &v)) {
+		g_ptr_array_add(suffixes, k);
+	}
+	g_ptr_array_sort(suffixes, mimetype_suffix_cmp);
+
+	table->key = g_string_sized_new(63);
+	g_string_append_len(table->key, GSTR_LEN(table->default_mimetype));
+	g_string_append_c(table->key, '\0');
+	for (i = 0; i < suffixes->len; i++) {
+		GString *suffix = g_ptr_array_index(suffixes, i);
+		GString *mimetype = g_hash_table_lookup(table->build, suffix);
+		g_string_append_len(table->key, GSTR_LEN(suffix));
+		g_string_append_c(table->key, '\0');
+		g_string_append_len(table->key, GSTR_LEN(mimetype));
+		g_string_append_c(table->key, '\0');
+	}
+
+	G_LOCK(mimetype_tables);
+
+	if (NULL == mimetype_tables) {
+		mimetype_tables = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	}
+
+	if (NULL != (shared = g_hash_table_lookup(mimetype_tables, table->key))) {
+		g_atomic_int_inc(&shared->refcount);
+		G_UNLOCK(mimetype_tables);
 
-	node = CORE_OPTIONPTR(LI_CORE_OPTION_MIME_TYPES).ptr;
+		g_ptr_array_free(suffixes, TRUE);
+		mimetype_table_free(table);
+		return shared;
+	}
 
-	mimetype = node->mimetype;
+	/* at least twice as many slots as entries, about two entries per bucket */
+	for (size = 8; size < 2 * suffixes->len; size <<= 1) ;
+	table->bucket_mask = (size >> 2) - 1;
+	table->displacements = g_new0(guint32, size >> 2);
 
-	for (s = (guchar*) filename->str, c = (guchar*) filename->str + filename->len; c-- > s; ) {
-		if (*c < node->cmin || *c > node->cmax)
-			return mimetype;
+	for (;;) {
+		table->mask = size - 1;
+		table->slots = g_new0(mimetype_slot, size);
 
-		ptr = node->children[*c - node->cmin];
-		if (NULL == ptr) {
-			return mimetype;
+		for (seed = 0; seed < MIME_MAX_SEED_TRIES; seed++) {
+			if (mimetype_table_fill(table, suffixes, seed)) break;
 		}
+		if (seed < MIME_MAX_SEED_TRIES) break;
+
+		/* practically unreachable: fewer entries per slot make displacing easier */
+		g_free(table->slots);
+		size <<= 1;
+	}
+
+	/* the slots own the entries of the build table now */
+	table->max_length = 0;
+	for (i = 0; i < suffixes->len; i++) {
+		GString *suffix = g_ptr_array_index(suffixes, i);
+		if (suffix->len > table->max_length) table->max_length = suffix->len;
+	}
+	table->first_chars = g_new0(guint32, (table->max_length + 1) * 8);
+	for (i = 0; i <= table->mask; i++) {
+		mimetype_slot *slot = &table->slots[i];
+		guchar c;
+
+		if (NULL == slot->suffix) continue;
 
-		if (!MIME_IS_NODE(ptr)) {
-			return ptr;
+		slot->mimetype = g_hash_table_lookup(table->build, slot->suffix);
+		c = slot->suffix->str[0];
+		table->first_chars[slot->suffix->len * 8 + (c >> 5)] |= 1u << (c & 31);
+	}
+
+	g_ptr_array_free(suffixes, TRUE);
+	g_hash_table_steal_all(table->build);
+	g_hash_table_destroy(table->build);
+	table->build = NULL;
+
+	g_hash_table_insert(mimetype_tables, table->key, table);
+
+	G_UNLOCK(mimetype_tables);
+
+	return table;
+}
+
+void li_mimetype_table_release(liMimetypeTable *table) {
+	if (NULL == table) return;
+
+	if (NULL == table->build) {
+		/* compiled tables are shared */
+		G_LOCK(mimetype_tables);
+		if (!g_atomic_int_dec_and_test(&table->refcount)) {
+			G_UNLOCK(mimetype_tables);
+			return;
+		}
+		g_hash_table_remove(mimetype_tables, table->key);
+		if (0 == g_hash_table_size(mimetype_tables)) {
+			g_hash_table_destroy(mimetype_tables);
+			mimetype_tables = NULL;
 		}
+		G_UNLOCK(mimetype_tables);
+	} else if (!g_atomic_int_dec_and_test(&table->refcount)) {
+		return;
+	}
 
-		node = MIME_UNMARK_NODE(ptr);
+	mimetype_table_free(table);
+}
+
+GString* li_mimetype_table_lookup(const liMimetypeTable *table, const gchar *filename, gsize len) {
+	guint l;
+
+	/* longest suffix first; the first hit is the result */
+	for (l = MIN(len, table->max_length); l > 0; l--) {
+		const gchar *s = filename + len - l;
+		const mimetype_slot *slot;
+		guint32 h;
 
-		if (NULL != node->mimetype) {
-			mimetype = node->mimetype;
+		if (!MIME_FIRST_CHAR_BIT(table, l, s[0])) continue;
+
+		/* the only slot the suffix can be in */
+		h = mimetype_hash(table->seed, s, l);
+		slot = &table->slots[mimetype_slot_index(h, table->displacements[h & table->bucket_mask], table->mask)];
+		if (slot->hash == h && NULL != slot->suffix && slot->suffix->len == l && 0 == memcmp(slot->suffix->str, s, l)) {
+			return slot->mimetype;
 		}
 	}
 
-	return mimetype;
+	return table->default_mimetype;
+}
+
+GString *li_mimetype_get(liVRequest *vr, GString *filename) {
+	/* search in mime_types option for the longest suffix match */
+	if (!vr || !filename || !filename->len)
+		return NULL;
+
+	return li_mimetype_table_lookup(CORE_OPTIONPTR(LI_CORE_OPTION_MIME_TYPES).ptr, GSTR_LEN(filename));
 }
@@ -12,8 +12,10 @@ typedef struct {
 	} type;
 
 	union {
-		/* PATTERN_STRING */
-		GString *str;
+		/* PATTERN_STRING: text in liPattern.literals */
+		struct {
+			gsize offset, len;
+		} literal;
 		/* PATTERN_NTH and PATTERN_NTH_PREV */
 		struct {
 			guint from, to;
@@ -23,6 +25,19 @@ typedef struct {
 	} data;
 } liPatternPart;
 
+/* upper limit for the preallocation of results */
+#define PATTERN_SIZE_HINT_MAX 4096
+/* initial guess for the length of a placeholder */
+#define PATTERN_SIZE_HINT_PART 32
+
+struct liPattern {
+	liPatternPart *parts;
+	guint parts_len;
+	GString *literals; /* text of all PATTERN_STRING parts */
+	gboolean literal_only; /* no placeholders: the result is literals */
+	gint size_hint; /* max result length seen so far (capped), atomic access */
+};
+
 static gboolean parse_range(liServer *srv, liPatternPart *part, const gchar **str, const gchar *origstr) {
 	guint64 val;
 	gchar *endc = NULL;
@@ -81,13 +96,48 @@ static gboolean parse_range(liServer *srv, liPatternPart *part, const gchar **st
 	return TRUE;
 }
 
+static void pattern_free_parts(GArray *parts) {
+	guint i;
+
+	for (i = 0; i < parts->len; i++) {
+		liPatternPart *part = &g_array_index(parts, liPatternPart, i);
+		switch (part->type) {
+		case PATTERN_VAR_ENCODED: /* fall through */
+		case PATTERN_VAR: li_condition_lvalue_release(part->data.lvalue); break;
+		default: break;
+		}
+	}
+
+	g_array_free(parts, TRUE);
+}
+
+/* turn the parsed parts into the final pattern */
+static liPattern *pattern_compile(GArray *parts, GString *literals) {
+	liPattern *pattern = g_slice_new0(liPattern);
+	guint i, dynamic = 0;
+
+	for (i = 0; i < parts->len; i++) {
+		if (PATTERN_STRING != g_array_index(parts, liPatternPart, i).type) dynamic++;
+	}
+
+	pattern->literals = literals;
+	pattern->literal_only = (0 == dynamic);
+	pattern->size_hint = MIN(literals->len + dynamic * PATTERN_SIZE_HINT_PART, PATTERN_SIZE_HINT_MAX);
+	pattern->parts_len = parts->len;
+	pattern->parts = (liPatternPart*) g_array_free(parts, FALSE);
+
+	return pattern;
+}
+
 liPattern *li_pattern_new(liServer *srv, const gchar* str) {
 	GArray *pattern;
+	GString *literals;
 	liPatternPart part;
 	const gchar *c;
 	gboolean encoded;
 
 	pattern = g_array_new(FALSE, TRUE, sizeof(liPatternPart));
+	literals = g_string_sized_new(0);
 
 	for (c = str; *c;) {
 		if (*c == '$') {
@@ -101,15 +151,13 @@ liPattern *li_pattern_new(liServer *srv, const gchar* str) {
 			} else if ('[' == *c) {
 				part.type = PATTERN_NTH;
 				if (!parse_range(srv, &part, &c, str)) {
-					li_pattern_free((liPattern*)pattern);
-					return NULL;
+					goto error;
 				}
 				g_array_append_val(pattern, part);
 			} else {
 				/* parse error */
 				ERROR(srv, "could not parse pattern: \"%s\"", str);
-				li_pattern_free((liPattern*)pattern);
-				return NULL;
+				goto error;
 			}
 		} else if (*c == '%') {
 			c++;
@@ -122,8 +170,7 @@ liPattern *li_pattern_new(liServer *srv, const gchar* str) {
 			} else if ('[' == *c) {
 				part.type = PATTERN_NTH_PREV;
 				if (!parse_range(srv, &part, &c, str)) {
-					li_pattern_free((liPattern*)pattern);
-					return NULL;
+					goto error;
 				}
 				g_array_append_val(pattern, part);
 			} else if (*c == '{') {
@@ -156,8 +203,7 @@ liPattern *li_pattern_new(liServer *srv, const gchar* str) {
 						if (key_len == 0 || *key_c != ']' || *(key_c+1) != '}') {
 							/* parse error */
 							ERROR(srv, "could not parse pattern (invalid key): \"%s\"", str);
-							li_pattern_free((liPattern*)pattern);
-							return NULL;
+							goto error;
 						}
 
 						key = g_string_new_len(key_start, key_len);
@@ -175,8 +221,7 @@ liPattern *li_pattern_new(liServer *srv, const gchar* str) {
 					ERROR(srv, "could not parse pattern (missing '}'): \"%s\"", str);
 					if (key)
 						g_string_free(key, TRUE);
-					li_pattern_free((liPattern*)pattern);
-					return NULL;
+					goto error;
 				}
 
 				part.data.lvalue = li_condition_lvalue_new(li_cond_lvalue_from_string(lval_start, lval_len), key);
@@ -187,66 +232,82 @@ liPattern *li_pattern_new(liServer *srv, const gchar* str) {
 				if (part.data.lvalue->type == LI_COMP_UNKNOWN) {
 					/* parse error */
 					ERROR(srv, "could not parse pattern (unknown condition lvalue): \"%s\"", str);
-					li_pattern_free((liPattern*)pattern);
-					return NULL;
+					goto error;
 				}
 			} else {
 				/* parse error */
 				ERROR(srv, "could not parse pattern (unepexcted character after '%%'): \"%s\"", str);
-				li_pattern_free((liPattern*)pattern);
-				return NULL;
+				goto error;
 			}
 		} else {
 			/* string */
 			const gchar *first;
 
 			part.type = PATTERN_STRING;
-			part.data.str= g_string_sized_new(0);
+			part.data.literal.offset = literals->len;
 
 			/* copy every chunk between escapes into dest buffer */
 			for (first = c ; *c && '$' != *c && '%' != *c; c++) {
 				if (*c == '\\') {
-					if (first != c) g_string_append_len(part.data.str, first, c - first);
+					if (first != c) g_string_append_len(literals, first, c - first);
 					c++;
 					first = c;
 					if (*c != '\\' && *c != '?' && *c != '$' && *c != '%') {
 						/* parse error */
 						ERROR(srv, "could not parse pattern: invalid escape in \"%s\"", str);
-						g_string_free(part.data.str, TRUE);
-						li_pattern_free((liPattern*)pattern);
-						return NULL;
+						goto error;
 					}
 				}
 			}
-			if (first != c) g_string_append_len(part.data.str, first, c - first);
-
+			if (first != c) g_string_append_len(literals, first, c - first);
+			part.data.literal.len = literals->len - part.data.literal.offset;
+			/* the loop stops only at placeholders, so two literals are never adjacent */
 			g_array_append_val(pattern, part);
 		}
 	}
 
-	return (liPattern*) pattern;
+	return pattern_compile(pattern, literals);
+
+error:
+	pattern_free_parts(pattern);
+	g_string_free(literals, TRUE);
+	return NULL;
 }
 
 
 void li_pattern_free(liPattern *pattern) {
 	guint i;
-	GArray *arr;
-	liPatternPart *part;
 
 	if (!pattern) return;
 
-	arr = (GArray*) pattern;
-	for (i = 0; i < arr->len; i++) {
-		part = &g_array_index(arr, liPatternPart, i);
+	for (i = 0; i < pattern->parts_len; i++) {
+		liPatternPart *part = &pattern->parts[i];
 		switch (part->type) {
-		case PATTERN_STRING: g_string_free(part->data.str, TRUE); break;
 		case PATTERN_VAR_ENCODED: /* fall through */
 		case PATTERN_VAR: li_condition_lvalue_release(part->data.lvalue); break;
 		default: break;
 		}
 	}
 
-	g_array_free(arr, TRUE);
+	g_free(pattern->parts);
+	g_string_free(pattern->literals, TRUE);
+	g_slice_free(liPattern, pattern);
+}
+
+gboolean li_pattern_only_nth(liPattern *pattern) {
+	guint i;
+
+	for (i = 0; i < pattern->parts_len; i++) {
+		switch (pattern->parts[i].type) {
+		case PATTERN_STRING:
+		case PATTERN_NTH:
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
+	return TRUE;
 }
 
 void li_pattern_eval(liVRequest *vr, GString *dest, liPattern *pattern, liPatternCB nth_callback, gpointer nth_data, liPatternCB nth_prev_callback, gpointer nth_prev_data) {
@@ -254,16 +315,28 @@ void li_pattern_eval(liVRequest *vr, GString *dest, liPattern *pattern, liPatter
 	gboolean encoded;
 	liHandlerResult res;
 	liConditionValue cond_val;
-	GArray *arr = (GArray*) pattern;
 	GString *tmpstr = NULL;
+	gsize start = dest->len, hint;
+
+	if (pattern->literal_only) {
+		g_string_append_len(dest, GSTR_LEN(pattern->literals));
+		return;
+	}
+
+	/* size dest once instead of growing it step by step */
+	hint = (gsize) g_atomic_int_get(&pattern->size_hint);
+	if (dest->allocated_len <= start + hint) {
+		g_string_set_size(dest, start + hint);
+		g_string_truncate(dest, start);
+	}
 
-	for (i = 0; i < arr->len; i++) {
-		liPatternPart *part = &g_array_index(arr, liPatternPart, i);
+	for (i = 0; i < pattern->parts_len; i++) {
+		liPatternPart *part = &pattern->parts[i];
 		encoded = FALSE;
 
 		switch (part->type) {
 		case PATTERN_STRING:
-			g_string_append_len(dest, GSTR_LEN(part->data.str));
+			g_string_append_len(dest, pattern->literals->str + part->data.literal.offset, part->data.literal.len);
 			break;
 		case PATTERN_NTH:
 			if (NULL != nth_callback) {
@@ -297,6 +370,11 @@ void li_pattern_eval(liVRequest *vr, GString *dest, liPattern *pattern, liPatter
 	}
 
 	if (NULL != tmpstr) g_string_free(tmpstr, TRUE);
+
+	/* patterns are shared between workers; a lost update only costs a reallocation */
+	if (dest->len - start > hint && hint < PATTERN_SIZE_HINT_MAX) {
+		g_atomic_int_set(&pattern->size_hint, (gint) MIN(dest->len - start, PATTERN_SIZE_HINT_MAX));
+	}
 }
 
 void li_pattern_array_cb(GString *pattern_result, guint from, guint to, gpointer data) {
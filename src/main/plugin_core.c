@@ -152,10 +152,24 @@ static void core_docroot_nth_cb(GString *pattern_result, guint to, guint from, g
 	}
 }
 
+typedef struct core_docroot core_docroot;
+struct core_docroot {
+	GArray *patterns; /* liPattern* */
+	guint cache_id; /* 0: result doesn't only depend on the hostname, not cached */
+};
+
+static void core_docroot_cache_key(liVRequest *vr, core_docroot *dr, GString *key) {
+	g_string_truncate(key, 0);
+	li_string_append_int(key, dr->cache_id);
+	g_string_append_c(key, ':');
+	g_string_append_len(key, GSTR_LEN(vr->request.uri.host));
+}
+
 static liHandlerResult core_handle_docroot(liVRequest *vr, gpointer param, gpointer *context) {
 	guint i;
 	GMatchInfo *match_info = NULL;
-	GArray *arr = param;
+	core_docroot *dr = param;
+	GArray *arr = dr->patterns;
 	docroot_split dsplit = { vr->request.uri.host, NULL, 0 };
 
 	g_string_truncate(vr->physical.doc_root, 0);
@@ -170,6 +184,19 @@ static liHandlerResult core_handle_docroot(liVRequest *vr, gpointer param, gpoin
 		i = GPOINTER_TO_INT(*context);
 	} else {
 		i = 0;
+
+		if (0 != dr->cache_id) {
+			GString *cached;
+
+			core_docroot_cache_key(vr, dr, vr->wrk->tmp_str);
+			if (NULL != (cached = li_worker_docroot_cache_lookup(vr->wrk, vr->wrk->tmp_str))) {
+				g_string_append_len(vr->physical.doc_root, GSTR_LEN(cached));
+				if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+					VR_DEBUG(vr, "docroot: cached \"%s\"", vr->physical.doc_root->str);
+				}
+				goto build_path;
+			}
+		}
 	}
 	*context = NULL;
 
@@ -208,6 +235,12 @@ static liHandlerResult core_handle_docroot(liVRequest *vr, gpointer param, gpoin
 
 	g_strfreev(dsplit.splits);
 
+	if (0 != dr->cache_id) {
+		core_docroot_cache_key(vr, dr, vr->wrk->tmp_str);
+		li_worker_docroot_cache_insert(vr->wrk, vr->wrk->tmp_str, vr->physical.doc_root);
+	}
+
+build_path:
 	/* build physical path: docroot + uri.path */
 	g_string_truncate(vr->physical.path, 0);
 	g_string_append_len(vr->physical.path, GSTR_LEN(vr->physical.doc_root));
@@ -225,20 +258,23 @@ static liHandlerResult core_handle_docroot(liVRequest *vr, gpointer param, gpoin
 
 static void core_docroot_free(liServer *srv, gpointer param) {
 	guint i;
-	GArray *arr = param;
+	core_docroot *dr = param;
 
 	UNUSED(srv);
 
-	for (i = 0; i < arr->len; i++) {
-		li_pattern_free(g_array_index(arr, liPattern*, i));
+	for (i = 0; i < dr->patterns->len; i++) {
+		li_pattern_free(g_array_index(dr->patterns, liPattern*, i));
 	}
 
-	g_array_free(arr, TRUE);
+	g_array_free(dr->patterns, TRUE);
+	g_slice_free(core_docroot, dr);
 }
 
 static liAction* core_docroot(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
-	GArray *arr;
+	core_docroot *dr;
 	liPattern *pattern;
+	guint i;
+	gboolean cacheable = TRUE;
 	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
 
 	val = li_value_get_single_argument(val);
@@ -248,31 +284,41 @@ static liAction* core_docroot(liServer *srv, liWorker *wrk, liPlugin* p, liValue
 		return NULL;
 	}
 
-	arr = g_array_new(FALSE, TRUE, sizeof(liPattern*));
+	dr = g_slice_new0(core_docroot);
+	dr->patterns = g_array_new(FALSE, TRUE, sizeof(liPattern*));
 
 	if (LI_VALUE_STRING == li_value_type(val)) {
 		pattern = li_pattern_new(srv, val->data.string->str);
-		if (NULL == pattern) return FALSE;
-		g_array_append_val(arr, pattern);
+		if (NULL == pattern) {
+			core_docroot_free(srv, dr);
+			return NULL;
+		}
+		g_array_append_val(dr->patterns, pattern);
 	} else {
 		LI_VALUE_FOREACH(v, val)
 			if (LI_VALUE_STRING != li_value_type(v)) {
 				ERROR(srv, "%s", "docroot action expects a string or list of strings as parameter");
-				core_docroot_free(srv, arr);
+				core_docroot_free(srv, dr);
 				return NULL;
 			}
 
 			pattern = li_pattern_new(srv, v->data.string->str);
 			if (NULL == pattern) {
 				ERROR(srv, "%s", "docroot: failed to parse pattern");
-				core_docroot_free(srv, arr);
-				return FALSE;
+				core_docroot_free(srv, dr);
+				return NULL;
 			}
-			g_array_append_val(arr, pattern);
+			g_array_append_val(dr->patterns, pattern);
 		LI_VALUE_END_FOREACH()
 	}
 
-	return li_action_new_function(core_handle_docroot, NULL, core_docroot_free, arr);
+	/* results only depending on the hostname are cached per worker (single patterns are cheap enough) */
+	for (i = 0; i < dr->patterns->len; i++) {
+		if (!li_pattern_only_nth(g_array_index(dr->patterns, liPattern*, i))) cacheable = FALSE;
+	}
+	if (cacheable && dr->patterns->len > 1) dr->cache_id = li_worker_docroot_cache_id();
+
+	return li_action_new_function(core_handle_docroot, NULL, core_docroot_free, dr);
 }
 
 typedef struct {
@@ -541,13 +587,158 @@ static liAction* core_index(liServer *srv, liWorker *wrk, liPlugin* p, liValue *
 }
 
 
+typedef struct {
+	goffset start, end;
+} core_static_range;
+
+static const gchar core_static_boundary[] = "fkj49sn38dcn3";
+
+static gint core_static_range_cmp(gconstpointer a, gconstpointer b) {
+	const core_static_range *ra = a, *rb = b;
+	return (ra->start < rb->start) ? -1 : (ra->start > rb->start) ? 1 : 0;
+}
+
+/* sort ranges and merge overlapping ones and ones separated by a gap smaller than
+ * the overhead of another part (RFC 7233, 4.1) */
+static void core_static_ranges_coalesce(GArray *ranges, goffset max_gap) {
+	guint i, n;
+
+	if (ranges->len < 2) return;
+
+	g_array_sort(ranges, core_static_range_cmp);
+
+	for (i = 1, n = 0; i < ranges->len; i++) {
+		core_static_range *cur = &g_array_index(ranges, core_static_range, n);
+		core_static_range *next = &g_array_index(ranges, core_static_range, i);
+
+		if (next->start <= cur->end + 1 + max_gap) {
+			if (next->end > cur->end) cur->end = next->end;
+		} else {
+			g_array_index(ranges, core_static_range, ++n) = *next;
+		}
+	}
+	g_array_set_size(ranges, n + 1);
+}
+
+/* returns FALSE if the complete file should be sent instead */
+static gboolean core_static_ranges(liVRequest *vr, liChunkFile *cf, goffset size, const GString *mime_str, liHttpHeader *hh_range) {
+	const GString range_str = li_const_gstring(LI_HEADER_VALUE_LEN(hh_range));
+	guint max_ranges = CORE_OPTION(LI_CORE_OPTION_STATIC_MAX_RANGES).number;
+	liParseHttpRangeState rs;
+	GArray *ranges;
+	gboolean done = FALSE, handled = FALSE, not_satisfiable = FALSE;
+	/* "\r\n--<boundary>\r\nContent-Type: <mime>\r\nContent-Range: bytes <start>-<end>/<size>\r\n\r\n" */
+	const gsize part_fixed_len = sizeof("\r\n--\r\nContent-Type: \r\nContent-Range: bytes -/\r\n\r\n") - 1
+		+ sizeof(core_static_boundary) - 1 + mime_str->len;
+
+	ranges = g_array_new(FALSE, FALSE, sizeof(core_static_range));
+
+	li_parse_http_range_init(&rs, &range_str, size);
+	do {
+		switch (li_parse_http_range_next(&rs)) {
+		case LI_PARSE_HTTP_RANGE_OK: {
+				core_static_range r = { rs.range_start, rs.range_end };
+				g_array_append_val(ranges, r);
+			}
+			break;
+		case LI_PARSE_HTTP_RANGE_DONE:
+			handled = TRUE;
+			done = TRUE;
+			break;
+		case LI_PARSE_HTTP_RANGE_INVALID:
+			done = TRUE;
+			break;
+		case LI_PARSE_HTTP_RANGE_NOT_SATISFIABLE:
+			not_satisfiable = TRUE;
+			done = TRUE;
+			break;
+		}
+	} while (!done);
+	li_parse_http_range_clear(&rs);
+
+	if (not_satisfiable) {
+		g_array_free(ranges, TRUE);
+		g_string_printf(vr->wrk->tmp_str, "bytes */%"G_GINT64_FORMAT, size);
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Range"), GSTR_LEN(vr->wrk->tmp_str));
+		vr->response.http_status = 416;
+		return TRUE;
+	}
+
+	if (handled) {
+		core_static_ranges_coalesce(ranges, part_fixed_len);
+
+		if (0 != max_ranges && ranges->len > max_ranges) {
+			if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+				VR_DEBUG(vr, "too many ranges requested (%u > %u), sending complete file", ranges->len, max_ranges);
+			}
+			handled = FALSE;
+		}
+	}
+
+	if (!handled) {
+		g_array_free(ranges, TRUE);
+		return FALSE;
+	}
+
+	vr->response.http_status = 206;
+
+	if (1 == ranges->len) {
+		core_static_range *r = &g_array_index(ranges, core_static_range, 0);
+
+		g_string_printf(vr->wrk->tmp_str, "bytes %"G_GINT64_FORMAT"-%"G_GINT64_FORMAT"/%"G_GINT64_FORMAT, r->start, r->end, size);
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Range"), GSTR_LEN(vr->wrk->tmp_str));
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(mime_str));
+		li_chunkqueue_append_chunkfile(vr->direct_out, cf, r->start, r->end - r->start + 1);
+	} else {
+		/* all part headers share one buffer; the file parts are sent with sendfile() */
+		/* 3 numbers with at most 20 digits each per part */
+		gsize max_len = ranges->len * (part_fixed_len + 3*20) + sizeof("\r\n----\r\n") - 1 + sizeof(core_static_boundary) - 1;
+		liBuffer *buf = li_buffer_new(max_len);
+		guint i;
+
+		for (i = 0; i < ranges->len; i++) {
+			core_static_range *r = &g_array_index(ranges, core_static_range, i);
+			gsize offset = buf->used;
+
+			buf->used += g_snprintf(buf->addr + buf->used, buf->alloc_size - buf->used,
+				"\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %"G_GINT64_FORMAT"-%"G_GINT64_FORMAT"/%"G_GINT64_FORMAT"\r\n\r\n",
+				core_static_boundary, mime_str->str, r->start, r->end, size);
+			li_buffer_acquire(buf);
+			li_chunkqueue_append_buffer2(vr->direct_out, buf, offset, buf->used - offset);
+			li_chunkqueue_append_chunkfile(vr->direct_out, cf, r->start, r->end - r->start + 1);
+		}
+
+		{
+			gsize offset = buf->used;
+			buf->used += g_snprintf(buf->addr + buf->used, buf->alloc_size - buf->used, "\r\n--%s--\r\n", core_static_boundary);
+			li_buffer_acquire(buf);
+			li_chunkqueue_append_buffer2(vr->direct_out, buf, offset, buf->used - offset);
+		}
+		li_buffer_release(buf);
+
+		g_string_printf(vr->wrk->tmp_str, "multipart/byteranges; boundary=%s", core_static_boundary);
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(vr->wrk->tmp_str));
+	}
+
+	g_array_free(ranges, TRUE);
+	return TRUE;
+}
+
+/* whether the mode bits allow us to read the file (without a syscall). conservative: if we might be in the
+ * group through a supplementary group both group and others need read permission; ACLs are not checked
+ */
+static gboolean core_static_readable(struct stat *st) {
+	if (st->st_uid == geteuid()) return 0 != (st->st_mode & S_IRUSR);
+	if (st->st_gid == getegid()) return 0 != (st->st_mode & S_IRGRP);
+	return (S_IRGRP | S_IROTH) == (st->st_mode & (S_IRGRP | S_IROTH));
+}
+
 static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpointer *context) {
 	int fd = -1;
 	struct stat st;
 	int err;
 	liHandlerResult res;
 	GPtrArray *exclude_arr = CORE_OPTIONPTR(LI_CORE_OPTION_STATIC_FILE_EXCLUDE_EXTENSIONS).list;
-	static const gchar boundary[] = "fkj49sn38dcn3";
 	gboolean no_fail = GPOINTER_TO_INT(param);
 
 	UNUSED(param);
@@ -597,6 +788,29 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 		}
 	}
 
+	if (NULL != li_http_header_lookup(vr->request.headers, CONST_STR_LEN("If-None-Match"))
+		|| NULL != li_http_header_lookup(vr->request.headers, CONST_STR_LEN("If-Modified-Since"))) {
+		/* revalidation: answer with 304 from the stat cache without opening the file. otherwise (not
+		 * cached, or modified) the headers are set again below from the fstat() of the opened file */
+		gboolean cachable;
+
+		/* files we might not be able to read take the open() path below (403) */
+		if (li_stat_cache_get_cached(vr, vr->physical.path, &st) && S_ISREG(st.st_mode) && core_static_readable(&st)) {
+			li_etag_set_header(vr, &st, &cachable);
+			if (cachable) {
+				if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+					VR_DEBUG(vr, "static file not modified: '%s'", vr->physical.path->str);
+				}
+
+				if (!li_vrequest_handle_direct(vr)) {
+					return LI_HANDLER_ERROR;
+				}
+				vr->response.http_status = 304;
+				return LI_HANDLER_GO_ON;
+			}
+		}
+	}
+
 	res = li_stat_cache_get(vr, vr->physical.path, &st, &err, &fd);
 	if (res == LI_HANDLER_WAIT_FOR_EVENT)
 		return res;
@@ -665,6 +879,7 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 			return LI_HANDLER_ERROR;
 		}
 
+		/* ETag, Last-Modified and the length all come from the same fstat() */
 		li_etag_set_header(vr, &st, &cachable);
 		if (cachable) {
 			vr->response.http_status = 304;
@@ -681,61 +896,8 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Accept-Ranges"), CONST_STR_LEN("bytes"));
 
 			hh_range = li_http_header_lookup(vr->request.headers, CONST_STR_LEN("range"));
-			if (hh_range) {
-				/* TODO: Check If-Range: header */
-				const GString range_str = li_const_gstring(LI_HEADER_VALUE_LEN(hh_range));
-				liParseHttpRangeState rs;
-				gboolean is_multipart = FALSE, done = FALSE;
-
-				li_parse_http_range_init(&rs, &range_str, st.st_size);
-				do {
-					switch (li_parse_http_range_next(&rs)) {
-					case LI_PARSE_HTTP_RANGE_OK:
-						if (!is_multipart && !rs.last_range) {
-							is_multipart = TRUE;
-						}
-						g_string_printf(vr->wrk->tmp_str, "bytes %"G_GINT64_FORMAT"-%"G_GINT64_FORMAT"/%"G_GINT64_FORMAT, rs.range_start, rs.range_end, (goffset) st.st_size);
-						if (is_multipart) {
-							GString *subheader = g_string_sized_new(1023);
-							g_string_append_printf(subheader, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: %s\r\n\r\n", boundary, mime_str->str, vr->wrk->tmp_str->str);
-							li_chunkqueue_append_string(vr->direct_out, subheader);
-							li_chunkqueue_append_chunkfile(vr->direct_out, cf, rs.range_start, rs.range_length);
-						} else {
-							li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Range"), GSTR_LEN(vr->wrk->tmp_str));
-							li_chunkqueue_append_chunkfile(vr->direct_out, cf, rs.range_start, rs.range_length);
-						}
-						break;
-					case LI_PARSE_HTTP_RANGE_DONE:
-						ranged_response = TRUE;
-						done = TRUE;
-						vr->response.http_status = 206;
-						if (is_multipart) {
-							GString *subheader = g_string_sized_new(1023);
-							g_string_append_printf(subheader, "\r\n--%s--\r\n", boundary);
-							li_chunkqueue_append_string(vr->direct_out, subheader);
-
-							g_string_printf(vr->wrk->tmp_str, "multipart/byteranges; boundary=%s", boundary);
-							li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(vr->wrk->tmp_str));
-						} else {
-							li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(mime_str));
-						}
-						break;
-					case LI_PARSE_HTTP_RANGE_INVALID:
-						done = TRUE;
-						/* indirect handing: out cq is already "closed" */
-						li_chunkqueue_reset(vr->direct_out); vr->direct_out->is_closed = TRUE;
-						break;
-					case LI_PARSE_HTTP_RANGE_NOT_SATISFIABLE:
-						ranged_response = TRUE;
-						done = TRUE;
-						li_chunkqueue_reset(vr->direct_out);
-						g_string_printf(vr->wrk->tmp_str, "bytes */%"G_GINT64_FORMAT, (goffset) st.st_size);
-						li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Range"), GSTR_LEN(vr->wrk->tmp_str));
-						vr->response.http_status = 416;
-						break;
-					}
-				} while (!done);
-				li_parse_http_range_clear(&rs);
+			if (hh_range && li_http_response_handle_if_range(vr)) {
+				ranged_response = core_static_ranges(vr, cf, st.st_size, mime_str, hh_range);
 			}
 		}
 
@@ -868,6 +1030,45 @@ static liAction* core_status(liServer *srv, liWorker *wrk, liPlugin* p, liValue
 	return li_action_new_function(core_handle_status, NULL, NULL, ptr);
 }
 
+static liHandlerResult core_handle_overload_shed(liVRequest *vr, gpointer param, gpointer *context) {
+	guint retry_after = GPOINTER_TO_UINT(param);
+	UNUSED(context);
+
+	if (!li_worker_overloaded(vr->wrk)) return LI_HANDLER_GO_ON;
+
+	if (!li_vrequest_handle_direct(vr)) return LI_HANDLER_GO_ON;
+
+	if (0 == retry_after) retry_after = vr->wrk->srv->overload_retry_after;
+
+	vr->response.http_status = 503;
+	vr->coninfo->keep_alive = FALSE;
+	g_string_printf(vr->wrk->tmp_str, "%u", retry_after);
+	li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Retry-After"), GSTR_LEN(vr->wrk->tmp_str));
+
+	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+		VR_DEBUG(vr, "overload.shed: server overloaded, retry after %u seconds", retry_after);
+	}
+
+	return LI_HANDLER_GO_ON;
+}
+
+static liAction* core_overload_shed(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	guint retry_after = 0;
+	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (NULL != val) {
+		if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 1 || val->data.number > G_MAXINT32) {
+			ERROR(srv, "%s", "overload.shed expects an optional positive number (Retry-After seconds) as parameter");
+			return NULL;
+		}
+		retry_after = val->data.number;
+	}
+
+	return li_action_new_function(core_handle_overload_shed, NULL, NULL, GUINT_TO_POINTER(retry_after));
+}
+
 
 static void core_log_write_free(liServer *srv, gpointer param) {
 	UNUSED(srv);
@@ -1160,28 +1361,82 @@ static liAction* core_env_clear(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 }
 
 
+static gboolean core_listen_parse_options(liServer *srv, liValue *val, liListenOptions *opts) {
+	GError *err = NULL;
+
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "listen expects a key-value list of socket options as second parameter");
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		gboolean ok;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "listen: socket options require a name");
+			return FALSE;
+		}
+
+		if (LI_VALUE_NUMBER == li_value_type(entryValue) && entryValue->data.number >= 0) {
+			gchar *num = g_strdup_printf("%" G_GINT64_FORMAT, entryValue->data.number);
+			ok = li_listen_options_set(opts, entryKey->data.string->str, num, &err);
+			g_free(num);
+		} else if (LI_VALUE_STRING == li_value_type(entryValue)) {
+			ok = li_listen_options_set(opts, entryKey->data.string->str, entryValue->data.string->str, &err);
+		} else {
+			ERROR(srv, "listen: invalid value for socket option '%s'", entryKey->data.string->str);
+			return FALSE;
+		}
+
+		if (!ok) {
+			ERROR(srv, "listen: %s", err->message);
+			g_error_free(err);
+			return FALSE;
+		}
+	LI_VALUE_END_FOREACH()
+
+	return TRUE;
+}
+
 static gboolean core_listen(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	liListenOptions opts;
+	liValue *addresses = NULL;
 	UNUSED(p); UNUSED(userdata);
 
-	val = li_value_get_single_argument(val);
+	li_listen_options_init(&opts);
 
-	if (NULL == val) goto fail;
+	if (li_value_list_has_len(val, 2) && LI_VALUE_LIST == li_value_list_type_at(val, 1)) {
+		/* listen <address(es)>, [ "backlog" => 4096, ... ]; */
+		if (!core_listen_parse_options(srv, li_value_list_at(val, 1), &opts)) {
+			li_listen_options_clear(&opts);
+			return FALSE;
+		}
+		addresses = li_value_list_at(val, 0);
+	} else {
+		addresses = li_value_get_single_argument(val);
+	}
 
-	if (LI_VALUE_STRING == li_value_type(val)) {
-		li_angel_listen(srv, val->data.string, NULL, NULL);
-	} else if (LI_VALUE_LIST == li_value_type(val)) {
-		LI_VALUE_FOREACH(ip, val);
+	if (NULL == addresses) goto fail;
+
+	if (LI_VALUE_STRING == li_value_type(addresses)) {
+		li_angel_listen_options(srv, addresses->data.string, &opts, NULL, NULL);
+	} else if (LI_VALUE_LIST == li_value_type(addresses)) {
+		LI_VALUE_FOREACH(ip, addresses);
 			if (LI_VALUE_STRING != li_value_type(ip)) goto fail;
-			li_angel_listen(srv, ip->data.string, NULL, NULL);
+			li_angel_listen_options(srv, ip->data.string, &opts, NULL, NULL);
 		LI_VALUE_END_FOREACH()
 	} else {
 		goto fail;
 	}
 
+	li_listen_options_clear(&opts);
 	return TRUE;
 
 fail:
-	ERROR(srv, "%s", "listen expects a string or list of strings as parameter");
+	li_listen_options_clear(&opts);
+	ERROR(srv, "%s", "listen expects a string or list of strings as parameter, optionally followed by a key-value list of socket options");
 	return FALSE;
 }
 
@@ -1204,6 +1459,76 @@ static gboolean core_workers(liServer *srv, liPlugin* p, liValue *val, gpointer
 	return TRUE;
 }
 
+#if defined(LIGHTY_OS_LINUX)
+/* parses a sysfs cpulist like "0-3,8-11" */
+static void core_numa_parse_cpulist(GArray *cpu_nodes, const gchar *cpulist, gint node) {
+	gchar **ranges = g_strsplit(cpulist, ",", 0);
+	guint i;
+
+	for (i = 0; NULL != ranges[i]; i++) {
+		gchar *end;
+		guint64 from, to, cpu;
+
+		g_strstrip(ranges[i]);
+		if ('\0' == ranges[i][0]) continue;
+
+		from = to = g_ascii_strtoull(ranges[i], &end, 10);
+		if ('-' == *end) to = g_ascii_strtoull(end + 1, &end, 10);
+		if ('\0' != *end || to < from || to >= CPU_SETSIZE) continue;
+
+		while (cpu_nodes->len <= to) {
+			gint unknown = -1;
+			g_array_append_val(cpu_nodes, unknown);
+		}
+		for (cpu = from; cpu <= to; cpu++) {
+			g_array_index(cpu_nodes, gint, cpu) = node;
+		}
+	}
+
+	g_strfreev(ranges);
+}
+
+/* cpu -> numa node map from sysfs; NULL if there is only one node (nothing to steer) */
+static GArray* core_numa_cpu_nodes(liServer *srv) {
+	GDir *dir;
+	const gchar *name;
+	GArray *cpu_nodes;
+	guint nodes = 0;
+
+	if (NULL == (dir = g_dir_open("/sys/devices/system/node", 0, NULL))) return NULL;
+
+	cpu_nodes = g_array_new(FALSE, FALSE, sizeof(gint));
+
+	while (NULL != (name = g_dir_read_name(dir))) {
+		gchar *path, *cpulist, *end;
+		guint64 node;
+
+		if (!g_str_has_prefix(name, "node")) continue;
+		node = g_ascii_strtoull(name + 4, &end, 10);
+		if (end == name + 4 || '\0' != *end || node > G_MAXINT) continue;
+
+		path = g_strdup_printf("/sys/devices/system/node/%s/cpulist", name);
+		if (g_file_get_contents(path, &cpulist, NULL, NULL)) {
+			core_numa_parse_cpulist(cpu_nodes, cpulist, (gint) node);
+			g_free(cpulist);
+			nodes++;
+		}
+		g_free(path);
+	}
+
+	g_dir_close(dir);
+
+	if (nodes < 2) {
+		g_array_free(cpu_nodes, TRUE);
+		return NULL;
+	}
+
+	DEBUG(srv, "found %u numa nodes", nodes);
+
+	return cpu_nodes;
+}
+#endif
+
 static gboolean core_workers_cpu_affinity(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 #if defined(LIGHTY_OS_LINUX)
 	UNUSED(p); UNUSED(userdata);
@@ -1229,6 +1554,10 @@ static gboolean core_workers_cpu_affinity(liServer *srv, liPlugin* p, liValue *v
 
 	srv->workers_cpu_affinity = li_value_copy(val);
 
+	if (NULL == srv->numa_cpu_nodes) {
+		srv->numa_cpu_nodes = core_numa_cpu_nodes(srv);
+	}
+
 	return TRUE;
 #else
 	UNUSED(p); UNUSED(val); UNUSED(userdata);
@@ -1237,6 +1566,63 @@ static gboolean core_workers_cpu_affinity(liServer *srv, liPlugin* p, liValue *v
 #endif
 }
 
+static const struct {
+	const gchar *name;
+	guint flag;
+} core_event_backends[] = {
+	{ "select", EVBACKEND_SELECT },
+	{ "poll", EVBACKEND_POLL },
+	{ "epoll", EVBACKEND_EPOLL },
+	{ "kqueue", EVBACKEND_KQUEUE },
+	{ "devpoll", EVBACKEND_DEVPOLL },
+	{ "port", EVBACKEND_PORT },
+};
+
+static gboolean core_event_backend(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	guint backends = 0;
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_STRING == li_value_type(val)) {
+		li_value_wrap_in_list(val);
+	}
+
+	if (LI_VALUE_LIST != li_value_type(val)) {
+		ERROR(srv, "%s", "event.backend expects a string or a list of strings as parameter");
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(v, val)
+		guint i;
+
+		if (LI_VALUE_STRING != li_value_type(v)) {
+			ERROR(srv, "%s", "event.backend expects a string or a list of strings as parameter");
+			return FALSE;
+		}
+
+		for (i = 0; i < G_N_ELEMENTS(core_event_backends); i++) {
+			if (g_str_equal(v->data.string->str, core_event_backends[i].name)) break;
+		}
+
+		if (i == G_N_ELEMENTS(core_event_backends)) {
+			ERROR(srv, "event.backend: unknown backend '%s'", v->data.string->str);
+			return FALSE;
+		}
+
+		if (0 == (ev_supported_backends() & core_event_backends[i].flag)) {
+			ERROR(srv, "event.backend: backend '%s' not supported on this system", v->data.string->str);
+			return FALSE;
+		}
+
+		backends |= core_event_backends[i].flag;
+	LI_VALUE_END_FOREACH()
+
+	srv->event_backends = backends;
+
+	return TRUE;
+}
+
 static gboolean core_module_load(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 	UNUSED(p); UNUSED(userdata);
 
@@ -1298,6 +1684,174 @@ static gboolean core_io_timeout(liServer *srv, liPlugin* p, liValue *val, gpoint
 	return TRUE;
 }
 
+static gboolean core_keepalive_trim_idle(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 0) {
+		ERROR(srv, "%s", "keepalive.trim_idle expects a positive number as parameter");
+		return FALSE;
+	}
+
+	srv->keep_alive_trim_idle = val->data.number;
+
+	return TRUE;
+}
+
+static gboolean core_connection_pool(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "connection_pool expects a key-value list as parameter");
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		GString *key;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "connection_pool: options require a name");
+			return FALSE;
+		}
+		key = entryKey->data.string;
+
+		if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0 || entryValue->data.number > G_MAXINT32) {
+			ERROR(srv, "connection_pool: option '%s' expects a positive number", key->str);
+			return FALSE;
+		}
+
+		if (g_str_equal(key->str, "min")) {
+			srv->connection_pool_min = entryValue->data.number;
+		} else if (g_str_equal(key->str, "max")) {
+			srv->connection_pool_max = entryValue->data.number;
+		} else if (g_str_equal(key->str, "max_vrequests")) {
+			srv->vrequest_pool_max = entryValue->data.number;
+		} else if (g_str_equal(key->str, "shrink_interval")) {
+			if (0 == entryValue->data.number) {
+				ERROR(srv, "%s", "connection_pool: shrink_interval must be at least 1 second");
+				return FALSE;
+			}
+			srv->pool_shrink_interval = entryValue->data.number;
+		} else {
+			ERROR(srv, "connection_pool: unknown option '%s'", key->str);
+			return FALSE;
+		}
+	LI_VALUE_END_FOREACH()
+
+	return TRUE;
+}
+
+static gboolean core_overload_priority(liServer *srv, liValue *val) {
+	if (LI_VALUE_STRING == li_value_type(val)) li_value_wrap_in_list(val);
+
+	if (LI_VALUE_LIST != li_value_type(val)) {
+		ERROR(srv, "%s", "overload: priority expects a list of networks");
+		return FALSE;
+	}
+
+	if (NULL == srv->priority_ipv4) {
+		srv->priority_ipv4 = li_radixtree_new();
+		srv->priority_ipv6 = li_radixtree_new();
+	}
+
+	LI_VALUE_FOREACH(ip, val)
+		guint32 ipv4, netmaskv4;
+		guint8 ipv6_addr[16];
+		guint ipv6_network;
+
+		if (LI_VALUE_STRING != li_value_type(ip)) {
+			ERROR(srv, "%s", "overload: priority expects a list of networks");
+			return FALSE;
+		}
+
+		if (li_parse_ipv4(ip->data.string->str, &ipv4, &netmaskv4, NULL)) {
+			gint prefixlen;
+			netmaskv4 = ntohl(netmaskv4);
+			prefixlen = 32 - g_bit_nth_lsf(netmaskv4, -1);
+			if (prefixlen < 0 || prefixlen > 32) prefixlen = 0;
+			li_radixtree_insert(srv->priority_ipv4, &ipv4, prefixlen, GINT_TO_POINTER(1));
+		} else if (li_parse_ipv6(ip->data.string->str, ipv6_addr, &ipv6_network, NULL)) {
+			li_radixtree_insert(srv->priority_ipv6, ipv6_addr, ipv6_network, GINT_TO_POINTER(1));
+		} else {
+			ERROR(srv, "overload: error parsing priority network: %s", ip->data.string->str);
+			return FALSE;
+		}
+	LI_VALUE_END_FOREACH()
+
+	return TRUE;
+}
+
+static gboolean core_overload(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "overload expects a key-value list as parameter");
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		GString *key;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "overload: options require a name");
+			return FALSE;
+		}
+		key = entryKey->data.string;
+
+		if (g_str_equal(key->str, "priority")) {
+			if (!core_overload_priority(srv, entryValue)) return FALSE;
+			continue;
+		}
+
+		if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0) {
+			ERROR(srv, "overload: option '%s' expects a positive number", key->str);
+			return FALSE;
+		}
+
+		if (g_str_equal(key->str, "memory")) {
+			srv->overload_memory = entryValue->data.number;
+			continue;
+		}
+
+		if (entryValue->data.number > G_MAXINT32) {
+			ERROR(srv, "overload: option '%s' is out of range", key->str);
+			return FALSE;
+		}
+
+		if (g_str_equal(key->str, "loop_lag")) {
+			srv->overload_loop_lag = entryValue->data.number / 1000.0;
+		} else if (g_str_equal(key->str, "backend_waiting")) {
+			srv->overload_backend_waiting = entryValue->data.number;
+		} else if (g_str_equal(key->str, "retry_after")) {
+			if (0 == entryValue->data.number) {
+				ERROR(srv, "%s", "overload: retry_after must be at least 1 second");
+				return FALSE;
+			}
+			srv->overload_retry_after = entryValue->data.number;
+		} else if (g_str_equal(key->str, "priority_connections")) {
+			srv->priority_connections = entryValue->data.number;
+		} else if (g_str_equal(key->str, "backend_codel_target")) {
+			srv->backend_codel_target = entryValue->data.number / 1000.0;
+		} else if (g_str_equal(key->str, "backend_codel_interval")) {
+			if (0 == entryValue->data.number) {
+				ERROR(srv, "%s", "overload: backend_codel_interval must be at least 1 millisecond");
+				return FALSE;
+			}
+			srv->backend_codel_interval = entryValue->data.number / 1000.0;
+		} else {
+			ERROR(srv, "overload: unknown option '%s'", key->str);
+			return FALSE;
+		}
+	LI_VALUE_END_FOREACH()
+
+	return TRUE;
+}
+
 static gboolean core_stat_cache_ttl(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 	UNUSED(p); UNUSED(userdata);
 
@@ -1313,6 +1867,21 @@ static gboolean core_stat_cache_ttl(liServer *srv, liPlugin* p, liValue *val, gp
 	return TRUE;
 }
 
+static gboolean core_warm_cache_snapshot(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_STRING != li_value_type(val) || 0 == val->data.string->len) {
+		ERROR(srv, "%s", "warm_cache.snapshot expects a filename as parameter");
+		return FALSE;
+	}
+
+	li_warm_cache_set_snapshot(srv, li_value_extract_string(val));
+
+	return TRUE;
+}
+
 static gboolean core_tasklet_pool_threads(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 	UNUSED(p); UNUSED(userdata);
 
@@ -1494,15 +2063,17 @@ static gboolean core_option_static_exclude_exts_parse(liServer *srv, liWorker *w
 
 
 static gboolean core_option_mime_types_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, gpointer *oval) {
-	liMimetypeNode *node;
+	liMimetypeTable *table;
 
 	UNUSED(srv); UNUSED(wrk); UNUSED(p); UNUSED(ndx);
 
-	*oval = node = li_mimetype_node_new();
-	node->mimetype = g_string_new_len(CONST_STR_LEN("application/octet-stream"));
+	table = li_mimetype_table_new(g_string_new_len(CONST_STR_LEN("application/octet-stream")));
 
 	/* default value */
-	if (NULL == val) return TRUE;
+	if (NULL == val) {
+		*oval = li_mimetype_table_compile(table);
+		return TRUE;
+	}
 
 	/* check if the passed val is of type (("a", "b"), ("x", y")) */
 	LI_VALUE_FOREACH(v, val)
@@ -1510,7 +2081,7 @@ static gboolean core_option_mime_types_parse(liServer *srv, liWorker *wrk, liPlu
 
 		if (!li_value_list_has_len(v, 2)) {
 			ERROR(srv, "mime_types option expects a list of string tuples, entry #%u is not a tuple", _v_i);
-			li_mimetype_node_free(node);
+			li_mimetype_table_release(table);
 			return FALSE;
 		}
 
@@ -1518,13 +2089,16 @@ static gboolean core_option_mime_types_parse(liServer *srv, liWorker *wrk, liPlu
 		v2 = li_value_list_at(v, 1);
 		if (LI_VALUE_STRING != li_value_type(v1) || LI_VALUE_STRING != li_value_type(v2)) {
 			ERROR(srv, "mime_types option expects a list of string tuples, entry #%u is a (%s,%s) tuple", _v_i, li_value_type_string(v1), li_value_type_string(v2));
-			li_mimetype_node_free(node);
+			li_mimetype_table_release(table);
 			return FALSE;
 		}
 
-		li_mimetype_insert(node, v1->data.string, li_value_extract_string(v2));
+		li_mimetype_table_insert(table, v1->data.string, li_value_extract_string(v2));
 	LI_VALUE_END_FOREACH()
 
+	/* identical mime_types values share one table */
+	*oval = li_mimetype_table_compile(table);
+
 	return TRUE;
 }
 
@@ -1533,7 +2107,71 @@ static void core_option_mime_types_free(liServer *srv, liPlugin *p, size_t ndx,
 	UNUSED(p);
 	UNUSED(ndx);
 
-	li_mimetype_node_free(oval);
+	li_mimetype_table_release(oval);
+}
+
+static gboolean core_option_backend_headers_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, gpointer *oval) {
+	liEnvironmentHeaderFilter *filter;
+	UNUSED(wrk); UNUSED(p); UNUSED(ndx);
+
+	/* default value: pass all headers */
+	if (NULL == val) return TRUE;
+
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "backend.headers option expects a key-value list");
+		return FALSE;
+	}
+
+	filter = li_environment_header_filter_new();
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		gboolean allow;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "backend.headers: entries require a name (\"allow\" or \"deny\")");
+			goto error;
+		}
+
+		if (g_str_equal(entryKey->data.string->str, "allow")) {
+			allow = TRUE;
+		} else if (g_str_equal(entryKey->data.string->str, "deny")) {
+			allow = FALSE;
+		} else {
+			ERROR(srv, "backend.headers: unknown entry '%s'", entryKey->data.string->str);
+			goto error;
+		}
+
+		if (LI_VALUE_STRING == li_value_type(entryValue)) li_value_wrap_in_list(entryValue);
+		if (LI_VALUE_LIST != li_value_type(entryValue)) {
+			ERROR(srv, "backend.headers: '%s' expects a list of header names", entryKey->data.string->str);
+			goto error;
+		}
+
+		LI_VALUE_FOREACH(name, entryValue)
+			if (LI_VALUE_STRING != li_value_type(name)) {
+				ERROR(srv, "backend.headers: '%s' expects a list of header names", entryKey->data.string->str);
+				goto error;
+			}
+			li_environment_header_filter_add(filter, allow, GSTR_LEN(name->data.string));
+		LI_VALUE_END_FOREACH()
+	LI_VALUE_END_FOREACH()
+
+	*oval = filter;
+	return TRUE;
+
+error:
+	li_environment_header_filter_free(filter);
+	return FALSE;
+}
+
+static void core_option_backend_headers_free(liServer *srv, liPlugin *p, size_t ndx, gpointer oval) {
+	UNUSED(srv);
+	UNUSED(p);
+	UNUSED(ndx);
+
+	li_environment_header_filter_free(oval);
 }
 
 static gboolean core_option_etag_use_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, liOptionValue *oval) {
@@ -1563,12 +2201,19 @@ static gboolean core_option_etag_use_parse(liServer *srv, liWorker *wrk, liPlugi
 			flags |= LI_ETAG_USE_MTIME;
 		} else if (0 == strcmp(v->data.string->str, "size")) {
 			flags |= LI_ETAG_USE_SIZE;
+		} else if (0 == strcmp(v->data.string->str, "content")) {
+			flags |= LI_ETAG_USE_CONTENT;
 		} else {
 			ERROR(srv, "unknown etag.use flag: %s", v->data.string->str);
 			return FALSE;
 		}
 	LI_VALUE_END_FOREACH()
 
+	if ((flags & LI_ETAG_USE_CONTENT) && flags != LI_ETAG_USE_CONTENT) {
+		ERROR(srv, "%s", "etag.use: \"content\" can't be combined with other flags");
+		return FALSE;
+	}
+
 	oval->number = (guint64) flags;
 	return TRUE;
 }
@@ -2065,10 +2710,32 @@ static void core_suspend(liServer *srv, liPlugin *p, gint32 id, GString *data) {
 	li_server_goto_state(srv, LI_SERVER_SUSPENDED);
 }
 
+/* idle keep-alive connections handed over by the instance we replace */
+static void core_adopt(liServer *srv, liPlugin *p, gint32 id, GString *data) {
+	GArray *fds = srv->acon->parse.fds;
+	guint i, adopted = 0;
+	UNUSED(p);
+	UNUSED(id);
+	UNUSED(data);
+
+	for (i = 0; i < fds->len; i++) {
+		int fd = g_array_index(fds, int, i);
+		if (li_server_adopt_connection(srv, fd)) {
+			adopted++;
+		} else {
+			close(fd);
+		}
+	}
+
+	DEBUG(srv, "adopted %u of %u idle connections from previous instance", adopted, fds->len);
+	g_array_set_size(fds, 0);
+}
+
 static const liPluginOption options[] = {
 	{ "debug.log_request_handling", LI_VALUE_BOOLEAN, FALSE, NULL },
 
 	{ "static.range_requests", LI_VALUE_BOOLEAN, TRUE, NULL },
+	{ "static.max_ranges", LI_VALUE_NUMBER, 32, NULL },
 
 	{ "keepalive.timeout", LI_VALUE_NUMBER, 5, NULL },
 	{ "keepalive.requests", LI_VALUE_NUMBER, 0, NULL },
@@ -2090,6 +2757,8 @@ static const liPluginOptionPtr optionptrs[] = {
 
 	{ "mime_types", LI_VALUE_LIST, NULL, core_option_mime_types_parse, core_option_mime_types_free },
 
+	{ "backend.headers", LI_VALUE_LIST, NULL, core_option_backend_headers_parse, core_option_backend_headers_free },
+
 	{ NULL, 0, NULL, NULL, NULL }
 };
 
@@ -2105,6 +2774,7 @@ static const liPluginAction actions[] = {
 	{ "pathinfo", core_pathinfo, NULL },
 
 	{ "set_status", core_status, NULL },
+	{ "overload.shed", core_overload_shed, NULL },
 
 	{ "log", core_log, NULL },
 	{ "log.write", core_log_write, NULL },
@@ -2138,9 +2808,14 @@ static const liPluginSetup setups[] = {
 	{ "listen", core_listen, NULL },
 	{ "workers", core_workers, NULL },
 	{ "workers.cpu_affinity", core_workers_cpu_affinity, NULL },
+	{ "event.backend", core_event_backend, NULL },
 	{ "module_load", core_module_load, NULL },
 	{ "io.timeout", core_io_timeout, NULL },
+	{ "keepalive.trim_idle", core_keepalive_trim_idle, NULL },
+	{ "connection_pool", core_connection_pool, NULL },
+	{ "overload", core_overload, NULL },
 	{ "stat_cache.ttl", core_stat_cache_ttl, NULL },
+	{ "warm_cache.snapshot", core_warm_cache_snapshot, NULL },
 	{ "tasklet_pool.threads", core_tasklet_pool_threads, NULL },
 	{ "log", core_setup_log, NULL },
 	{ "log.timestamp", core_setup_log_timestamp, NULL },
@@ -2153,6 +2828,7 @@ static const liPluginAngel angelcbs[] = {
 	{ "warmup", core_warmup },
 	{ "run", core_run },
 	{ "suspend", core_suspend },
+	{ "adopt", core_adopt },
 
 	{ NULL, NULL }
 };
@@ -2166,17 +2842,29 @@ static void plugin_core_prepare_worker(liServer *srv, liPlugin *p, liWorker *wrk
 	{
 		cpu_set_t mask;
 		liValue *v = srv->workers_cpu_affinity;
+		guint ndx = wrk->ndx;
 
 		if (NULL == v) return;
 
-		if (wrk->ndx >= li_value_list_len(v)) {
+		/* with multiple processes ("processes" in the angel config) each process uses its own
+		 * slice of the list: process #n starts at entry n * workers */
+		if (srv->process_ndx > 0) {
+			if ((srv->process_ndx + 1) * srv->worker_count <= li_value_list_len(v)) {
+				ndx += srv->process_ndx * srv->worker_count;
+			} else if (0 == wrk->ndx) {
+				WARNING(srv, "workers.cpu_affinity has no entries for process #%u (needs %u entries), binding to the same cpus as process #1",
+					srv->process_ndx + 1, (srv->process_ndx + 1) * srv->worker_count);
+			}
+		}
+
+		if (ndx >= li_value_list_len(v)) {
 			WARNING(srv, "worker #%u has no entry in workers.cpu_affinity", wrk->ndx+1);
 			return;
 		}
 
 		CPU_ZERO(&mask);
 
-		v = li_value_list_at(v, wrk->ndx);
+		v = li_value_list_at(v, ndx);
 		if (LI_VALUE_NUMBER == li_value_type(v)) {
 			CPU_SET(v->data.number, &mask);
 			DEBUG(srv, "binding worker #%u to cpu %u", wrk->ndx+1, (guint)v->data.number);
@@ -2193,6 +2881,54 @@ static void plugin_core_prepare_worker(liServer *srv, liPlugin *p, liWorker *wrk
 
 		if (0 != sched_setaffinity(0, sizeof(mask), &mask)) {
 			ERROR(srv, "couldn't set cpu affinity mask for worker #%u: %s", wrk->ndx, g_strerror(errno));
+			return;
+		}
+
+		if (NULL != srv->numa_cpu_nodes) {
+			guint cpu;
+			gint node = -1;
+
+			for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				gint n;
+				if (!CPU_ISSET(cpu, &mask)) continue;
+				n = (cpu < srv->numa_cpu_nodes->len) ? g_array_index(srv->numa_cpu_nodes, gint, cpu) : -1;
+				if (-1 == n || (-1 != node && n != node)) {
+					/* spans more than one node */
+					node = -1;
+					break;
+				}
+				node = n;
+			}
+
+			wrk->numa_node = node;
+			if (-1 != node) {
+				gint threads = li_tasklet_pool_get_threads(wrk->tasklets);
+
+				DEBUG(srv, "worker #%u is on numa node %i", wrk->ndx+1, node);
+
+				/* exclusive tasklet threads were spawned by the main thread; restart them from here,
+				 * so they inherit the affinity and allocate their memory on the same node.
+				 * they get all cpus of the node (not just the ones of the worker), then pin the worker again */
+				if (threads > 0) {
+					cpu_set_t node_mask;
+
+					CPU_ZERO(&node_mask);
+					for (cpu = 0; cpu < srv->numa_cpu_nodes->len; cpu++) {
+						if (g_array_index(srv->numa_cpu_nodes, gint, cpu) == node) CPU_SET(cpu, &node_mask);
+					}
+
+					if (0 != sched_setaffinity(0, sizeof(node_mask), &node_mask)) {
+						ERROR(srv, "couldn't set numa node cpu mask for tasklets of worker #%u: %s", wrk->ndx, g_strerror(errno));
+					}
+
+					li_tasklet_pool_set_threads(wrk->tasklets, 0);
+					li_tasklet_pool_set_threads(wrk->tasklets, threads);
+
+					if (0 != sched_setaffinity(0, sizeof(mask), &mask)) {
+						ERROR(srv, "couldn't set cpu affinity mask for worker #%u: %s", wrk->ndx, g_strerror(errno));
+					}
+				}
+			}
 		}
 	}
 #else
@@ -24,10 +24,45 @@ void li_response_clear(liResponse *resp) {
 
 static void li_response_send_error_page(liVRequest *vr, liChunkQueue *response_body);
 
+/* copies the response headers to p if p != NULL, returns the length in any case */
+static gsize response_copy_headers(liVRequest *vr, gchar *p, gboolean *have_date, gboolean *have_server) {
+	liHttpHeader *header;
+	GList *iter;
+	gsize len = 0;
+
+	for (iter = g_queue_peek_head_link(&vr->response.headers->entries); iter; iter = g_list_next(iter)) {
+		header = (liHttpHeader*) iter->data;
+		/* ignore connection headers from backends. set con->info.keep_alive = FALSE to disable keep-alive */
+		if (li_http_header_key_is(header, CONST_STR_LEN("connection"))) continue;
+
+		if (NULL != p) {
+			memcpy(p + len, header->data->str, header->data->len);
+		}
+		len += header->data->len;
+
+		if (NULL != p) memcpy(p + len, CONST_STR_LEN("\r\n"));
+		len += 2;
+
+		if (!*have_date && li_http_header_key_is(header, CONST_STR_LEN("date"))) *have_date = TRUE;
+		if (!*have_server && li_http_header_key_is(header, CONST_STR_LEN("server"))) *have_server = TRUE;
+	}
+
+	return len;
+}
+
 void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueue *response_body, gboolean upgraded) {
-	GString *head;
 	gboolean have_real_body, response_complete;
+	gboolean have_date = FALSE, have_server = FALSE;
 	liChunkQueue *tmp_cq = NULL;
+	const gchar *status_line, *connection = NULL;
+	guint status_line_len, connection_len = 0;
+	gchar status_buf[4];
+	guint status_desc_len = 0;
+	gchar *status_desc = NULL;
+	GString *date = NULL, *tag = NULL;
+	liBuffer *buf;
+	gsize len;
+	gchar *p;
 
 	if (vr->response.http_status < 100 || vr->response.http_status > 999) {
 		VR_ERROR(vr, "wrong status: %i, internal error", vr->response.http_status);
@@ -39,8 +74,6 @@ void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueu
 	have_real_body = (NULL != response_body) && ((response_body->length > 0) || !response_body->is_closed);
 	response_complete = (NULL != response_body) && response_body->is_closed;
 
-	head = g_string_sized_new(8*1024-1);
-
 	if (!have_real_body && vr->response.http_status >= 400 && vr->response.http_status < 600) {
 		tmp_cq = li_chunkqueue_new(); /* create a temporary cq for the response body */
 		response_body = tmp_cq;
@@ -58,8 +91,13 @@ void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueu
 	} else if (response_complete) {
 		if (vr->request.http_method != LI_HTTP_METHOD_HEAD || response_body->length > 0) {
 			/* do not send content-length: 0 if backend already skipped content generation for HEAD */
-			g_string_printf(vr->wrk->tmp_str, "%"LI_GOFFSET_FORMAT, response_body->length);
-			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Length"), GSTR_LEN(vr->wrk->tmp_str));
+			gchar content_length[24], *cl_end = content_length + sizeof(content_length), *cl_start = cl_end;
+			goffset l = response_body->length;
+			do {
+				*--cl_start = '0' + (l % 10);
+				l /= 10;
+			} while (l > 0);
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Length"), cl_start, cl_end - cl_start);
 		}
 	} else if (vr->coninfo->keep_alive && vr->request.http_version == LI_HTTP_VERSION_1_1) {
 		/* TODO: maybe someone set a content length header? */
@@ -79,71 +117,85 @@ void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueu
 	}
 
 	/* Status line */
-	if (vr->request.http_version == LI_HTTP_VERSION_1_1) {
-		g_string_append_len(head, CONST_STR_LEN("HTTP/1.1 "));
+	if (NULL == (status_line = li_http_status_line(vr->response.http_status, &status_line_len))) {
+		li_http_status_to_str(vr->response.http_status, status_buf);
+		status_buf[3] = ' ';
+		status_desc = li_http_status_string(vr->response.http_status, &status_desc_len);
+		status_line = status_buf;
+		status_line_len = 4;
+	}
+
+	/* connection header, if needed. connection entries in the list are ignored, send them directly */
+	if (upgraded) {
+		connection = "Connection: Upgrade\r\n";
+	} else if (vr->request.http_version == LI_HTTP_VERSION_1_1) {
+		if (!vr->coninfo->keep_alive) connection = "Connection: close\r\n";
 	} else {
-		g_string_append_len(head, CONST_STR_LEN("HTTP/1.0 "));
+		if (vr->coninfo->keep_alive) connection = "Connection: keep-alive\r\n";
 	}
+	if (NULL != connection) connection_len = strlen(connection);
+
+	/* calculate the size of the head */
+	len = sizeof("HTTP/1.1 ") - 1 + status_line_len + connection_len;
+	if (NULL != status_desc) len += status_desc_len + 2;
+	len += response_copy_headers(vr, NULL, &have_date, &have_server);
 
-	{
-		guint len;
-		gchar status_str[4];
-		gchar *str = li_http_status_string(vr->response.http_status, &len);
-		li_http_status_to_str(vr->response.http_status, status_str);
-		status_str[3] = ' ';
-		g_string_append_len(head, status_str, 4);
-		g_string_append_len(head, str, len);
-		g_string_append_len(head, CONST_STR_LEN("\r\n"));
+	if (!have_date) {
+		/* HTTP/1.1 requires a Date: header */
+		date = li_worker_current_timestamp(vr->wrk, LI_GMTIME, LI_TS_FORMAT_HEADER);
+		if (NULL != date) len += sizeof("Date: \r\n") - 1 + date->len;
 	}
 
-	/* connection header, if needed. connection entries in the list are ignored below, send them directly */
-	if (upgraded) {
-		g_string_append_len(head, CONST_STR_LEN("Connection: Upgrade\r\n"));
-	} else if (vr->request.http_version == LI_HTTP_VERSION_1_1) {
-		if (!vr->coninfo->keep_alive)
-			g_string_append_len(head, CONST_STR_LEN("Connection: close\r\n"));
+	if (!have_server) {
+		tag = CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string;
+		if (0 == tag->len) tag = NULL;
+		else len += sizeof("Server: \r\n") - 1 + tag->len;
+	}
+
+	len += 2;
+
+	/* and write it */
+	buf = li_worker_scratch_buffer(vr->wrk, len);
+	p = buf->addr + buf->used;
+
+#define HEAD_APPEND(s, l) do { memcpy(p, (s), (l)); p += (l); } while (0)
+#define HEAD_APPEND_CONST(s) HEAD_APPEND(s, sizeof(s) - 1)
+
+	if (vr->request.http_version == LI_HTTP_VERSION_1_1) {
+		HEAD_APPEND_CONST("HTTP/1.1 ");
 	} else {
-		if (vr->coninfo->keep_alive)
-			g_string_append_len(head, CONST_STR_LEN("Connection: keep-alive\r\n"));
+		HEAD_APPEND_CONST("HTTP/1.0 ");
+	}
+	HEAD_APPEND(status_line, status_line_len);
+	if (NULL != status_desc) {
+		HEAD_APPEND(status_desc, status_desc_len);
+		HEAD_APPEND_CONST("\r\n");
 	}
 
-	/* Append headers */
-	{
-		liHttpHeader *header;
-		GList *iter;
-		gboolean have_date = FALSE, have_server = FALSE;
-
-		for (iter = g_queue_peek_head_link(&vr->response.headers->entries); iter; iter = g_list_next(iter)) {
-			header = (liHttpHeader*) iter->data;
-			/* ignore connection headers from backends. set con->info.keep_alive = FALSE to disable keep-alive */
-			if (li_http_header_key_is(header, CONST_STR_LEN("connection"))) continue;
-			g_string_append_len(head, GSTR_LEN(header->data));
-			g_string_append_len(head, CONST_STR_LEN("\r\n"));
-			if (!have_date && li_http_header_key_is(header, CONST_STR_LEN("date"))) have_date = TRUE;
-			if (!have_server && li_http_header_key_is(header, CONST_STR_LEN("server"))) have_server = TRUE;
-		}
+	if (NULL != connection) HEAD_APPEND(connection, connection_len);
 
-		if (!have_date) {
-			GString *d = li_worker_current_timestamp(vr->wrk, LI_GMTIME, LI_TS_FORMAT_HEADER);
-			/* HTTP/1.1 requires a Date: header */
-			g_string_append_len(head, CONST_STR_LEN("Date: "));
-			g_string_append_len(head, GSTR_LEN(d));
-			g_string_append_len(head, CONST_STR_LEN("\r\n"));
-		}
+	p += response_copy_headers(vr, p, &have_date, &have_server);
 
-		if (!have_server) {
-			GString *tag = CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string;
+	if (NULL != date) {
+		HEAD_APPEND_CONST("Date: ");
+		HEAD_APPEND(date->str, date->len);
+		HEAD_APPEND_CONST("\r\n");
+	}
 
-			if (tag->len) {
-				g_string_append_len(head, CONST_STR_LEN("Server: "));
-				g_string_append_len(head, GSTR_LEN(tag));
-				g_string_append_len(head, CONST_STR_LEN("\r\n"));
-			}
-		}
+	if (NULL != tag) {
+		HEAD_APPEND_CONST("Server: ");
+		HEAD_APPEND(tag->str, tag->len);
+		HEAD_APPEND_CONST("\r\n");
 	}
 
-	g_string_append_len(head, CONST_STR_LEN("\r\n"));
-	li_chunkqueue_append_string(raw_out, head);
+	HEAD_APPEND_CONST("\r\n");
+
+#undef HEAD_APPEND_CONST
+#undef HEAD_APPEND
+
+	LI_FORCE_ASSERT((gsize) (p - (buf->addr + buf->used)) == len);
+	buf->used += len;
+	li_chunkqueue_append_buffer2(raw_out, buf, buf->used - len, len);
 
 	if (NULL != tmp_cq) {
 		li_chunkqueue_steal_all(raw_out, tmp_cq);
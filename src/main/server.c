@@ -34,6 +34,7 @@ void li_server_socket_release(liServerSocket* sock) {
 
 		/* loop is already destroyed */
 		li_sockaddr_clear(&sock->local_addr);
+		if (NULL != sock->listen_options) g_string_free(sock->listen_options, TRUE);
 
 		g_slice_free(liServerSocket, sock);
 	}
@@ -143,9 +144,19 @@ liServer* li_server_new(const gchar *module_dir, gboolean module_resident) {
 
 	srv->io_timeout = 300; /* default I/O timeout */
 	srv->keep_alive_queue_timeout = 5;
+	srv->keep_alive_trim_idle = 0;
+	srv->connection_pool_min = 0;
+	srv->connection_pool_max = 0;
+	srv->vrequest_pool_max = 0;
+	srv->pool_shrink_interval = 300;
+	srv->overload_retry_after = 5;
+	srv->backend_codel_interval = 0.1;
 	srv->stat_cache_ttl = 10.0; /* default stat cache ttl */
 	srv->tasklet_pool_threads = 4; /* default per-worker tasklet_pool threads */
 
+	li_warm_cache_init(srv);
+	srv->content_hashes = li_content_hash_cache_new();
+
 	return srv;
 }
 
@@ -166,6 +177,9 @@ void li_server_free(liServer* srv) {
 		}
 	}
 
+	li_warm_cache_save(srv);
+	li_warm_cache_free(srv);
+
 	li_action_release(srv, srv->mainaction);
 	srv->mainaction = NULL;
 	g_hash_table_destroy(srv->config_global_vars);
@@ -181,6 +195,14 @@ void li_server_free(liServer* srv) {
 		srv->acon = NULL;
 	}
 
+	li_shm_counters_free(srv->shm_counters);
+
+	if (NULL != srv->priority_ipv4) {
+		li_radixtree_free(srv->priority_ipv4, NULL, NULL);
+		li_radixtree_free(srv->priority_ipv6, NULL, NULL);
+	}
+	srv->shm_counters = NULL;
+
 	li_event_clear(&srv->srv_1sec_timer);
 
 	li_event_clear(&srv->sig_w_INT);
@@ -204,6 +226,10 @@ void li_server_free(liServer* srv) {
 		g_array_free(srv->workers, TRUE);
 	}
 
+	/* after the workers: their tasklet pools deliver pending hashes on shutdown */
+	li_content_hash_cache_free(srv->content_hashes);
+	srv->content_hashes = NULL;
+
 	{
 		guint i; for (i = 0; i < srv->sockets->len; i++) {
 			liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
@@ -249,6 +275,7 @@ void li_server_free(liServer* srv) {
 
 #ifdef LIGHTY_OS_LINUX
 	li_value_free(srv->workers_cpu_affinity);
+	if (NULL != srv->numa_cpu_nodes) g_array_free(srv->numa_cpu_nodes, TRUE);
 #endif
 
 	if (srv->started_str)
@@ -304,6 +331,11 @@ static void li_server_1sec_timer(liEventBase *watcher, int events) {
 	liServer *srv = LI_CONTAINER_OF(li_event_timer_from(watcher), liServer, srv_1sec_timer);
 	UNUSED(events);
 
+	if (srv->overload_memory > 0) {
+		guint64 mem = li_memory_usage();
+		g_atomic_int_set(&srv->memory_overloaded, mem >= srv->overload_memory);
+	}
+
 	if (srv->connection_limit_hit) {
 		guint srv_cur_load = g_atomic_int_get(&srv->connection_load);
 		guint srv_max_load = g_atomic_int_get(&srv->max_connections);
@@ -329,11 +361,17 @@ static gboolean li_server_worker_init(liServer *srv) {
 	g_array_set_size(srv->workers, srv->worker_count);
 	g_array_index(srv->workers, liWorker*, 0) = srv->main_worker;
 
+	if (0 != srv->event_backends && 0 == (ev_backend(srv->main_worker->loop.loop) & srv->event_backends)) {
+		/* the main loop is created before the config is loaded */
+		WARNING(srv, "event.backend: main worker uses '%s' (select the backend for it with $LIBEV_FLAGS)",
+			li_event_loop_backend_string(&srv->main_worker->loop));
+	}
+
 	for (i = 1; i < srv->worker_count; i++) {
 		liWorker *wrk;
 		struct ev_loop *loop;
 
-		if (NULL == (loop = ev_loop_new(srv->loop_flags))) {
+		if (NULL == (loop = ev_loop_new(srv->loop_flags | srv->event_backends))) {
 			LI_FATAL("could not create extra libev loops");
 			return FALSE;
 		}
@@ -377,6 +415,69 @@ static void server_connection_limit_hit(liServer *srv) {
 	srv->connection_limit_hit = TRUE;
 }
 
+/* whether the client belongs to the networks configured with "overload" => [ "priority" => ... ] */
+static gboolean server_priority_client(liServer *srv, liSockAddr *sa, socklen_t len) {
+	if (len >= sizeof(struct sockaddr_in) && AF_INET == sa->plain.sa_family) {
+		return NULL != li_radixtree_lookup(srv->priority_ipv4, &sa->ipv4.sin_addr.s_addr, 32);
+#ifdef HAVE_IPV6
+	} else if (len >= sizeof(struct sockaddr_in6) && AF_INET6 == sa->plain.sa_family) {
+		if (IN6_IS_ADDR_V4MAPPED(&sa->ipv6.sin6_addr)) {
+			/* IPv4 client on a dual-stack socket (::ffff:a.b.c.d): match the IPv4 networks */
+			return NULL != li_radixtree_lookup(srv->priority_ipv4, &sa->ipv6.sin6_addr.s6_addr[12], 32);
+		}
+		return NULL != li_radixtree_lookup(srv->priority_ipv6, &sa->ipv6.sin6_addr.s6_addr, 128);
+#endif
+	}
+
+	return FALSE;
+}
+
+/* picks the worker for a new connection and passes the connection to it */
+static void server_dispatch_connection(liServer *srv, liServerSocket *sock, int s, liSocketAddress remote_addr) {
+	liWorker *wrk, *node_wrk;
+	guint i, min_load, node_min_load;
+	gint node = -1;
+
+#if defined(LIGHTY_OS_LINUX) && defined(SO_INCOMING_CPU)
+	if (NULL != srv->numa_cpu_nodes) {
+		/* cpu which handled the packets of the connection (rx queue of the nic) */
+		int cpu;
+		socklen_t cpu_len = sizeof(cpu);
+		if (0 == getsockopt(s, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpu_len) && cpu >= 0 && (guint) cpu < srv->numa_cpu_nodes->len) {
+			node = g_array_index(srv->numa_cpu_nodes, gint, cpu);
+		}
+	}
+#endif
+
+	wrk = srv->main_worker;
+	min_load = g_atomic_int_get(&wrk->connection_load);
+	node_wrk = (-1 != node && wrk->numa_node == node) ? wrk : NULL;
+	node_min_load = min_load;
+
+	for (i = 1; i < srv->worker_count; i++) {
+		liWorker *wt = g_array_index(srv->workers, liWorker*, i);
+		guint load = g_atomic_int_get(&wt->connection_load);
+		if (load < min_load) {
+			wrk = wt;
+			min_load = load;
+		}
+		if (-1 != node && wt->numa_node == node && (NULL == node_wrk || load < node_min_load)) {
+			node_wrk = wt;
+			node_min_load = load;
+		}
+	}
+
+	/* keep the connection on the numa node that received it, unless the workers there are clearly busier */
+	if (NULL != node_wrk && node_min_load <= min_load + min_load / 4 + 8) {
+		wrk = node_wrk;
+	}
+
+	g_atomic_int_inc((gint*) &wrk->connection_load);
+	g_atomic_int_inc((gint*) &srv->connection_load);
+	li_server_socket_acquire(sock);
+	li_worker_new_con(srv->main_worker, wrk, remote_addr, s, sock);
+}
+
 static void li_server_listen_cb(liEventBase *watcher, int events) {
 	liServerSocket *sock = LI_CONTAINER_OF(li_event_io_from(watcher), liServerSocket, watcher);
 	liServer *srv = sock->srv;
@@ -388,14 +489,20 @@ static void li_server_listen_cb(liEventBase *watcher, int events) {
 	UNUSED(events);
 
 	for ( ;; ) {
-		liWorker *wrk;
-		guint i, min_load, srv_cur_load, srv_max_load;
+		guint srv_cur_load, srv_max_load;
+		gboolean priority_only = FALSE;
 
 		srv_cur_load = g_atomic_int_get(&srv->connection_load);
 		srv_max_load = g_atomic_int_get(&srv->max_connections);
 		if (srv_cur_load >= srv_max_load) {
-			server_connection_limit_hit(srv);
-			return;
+			/* with priority clients keep accepting: reject the others right away instead of leaving
+			 * everyone in the backlog, until the reserved connections are used too */
+			guint reserved = (0 != srv->priority_connections) ? srv->priority_connections : MAX(srv_max_load / 16, 16u);
+			if (NULL == srv->priority_ipv4 || srv_cur_load - srv_max_load >= reserved) {
+				server_connection_limit_hit(srv);
+				return;
+			}
+			priority_only = TRUE;
 		}
 
 		l = sizeof(sa);
@@ -413,8 +520,10 @@ static void li_server_listen_cb(liEventBase *watcher, int events) {
 		li_fd_no_block(s); /* we don't fork, don't care about FD_CLOEXEC */
 #endif
 
-		wrk = srv->main_worker;
-		min_load = g_atomic_int_get(&wrk->connection_load);
+		if (priority_only && !server_priority_client(srv, &sa, l)) {
+			close(s);
+			continue;
+		}
 
 		if (l <= sizeof(sa)) {
 			remote_addr.addr = g_slice_alloc(l);
@@ -424,19 +533,7 @@ static void li_server_listen_cb(liEventBase *watcher, int events) {
 			remote_addr = li_sockaddr_remote_from_socket(s);
 		}
 
-		for (i = 1; i < srv->worker_count; i++) {
-			liWorker *wt = g_array_index(srv->workers, liWorker*, i);
-			guint load = g_atomic_int_get(&wt->connection_load);
-			if (load < min_load) {
-				wrk = wt;
-				min_load = load;
-			}
-		}
-
-		g_atomic_int_inc((gint*) &wrk->connection_load);
-		g_atomic_int_inc((gint*) &srv->connection_load);
-		li_server_socket_acquire(sock);
-		li_worker_new_con(srv->main_worker, wrk, remote_addr, s, sock);
+		server_dispatch_connection(srv, sock, s, remote_addr);
 	}
 
 #ifdef _WIN32
@@ -464,6 +561,56 @@ static void li_server_listen_cb(liEventBase *watcher, int events) {
 	}
 }
 
+/* whether a connection with the local address local was accepted on the listening socket sock */
+static gboolean server_socket_matches(liServerSocket *sock, liSocketAddress *local) {
+	liSockAddr *la = sock->local_addr.addr, *ca = local->addr;
+
+	if (NULL == la || NULL == ca || la->plain.sa_family != ca->plain.sa_family) return FALSE;
+
+	switch (la->plain.sa_family) {
+	case AF_INET:
+		return la->ipv4.sin_port == ca->ipv4.sin_port
+			&& (INADDR_ANY == la->ipv4.sin_addr.s_addr || la->ipv4.sin_addr.s_addr == ca->ipv4.sin_addr.s_addr);
+#ifdef HAVE_IPV6
+	case AF_INET6:
+		return la->ipv6.sin6_port == ca->ipv6.sin6_port
+			&& (IN6_IS_ADDR_UNSPECIFIED(&la->ipv6.sin6_addr) || IN6_ARE_ADDR_EQUAL(&la->ipv6.sin6_addr, &ca->ipv6.sin6_addr));
+#endif
+	default:
+		return li_equal_sockaddr(&sock->local_addr, local);
+	}
+}
+
+/* main worker only */
+gboolean li_server_adopt_connection(liServer *srv, int s) {
+	liSocketAddress local_addr, remote_addr;
+	liServerSocket *sock = NULL;
+	guint i;
+
+	if (g_atomic_int_get(&srv->connection_load) >= g_atomic_int_get(&srv->max_connections)) return FALSE;
+
+	local_addr = li_sockaddr_local_from_socket(s);
+	for (i = 0; i < srv->sockets->len; i++) {
+		liServerSocket *cur = g_ptr_array_index(srv->sockets, i);
+		/* only plain sockets: there is no way to take over ssl state */
+		if (NULL == cur->new_cb && server_socket_matches(cur, &local_addr)) {
+			sock = cur;
+			break;
+		}
+	}
+	li_sockaddr_clear(&local_addr);
+
+	if (NULL == sock) return FALSE;
+
+	remote_addr = li_sockaddr_remote_from_socket(s);
+	if (NULL == remote_addr.addr) return FALSE;
+
+	li_fd_no_block(s);
+	server_dispatch_connection(srv, sock, s, remote_addr);
+
+	return TRUE;
+}
+
 /* main worker only */
 liServerSocket* li_server_listen(liServer *srv, int fd) {
 	liServerSocket *sock = server_socket_new(srv, fd);
@@ -691,6 +838,7 @@ static void li_server_start_transition(liServer *srv, liServerState state) {
 		}
 		break;
 	case LI_SERVER_WARMUP:
+		li_warm_cache_prefetch(srv);
 		li_server_start_listen(srv);
 		li_plugins_start_listen(srv);
 		break;
@@ -705,6 +853,7 @@ static void li_server_start_transition(liServer *srv, liServerState state) {
 	case LI_SERVER_SUSPENDING:
 		li_server_stop_listen(srv);
 		li_plugins_stop_listen(srv);
+		li_warm_cache_snapshot(srv);
 		/* wait for closed connections and plugins */
 		break;
 	case LI_SERVER_STOPPING:
@@ -189,6 +189,8 @@ static void stat_cache_entry_free(liStatCacheEntry *sce) {
 	LI_FORCE_ASSERT(sce->vrequests->len == 0);
 
 	g_string_free(sce->data.path, TRUE);
+	if (NULL != sce->data.etag) g_string_free(sce->data.etag, TRUE);
+	if (NULL != sce->data.last_modified) g_string_free(sce->data.last_modified, TRUE);
 	g_ptr_array_free(sce->vrequests, TRUE);
 
 	if (NULL != sce->dirlist) {
@@ -222,6 +224,46 @@ void li_stat_cache_entry_release(liVRequest *vr, liStatCacheEntry *sce) {
 	stat_cache_entry_release(sce);
 }
 
+gboolean li_stat_cache_get_cached(liVRequest *vr, GString *path, struct stat *st) {
+	liStatCache *sc;
+	liStatCacheEntry *sce;
+
+	if (!vr || !(sc = vr->wrk->stat_cache)) return FALSE;
+
+	sce = g_hash_table_lookup(sc->entries, path);
+	if (NULL == sce || g_atomic_int_get(&sce->state) != STAT_CACHE_ENTRY_FINISHED || sce->data.failed) return FALSE;
+
+	sc->hits++;
+	*st = sce->data.st;
+	return TRUE;
+}
+
+liStatCacheEntry* li_stat_cache_lookup(liVRequest *vr, GString *path, struct stat *st) {
+	liStatCache *sc;
+	liStatCacheEntry *sce;
+
+	if (!vr || !(sc = vr->wrk->stat_cache)) return NULL;
+
+	sce = g_hash_table_lookup(sc->entries, path);
+	if (NULL == sce || g_atomic_int_get(&sce->state) != STAT_CACHE_ENTRY_FINISHED || sce->data.failed) return NULL;
+
+	if (sce->data.st.st_ino != st->st_ino || sce->data.st.st_dev != st->st_dev
+		|| sce->data.st.st_size != st->st_size || sce->data.st.st_mtime != st->st_mtime) {
+		/* file changed since the entry was created */
+		sce->data.st = *st;
+		if (NULL != sce->data.etag) {
+			g_string_free(sce->data.etag, TRUE);
+			sce->data.etag = NULL;
+		}
+		if (NULL != sce->data.last_modified) {
+			g_string_free(sce->data.last_modified, TRUE);
+			sce->data.last_modified = NULL;
+		}
+	}
+
+	return sce;
+}
+
 liHandlerResult li_stat_cache_get_dirlist(liVRequest *vr, GString *path, liStatCacheEntry **result) {
 	liStatCache *sc;
 	liStatCacheEntry *sce;
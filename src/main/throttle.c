@@ -61,6 +61,7 @@ struct liThrottlePool {
 	GMutex *rearm_mutex;
 	guint rate, burst;
 	guint last_rearm;
+	gsize shared_key; /* 0: not shared; key in srv->shm_counters otherwise */
 
 	liThrottlePoolWorkerState *workers;
 };
@@ -69,7 +70,9 @@ static guint msec_timestamp(li_tstamp now) {
 	return (1000u * (guint64) floor(now)) + (guint64)(1000.0 * fmod(now, 1.0));
 }
 
-static void S_throttle_pool_rearm_workers(liThrottlePool *pool, guint worker_count, guint time_diff) {
+static void S_throttle_pool_rearm_workers(liWorker *wrk, liThrottlePool *pool, guint time_diff) {
+	liServer *srv = wrk->srv;
+	guint worker_count = srv->worker_count;
 	guint i;
 	gint64 connections = 0;
 	gint64 wrk_connections[worker_count];
@@ -86,6 +89,12 @@ static void S_throttle_pool_rearm_workers(liThrottlePool *pool, guint worker_cou
 
 	fill = MIN((guint64) pool->burst, ((guint64) pool->rate * time_diff) / 1000u);
 
+	if (0 != pool->shared_key && NULL != srv->shm_counters) {
+		/* other processes use the same pool: only take what is left in the shared bucket */
+		fill = li_shm_counters_take(srv->shm_counters, pool->shared_key, pool->rate, pool->burst,
+			LI_THROTTLE_GRANULARITY, li_cur_ts(wrk), fill);
+	}
+
 	throttle_debug("rearm workers: refill %i after %u (or more) msecs (rate %u, burst %u)\n",
 		(guint) fill, (guint) time_diff, pool->rate, pool->burst);
 
@@ -109,7 +118,7 @@ static void throttle_pool_rearm(liWorker *wrk, liThrottlePool *pool, guint now)
 			last = g_atomic_int_get((gint*) &pool->last_rearm);
 			time_diff = now - last;
 			if (G_LIKELY(time_diff >= LI_THROTTLE_GRANULARITY)) {
-				S_throttle_pool_rearm_workers(pool, wrk->srv->worker_count, time_diff);
+				S_throttle_pool_rearm_workers(wrk, pool, time_diff);
 				g_atomic_int_set((gint*) &pool->last_rearm, now);
 			}
 		g_mutex_unlock(pool->rearm_mutex);
@@ -352,6 +361,10 @@ liThrottlePool* li_throttle_pool_new(liServer *srv, guint rate, guint burst) {
 	return pool;
 }
 
+void li_throttle_pool_share(liThrottlePool *pool, gsize key) {
+	pool->shared_key = key;
+}
+
 void li_throttle_waitqueue_cb(liWaitQueue *wq, gpointer data) {
 	liWaitQueueElem *wqe;
 	UNUSED(data); /* should contain worker */
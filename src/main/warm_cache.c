@@ -0,0 +1,451 @@
+
+#include <lighttpd/base.h>
+
+#include <sys/stat.h>
+
+/* prefetching doesn't delay reaching WARMUP longer than this (seconds) */
+#define WARM_CACHE_MAX_WAIT 30.0
+/* max number of keys stored for each cache */
+#define WARM_CACHE_MAX_KEYS 16384
+/* the running server writes the snapshot that often (seconds): on a graceful restart the new
+ * instance reads it while warming up, before the old instance is stopped */
+#define WARM_CACHE_SAVE_INTERVAL 60.0
+
+typedef struct warm_cache_provider warm_cache_provider;
+struct warm_cache_provider {
+	GString *name;
+	liWarmCacheDumpCB dump_cb;
+	liWarmCachePrefetchCB prefetch_cb;
+	liWarmCacheFreeCB free_cb;
+	gpointer data;
+
+	GHashTable *keys; /* GString -> NULL, collected from the workers; protected by liWarmCache.lock */
+};
+
+struct liWarmCache {
+	liServer *srv;
+	GString *snapshot; /* filename, NULL: disabled */
+	GPtrArray *providers; /* <warm_cache_provider> */
+	GMutex *lock;
+	gboolean dumped; /* keys were collected (graceful stop); protected by lock */
+
+	gboolean prefetched;
+	gint pending; /* atomic; running prefetches (+1 while starting them) */
+	liServerStateWait wait;
+	liEventTimer timeout;
+
+	gboolean collecting; /* li_warm_cache_snapshot is collecting keys from the workers */
+	liEventTimer save_timer;
+};
+
+/* stat cache */
+
+typedef struct {
+	liServer *srv;
+	GPtrArray *paths;
+} warm_cache_stat_job;
+
+static void warm_cache_stat_dump(liWorker *wrk, gpointer data, GPtrArray *keys) {
+	GHashTableIter iter;
+	gpointer v;
+	UNUSED(data);
+
+	if (NULL == wrk->stat_cache) return;
+
+	g_hash_table_iter_init(&iter, wrk->stat_cache->entries);
+	while (g_hash_table_iter_next(&iter, NULL, &v)) {
+		liStatCacheEntry *sce = v;
+
+		if (STAT_CACHE_ENTRY_FINISHED != g_atomic_int_get(&sce->state) || sce->data.failed) continue;
+		g_ptr_array_add(keys, g_string_new_len(GSTR_LEN(sce->data.path)));
+	}
+}
+
+static void warm_cache_stat_run(gpointer data) {
+	warm_cache_stat_job *job = data;
+	struct stat st;
+	guint i;
+
+	/* fills the kernel inode/dentry caches, the stat caches of the workers profit from that */
+	for (i = 0; i < job->paths->len; i++) {
+		GString *path = g_ptr_array_index(job->paths, i);
+		(void) stat(path->str, &st);
+	}
+}
+
+static void warm_cache_stat_finished(gpointer data) {
+	warm_cache_stat_job *job = data;
+	guint i;
+
+	for (i = 0; i < job->paths->len; i++) {
+		g_string_free(g_ptr_array_index(job->paths, i), TRUE);
+	}
+	g_ptr_array_free(job->paths, TRUE);
+
+	li_warm_cache_done(job->srv);
+	g_slice_free(warm_cache_stat_job, job);
+}
+
+static void warm_cache_stat_prefetch(liServer *srv, gpointer data, GPtrArray *keys) {
+	warm_cache_stat_job *job;
+	guint i;
+	UNUSED(data);
+
+	job = g_slice_new0(warm_cache_stat_job);
+	job->srv = srv;
+	job->paths = g_ptr_array_sized_new(keys->len);
+	for (i = 0; i < keys->len; i++) {
+		GString *key = g_ptr_array_index(keys, i);
+		g_ptr_array_add(job->paths, g_string_new_len(GSTR_LEN(key)));
+	}
+
+	li_warm_cache_wait(srv);
+	li_tasklet_push(srv->main_worker->tasklets, warm_cache_stat_run, warm_cache_stat_finished, job);
+}
+
+/* fetch databases */
+
+typedef struct {
+	liServer *srv;
+	liFetchDatabase *db;
+	GString *key;
+	liFetchWait *wait;
+} warm_cache_fetch_lookup;
+
+static void warm_cache_fetch_dump(liWorker *wrk, gpointer data, GPtrArray *keys) {
+	/* the database is shared between the workers */
+	if (wrk != wrk->srv->main_worker) return;
+
+	li_fetch_database_keys(data, keys);
+}
+
+static void warm_cache_fetch_ready(gpointer data) {
+	warm_cache_fetch_lookup *lookup = data;
+	liFetchEntry *entry;
+
+	entry = li_fetch_get2(lookup->db, lookup->key, warm_cache_fetch_ready, lookup, &lookup->wait);
+	if (NULL != entry) {
+		liServer *srv = lookup->srv;
+
+		li_fetch_entry_release(entry);
+		g_string_free(lookup->key, TRUE);
+		g_slice_free(warm_cache_fetch_lookup, lookup);
+
+		li_warm_cache_done(srv);
+	}
+}
+
+static void warm_cache_fetch_prefetch(liServer *srv, gpointer data, GPtrArray *keys) {
+	guint i;
+
+	for (i = 0; i < keys->len; i++) {
+		GString *key = g_ptr_array_index(keys, i);
+		warm_cache_fetch_lookup *lookup = g_slice_new0(warm_cache_fetch_lookup);
+
+		lookup->srv = srv;
+		lookup->db = data;
+		lookup->key = g_string_new_len(GSTR_LEN(key));
+
+		li_warm_cache_wait(srv);
+		warm_cache_fetch_ready(lookup);
+	}
+}
+
+static void warm_cache_fetch_free(liServer *srv, gpointer data) {
+	UNUSED(srv);
+
+	li_fetch_database_release(data);
+}
+
+/* registry */
+
+void li_warm_cache_register(liServer *srv, const gchar *name, liWarmCacheDumpCB dump_cb, liWarmCachePrefetchCB prefetch_cb, liWarmCacheFreeCB free_cb, gpointer data) {
+	liWarmCache *wc = srv->warm_cache;
+	warm_cache_provider *provider = g_slice_new0(warm_cache_provider);
+
+	provider->name = g_string_new(name);
+	provider->dump_cb = dump_cb;
+	provider->prefetch_cb = prefetch_cb;
+	provider->free_cb = free_cb;
+	provider->data = data;
+	provider->keys = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, li_g_string_free, NULL);
+
+	g_ptr_array_add(wc->providers, provider);
+}
+
+void li_warm_cache_register_fetch_database(liServer *srv, const gchar *name, liFetchDatabase *db) {
+	li_fetch_database_acquire(db);
+	li_warm_cache_register(srv, name, warm_cache_fetch_dump, warm_cache_fetch_prefetch, warm_cache_fetch_free, db);
+}
+
+void li_warm_cache_init(liServer *srv) {
+	liWarmCache *wc = g_slice_new0(liWarmCache);
+
+	wc->srv = srv;
+	wc->providers = g_ptr_array_new();
+	wc->lock = g_mutex_new();
+	srv->warm_cache = wc;
+
+	li_warm_cache_register(srv, "stat", warm_cache_stat_dump, warm_cache_stat_prefetch, NULL, NULL);
+}
+
+void li_warm_cache_free(liServer *srv) {
+	liWarmCache *wc = srv->warm_cache;
+	guint i;
+
+	if (NULL == wc) return;
+	srv->warm_cache = NULL;
+
+	for (i = 0; i < wc->providers->len; i++) {
+		warm_cache_provider *provider = g_ptr_array_index(wc->providers, i);
+
+		if (NULL != provider->free_cb) provider->free_cb(srv, provider->data);
+		g_hash_table_destroy(provider->keys);
+		g_string_free(provider->name, TRUE);
+		g_slice_free(warm_cache_provider, provider);
+	}
+	g_ptr_array_free(wc->providers, TRUE);
+
+	if (wc->prefetched) {
+		li_event_clear(&wc->timeout);
+		li_event_clear(&wc->save_timer);
+	}
+	if (NULL != wc->snapshot) g_string_free(wc->snapshot, TRUE);
+	g_mutex_free(wc->lock);
+
+	g_slice_free(liWarmCache, wc);
+}
+
+void li_warm_cache_set_snapshot(liServer *srv, GString *filename) {
+	liWarmCache *wc = srv->warm_cache;
+
+	if (NULL != wc->snapshot) g_string_free(wc->snapshot, TRUE);
+	wc->snapshot = filename;
+
+	/* each process of the angel ("processes") has its own caches */
+	if (srv->process_ndx > 0) g_string_append_printf(filename, ".%u", srv->process_ndx);
+}
+
+/* prefetching */
+
+void li_warm_cache_wait(liServer *srv) {
+	g_atomic_int_inc(&srv->warm_cache->pending);
+}
+
+void li_warm_cache_done(liServer *srv) {
+	liWarmCache *wc = srv->warm_cache;
+
+	if (NULL == wc) return; /* server is shutting down */
+
+	if (g_atomic_int_dec_and_test(&wc->pending)) {
+		li_server_state_ready(srv, &wc->wait);
+	}
+}
+
+static void warm_cache_timeout_cb(liEventBase *watcher, int events) {
+	liWarmCache *wc = LI_CONTAINER_OF(li_event_timer_from(watcher), liWarmCache, timeout);
+	UNUSED(events);
+
+	if (wc->wait.active) {
+		WARNING(wc->srv, "warm cache: prefetching not done after %.0f seconds, continuing anyway", WARM_CACHE_MAX_WAIT);
+		li_server_state_ready(wc->srv, &wc->wait);
+	}
+}
+
+static void warm_cache_save_cb(liEventBase *watcher, int events) {
+	liWarmCache *wc = LI_CONTAINER_OF(li_event_timer_from(watcher), liWarmCache, save_timer);
+	UNUSED(events);
+
+	li_warm_cache_snapshot(wc->srv);
+	li_event_timer_once(&wc->save_timer, WARM_CACHE_SAVE_INTERVAL);
+}
+
+void li_warm_cache_prefetch(liServer *srv) {
+	liWarmCache *wc = srv->warm_cache;
+	gchar *contents = NULL, *line, *next, *tab;
+	gsize len;
+	GError *err = NULL;
+	GPtrArray **keys;
+	guint i, count = 0;
+
+	if (NULL == wc->snapshot || wc->prefetched) return;
+	wc->prefetched = TRUE;
+
+	li_event_timer_init(&srv->main_worker->loop, "warm cache timeout", &wc->timeout, warm_cache_timeout_cb);
+	li_event_set_keep_loop_alive(&wc->timeout, FALSE);
+
+	li_event_timer_init(&srv->main_worker->loop, "warm cache save", &wc->save_timer, warm_cache_save_cb);
+	li_event_set_keep_loop_alive(&wc->save_timer, FALSE);
+	li_event_timer_once(&wc->save_timer, WARM_CACHE_SAVE_INTERVAL);
+
+	if (!g_file_get_contents(wc->snapshot->str, &contents, &len, &err)) {
+		if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			WARNING(srv, "warm cache: couldn't read snapshot '%s': %s", wc->snapshot->str, err->message);
+		}
+		g_error_free(err);
+		return;
+	}
+
+	/* "name\tkey\n" lines */
+	keys = g_new0(GPtrArray*, wc->providers->len);
+	for (line = contents; line < contents + len; line = next) {
+		next = memchr(line, '\n', contents + len - line);
+		if (NULL == next) break; /* incomplete line */
+		*next++ = '\0';
+
+		if ('#' == line[0] || NULL == (tab = strchr(line, '\t'))) continue;
+		*tab++ = '\0';
+
+		for (i = 0; i < wc->providers->len; i++) {
+			warm_cache_provider *provider = g_ptr_array_index(wc->providers, i);
+			if (0 != strcmp(provider->name->str, line)) continue;
+
+			if (NULL == keys[i]) keys[i] = g_ptr_array_new();
+			if (keys[i]->len < WARM_CACHE_MAX_KEYS) {
+				g_ptr_array_add(keys[i], g_string_new(tab));
+				count++;
+			}
+			break;
+		}
+	}
+	g_free(contents);
+
+	if (count > 0) {
+		INFO(srv, "warm cache: prefetching %u entries", count);
+
+		li_server_state_wait(srv, &wc->wait);
+		wc->pending = 1;
+		li_event_timer_once(&wc->timeout, WARM_CACHE_MAX_WAIT);
+	}
+
+	for (i = 0; i < wc->providers->len; i++) {
+		warm_cache_provider *provider = g_ptr_array_index(wc->providers, i);
+		guint j;
+
+		if (NULL == keys[i]) continue;
+
+		if (NULL != provider->prefetch_cb) provider->prefetch_cb(srv, provider->data, keys[i]);
+
+		for (j = 0; j < keys[i]->len; j++) {
+			g_string_free(g_ptr_array_index(keys[i], j), TRUE);
+		}
+		g_ptr_array_free(keys[i], TRUE);
+	}
+	g_free(keys);
+
+	if (count > 0) li_warm_cache_done(srv);
+}
+
+/* snapshot */
+
+void li_warm_cache_dump_worker(liWorker *wrk) {
+	liWarmCache *wc = wrk->srv->warm_cache;
+	GPtrArray *keys;
+	guint i, j;
+
+	if (NULL == wc || NULL == wc->snapshot) return;
+
+	keys = g_ptr_array_new();
+
+	for (i = 0; i < wc->providers->len; i++) {
+		warm_cache_provider *provider = g_ptr_array_index(wc->providers, i);
+
+		if (NULL == provider->dump_cb) continue;
+		provider->dump_cb(wrk, provider->data, keys);
+
+		g_mutex_lock(wc->lock);
+		for (j = 0; j < keys->len; j++) {
+			GString *key = g_ptr_array_index(keys, j);
+			if (g_hash_table_size(provider->keys) < WARM_CACHE_MAX_KEYS && NULL == g_hash_table_lookup(provider->keys, key)) {
+				g_hash_table_insert(provider->keys, key, NULL);
+			} else {
+				g_string_free(key, TRUE);
+			}
+		}
+		g_mutex_unlock(wc->lock);
+
+		g_ptr_array_set_size(keys, 0);
+	}
+
+	g_mutex_lock(wc->lock);
+	wc->dumped = TRUE;
+	g_mutex_unlock(wc->lock);
+
+	g_ptr_array_free(keys, TRUE);
+}
+
+static void warm_cache_write(liServer *srv, gboolean final) {
+	liWarmCache *wc = srv->warm_cache;
+	GString *contents;
+	GError *err = NULL;
+	guint i, count = 0;
+
+	/* don't overwrite the snapshot if we didn't run */
+	if (NULL == wc || NULL == wc->snapshot || !wc->dumped) return;
+
+	contents = g_string_sized_new(4095);
+	g_string_append_len(contents, CONST_STR_LEN("# lighttpd2 warm cache snapshot\n"));
+
+	g_mutex_lock(wc->lock);
+	for (i = 0; i < wc->providers->len; i++) {
+		warm_cache_provider *provider = g_ptr_array_index(wc->providers, i);
+		GHashTableIter iter;
+		gpointer k;
+
+		g_hash_table_iter_init(&iter, provider->keys);
+		while (g_hash_table_iter_next(&iter, &k, NULL)) {
+			GString *key = k;
+
+			if (0 == key->len || NULL != memchr(key->str, '\n', key->len) || NULL != memchr(key->str, '\0', key->len)) continue;
+
+			g_string_append_len(contents, GSTR_LEN(provider->name));
+			g_string_append_c(contents, '\t');
+			g_string_append_len(contents, GSTR_LEN(key));
+			g_string_append_c(contents, '\n');
+			count++;
+		}
+		g_hash_table_remove_all(provider->keys);
+	}
+	g_mutex_unlock(wc->lock);
+
+	/* writes a temporary file and renames it */
+	if (!g_file_set_contents(wc->snapshot->str, GSTR_LEN(contents), &err)) {
+		WARNING(srv, "warm cache: couldn't write snapshot '%s': %s", wc->snapshot->str, err->message);
+		g_error_free(err);
+	} else if (final) {
+		INFO(srv, "warm cache: stored %u entries in snapshot", count);
+	}
+
+	g_string_free(contents, TRUE);
+}
+
+void li_warm_cache_save(liServer *srv) {
+	warm_cache_write(srv, TRUE);
+}
+
+static gpointer warm_cache_collect_worker(liWorker *wrk, gpointer fdata) {
+	UNUSED(fdata);
+
+	li_warm_cache_dump_worker(wrk);
+	return NULL;
+}
+
+static void warm_cache_collect_done(gpointer cbdata, gpointer fdata, GPtrArray *result, gboolean complete) {
+	liServer *srv = cbdata;
+	UNUSED(fdata);
+	UNUSED(result);
+
+	if (!complete || NULL == srv->warm_cache) return;
+
+	srv->warm_cache->collecting = FALSE;
+	warm_cache_write(srv, FALSE);
+}
+
+void li_warm_cache_snapshot(liServer *srv) {
+	liWarmCache *wc = srv->warm_cache;
+
+	if (NULL == wc || NULL == wc->snapshot || wc->collecting) return;
+
+	wc->collecting = TRUE;
+	li_collect_start_global(srv, warm_cache_collect_worker, NULL, warm_cache_collect_done, srv);
+}
@@ -5,6 +5,8 @@
 #include <lighttpd/throttle.h>
 
 static liConnection* worker_con_get(liWorker *wrk);
+static void worker_pools_shrink(liWorker *wrk, li_tstamp now);
+static void worker_pools_prealloc(liWorker *wrk);
 
 /* closing sockets - wait for proper shutdown */
 
@@ -76,7 +78,7 @@ static void worker_io_timeout_cb(liWaitQueue *wq, gpointer data) {
 		/* connection has timed out */
 		con = wqe->data;
 		vr = con->mainvr;
-		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+		if (NULL != vr && CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 			VR_DEBUG(vr, "connection io-timeout from %s after %.2f seconds", con->info.remote_addr_str->str, now - wqe->ts);
 		}
 		li_plugins_handle_close(con);
@@ -86,6 +88,18 @@ static void worker_io_timeout_cb(liWaitQueue *wq, gpointer data) {
 	li_waitqueue_update(wq);
 }
 
+/* trim idle keep-alive connections */
+static void worker_idle_trim_cb(liWaitQueue *wq, gpointer data) {
+	liWaitQueueElem *wqe;
+	UNUSED(data);
+
+	while ((wqe = li_waitqueue_pop(wq)) != NULL) {
+		li_connection_trim(wqe->data);
+	}
+
+	li_waitqueue_update(wq);
+}
+
 static void worker_close_idle_connections(liWorker *wrk) {
 	guint i;
 
@@ -228,11 +242,36 @@ static void li_worker_new_con_cb(liEventBase *watcher, int events) {
 }
 
 /* stats watcher */
+
+/* one-way message to the angel, no result: gint32 worker index followed by "key=value" pairs */
+static void worker_stats_send(liWorker *wrk) {
+	GString *data = g_string_sized_new(127);
+	GError *err = NULL;
+
+	li_angel_data_write_int32(data, wrk->ndx, NULL);
+	g_string_append_printf(data, "requests=%" G_GUINT64_FORMAT " bytes_in=%" G_GUINT64_FORMAT " bytes_out=%" G_GUINT64_FORMAT
+		" active_cons=%u peak_active_cons=%u",
+		wrk->stats.requests, wrk->stats.bytes_in, wrk->stats.bytes_out,
+		wrk->connections_active, wrk->stats.peak.active_cons);
+
+	if (!li_angel_send_simple_call(wrk->srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("stats"), data, &err)) {
+		GERROR(wrk->srv, err, "%s", "couldn't send statistics to angel");
+		g_error_free(err);
+	}
+}
+
 static void worker_stats_watcher_cb(liEventBase *watcher, int events) {
 	liWorker *wrk = LI_CONTAINER_OF(li_event_timer_from(watcher), liWorker, stats_watcher);
 	li_tstamp now = li_cur_ts(wrk);
+	gboolean full_snapshot = FALSE;
 	UNUSED(events);
 
+	/* the timer is due 1 second after the last run; everything later was spent in other callbacks */
+	if (wrk->stats.last_update) {
+		wrk->loop_lag = now - wrk->stats.last_update - 1;
+		if (wrk->loop_lag < 0) wrk->loop_lag = 0;
+	}
+
 	if (wrk->stats.last_update && now != wrk->stats.last_update) {
 		wrk->stats.requests_per_sec =
 			(wrk->stats.requests - wrk->stats.last_requests) / (now - wrk->stats.last_update);
@@ -264,22 +303,129 @@ static void worker_stats_watcher_cb(liEventBase *watcher, int events) {
 		wrk->stats.peak.active_cons = MAX(wrk->stats.peak.active_cons, wrk->connections_active);
 
 		wrk->stats.last_avg = now;
+		full_snapshot = TRUE;
+
+		if (NULL != wrk->srv->acon) worker_stats_send(wrk);
 	}
 
+	worker_pools_shrink(wrk, now);
+
 	wrk->stats.active_cons_cum += wrk->connections_active;
 
 	wrk->stats.last_requests = wrk->stats.requests;
 	wrk->stats.last_update = now;
 
+	li_collect_snapshot_publish(wrk, full_snapshot);
+
 	/* and run again next second */
 	li_event_timer_once(&wrk->stats_watcher, 1);
 }
 
+#define WORKER_SCRATCH_BUFFER_SIZE (16*1024)
+
+liBuffer* li_worker_scratch_buffer(liWorker *wrk, gsize len) {
+	liBuffer *buf = wrk->scratch_buf;
+
+	if (len > WORKER_SCRATCH_BUFFER_SIZE / 4) return li_buffer_new(len);
+
+	if (NULL != buf) {
+		/* no chunk references the buffer anymore */
+		if (1 == g_atomic_int_get(&buf->refcount)) buf->used = 0;
+
+		if (buf->alloc_size - buf->used < len) {
+			li_buffer_release(buf);
+			wrk->scratch_buf = buf = NULL;
+		}
+	}
+
+	if (NULL == buf) {
+		wrk->scratch_buf = buf = li_buffer_new_slice(WORKER_SCRATCH_BUFFER_SIZE);
+	}
+
+	li_buffer_acquire(buf);
+	return buf;
+}
+
+/* docroot cache: resolved document roots per (action, host), expire like stat cache entries */
+
+#define WORKER_DOCROOT_CACHE_MAX 4096
+
+typedef struct worker_docroot_entry worker_docroot_entry;
+struct worker_docroot_entry {
+	GString *docroot;
+	li_tstamp expires;
+};
+
+static void worker_docroot_entry_free(gpointer data) {
+	worker_docroot_entry *entry = data;
+
+	g_string_free(entry->docroot, TRUE);
+	g_slice_free(worker_docroot_entry, entry);
+}
+
+static void worker_docroot_key_free(gpointer data) {
+	g_string_free(data, TRUE);
+}
+
+guint li_worker_docroot_cache_id(void) {
+	static gint last_id = 0;
+	gint id;
+
+	do {
+		id = g_atomic_int_get(&last_id);
+	} while (!g_atomic_int_compare_and_exchange(&last_id, id, id + 1));
+
+	return (guint) id + 1;
+}
+
+GString* li_worker_docroot_cache_lookup(liWorker *wrk, const GString *key) {
+	worker_docroot_entry *entry;
+
+	/* without stat cache the filesystem is checked every time */
+	if (NULL == wrk->stat_cache) return NULL;
+
+	if (NULL == (entry = g_hash_table_lookup(wrk->docroot_cache, key))) return NULL;
+
+	if (entry->expires <= li_cur_ts(wrk)) {
+		g_hash_table_remove(wrk->docroot_cache, key);
+		return NULL;
+	}
+
+	return entry->docroot;
+}
+
+void li_worker_docroot_cache_insert(liWorker *wrk, const GString *key, const GString *docroot) {
+	worker_docroot_entry *entry;
+
+	if (NULL == wrk->stat_cache) return;
+
+	/* mass vhosting: don't grow without limit, just start over */
+	if (g_hash_table_size(wrk->docroot_cache) >= WORKER_DOCROOT_CACHE_MAX) {
+		g_hash_table_remove_all(wrk->docroot_cache);
+	}
+
+	entry = g_slice_new(worker_docroot_entry);
+	entry->docroot = g_string_new_len(GSTR_LEN(docroot));
+	entry->expires = li_cur_ts(wrk) + wrk->srv->stat_cache_ttl;
+	g_hash_table_replace(wrk->docroot_cache, g_string_new_len(GSTR_LEN(key)), entry);
+}
+
+gboolean li_worker_overloaded(liWorker *wrk) {
+	liServer *srv = wrk->srv;
+
+	if (srv->overload_loop_lag > 0 && wrk->loop_lag >= srv->overload_loop_lag) return TRUE;
+	if (srv->overload_backend_waiting > 0 && (guint) g_atomic_int_get(&srv->backend_waiting) >= srv->overload_backend_waiting) return TRUE;
+	if (srv->overload_memory > 0 && g_atomic_int_get(&srv->memory_overloaded)) return TRUE;
+
+	return FALSE;
+}
+
 /* init */
 
 liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	liWorker *wrk = g_slice_new0(liWorker);
 	wrk->srv = srv;
+	wrk->numa_node = -1;
 	li_event_loop_init(&wrk->loop, loop);
 
 	li_lua_init(&wrk->LL, srv, wrk);
@@ -292,6 +438,8 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 
 	wrk->tmp_str = g_string_sized_new(255);
 
+	wrk->docroot_cache = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, worker_docroot_key_free, worker_docroot_entry_free);
+
 	wrk->timestamps_gmt = g_array_sized_new(FALSE, TRUE, sizeof(liWorkerTS), srv->ts_formats->len);
 	g_array_set_size(wrk->timestamps_gmt, srv->ts_formats->len);
 	{
@@ -323,15 +471,24 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	li_event_async_init(&wrk->loop, "worker collect", &wrk->collect_watcher, li_collect_watcher_cb);
 	wrk->collect_queue = g_async_queue_new();
 
+	wrk->snapshot = g_slice_new0(liWorkerSnapshot);
+	wrk->snapshot_seq = 0;
+	wrk->connection_state_count = g_new0(guint, LI_CON_STATE_LAST+1);
+
 	/* io timeout timer */
 	li_waitqueue_init(&wrk->io_timeout_queue, &wrk->loop, "io timeout queue", worker_io_timeout_cb, srv->io_timeout, wrk);
 
+	/* idle keep-alive connections */
+	li_waitqueue_init(&wrk->idle_trim_queue, &wrk->loop, "idle trim queue", worker_idle_trim_cb, srv->keep_alive_trim_idle, wrk);
+	g_queue_init(&wrk->vrequest_pool);
+
 	/* throttling */
 	li_waitqueue_init(&wrk->throttle_queue, &wrk->loop, "throttle queue", li_throttle_waitqueue_cb, ((gdouble)LI_THROTTLE_GRANULARITY) / 1000, wrk);
 
 	wrk->tasklets = li_tasklet_pool_new(&wrk->loop, srv->tasklet_pool_threads);
 
 	wrk->network_read_buf = NULL;
+	wrk->scratch_buf = NULL;
 
 	return wrk;
 }
@@ -360,6 +517,13 @@ struct ev_loop* li_worker_free(liWorker *wrk) {
 		g_array_free(wrk->connections, TRUE);
 	}
 
+	{ /* free main vrequests of trimmed connections */
+		liVRequest *vr;
+		while (NULL != (vr = g_queue_pop_head(&wrk->vrequest_pool))) {
+			li_vrequest_free(vr);
+		}
+	}
+
 	{ /* free timestamps */
 		guint i;
 		for (i = 0; i < wrk->timestamps_gmt->len; i++) {
@@ -371,6 +535,7 @@ struct ev_loop* li_worker_free(liWorker *wrk) {
 	}
 
 	li_waitqueue_stop(&wrk->io_timeout_queue);
+	li_waitqueue_stop(&wrk->idle_trim_queue);
 	li_waitqueue_stop(&wrk->throttle_queue);
 
 	li_event_clear(&wrk->worker_stop_watcher);
@@ -394,12 +559,17 @@ struct ev_loop* li_worker_free(liWorker *wrk) {
 	g_string_free(wrk->tmp_str, TRUE);
 
 	li_stat_cache_free(wrk->stat_cache);
+	g_hash_table_destroy(wrk->docroot_cache);
 
 	li_tasklet_pool_free(wrk->tasklets);
 
 	li_lua_clear(&wrk->LL);
 
 	li_buffer_release(wrk->network_read_buf);
+	li_buffer_release(wrk->scratch_buf);
+
+	g_slice_free(liWorkerSnapshot, wrk->snapshot);
+	g_free(wrk->connection_state_count);
 
 	evloop = li_event_loop_clear(&wrk->loop);
 
@@ -412,6 +582,7 @@ void li_worker_run(liWorker *wrk) {
 	/* update and start io timeout queue since first worker is allocated before srv->io_timeout is set */
 	li_waitqueue_set_delay(&wrk->io_timeout_queue, wrk->srv->io_timeout);
 	li_waitqueue_update(&wrk->io_timeout_queue);
+	li_waitqueue_set_delay(&wrk->idle_trim_queue, wrk->srv->keep_alive_trim_idle);
 
 	/* initialize timestamp caches for new ones that have been added by modules */
 	if (wrk->srv->ts_formats->len > wrk->timestamps_gmt->len) {
@@ -426,6 +597,9 @@ void li_worker_run(liWorker *wrk) {
 		}
 	}
 
+	wrk->connections_gc_ts = li_cur_ts(wrk);
+	worker_pools_prealloc(wrk);
+
 	/* setup stat cache if necessary */
 	if (wrk->srv->stat_cache_ttl && !wrk->stat_cache)
 		wrk->stat_cache = li_stat_cache_new(wrk, wrk->srv->stat_cache_ttl);
@@ -437,6 +611,7 @@ void li_worker_stop(liWorker *context, liWorker *wrk) {
 	if (context == wrk) {
 		guint i;
 
+		li_warm_cache_dump_worker(wrk);
 		li_plugins_worker_stop(wrk);
 
 		li_event_stop(&wrk->worker_stop_watcher);
@@ -494,13 +669,33 @@ void li_worker_stopping(liWorker *context, liWorker *wrk) {
 void li_worker_suspend(liWorker *context, liWorker *wrk) {
 	if (context == wrk) {
 		guint i;
+		GArray *handoff_fds = NULL;
+
+		/* with an angel idle keep-alive connections are handed over to it (and to the instance replacing us),
+		 * close the others */
+		if (NULL != wrk->srv->acon) handoff_fds = g_array_new(FALSE, FALSE, sizeof(int));
 
-		/* close keep alive connections */
 		for (i = wrk->connections_active; i-- > 0;) {
 			liConnection *con = g_array_index(wrk->connections, liConnection*, i);
 			if (con->state == LI_CON_STATE_KEEP_ALIVE) {
-				li_connection_reset(con);
+				int fd = (NULL != handoff_fds) ? li_connection_handoff(con) : -1;
+				if (-1 != fd) {
+					g_array_append_val(handoff_fds, fd);
+				} else {
+					li_connection_reset(con);
+				}
+			}
+		}
+
+		if (NULL != handoff_fds && 0 != handoff_fds->len) {
+			GError *err = NULL;
+			DEBUG(wrk->srv, "handing over %u idle connections", handoff_fds->len);
+			if (!li_angel_send_simple_call_fds(wrk->srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("handoff"), NULL, handoff_fds, &err)) {
+				GERROR(wrk->srv, err, "%s", "couldn't hand over idle connections");
+				g_error_free(err);
 			}
+		} else if (NULL != handoff_fds) {
+			g_array_free(handoff_fds, TRUE);
 		}
 
 		li_worker_check_keepalive(wrk);
@@ -528,6 +723,48 @@ void li_worker_exit(liWorker *context, liWorker *wrk) {
 }
 
 
+/* frees unused connections above keep (but not below connection_pool_min) */
+static void worker_con_shrink(liWorker *wrk, guint keep) {
+	guint i;
+
+	keep = MAX(keep, wrk->connections_active);
+	keep = MAX(keep, wrk->srv->connection_pool_min);
+
+	for (i = wrk->connections->len; i > keep; i--) {
+		li_connection_free(g_array_index(wrk->connections, liConnection*, i-1));
+		g_array_index(wrk->connections, liConnection*, i-1) = NULL;
+	}
+
+	if (wrk->connections->len > keep) wrk->connections->len = keep;
+}
+
+static void worker_pools_shrink(liWorker *wrk, li_tstamp now) {
+	liServer *srv = wrk->srv;
+	guint unused;
+
+	if ((now - wrk->connections_gc_ts) <= srv->pool_shrink_interval) return;
+
+	/* keep max(connections_active) of the last interval allocated */
+	worker_con_shrink(wrk, wrk->connections_active_max_5min);
+	wrk->connections_active_max_5min = wrk->connections_active;
+
+	/* vrequests which stayed in the pool the whole interval weren't needed */
+	for (unused = wrk->vrequest_pool_min_5min; unused > 0; unused--) {
+		li_vrequest_free(g_queue_pop_tail(&wrk->vrequest_pool));
+	}
+	wrk->vrequest_pool_min_5min = wrk->vrequest_pool.length;
+
+	wrk->connections_gc_ts = now;
+}
+
+static void worker_pools_prealloc(liWorker *wrk) {
+	while (wrk->connections->len < wrk->srv->connection_pool_min) {
+		liConnection *con = li_connection_new(wrk);
+		con->idx = -1;
+		g_array_append_val(wrk->connections, con);
+	}
+}
+
 static liConnection* worker_con_get(liWorker *wrk) {
 	liConnection *con;
 
@@ -550,7 +787,6 @@ static liConnection* worker_con_get(liWorker *wrk) {
 
 void li_worker_con_put(liConnection *con) {
 	liWorker *wrk = con->wrk;
-	li_tstamp now = li_cur_ts(wrk);
 
 	if (-1 == (gint) con->idx)
 		/* already inactive connection */
@@ -571,18 +807,9 @@ void li_worker_con_put(liConnection *con) {
 		g_array_index(wrk->connections, liConnection*, tmp->idx) = tmp;
 	}
 
-	/* free unused connections. we keep max(connections_active) for the past 5min allocated */
-	if ((now - wrk->connections_gc_ts) > 300.0) {
-		guint i;
-
-		for (i = wrk->connections->len; i > wrk->connections_active_max_5min; i--) {
-			li_connection_free(g_array_index(wrk->connections, liConnection*, i-1));
-			g_array_index(wrk->connections, liConnection*, i-1) = NULL;
-		}
-
-		wrk->connections->len = wrk->connections_active_max_5min;
-		wrk->connections_active_max_5min = wrk->connections_active;
-		wrk->connections_gc_ts = now;
+	/* pool limit */
+	if (0 != wrk->srv->connection_pool_max) {
+		worker_con_shrink(wrk, wrk->connections_active + wrk->srv->connection_pool_max);
 	}
 
 
@@ -83,6 +83,9 @@ struct liFastCGIBackendPool_p {
 	const liFastCGIBackendCallbacks *callbacks;
 
 	liBackendConfig config;
+
+	liEnvironmentPrefixCache *env_prefixes; /* pre-encoded constant parameters */
+	gint env_size_hint; /* size of the last PARAMS stream, atomic access */
 };
 
 /* debug */
@@ -218,6 +221,8 @@ static void backend_free(liBackendPool *bpool) {
 
 	li_sockaddr_clear(&pool->config.sock_addr);
 
+	li_environment_prefix_cache_free(pool->env_prefixes);
+
 	g_slice_free(liFastCGIBackendPool_p, pool);
 }
 
@@ -322,25 +327,27 @@ static gboolean append_key_value_pair(GByteArray *a, const gchar *key, size_t ke
 	return TRUE;
 }
 
-/* returns padding length */
-static guint8 stream_build_fcgi_record(GByteArray *buf, guint8 type, guint16 requestid, guint16 datalen) {
-	guint16 w;
+/* writes FCGI_HEADER_LEN bytes; returns padding length */
+static guint8 fcgi_write_record_header(guint8 *p, guint8 type, guint16 requestid, guint16 datalen) {
 	guint8 padlen = (8 - (datalen & 0x7)) % 8; /* padding must be < 8 */
 
-	g_byte_array_set_size(buf, FCGI_HEADER_LEN);
-	g_byte_array_set_size(buf, 0);
-
-	l_byte_array_append_c(buf, FCGI_VERSION_1);
-	l_byte_array_append_c(buf, type);
-	w = htons(requestid);
-	g_byte_array_append(buf, (const guint8*) &w, sizeof(w));
-	w = htons(datalen);
-	g_byte_array_append(buf, (const guint8*) &w, sizeof(w));
-	l_byte_array_append_c(buf, padlen);
-	l_byte_array_append_c(buf, 0);
+	p[0] = FCGI_VERSION_1;
+	p[1] = type;
+	p[2] = (requestid >> 8) & 0xff;
+	p[3] = requestid & 0xff;
+	p[4] = (datalen >> 8) & 0xff;
+	p[5] = datalen & 0xff;
+	p[6] = padlen;
+	p[7] = 0;
 	return padlen;
 }
 
+/* returns padding length */
+static guint8 stream_build_fcgi_record(GByteArray *buf, guint8 type, guint16 requestid, guint16 datalen) {
+	g_byte_array_set_size(buf, FCGI_HEADER_LEN);
+	return fcgi_write_record_header(buf->data, type, requestid, datalen);
+}
+
 /* returns padding length */
 static guint8 stream_send_fcgi_record(liChunkQueue *out, guint8 type, guint16 requestid, guint16 datalen) {
 	GByteArray *record = g_byte_array_sized_new(FCGI_HEADER_LEN);
@@ -362,18 +369,6 @@ static void stream_send_data(liChunkQueue *out, guint8 type, guint16 requestid,
 	}
 }
 
-/* kills the data */
-static void stream_send_bytearr(liChunkQueue *out, guint8 type, guint16 requestid, GByteArray *data) {
-	if (data->len > G_MAXUINT16) {
-		stream_send_data(out, type, requestid, (const gchar*) data->data, data->len);
-		g_byte_array_free(data, TRUE);
-	} else {
-		guint8 padlen = stream_send_fcgi_record(out, type, requestid, data->len);
-		append_padding(data, padlen);
-		li_chunkqueue_append_bytearr(out, data);
-	}
-}
-
 static void stream_send_chunks(liChunkQueue *out, guint8 type, guint16 requestid, liChunkQueue *in) {
 	while (in->length > 0) {
 		guint16 tosend = (in->length > G_MAXUINT16) ? G_MAXUINT16 : in->length;
@@ -402,23 +397,48 @@ static void stream_send_begin(liChunkQueue *out, guint16 requestid) {
 
 /**********************************************************************************/
 /* fastcgi environment build helpers */
+/* envdup is NULL if the request has no environment entries */
 static void fastcgi_env_add(GByteArray *buf, liEnvironmentDup *envdup, const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
 	GString *sval;
 
-	if (NULL != (sval = li_environment_dup_pop(envdup, key, keylen))) {
+	if (NULL != envdup && NULL != (sval = li_environment_dup_pop(envdup, key, keylen))) {
 		append_key_value_pair(buf, key, keylen, GSTR_LEN(sval));
 	} else {
 		append_key_value_pair(buf, key, keylen, val, valuelen);
 	}
 }
 
-static void fastcgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray* buf) {
+typedef struct fastcgi_env_param fastcgi_env_param;
+struct fastcgi_env_param {
+	GByteArray *buf;
+	liEnvironmentDup *envdup;
+};
+
+static void fastcgi_env_add_cb(gpointer param, const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
+	fastcgi_env_param *p = param;
+	fastcgi_env_add(p->buf, p->envdup, key, keylen, val, valuelen);
+}
+
+/* the variables which don't depend on the request (only on server.tag) */
+static void fastcgi_env_create_constant(GByteArray *buf, liEnvironmentDup *envdup, GString *tag) {
+	fastcgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_SOFTWARE"), GSTR_LEN(tag));
+	fastcgi_env_add(buf, envdup, CONST_STR_LEN("GATEWAY_INTERFACE"), CONST_STR_LEN("CGI/1.1"));
+	fastcgi_env_add(buf, envdup, CONST_STR_LEN("REDIRECT_STATUS"), CONST_STR_LEN("200")); /* if php is compiled with --force-redirect */
+}
+
+static const gchar * const fastcgi_env_constant_keys[] = { "SERVER_SOFTWARE", "GATEWAY_INTERFACE", "REDIRECT_STATUS", NULL };
+
+static void fastcgi_env_prefix_create(GByteArray *buf, GString *tag) {
+	fastcgi_env_create_constant(buf, NULL, tag);
+}
+
+/* with_constant: also add the variables from fastcgi_env_create_constant */
+static void fastcgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray* buf, gboolean with_constant) {
 	liConInfo *coninfo = vr->coninfo;
 	GString *tmp = vr->wrk->tmp_str;
 
-	fastcgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_SOFTWARE"), GSTR_LEN(CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string));
+	if (with_constant) fastcgi_env_create_constant(buf, envdup, CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string);
 	fastcgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_NAME"), GSTR_LEN(vr->request.uri.host));
-	fastcgi_env_add(buf, envdup, CONST_STR_LEN("GATEWAY_INTERFACE"), CONST_STR_LEN("CGI/1.1"));
 	{
 		guint port = 0;
 		switch (coninfo->local_addr.addr->plain.sa_family) {
@@ -474,7 +494,6 @@ static void fastcgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteAr
 	fastcgi_env_add(buf, envdup, CONST_STR_LEN("QUERY_STRING"), GSTR_LEN(vr->request.uri.query));
 
 	fastcgi_env_add(buf, envdup, CONST_STR_LEN("REQUEST_METHOD"), GSTR_LEN(vr->request.http_method_str));
-	fastcgi_env_add(buf, envdup, CONST_STR_LEN("REDIRECT_STATUS"), CONST_STR_LEN("200")); /* if php is compiled with --force-redirect */
 	switch (vr->request.http_version) {
 	case LI_HTTP_VERSION_1_1:
 		fastcgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_PROTOCOL"), CONST_STR_LEN("HTTP/1.1"));
@@ -490,44 +509,33 @@ static void fastcgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteAr
 	}
 }
 
-static void fix_header_name(GString *str) {
-	guint i, len = str->len;
-	gchar *s = str->str;
-	for (i = 0; i < len; i++) {
-		if (g_ascii_isalpha(s[i])) {
-			s[i] = g_ascii_toupper(s[i]);
-		} else if (!g_ascii_isdigit(s[i])) {
-			s[i] = '_';
-		}
-	}
-}
+/* the whole PARAMS stream is encoded into one buffer (sized by the previous request), including the
+ * record headers, padding and the empty terminating record; it becomes a single chunk */
+static void fastcgi_send_env(liVRequest *vr, liFastCGIBackendPool_p *pool, liChunkQueue *out, int requestid) {
+	GByteArray *buf;
+	liEnvironmentDup *envdup = NULL;
+	GByteArray *prefix;
+	gint size_hint = g_atomic_int_get(&pool->env_size_hint);
+	guint datalen;
 
-static void fastcgi_send_env(liVRequest *vr, liChunkQueue *out, int requestid) {
-	GByteArray *buf = g_byte_array_sized_new(0);
-	liEnvironmentDup *envdup;
+	buf = g_byte_array_sized_new(size_hint > 0 ? (guint) size_hint : 1024);
+	g_byte_array_set_size(buf, FCGI_HEADER_LEN); /* record header, written below */
+
+	/* nothing to override if the environment is empty (the common case) */
+	if (0 != g_hash_table_size(vr->env.table)) envdup = li_environment_make_dup(&vr->env);
 
-	envdup = li_environment_make_dup(&vr->env);
-	fastcgi_env_create(vr, envdup, buf);
+	prefix = li_environment_prefix_cache_get(pool->env_prefixes, envdup, CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string);
+	if (NULL != prefix) g_byte_array_append(buf, prefix->data, prefix->len);
+	fastcgi_env_create(vr, envdup, buf, NULL == prefix);
 
 	{
-		GList *i;
-		GString *tmp = vr->wrk->tmp_str;
-
-		for (i = vr->request.headers->entries.head; NULL != i; i = i->next) {
-			liHttpHeader *h = (liHttpHeader*) i->data;
-			const GString hkey = li_const_gstring(h->data->str, h->keylen);
-			g_string_truncate(tmp, 0);
-			if (!li_strncase_equal(&hkey, CONST_STR_LEN("CONTENT-TYPE"))) {
-				g_string_append_len(tmp, CONST_STR_LEN("HTTP_"));
-			}
-			g_string_append_len(tmp, h->data->str, h->keylen);
-			fix_header_name(tmp);
-	
-			fastcgi_env_add(buf, envdup, GSTR_LEN(tmp), h->data->str + h->keylen+2, h->data->len - (h->keylen+2));
-		}
+		fastcgi_env_param param;
+		param.buf = buf;
+		param.envdup = envdup;
+		li_environment_cgi_headers(vr, fastcgi_env_add_cb, &param);
 	}
 
-	{
+	if (NULL != envdup) {
 		GHashTableIter i;
 		gpointer key, val;
 
@@ -535,12 +543,29 @@ static void fastcgi_send_env(liVRequest *vr, liChunkQueue *out, int requestid) {
 		while (g_hash_table_iter_next(&i, &key, &val)) {
 			append_key_value_pair(buf, GSTR_LEN((GString*) key), GSTR_LEN((GString*) val));
 		}
+
+		li_environment_dup_free(envdup);
 	}
 
-	li_environment_dup_free(envdup);
+	datalen = buf->len - FCGI_HEADER_LEN;
+	li_environment_cgi_account(vr, datalen);
+	g_atomic_int_set(&pool->env_size_hint, (gint) MIN(buf->len + 2*FCGI_HEADER_LEN + 64, 65536u));
+
+	if (datalen > G_MAXUINT16) {
+		/* needs more than one record */
+		stream_send_data(out, FCGI_PARAMS, requestid, (const gchar*) buf->data + FCGI_HEADER_LEN, datalen);
+		g_byte_array_set_size(buf, 0);
+	} else if (datalen > 0) {
+		guint8 padlen = fcgi_write_record_header(buf->data, FCGI_PARAMS, requestid, datalen);
+		append_padding(buf, padlen);
+	} else {
+		g_byte_array_set_size(buf, 0);
+	}
 
-	if (buf->len > 0) stream_send_bytearr(out, FCGI_PARAMS, requestid, buf);
-	stream_send_fcgi_record(out, FCGI_PARAMS, requestid, 0);
+	/* empty record terminates the stream */
+	g_byte_array_set_size(buf, buf->len + FCGI_HEADER_LEN);
+	fcgi_write_record_header(buf->data + buf->len - FCGI_HEADER_LEN, FCGI_PARAMS, requestid, 0);
+	li_chunkqueue_append_bytearr(out, buf);
 }
 
 /* end fastcgi environment build helpers */
@@ -801,6 +826,8 @@ liFastCGIBackendPool* li_fastcgi_backend_pool_new(const liFastCGIBackendConfig *
 
 	pool->callbacks = config->callbacks;
 
+	pool->env_prefixes = li_environment_prefix_cache_new(fastcgi_env_prefix_create, fastcgi_env_constant_keys);
+
 	pool->public.subpool = li_backend_pool_new(&pool->config);
 
 	return &pool->public;
@@ -856,7 +883,7 @@ liBackendResult li_fastcgi_backend_get(liVRequest *vr, liFastCGIBackendPool *bpo
 		li_chunkqueue_reset(ctx->fcgi_in.out);
 
 		stream_send_begin(ctx->fcgi_out.out, 1);
-		fastcgi_send_env(vr, ctx->fcgi_out.out, 1);
+		fastcgi_send_env(vr, pool, ctx->fcgi_out.out, 1);
 		li_stream_notify_later(&ctx->fcgi_out);
 
 		http_out = li_stream_http_response_handle(&ctx->fcgi_in, vr, TRUE, TRUE);
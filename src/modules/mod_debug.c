@@ -100,12 +100,22 @@ static gpointer debug_collect_func(liWorker *wrk, gpointer fdata) {
 		cd->keep_alive = c->info.keep_alive;
 		cd->remote_addr_str = g_string_new_len(GSTR_LEN(c->info.remote_addr_str));
 		cd->local_addr_str = g_string_new_len(GSTR_LEN(c->info.local_addr_str));
-		cd->host = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.host));
-		cd->path = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.path));
-		cd->query = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.query));
-		cd->method = c->mainvr->request.http_method;
-		cd->request_size = c->mainvr->request.content_length;
-		cd->response_size = (NULL != c->mainvr->backend_source) ? c->mainvr->backend_source->out->bytes_out : 0;
+		if (NULL != c->mainvr) {
+			cd->host = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.host));
+			cd->path = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.path));
+			cd->query = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.query));
+			cd->method = c->mainvr->request.http_method;
+			cd->request_size = c->mainvr->request.content_length;
+			cd->response_size = (NULL != c->mainvr->backend_source) ? c->mainvr->backend_source->out->bytes_out : 0;
+		} else {
+			/* trimmed idle connection */
+			cd->host = g_string_sized_new(0);
+			cd->path = g_string_sized_new(0);
+			cd->query = g_string_sized_new(0);
+			cd->method = LI_HTTP_METHOD_UNSET;
+			cd->request_size = -1;
+			cd->response_size = 0;
+		}
 		cd->state = c->state;
 		cd->ts_started = c->ts_started;
 		cd->bytes_in = c->info.stats.bytes_in;
@@ -125,6 +135,7 @@ static gpointer debug_collect_func(liWorker *wrk, gpointer fdata) {
 				g_string_append_printf(cd->detailed, "	is_ssl = \"%s\",\n", cd->is_ssl ? "true" : "false");
 				g_string_append_printf(cd->detailed, "	keep_alive = \"%s\",\n", cd->keep_alive ? "true" : "false");
 				g_string_append_printf(cd->detailed, "	state = \"%s\",\n", li_connection_state_str(cd->state));
+				g_string_append_printf(cd->detailed, "	memory = %" G_GSIZE_FORMAT ",\n", li_connection_memory_usage(c));
 				g_string_append_printf(cd->detailed, "	ts_started = %f,\n", cd->ts_started);
 				g_string_append_printf(cd->detailed,
 					"	io_timeout_elem = {\n"
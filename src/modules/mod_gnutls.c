@@ -503,10 +503,17 @@ static liThrottleState* gnutls_tcp_throttle_in(liConnection *con) {
 	return conctx->sock_stream->throttle_in;
 }
 
+static void gnutls_tcp_trim(liConnection *con) {
+	mod_connection_ctx *conctx = con->con_sock.data;
+	if (NULL == conctx) return;
+	li_connection_simple_tcp_trim(con, &conctx->simple_socket_data);
+}
+
 static const liConnectionSocketCallbacks gnutls_tcp_cbs = {
 	gnutls_tcp_finished,
 	gnutls_tcp_throttle_out,
-	gnutls_tcp_throttle_in
+	gnutls_tcp_throttle_in,
+	gnutls_tcp_trim
 };
 
 #ifdef USE_SNI
@@ -915,6 +922,14 @@ static gboolean gnutls_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 		ctx->sni_backend_db = backend;
 		mod_gnutls_context_acquire(ctx);
 		ctx->sni_db = li_fetch_database_new(&fetch_cert_callbacks, ctx, 64, 16);
+
+		{
+			/* prefetch the certificates of recently used server names after a restart; the name only
+			 * depends on the config (setups using the same backend fetch the same certificates) */
+			gchar *name = g_strdup_printf("gnutls.sni:%s", sni_backend);
+			li_warm_cache_register_fetch_database(srv, name, ctx->sni_db);
+			g_free(name);
+		}
 	}
 
 	if (NULL != sni_fallback_pemfile) {
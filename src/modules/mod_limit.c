@@ -1,6 +1,13 @@
 /*
  * mod_limit - limit concurrent connections or requests per second
  *
+ * Description:
+ *     counters are kept in process memory (per action), unless the limit has a name: named limits use
+ *     the shared counters from the angel (srv->shm_counters), so all worker processes count together
+ *     and the counters survive instance replacements. limits of the same type with the same name share
+ *     their counters. without angel (or if the shared table is full) named limits are counted in
+ *     process memory too.
+ *
  * Author:
  *     Copyright (c) 2010 Thomas Porzelt
  * License:
@@ -24,6 +31,8 @@ struct mod_limit_context {
 	mod_limit_context_type type;
 	gint limit;
 	gint refcount;
+	GString *name;           /* namespace for shared counters; NULL: not shared */
+	gint full_warned;        /* logged that the shared table is full (atomic) */
 	GMutex *mutex;           /* used when type != ML_TYPE_CON */
 	liPlugin *plugin;
 	liAction *action_limit_reached;
@@ -48,6 +57,14 @@ struct mod_limit_req_ip_data {
 };
 typedef struct mod_limit_req_ip_data mod_limit_req_ip_data;
 
+/* a limit a vrequest is counted in */
+struct mod_limit_vr_entry {
+	mod_limit_context *ctx;
+	gint handle; /* shared counter handle (>= 0); < 0: not counted in a shared counter */
+	gboolean shared; /* counted in a shared rate counter (nothing to release) */
+};
+typedef struct mod_limit_vr_entry mod_limit_vr_entry;
+
 struct mod_limit_data {
 	liWaitQueue *timeout_queues; /* each worker has its own timeout queue */
 };
@@ -87,6 +104,8 @@ static void mod_limit_context_free(liServer *srv, mod_limit_context *ctx) {
 	if (ctx->mutex)
 		g_mutex_free(ctx->mutex);
 
+	if (NULL != ctx->name) g_string_free(ctx->name, TRUE);
+
 	if (ctx->action_limit_reached) {
 		li_action_release(srv, ctx->action_limit_reached);
 	}
@@ -138,7 +157,7 @@ static void mod_limit_timeout_callback(liWaitQueue *wq, gpointer data) {
 }
 
 static void mod_limit_vrclose(liVRequest *vr, liPlugin *p) {
-	GPtrArray *arr = g_ptr_array_index(vr->plugin_ctx, p->id);
+	GArray *arr = g_ptr_array_index(vr->plugin_ctx, p->id);
 	mod_limit_context *ctx;
 	guint i;
 	gint cons;
@@ -150,9 +169,12 @@ static void mod_limit_vrclose(liVRequest *vr, liPlugin *p) {
 		return;
 
 	for (i = 0; i < arr->len; i++) {
-		ctx = g_ptr_array_index(arr, i);
+		mod_limit_vr_entry *entry = &g_array_index(arr, mod_limit_vr_entry, i);
+		ctx = entry->ctx;
 
-		switch (ctx->type) {
+		if (entry->handle >= 0) {
+			li_shm_counters_dec(vr->wrk->srv->shm_counters, entry->handle, li_cur_ts(vr->wrk));
+		} else if (!entry->shared) switch (ctx->type) {
 		case ML_TYPE_CON:
 			g_atomic_int_add(&ctx->pool.con, -1);
 			break;
@@ -185,13 +207,55 @@ static void mod_limit_vrclose(liVRequest *vr, liPlugin *p) {
 		}
 	}
 
-	g_ptr_array_free(arr, TRUE);
+	g_array_free(arr, TRUE);
+}
+
+/* counts the request in the shared counters (sets *limit_reached); returns FALSE if the table is full
+ * and the request has to be counted in process memory instead
+ */
+static gboolean mod_limit_shared(liVRequest *vr, mod_limit_context *ctx, gconstpointer addr, guint32 bits, mod_limit_vr_entry *entry, gboolean *limit_reached) {
+	liShmCounters *counters = vr->wrk->srv->shm_counters;
+	gsize key = li_shm_counters_key(GSTR_LEN(ctx->name), addr, bits / 8);
+	li_tstamp now = li_cur_ts(vr->wrk);
+	gint res = -2;
+
+	switch (ctx->type) {
+	case ML_TYPE_CON:
+	case ML_TYPE_CON_IP:
+		res = li_shm_counters_inc(counters, key, ctx->limit, now);
+		if (-1 == res) {
+			VR_DEBUG(vr, "%s: limit reached (%d active connections)", (ML_TYPE_CON == ctx->type) ? "limit.con" : "limit.con_ip", ctx->limit);
+		} else if (res >= 0) {
+			entry->handle = res;
+		}
+		break;
+	case ML_TYPE_REQ:
+	case ML_TYPE_REQ_IP:
+		res = li_shm_counters_rate(counters, key, ctx->limit, now);
+		if (-1 == res) {
+			VR_DEBUG(vr, "%s: limit reached (%d req/s)", (ML_TYPE_REQ == ctx->type) ? "limit.req" : "limit.req_ip", ctx->limit);
+		} else if (0 == res) {
+			entry->shared = TRUE;
+		}
+		break;
+	}
+
+	if (-2 == res) {
+		if (g_atomic_int_compare_and_exchange(&ctx->full_warned, 0, 1)) {
+			WARNING(vr->wrk->srv, "%s: shared counters are full, counting in process memory (see angel item shared_counters)", ctx->name->str);
+		}
+		return FALSE;
+	}
+
+	*limit_reached = (-1 == res);
+	return TRUE;
 }
 
 static liHandlerResult mod_limit_action_handle(liVRequest *vr, gpointer param, gpointer *context) {
 	gboolean limit_reached = FALSE;
 	mod_limit_context *ctx = (mod_limit_context*) param;
-	GPtrArray *arr = g_ptr_array_index(vr->plugin_ctx, ctx->plugin->id);
+	GArray *arr = g_ptr_array_index(vr->plugin_ctx, ctx->plugin->id);
+	mod_limit_vr_entry entry;
 	gint cons;
 	mod_limit_req_ip_data *rid;
 	liSocketAddress *remote_addr = &vr->coninfo->remote_addr;
@@ -226,11 +290,16 @@ static liHandlerResult mod_limit_action_handle(liVRequest *vr, gpointer param, g
 
 	if (!arr) {
 		/* request is not in any context yet, create new array */
-		arr = g_ptr_array_sized_new(2);
+		arr = g_array_sized_new(FALSE, FALSE, sizeof(mod_limit_vr_entry), 2);
 		g_ptr_array_index(vr->plugin_ctx, ctx->plugin->id) = arr;
 	}
 
-	switch (ctx->type) {
+	entry.ctx = ctx;
+	entry.handle = -1;
+	entry.shared = FALSE;
+
+	if (NULL == ctx->name || NULL == vr->wrk->srv->shm_counters
+	    || !mod_limit_shared(vr, ctx, addr, (ML_TYPE_CON_IP == ctx->type || ML_TYPE_REQ_IP == ctx->type) ? bits : 0, &entry, &limit_reached)) switch (ctx->type) {
 	case ML_TYPE_CON:
 #ifdef GLIB_VERSION_2_30
 		/* since 2.30 g_atomic_int_add does the same as g_atomic_int_exchange_and_add,
@@ -310,7 +379,7 @@ static liHandlerResult mod_limit_action_handle(liVRequest *vr, gpointer param, g
 			vr->response.http_status = 503;
 		}
 	} else {
-		g_ptr_array_add(arr, ctx);
+		g_array_append_val(arr, entry);
 		g_atomic_int_inc(&ctx->refcount);
 	}
 
@@ -330,6 +399,8 @@ static liAction* mod_limit_action_create(liServer *srv, liPlugin *p, mod_limit_c
 	mod_limit_context *ctx;
 	gint limit = 0;
 	liAction *action_limit_reached = NULL;
+	GString *name = NULL;
+	guint len;
 
 	val = li_value_get_single_argument(val);
 	val = li_value_get_single_argument(val);
@@ -337,21 +408,38 @@ static liAction* mod_limit_action_create(liServer *srv, liPlugin *p, mod_limit_c
 	if (LI_VALUE_NUMBER == li_value_type(val) && val->data.number > 0) {
 		/* limit.* N; */
 		limit = val->data.number;
-		action_limit_reached = NULL;
 	} else if (LI_VALUE_LIST == li_value_type(val)
-			&& li_value_list_has_len(val, 2)
+			&& ((len = li_value_list_len(val)) == 2 || len == 3)
 			&& LI_VALUE_NUMBER == li_value_list_type_at(val, 0)
 			&& li_value_list_at(val, 0)->data.number > 0
-			&& LI_VALUE_ACTION == li_value_list_type_at(val, 1)) {
-
+			&& (LI_VALUE_ACTION == li_value_list_type_at(val, 1) || (2 == len && LI_VALUE_STRING == li_value_list_type_at(val, 1)))
+			&& (2 == len || LI_VALUE_STRING == li_value_list_type_at(val, 2))) {
+		/* limit.* (N, action); limit.* (N, "name"); limit.* (N, action, "name"); */
 		limit = li_value_list_at(val, 0)->data.number;
-		action_limit_reached = li_value_extract_action(li_value_list_at(val, 1));
+		if (LI_VALUE_ACTION == li_value_list_type_at(val, 1)) {
+			action_limit_reached = li_value_extract_action(li_value_list_at(val, 1));
+		}
+		if (LI_VALUE_STRING == li_value_list_type_at(val, len - 1)) {
+			name = li_value_list_at(val, len - 1)->data.string;
+			if (0 == name->len) {
+				ERROR(srv, "%s: the name must not be empty", act_names[type]);
+				if (NULL != action_limit_reached) li_action_release(srv, action_limit_reached);
+				return NULL;
+			}
+		}
 	} else {
-		ERROR(srv, "%s expects either an integer > 0 as parameter, or a list of (int > 0,action)", act_names[type]);
+		ERROR(srv, "%s expects either an integer > 0 as parameter, or a list of (int > 0, action), (int > 0, name) or (int > 0, action, name)", act_names[type]);
 		return NULL;
 	}
 
 	ctx = mod_limit_context_new(type, limit, action_limit_reached, p);
+	if (NULL != name) {
+		/* the user given name identifies the shared counters in all processes, after a restart and
+		 * for the copies created for each worker (lua.handler) */
+		ctx->name = g_string_sized_new(31);
+		g_string_printf(ctx->name, "%s:%s", act_names[type], name->str);
+		g_atomic_int_set(&srv->shm_counters_wanted, 1);
+	}
 
 	return li_action_new_function(mod_limit_action_handle, NULL, mod_limit_action_free, ctx);
 }
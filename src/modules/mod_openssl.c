@@ -192,10 +192,17 @@ static liThrottleState* openssl_tcp_throttle_in(liConnection *con) {
 	return conctx->sock_stream->throttle_in;
 }
 
+static void openssl_tcp_trim(liConnection *con) {
+	openssl_connection_ctx *conctx = con->con_sock.data;
+	if (NULL == conctx) return;
+	li_connection_simple_tcp_trim(con, &conctx->simple_socket_data);
+}
+
 static const liConnectionSocketCallbacks openssl_tcp_cbs = {
 	openssl_tcp_finished,
 	openssl_tcp_throttle_out,
-	openssl_tcp_throttle_in
+	openssl_tcp_throttle_in,
+	openssl_tcp_trim
 };
 
 static gboolean openssl_con_new(liConnection *con, int fd) {
@@ -1,6 +1,9 @@
 /*
  * mod_progress - track connection progress (state) via a unique identifier
  *
+ * The progress of tracked requests is published by the worker handling the request
+ * into a table shared by all workers, so progress.show doesn't need to ask other workers.
+ *
  * Todo:
  *     - stop waitqueues
  *     - "dump" format to return an array of all tracked requests?
@@ -26,17 +29,21 @@ typedef enum {
 	PROGRESS_FORMAT_DUMP
 } mod_progress_format;
 
+/* the lookup table is shared by all workers, split into shards with their own lock */
+#define PROGRESS_SHARDS 64
+/* how often (seconds) a worker publishes the counters of the requests it tracks */
+#define PROGRESS_UPDATE_INTERVAL 0.25
+
+typedef struct mod_progress_state mod_progress_state;
 typedef struct mod_progress_node mod_progress_node;
+typedef struct mod_progress_waiter mod_progress_waiter;
+typedef struct mod_progress_shard mod_progress_shard;
 typedef struct mod_progress_data mod_progress_data;
 typedef struct mod_progress_worker_data mod_progress_worker_data;
 typedef struct mod_progress_show_param mod_progress_show_param;
-typedef struct mod_progress_job mod_progress_job;
 
-struct mod_progress_node {
-	gchar *id; /* unique id */
-	liWaitQueueElem timeout_queue_elem;
-	mod_progress_worker_data *worker_data;
-	liVRequest *vr; /* null in case of tombstone. otherwise the following vars will not be valid! */
+struct mod_progress_state {
+	gboolean done;
 	goffset request_size;
 	goffset response_size;
 	guint64 bytes_in;
@@ -44,17 +51,54 @@ struct mod_progress_node {
 	gint status_code;
 };
 
+/* a node belongs to the worker of the tracked request; it is in the update_queue of that worker
+ * while the request is running and in its timeout_queue afterwards (until the ttl is over)
+ */
+struct mod_progress_node {
+	gchar *id; /* unique id */
+	guint shard;
+	mod_progress_worker_data *worker_data;
+	liVRequest *vr; /* null in case of tombstone */
+	liWaitQueueElem update_queue_elem, timeout_queue_elem;
+
+	/* written only by the owning worker, others read it with progress_state_read (seqlock) */
+	mod_progress_state state;
+	gint state_seq; /* odd while state gets written */
+
+	/* long-poll requests waiting for a change (mod_progress_waiter), protected by the shard lock */
+	GQueue waiters;
+	gint waiting; /* length of waiters, atomic access */
+};
+
+struct mod_progress_waiter {
+	GList link; /* in node->waiters */
+	mod_progress_node *node; /* NULL after wakeup; protected by the shard lock */
+	guint shard;
+	liVRequest *vr;
+	liJobRef *vr_ref;
+	liWaitQueueElem timeout_queue_elem;
+	mod_progress_worker_data *worker_data;
+};
+
+struct mod_progress_shard {
+	GMutex *lock;
+	GHashTable *hash_table; /* id => mod_progress_node* */
+};
+
 struct mod_progress_data {
 	liPlugin *p;
 	guint ttl;
+	guint long_poll;
 	mod_progress_worker_data *worker_data;
+	mod_progress_shard shards[PROGRESS_SHARDS];
 };
 
 struct mod_progress_worker_data {
 	mod_progress_data *pd;
 	guint wrk_ndx;
-	GHashTable *hash_table;
+	liWaitQueue update_queue; /* running tracked requests of this worker */
 	liWaitQueue timeout_queue; /* each worker has its own timeout queue */
+	liWaitQueue poll_queue; /* long-poll requests of this worker */
 };
 
 struct mod_progress_show_param {
@@ -62,57 +106,153 @@ struct mod_progress_show_param {
 	mod_progress_format format;
 };
 
-struct mod_progress_job {
-	liVRequest *vr;
-	gpointer *context;
-	gboolean debug;
-	mod_progress_format format;
+/* global data */
 
-	gchar *id;
-	liPlugin *p;
-};
+static void progress_state_read(mod_progress_node *node, mod_progress_state *dest) {
+	li_seqlock_read(&node->state_seq, dest, &node->state, sizeof(*dest));
+}
 
-/* global data */
+static void progress_state_live(liVRequest *vr, mod_progress_state *state) {
+	state->done = FALSE;
+	state->request_size = vr->request.content_length;
+	state->response_size = (NULL != vr->backend_source) ? vr->backend_source->out->bytes_out : 0;
+	state->bytes_in = vr->coninfo->req->out->bytes_in;
+	state->bytes_out = MAX(0, vr->coninfo->resp->out->bytes_in - vr->coninfo->out_queue_length);
+	state->status_code = vr->response.http_status;
+}
 
-static void progress_timeout_callback(liWaitQueue *wq, gpointer data) {
-	mod_progress_worker_data *wrk_data = data;
+static void progress_state_done(liVRequest *vr, mod_progress_state *state) {
+	state->done = TRUE;
+	state->request_size = vr->request.content_length;
+	state->response_size = vr->coninfo->resp->out->bytes_in;
+	state->bytes_in = vr->coninfo->req->out->bytes_in;
+	state->bytes_out = MAX(0, vr->coninfo->resp->out->bytes_in - vr->coninfo->out_queue_length);
+	state->status_code = vr->response.http_status;
+}
+
+/* shard lock must be held */
+static void progress_node_wake_locked(mod_progress_node *node) {
+	GList *link;
+
+	while (NULL != (link = g_queue_pop_head_link(&node->waiters))) {
+		mod_progress_waiter *waiter = link->data;
+		waiter->node = NULL;
+		g_atomic_int_add(&node->waiting, -1);
+		li_job_async(waiter->vr_ref);
+	}
+}
+
+/* owning worker: publish a new state and wake long-poll requests if something changed */
+static void progress_node_publish(mod_progress_node *node, const mod_progress_state *state) {
+	mod_progress_shard *shard;
+
+	if (node->state.done == state->done && node->state.bytes_in == state->bytes_in && node->state.bytes_out == state->bytes_out
+		&& node->state.request_size == state->request_size && node->state.response_size == state->response_size
+		&& node->state.status_code == state->status_code) {
+		return;
+	}
+
+	li_seqlock_write(&node->state_seq, &node->state, state, sizeof(*state));
+
+	if (0 == g_atomic_int_get(&node->waiting)) return;
+
+	shard = &node->worker_data->pd->shards[node->shard];
+	g_mutex_lock(shard->lock);
+	progress_node_wake_locked(node);
+	g_mutex_unlock(shard->lock);
+}
+
+/* owning worker */
+static void progress_node_free(mod_progress_node *node) {
+	mod_progress_worker_data *wd = node->worker_data;
+	mod_progress_shard *shard = &wd->pd->shards[node->shard];
+
+	g_mutex_lock(shard->lock);
+	/* the id might have been taken over by a newer request */
+	if (node == g_hash_table_lookup(shard->hash_table, node->id)) {
+		g_hash_table_remove(shard->hash_table, node->id);
+	}
+	progress_node_wake_locked(node);
+	g_mutex_unlock(shard->lock);
+
+	li_waitqueue_remove(&wd->update_queue, &(node->update_queue_elem));
+	li_waitqueue_remove(&wd->timeout_queue, &(node->timeout_queue_elem));
+	g_free(node->id);
+	g_slice_free(mod_progress_node, node);
+}
+
+static void progress_update_callback(liWaitQueue *wq, gpointer data) {
 	liWaitQueueElem *wqe;
 	mod_progress_node *node;
+	mod_progress_state state;
+	UNUSED(data);
 
 	while ((wqe = li_waitqueue_pop(wq)) != NULL) {
 		node = wqe->data;
-		g_hash_table_remove(wrk_data->hash_table, node->id);
+		progress_state_live(node->vr, &state);
+		progress_node_publish(node, &state);
+		li_waitqueue_push(wq, wqe);
 	}
 
 	li_waitqueue_update(wq);
 }
 
-static void progress_hashtable_free_callback(gpointer data) {
-	mod_progress_node *node = data;
-	mod_progress_worker_data *wd = node->worker_data;
+static void progress_timeout_callback(liWaitQueue *wq, gpointer data) {
+	liWaitQueueElem *wqe;
+	UNUSED(data);
 
-	if (node->vr) {
-		g_ptr_array_index(node->vr->plugin_ctx, wd->pd->p->id) = NULL;
+	while ((wqe = li_waitqueue_pop(wq)) != NULL) {
+		progress_node_free(wqe->data);
 	}
 
-	li_waitqueue_remove(&wd->timeout_queue, &(node->timeout_queue_elem));
-	g_free(node->id);
-	g_slice_free(mod_progress_node, node);
+	li_waitqueue_update(wq);
+}
+
+static void progress_poll_timeout_callback(liWaitQueue *wq, gpointer data) {
+	liWaitQueueElem *wqe;
+	UNUSED(data);
+
+	while ((wqe = li_waitqueue_pop(wq)) != NULL) {
+		mod_progress_waiter *waiter = wqe->data;
+		/* progress_show answers with the current state */
+		li_vrequest_joblist_append(waiter->vr);
+	}
+
+	li_waitqueue_update(wq);
+}
+
+static void progress_waiter_free(mod_progress_waiter *waiter) {
+	mod_progress_shard *shard = &waiter->worker_data->pd->shards[waiter->shard];
+
+	g_mutex_lock(shard->lock);
+	if (NULL != waiter->node) {
+		g_queue_unlink(&waiter->node->waiters, &waiter->link);
+		g_atomic_int_add(&waiter->node->waiting, -1);
+		waiter->node = NULL;
+	}
+	g_mutex_unlock(shard->lock);
+
+	li_waitqueue_remove(&waiter->worker_data->poll_queue, &waiter->timeout_queue_elem);
+	li_job_ref_release(waiter->vr_ref);
+	g_slice_free(mod_progress_waiter, waiter);
+}
+
+static guint progress_shard_ndx(const gchar *id) {
+	return g_str_hash(id) % PROGRESS_SHARDS;
 }
 
 static void progress_vrclose(liVRequest *vr, liPlugin *p) {
 	mod_progress_node *node = (mod_progress_node*) g_ptr_array_index(vr->plugin_ctx, p->id);
-	mod_progress_data *pd = p->data;
+	mod_progress_state state;
 
 	if (node) {
 		/* connection is being tracked, replace with tombstone */
+		g_ptr_array_index(vr->plugin_ctx, p->id) = NULL;
 		node->vr = NULL;
-		node->request_size = vr->request.content_length;
-		node->response_size = vr->coninfo->resp->out->bytes_in;
-		node->bytes_in = vr->coninfo->req->out->bytes_in;
-		node->bytes_out = MAX(0, vr->coninfo->resp->out->bytes_in - vr->coninfo->out_queue_length);
-		node->status_code = vr->response.http_status;
-		li_waitqueue_push(&pd->worker_data[vr->wrk->ndx].timeout_queue, &(node->timeout_queue_elem));
+		progress_state_done(vr, &state);
+		progress_node_publish(node, &state);
+		li_waitqueue_remove(&node->worker_data->update_queue, &(node->update_queue_elem));
+		li_waitqueue_push(&node->worker_data->timeout_queue, &(node->timeout_queue_elem));
 	}
 }
 
@@ -134,12 +274,23 @@ static liHandlerResult progress_track(liVRequest *vr, gpointer param, gpointer *
 	} else if (li_querystring_find(vr->request.uri.query, CONST_STR_LEN("X-Progress-Id"), &id, &id_len) && id_len <= 128) {
 		/* progress id found, start tracking of connection */
 		mod_progress_node *node = g_slice_new0(mod_progress_node);
+		mod_progress_shard *shard;
+
+		node->update_queue_elem.data = node;
 		node->timeout_queue_elem.data = node;
 		node->id = g_strndup(id, id_len);
+		node->shard = progress_shard_ndx(node->id);
 		node->worker_data = &pd->worker_data[vr->wrk->ndx];
 		node->vr = vr;
+		progress_state_live(vr, &node->state);
 		g_ptr_array_index(vr->plugin_ctx, pd->p->id) = node;
-		g_hash_table_replace(node->worker_data->hash_table, node->id, node);
+
+		shard = &pd->shards[node->shard];
+		g_mutex_lock(shard->lock);
+		g_hash_table_replace(shard->hash_table, node->id, node);
+		g_mutex_unlock(shard->lock);
+
+		li_waitqueue_push(&node->worker_data->update_queue, &(node->update_queue_elem));
 
 		if (debug)
 			VR_DEBUG(vr, "progress.track: tracking progress with id \"%s\"", node->id);
@@ -161,166 +312,129 @@ static liAction* progress_track_create(liServer *srv, liWorker *wrk, liPlugin* p
 	return li_action_new_function(progress_track, NULL, NULL, p);
 }
 
+/* state is NULL if the id is unknown */
+static void progress_show_output(liVRequest *vr, mod_progress_format format, gboolean debug, const gchar *id, const mod_progress_state *state) {
+	GString *output = g_string_sized_new(128);
 
-/* the CollectFunc */
-static gpointer progress_collect_func(liWorker *wrk, gpointer fdata) {
-	mod_progress_node *node, *node_new;
-	mod_progress_job *job = fdata;
-	mod_progress_data *pd = job->p->data;
-
-	node = g_hash_table_lookup(pd->worker_data[wrk->ndx].hash_table, job->id);
-
-	if (!node)
-		return NULL;
+	/* send mime-type. there seems to be no standard for javascript... using the most commong */
+	li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/x-javascript"));
 
-	node_new = g_slice_new0(mod_progress_node);
+	if (format == PROGRESS_FORMAT_LEGACY) {
+		g_string_append_len(output, CONST_STR_LEN("new Object("));
+	} else if (format == PROGRESS_FORMAT_JSONP) {
+		gchar *val;
+		guint len;
 
-	if (node->vr) {
-		/* copy live data */
-		node_new->vr = node->vr;
-		node_new->request_size = node->vr->request.content_length;
-		node_new->response_size = (NULL != node->vr->backend_source) ? node->vr->backend_source->out->bytes_out : 0;
-		node_new->bytes_in = node->vr->coninfo->req->out->bytes_in;
-		node_new->bytes_out = MAX(0, node->vr->coninfo->resp->out->bytes_in - node->vr->coninfo->out_queue_length);
-		node_new->status_code = node->vr->response.http_status;
-	} else {
-		/* copy dead data */
-		*node_new = *node;
-	}
-
-	return node_new;
-}
+		if (li_querystring_find(vr->request.uri.query, CONST_STR_LEN("X-Progress-Callback"), &val, &len)) {
+			/* X-Progress-Callback specified, need to check for xss */
+			gchar *c;
 
-/* the CollectCallback */
-static void progress_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result, gboolean complete) {
-	guint i;
-	GString *output;
-	mod_progress_node *node = NULL;
-	mod_progress_job *job = fdata;
-	liVRequest *vr = job->vr;
-	gboolean debug = job->debug;
-	mod_progress_format format = job->format;
-
-	UNUSED(cbdata);
-
-	if (complete) {
-		/* clear context so it doesn't get cleaned up anymore */
-		*(job->context) = NULL;
-
-		for (i = 0; i < result->len; i++) {
-			node = g_ptr_array_index(result, i);
-			if (node)
+			for (c = val; c != val+len; c++) {
+				if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '.' || *c == '_')
+					continue;
 				break;
-		}
-
-		output = g_string_sized_new(128);
-
-		/* send mime-type. there seems to be no standard for javascript... using the most commong */
-		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/x-javascript"));
-
-		if (format == PROGRESS_FORMAT_LEGACY) {
-			g_string_append_len(output, CONST_STR_LEN("new Object("));
-		} else if (format == PROGRESS_FORMAT_JSONP) {
-			gchar *val;
-			guint len;
-
-			if (li_querystring_find(vr->request.uri.query, CONST_STR_LEN("X-Progress-Callback"), &val, &len)) {
-				/* X-Progress-Callback specified, need to check for xss */
-				gchar *c;
-
-				for (c = val; c != val+len; c++) {
-					if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '.' || *c == '_')
-						continue;
-					break;
-				}
-
-				/* was there a bad char? */
-				if (c != val+len) {
-					g_string_append_len(output, CONST_STR_LEN("progress("));
-				} else {
-					g_string_append_len(output,val, len);
-					g_string_append_c(output, '(');
-				}
-			} else {
-				g_string_append_len(output, CONST_STR_LEN("progress("));
 			}
-		}
 
-		if (!node) {
-			/* progress id not known */
-			if (debug)
-				VR_DEBUG(vr, "progress.show: progress id \"%s\" unknown", job->id);
-			
-			g_string_append_len(output, CONST_STR_LEN("{\"state\": \"unknown\"}"));
-		} else {
-			if (debug)
-				VR_DEBUG(vr, "progress.show: progress id \"%s\" found", job->id);
-
-			if (node->vr) {
-				/* still in progress */
-				g_string_append_printf(output,
-					"{\"state\": \"running\", \"received\": %"G_GUINT64_FORMAT", \"sent\": %"G_GUINT64_FORMAT", \"request_size\": %"G_GUINT64_FORMAT", \"response_size\": %"G_GUINT64_FORMAT"}",
-					node->bytes_in, node->bytes_out, node->request_size, node->response_size
-				);
-			} else if (node->status_code == 200) {
-				/* done, success */
-				g_string_append_printf(output,
-					"{\"state\": \"done\", \"received\": %"G_GUINT64_FORMAT", \"sent\": %"G_GUINT64_FORMAT", \"request_size\": %"G_GUINT64_FORMAT", \"response_size\": %"G_GUINT64_FORMAT"}",
-					node->bytes_in, node->bytes_out, node->request_size, node->response_size
-				);
+			/* was there a bad char? */
+			if (c != val+len) {
+				g_string_append_len(output, CONST_STR_LEN("progress("));
 			} else {
-				/* done, error */
-				g_string_append_printf(output,
-					"{\"state\": \"error\", \"status\": %d}",
-					node->status_code
-				);
+				g_string_append_len(output,val, len);
+				g_string_append_c(output, '(');
 			}
+		} else {
+			g_string_append_len(output, CONST_STR_LEN("progress("));
 		}
+	}
 
-		if (format == PROGRESS_FORMAT_LEGACY || format == PROGRESS_FORMAT_JSONP) {
-			g_string_append_c(output, ')');
-		}
+	if (!state) {
+		/* progress id not known */
+		if (debug)
+			VR_DEBUG(vr, "progress.show: progress id \"%s\" unknown", id);
 
-		if (li_vrequest_handle_direct(vr)) {
-			vr->response.http_status = 200;
-			li_chunkqueue_append_string(vr->direct_out, output);
-			li_vrequest_joblist_append(vr);
+		g_string_append_len(output, CONST_STR_LEN("{\"state\": \"unknown\"}"));
+	} else {
+		if (debug)
+			VR_DEBUG(vr, "progress.show: progress id \"%s\" found", id);
+
+		if (!state->done) {
+			/* still in progress */
+			g_string_append_printf(output,
+				"{\"state\": \"running\", \"received\": %"G_GUINT64_FORMAT", \"sent\": %"G_GUINT64_FORMAT", \"request_size\": %"G_GUINT64_FORMAT", \"response_size\": %"G_GUINT64_FORMAT"}",
+				state->bytes_in, state->bytes_out, state->request_size, state->response_size
+			);
+		} else if (state->status_code == 200) {
+			/* done, success */
+			g_string_append_printf(output,
+				"{\"state\": \"done\", \"received\": %"G_GUINT64_FORMAT", \"sent\": %"G_GUINT64_FORMAT", \"request_size\": %"G_GUINT64_FORMAT", \"response_size\": %"G_GUINT64_FORMAT"}",
+				state->bytes_in, state->bytes_out, state->request_size, state->response_size
+			);
 		} else {
-			g_string_free(output, TRUE);
+			/* done, error */
+			g_string_append_printf(output,
+				"{\"state\": \"error\", \"status\": %d}",
+				state->status_code
+			);
 		}
 	}
 
-	/* free results */
-	for (i = 0; i < result->len; i++) {
-		if (g_ptr_array_index(result, i))
-			g_slice_free(mod_progress_node, g_ptr_array_index(result, i));
+	if (format == PROGRESS_FORMAT_LEGACY || format == PROGRESS_FORMAT_JSONP) {
+		g_string_append_c(output, ')');
 	}
 
-	g_free(job->id);
-	g_slice_free(mod_progress_job, job);
+	if (li_vrequest_handle_direct(vr)) {
+		vr->response.http_status = 200;
+		li_chunkqueue_append_string(vr->direct_out, output);
+	} else {
+		g_string_free(output, TRUE);
+	}
 }
 
-static liHandlerResult progress_collect_cleanup(liVRequest *vr, gpointer param, gpointer context) {
-	liCollectInfo *ci = (liCollectInfo*) context;
+/* long-poll: the client passes the "received" value it already knows with X-Progress-Received */
+static gboolean progress_show_wait_for(liVRequest *vr, guint64 *received) {
+	gchar *val, buf[32];
+	guint len;
+
+	if (!li_querystring_find(vr->request.uri.query, CONST_STR_LEN("X-Progress-Received"), &val, &len)) return FALSE;
+	if (0 == len || len >= sizeof(buf)) return FALSE;
+
+	memcpy(buf, val, len);
+	buf[len] = '\0';
+	*received = g_ascii_strtoull(buf, NULL, 10);
+
+	return TRUE;
+}
+
+static liHandlerResult progress_show_cleanup(liVRequest *vr, gpointer param, gpointer context) {
+	mod_progress_waiter *waiter = context;
 
 	UNUSED(vr);
 	UNUSED(param);
 
-	li_collect_break(ci);
+	if (NULL != waiter) progress_waiter_free(waiter);
 
 	return LI_HANDLER_GO_ON;
 }
 
 static liHandlerResult progress_show(liVRequest *vr, gpointer param, gpointer *context) {
 	mod_progress_show_param *psp = (mod_progress_show_param*) param;
+	mod_progress_data *pd = psp->p->data;
 	gboolean debug = _OPTION(vr, psp->p, 0).boolean;
+	gboolean woken = FALSE;
 	gchar *id;
 	guint id_len;
-	liCollectInfo *ci;
-	mod_progress_job *job;
-
-	if (*context)
-		return LI_HANDLER_WAIT_FOR_EVENT;
+	GString *key = vr->wrk->tmp_str;
+	mod_progress_shard *shard;
+	mod_progress_node *node;
+	mod_progress_state state;
+	guint64 received;
+
+	if (*context) {
+		/* woken up by a change, the long-poll timeout or the end of the tracked request */
+		progress_waiter_free(*context);
+		*context = NULL;
+		woken = TRUE;
+	}
 
 	if (li_vrequest_is_handled(vr))
 		return LI_HANDLER_GO_ON;
@@ -331,19 +445,46 @@ static liHandlerResult progress_show(liVRequest *vr, gpointer param, gpointer *c
 		return LI_HANDLER_GO_ON;
 	}
 
-	/* start collect job */
-	job = g_slice_new(mod_progress_job);
-	job->vr = vr;
-	job->context = context;
-	job->format = psp->format;
-	job->debug = debug;
+	g_string_truncate(key, 0);
+	g_string_append_len(key, id, id_len);
+	shard = &pd->shards[progress_shard_ndx(key->str)];
+
+	g_mutex_lock(shard->lock);
+	node = g_hash_table_lookup(shard->hash_table, key->str);
+	if (NULL != node) progress_state_read(node, &state);
+
+	if (NULL != node && !state.done && !woken && pd->long_poll > 0
+		&& progress_show_wait_for(vr, &received) && received == state.bytes_in) {
+		/* nothing new yet: wait until the owning worker publishes a change */
+		mod_progress_waiter *waiter = g_slice_new0(mod_progress_waiter);
+		waiter->link.data = waiter;
+		waiter->node = node;
+		waiter->shard = progress_shard_ndx(key->str);
+		waiter->vr = vr;
+		waiter->vr_ref = li_vrequest_get_ref(vr);
+		waiter->timeout_queue_elem.data = waiter;
+		waiter->worker_data = &pd->worker_data[vr->wrk->ndx];
+		g_queue_push_tail_link(&node->waiters, &waiter->link);
+		g_atomic_int_inc(&node->waiting);
+
+		/* the owner doesn't lock if nobody was waiting: check again after registering */
+		progress_state_read(node, &state);
+		if (state.done || received != state.bytes_in) {
+			g_mutex_unlock(shard->lock);
+			progress_waiter_free(waiter);
+		} else {
+			g_mutex_unlock(shard->lock);
+			li_waitqueue_push(&waiter->worker_data->poll_queue, &waiter->timeout_queue_elem);
+			*context = waiter;
+			return LI_HANDLER_WAIT_FOR_EVENT;
+		}
+	} else {
+		g_mutex_unlock(shard->lock);
+	}
 
-	job->p = psp->p;
-	job->id = g_strndup(id, id_len);
+	progress_show_output(vr, psp->format, debug, key->str, NULL != node ? &state : NULL);
 
-	ci = li_collect_start(vr->wrk, progress_collect_func, job, progress_collect_cb, NULL);
-	*context = ci; /* may be NULL */
-	return ci ? LI_HANDLER_WAIT_FOR_EVENT : LI_HANDLER_GO_ON;
+	return LI_HANDLER_GO_ON;
 }
 
 static void progress_show_free(liServer *srv, gpointer param) {
@@ -384,7 +525,7 @@ static liAction* progress_show_create(liServer *srv, liWorker *wrk, liPlugin* p,
 	psp->format = format;
 	psp->p = p;
 
-	return li_action_new_function(progress_show, progress_collect_cleanup, progress_show_free, psp);
+	return li_action_new_function(progress_show, progress_show_cleanup, progress_show_free, psp);
 }
 
 static gboolean progress_methods_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, liOptionValue *oval) {
@@ -443,6 +584,22 @@ static gboolean progress_ttl(liServer *srv, liPlugin* p, liValue *val, gpointer
 	return TRUE;
 }
 
+static gboolean progress_long_poll(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	mod_progress_data *pd = p->data;
+	UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 0) {
+		ERROR(srv, "progress.long_poll: expected non-negative number, got %s", li_value_type_string(val));
+		return FALSE;
+	}
+
+	pd->long_poll = val->data.number;
+
+	return TRUE;
+}
+
 static void progress_prepare(liServer *srv, liPlugin *p) {
 	mod_progress_data *pd = p->data;
 	guint i;
@@ -453,8 +610,9 @@ static void progress_prepare(liServer *srv, liPlugin *p) {
 
 		pd->worker_data[i].pd = pd;
 		pd->worker_data[i].wrk_ndx = i;
-		pd->worker_data[i].hash_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, progress_hashtable_free_callback);
+		li_waitqueue_init(&(pd->worker_data[i].update_queue), &wrk->loop, "mod_progress update queue", progress_update_callback, PROGRESS_UPDATE_INTERVAL, &pd->worker_data[i]);
 		li_waitqueue_init(&(pd->worker_data[i].timeout_queue), &wrk->loop, "mod_progress cleanup queue", progress_timeout_callback, pd->ttl, &pd->worker_data[i]);
+		li_waitqueue_init(&(pd->worker_data[i].poll_queue), &wrk->loop, "mod_progress long-poll queue", progress_poll_timeout_callback, pd->long_poll, &pd->worker_data[i]);
 	}
 }
 
@@ -479,6 +637,7 @@ static const liPluginAction actions[] = {
 
 static const liPluginSetup setups[] = {
 	{ "progress.ttl", progress_ttl, NULL },
+	{ "progress.long_poll", progress_long_poll, NULL },
 
 	{ NULL, NULL, NULL }
 };
@@ -487,21 +646,41 @@ static void plugin_progress_free(liServer *srv, liPlugin *p) {
 	guint i;
 	mod_progress_data *pd = p->data;
 
-	for (i = 0; i < srv->worker_count; i++) {
-		g_hash_table_destroy(pd->worker_data[i].hash_table);
+	if (pd->worker_data) {
+		for (i = 0; i < srv->worker_count; i++) {
+			mod_progress_worker_data *wd = &pd->worker_data[i];
+			liWaitQueueElem *wqe;
+
+			/* every node is in one of these queues of its worker */
+			while (NULL != (wqe = li_waitqueue_pop_force(&wd->update_queue))) progress_node_free(wqe->data);
+			while (NULL != (wqe = li_waitqueue_pop_force(&wd->timeout_queue))) progress_node_free(wqe->data);
+		}
+
+		g_slice_free1(sizeof(mod_progress_worker_data) * srv->worker_count, pd->worker_data);
+	}
+
+	for (i = 0; i < PROGRESS_SHARDS; i++) {
+		g_hash_table_destroy(pd->shards[i].hash_table);
+		g_mutex_free(pd->shards[i].lock);
 	}
 
-	g_slice_free1(sizeof(mod_progress_worker_data) * srv->worker_count, pd->worker_data);
 	g_slice_free(mod_progress_data, pd);
 }
 
 static void plugin_progress_init(liServer *srv, liPlugin *p, gpointer userdata) {
 	mod_progress_data *pd = g_slice_new0(mod_progress_data);
+	guint i;
 	UNUSED(srv); UNUSED(userdata);
 
 	p->data = pd;
 	pd->p = p;
 	pd->ttl = 30;
+	pd->long_poll = 0;
+
+	for (i = 0; i < PROGRESS_SHARDS; i++) {
+		pd->shards[i].lock = g_mutex_new();
+		pd->shards[i].hash_table = g_hash_table_new(g_str_hash, g_str_equal);
+	}
 
 	p->options = options;
 	p->optionptrs = optionptrs;
@@ -24,6 +24,9 @@ struct scgi_context {
 	liBackendPool *pool;
 
 	GString *socket_str;
+
+	liEnvironmentPrefixCache *env_prefixes; /* pre-encoded constant variables */
+	gint env_size_hint; /* size of the last header netstring, atomic access */
 };
 
 
@@ -44,17 +47,44 @@ static gboolean append_key_value_pair(GByteArray *a, const gchar *key, size_t ke
 	return TRUE;
 }
 
+/* envdup is NULL if the request has no environment entries */
 static void scgi_env_add(GByteArray *buf, liEnvironmentDup *envdup, const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
 	GString *sval;
 
-	if (NULL != (sval = li_environment_dup_pop(envdup, key, keylen))) {
+	if (NULL != envdup && NULL != (sval = li_environment_dup_pop(envdup, key, keylen))) {
 		append_key_value_pair(buf, key, keylen, GSTR_LEN(sval));
 	} else {
 		append_key_value_pair(buf, key, keylen, val, valuelen);
 	}
 }
 
-static void scgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray* buf) {
+typedef struct scgi_env_param scgi_env_param;
+struct scgi_env_param {
+	GByteArray *buf;
+	liEnvironmentDup *envdup;
+};
+
+static void scgi_env_add_cb(gpointer param, const gchar *key, size_t keylen, const gchar *val, size_t valuelen) {
+	scgi_env_param *p = param;
+	scgi_env_add(p->buf, p->envdup, key, keylen, val, valuelen);
+}
+
+/* the variables which don't depend on the request (only on server.tag) */
+static void scgi_env_create_constant(GByteArray *buf, liEnvironmentDup *envdup, GString *tag) {
+	scgi_env_add(buf, envdup, CONST_STR_LEN("SCGI"), CONST_STR_LEN("1"));
+	scgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_SOFTWARE"), GSTR_LEN(tag));
+	scgi_env_add(buf, envdup, CONST_STR_LEN("GATEWAY_INTERFACE"), CONST_STR_LEN("CGI/1.1"));
+	scgi_env_add(buf, envdup, CONST_STR_LEN("REDIRECT_STATUS"), CONST_STR_LEN("200")); /* if php is compiled with --force-redirect */
+}
+
+static const gchar * const scgi_env_constant_keys[] = { "SCGI", "SERVER_SOFTWARE", "GATEWAY_INTERFACE", "REDIRECT_STATUS", NULL };
+
+static void scgi_env_prefix_create(GByteArray *buf, GString *tag) {
+	scgi_env_create_constant(buf, NULL, tag);
+}
+
+/* prefix: pre-encoded constant variables, NULL to add them one by one */
+static void scgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray* buf, GByteArray *prefix) {
 	liConInfo *coninfo = vr->coninfo;
 	GString *tmp = vr->wrk->tmp_str;
 
@@ -65,12 +95,14 @@ static void scgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray
 		scgi_env_add(buf, envdup, CONST_STR_LEN("CONTENT_LENGTH"), GSTR_LEN(tmp));
 	}
 
-	scgi_env_add(buf, envdup, CONST_STR_LEN("SCGI"), CONST_STR_LEN("1"));
+	if (NULL != prefix) {
+		g_byte_array_append(buf, prefix->data, prefix->len);
+	} else {
+		scgi_env_create_constant(buf, envdup, CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string);
+	}
 
 
-	scgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_SOFTWARE"), GSTR_LEN(CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string));
 	scgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_NAME"), GSTR_LEN(vr->request.uri.host));
-	scgi_env_add(buf, envdup, CONST_STR_LEN("GATEWAY_INTERFACE"), CONST_STR_LEN("CGI/1.1"));
 	{
 		guint port = 0;
 		switch (coninfo->local_addr.addr->plain.sa_family) {
@@ -121,7 +153,6 @@ static void scgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray
 	scgi_env_add(buf, envdup, CONST_STR_LEN("QUERY_STRING"), GSTR_LEN(vr->request.uri.query));
 
 	scgi_env_add(buf, envdup, CONST_STR_LEN("REQUEST_METHOD"), GSTR_LEN(vr->request.http_method_str));
-	scgi_env_add(buf, envdup, CONST_STR_LEN("REDIRECT_STATUS"), CONST_STR_LEN("200")); /* if php is compiled with --force-redirect */
 	switch (vr->request.http_version) {
 	case LI_HTTP_VERSION_1_1:
 		scgi_env_add(buf, envdup, CONST_STR_LEN("SERVER_PROTOCOL"), CONST_STR_LEN("HTTP/1.1"));
@@ -137,44 +168,30 @@ static void scgi_env_create(liVRequest *vr, liEnvironmentDup *envdup, GByteArray
 	}
 }
 
-static void fix_header_name(GString *str) {
-	guint i, len = str->len;
-	gchar *s = str->str;
-	for (i = 0; i < len; i++) {
-		if (g_ascii_isalpha(s[i])) {
-			s[i] = g_ascii_toupper(s[i]);
-		} else if (!g_ascii_isdigit(s[i])) {
-			s[i] = '_';
-		}
-	}
-}
+/* the netstring is encoded into one buffer, sized by the previous request; the length prefix goes
+ * into the worker scratch buffer */
+static void scgi_send_env(liVRequest *vr, scgi_context *ctx, liChunkQueue *out) {
+	GByteArray *buf;
+	liEnvironmentDup *envdup = NULL;
+	GByteArray *prefix;
+	gint size_hint = g_atomic_int_get(&ctx->env_size_hint);
 
-static void scgi_send_env(liVRequest *vr, liChunkQueue *out) {
-	GByteArray *buf = g_byte_array_sized_new(0);
-	liEnvironmentDup *envdup;
-	GString *tmp = vr->wrk->tmp_str;
+	buf = g_byte_array_sized_new(size_hint > 0 ? (guint) size_hint : 1024);
 
-	envdup = li_environment_make_dup(&vr->env);
-	scgi_env_create(vr, envdup, buf);
+	/* nothing to override if the environment is empty (the common case) */
+	if (0 != g_hash_table_size(vr->env.table)) envdup = li_environment_make_dup(&vr->env);
+
+	prefix = li_environment_prefix_cache_get(ctx->env_prefixes, envdup, CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string);
+	scgi_env_create(vr, envdup, buf, prefix);
 
 	{
-		GList *i;
-
-		for (i = vr->request.headers->entries.head; NULL != i; i = i->next) {
-			liHttpHeader *h = (liHttpHeader*) i->data;
-			const GString hkey = li_const_gstring(h->data->str, h->keylen);
-			g_string_truncate(tmp, 0);
-			if (!li_strncase_equal(&hkey, CONST_STR_LEN("CONTENT-TYPE"))) {
-				g_string_append_len(tmp, CONST_STR_LEN("HTTP_"));
-			}
-			g_string_append_len(tmp, h->data->str, h->keylen);
-			fix_header_name(tmp);
-
-			scgi_env_add(buf, envdup, GSTR_LEN(tmp), h->data->str + h->keylen+2, h->data->len - (h->keylen+2));
-		}
+		scgi_env_param param;
+		param.buf = buf;
+		param.envdup = envdup;
+		li_environment_cgi_headers(vr, scgi_env_add_cb, &param);
 	}
 
-	{
+	if (NULL != envdup) {
 		GHashTableIter i;
 		gpointer key, val;
 
@@ -182,16 +199,23 @@ static void scgi_send_env(liVRequest *vr, liChunkQueue *out) {
 		while (g_hash_table_iter_next(&i, &key, &val)) {
 			append_key_value_pair(buf, GSTR_LEN((GString*) key), GSTR_LEN((GString*) val));
 		}
+
+		li_environment_dup_free(envdup);
 	}
 
-	li_environment_dup_free(envdup);
+	li_environment_cgi_account(vr, buf->len);
 
-	g_string_printf(tmp, "%u:", buf->len);
-	li_chunkqueue_append_mem(out, GSTR_LEN(tmp));
+	{
+		liBuffer *lenbuf = li_worker_scratch_buffer(vr->wrk, 16);
+		gint len = g_snprintf(lenbuf->addr + lenbuf->used, 16, "%u:", buf->len);
+		lenbuf->used += len;
+		li_chunkqueue_append_buffer2(out, lenbuf, lenbuf->used - len, len);
+	}
 	{
 		const guint8 c = ',';
 		g_byte_array_append(buf, &c, 1);
 	}
+	g_atomic_int_set(&ctx->env_size_hint, (gint) MIN(buf->len + 64, 65536u));
 	li_chunkqueue_append_bytearr(out, buf);
 }
 
@@ -238,6 +262,7 @@ static scgi_context* scgi_context_new(liServer *srv, GString *dest_socket) {
 	ctx->refcount = 1;
 	ctx->pool = li_backend_pool_new(config);
 	ctx->socket_str = g_string_new_len(GSTR_LEN(dest_socket));
+	ctx->env_prefixes = li_environment_prefix_cache_new(scgi_env_prefix_create, scgi_env_constant_keys);
 
 	return ctx;
 }
@@ -248,6 +273,9 @@ static void scgi_context_release(scgi_context *ctx) {
 	if (g_atomic_int_dec_and_test(&ctx->refcount)) {
 		li_backend_pool_free(ctx->pool);
 		g_string_free(ctx->socket_str, TRUE);
+
+		li_environment_prefix_cache_free(ctx->env_prefixes);
+
 		g_slice_free(scgi_context, ctx);
 	}
 }
@@ -304,7 +332,7 @@ static void scgi_connection_new(liVRequest *vr, liBackendConnection *bcon, scgi_
 
 	li_stream_connect(outplug, &iostream->stream_out);
 
-	scgi_send_env(vr, outplug->out);
+	scgi_send_env(vr, ctx, outplug->out);
 	li_stream_notify_later(outplug);
 
 	http_out = li_stream_http_response_handle(&iostream->stream_in, vr, TRUE, FALSE);
@@ -23,8 +23,8 @@ LI_API gboolean mod_status_init(liModules *mods, liModule *mod);
 LI_API gboolean mod_status_free(liModules *mods, liModule *mod);
 
 static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_info, GPtrArray *result, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count);
-static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count);
-static GString *status_info_auto(liVRequest *vr, guint uptime, liStatistics *totals, guint *connection_count);
+static GString *status_info_plain(liVRequest *vr, guint uptime, const liWorkerSnapshot *sum);
+static GString *status_info_auto(liVRequest *vr, guint uptime, const liWorkerSnapshot *sum);
 static liHandlerResult status_info_runtime(liVRequest *vr, liPlugin *p);
 static gint str_comp(gconstpointer a, gconstpointer b);
 
@@ -144,6 +144,23 @@ static const gchar html_worker_row_avg[] =
 	"				<td>%s</td>\n"
 	"				<td>%u</td>\n"
 	"			</tr>\n";
+static const gchar html_pools_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\"></th>\n"
+	"				<th style=\"width: 175px;\">Pooled connections</th>\n"
+	"				<th style=\"width: 175px;\">Pooled vrequests</th>\n"
+	"				<th style=\"width: 175px;\">Trimmed connections</th>\n"
+	"				<th style=\"width: 175px;\">Connection memory</th>\n"
+	"			</tr>\n";
+static const gchar html_pools_row[] =
+	"			<tr class=\"%s\">\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td>%u</td>\n"
+	"				<td>%u</td>\n"
+	"				<td>%u</td>\n"
+	"				<td>%s</td>\n"
+	"			</tr>\n";
 static const gchar html_connections_sum[] =
 	"		<table cellspacing=\"0\">\n"
 	"			<tr>\n"
@@ -197,6 +214,7 @@ static const gchar html_connections_th[] =
 	"				<th><span class=\"string\" onclick=\"sort(this, 0); return false;\">Method</span><span></span></th>\n"
 	"				<th><span class=\"int\" onclick=\"sort(this, 0); return false;\">Request Size</span><span></span></th>\n"
 	"				<th><span class=\"int\" onclick=\"sort(this, 0); return false;\">Response Size</span><span></span></th>\n"
+	"				<th><span class=\"int\" onclick=\"sort(this, 0); return false;\">Memory</span><span></span></th>\n"
 	"			</tr>\n";
 static const gchar html_connections_row[] =
 	"			<tr>\n"
@@ -211,6 +229,7 @@ static const gchar html_connections_row[] =
 	"				<td><span>%s</span></td>\n"
 	"				<td><span value=\"%"G_GUINT64_FORMAT"\">%s</span></td>\n"
 	"				<td><span value=\"%"G_GUINT64_FORMAT"\">%s</span></td>\n"
+	"				<td><span value=\"%"G_GUINT64_FORMAT"\">%s</span></td>\n"
 	"			</tr>\n";
 
 
@@ -258,6 +277,17 @@ static const gchar html_libinfo_row[] =
 	"				<td style=\"text-align: center;\">%s</td>\n"
 	"				<td style=\"text-align: center;\">%s</td>\n"
 	"			</tr>\n";
+static const gchar html_sockets_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 250px;\">address</th>\n"
+	"				<th style=\"width: 400px;\">options</th>\n"
+	"			</tr>\n";
+static const gchar html_sockets_row[] =
+	"			<tr>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"			</tr>\n";
 static const gchar html_libev_th[] =
 	"		<table cellspacing=\"0\">\n"
 	"			<tr>\n"
@@ -351,6 +381,7 @@ struct mod_status_con_data {
 	guint64 bytes_out;
 	guint64 bytes_in_5s_diff;
 	guint64 bytes_out_5s_diff;
+	guint64 memory;
 };
 
 struct mod_status_wrk_data {
@@ -358,6 +389,9 @@ struct mod_status_wrk_data {
 	liStatistics stats;
 	GArray *connections;
 	guint connection_count[LI_CON_STATE_LAST+1];
+	guint64 connection_memory;
+	guint connections_trimmed;
+	guint connections_pooled, vrequests_pooled;
 };
 
 struct mod_status_job {
@@ -368,6 +402,53 @@ struct mod_status_job {
 };
 
 
+static void status_stats_add(liStatistics *totals, const liStatistics *stats) {
+	totals->bytes_out += stats->bytes_out;
+	totals->bytes_in += stats->bytes_in;
+	totals->requests += stats->requests;
+	totals->actions_executed += stats->actions_executed;
+	totals->backend_envs += stats->backend_envs;
+	totals->backend_env_bytes += stats->backend_env_bytes;
+	totals->backend_env_max = MAX(totals->backend_env_max, stats->backend_env_max);
+	totals->backend_env_headers_filtered += stats->backend_env_headers_filtered;
+
+	totals->requests_5s_diff += stats->requests_5s_diff;
+	totals->bytes_in_5s_diff += stats->bytes_in_5s_diff;
+	totals->bytes_out_5s_diff += stats->bytes_out_5s_diff;
+	totals->active_cons_cum += stats->active_cons_cum;
+	totals->active_cons_5s += stats->active_cons_5s;
+
+	totals->peak.bytes_out += stats->peak.bytes_out;
+	totals->peak.bytes_in += stats->peak.bytes_in;
+	totals->peak.requests += stats->peak.requests;
+	totals->peak.active_cons += stats->peak.active_cons;
+}
+
+/* sums up the last published snapshots of all workers; doesn't wait for any worker */
+static void status_snapshot_totals(liServer *srv, liWorkerSnapshot *sum) {
+	liWorkerSnapshot snap;
+	guint i, j;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for (i = 0; i < srv->worker_count; i++) {
+		liWorker *wrk = g_array_index(srv->workers, liWorker*, i);
+
+		li_collect_snapshot_want_memory(wrk);
+		li_collect_snapshot_read(wrk, &snap);
+
+		status_stats_add(&sum->stats, &snap.stats);
+		sum->connections_active += snap.connections_active;
+		for (j = 0; j <= LI_CON_STATE_LAST; ++j) {
+			sum->connection_count[j] += snap.connection_count[j];
+		}
+		sum->connections_trimmed += snap.connections_trimmed;
+		sum->connection_memory += snap.connection_memory;
+		sum->connections_pooled += snap.connections_pooled;
+		sum->vrequests_pooled += snap.vrequests_pooled;
+	}
+}
+
 /* the CollectFunc */
 static gpointer status_collect_func(liWorker *wrk, gpointer fdata) {
 	mod_status_wrk_data *sd = g_slice_new0(mod_status_wrk_data);
@@ -376,6 +457,8 @@ static gpointer status_collect_func(liWorker *wrk, gpointer fdata) {
 
 	sd->stats = wrk->stats;
 	sd->worker_ndx = wrk->ndx;
+	sd->connections_pooled = wrk->connections->len - wrk->connections_active;
+	sd->vrequests_pooled = wrk->vrequest_pool.length;
 	/* gather connection info */
 	sd->connections = g_array_sized_new(FALSE, TRUE, sizeof(mod_status_con_data), wrk->connections_active);
 	g_array_set_size(sd->connections, wrk->connections_active);
@@ -386,17 +469,30 @@ static gpointer status_collect_func(liWorker *wrk, gpointer fdata) {
 		cd->keep_alive = c->info.keep_alive;
 		cd->remote_addr_str = g_string_new_len(GSTR_LEN(c->info.remote_addr_str));
 		cd->local_addr_str = g_string_new_len(GSTR_LEN(c->info.local_addr_str));
-		cd->host = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.host));
-		cd->path = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.path));
-		cd->query = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.query));
-		cd->method = c->mainvr->request.http_method;
-		cd->request_size = c->mainvr->request.content_length;
-		cd->response_size = (NULL != c->mainvr->backend_source) ? c->mainvr->backend_source->out->bytes_out : 0;
+		if (NULL != c->mainvr) {
+			cd->host = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.host));
+			cd->path = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.path));
+			cd->query = g_string_new_len(GSTR_LEN(c->mainvr->request.uri.query));
+			cd->method = c->mainvr->request.http_method;
+			cd->request_size = c->mainvr->request.content_length;
+			cd->response_size = (NULL != c->mainvr->backend_source) ? c->mainvr->backend_source->out->bytes_out : 0;
+		} else {
+			/* trimmed idle connection */
+			sd->connections_trimmed++;
+			cd->host = g_string_sized_new(0);
+			cd->path = g_string_sized_new(0);
+			cd->query = g_string_sized_new(0);
+			cd->method = LI_HTTP_METHOD_UNSET;
+			cd->request_size = -1;
+			cd->response_size = 0;
+		}
 		cd->state = c->state;
 		cd->bytes_in = c->info.stats.bytes_in;
 		cd->bytes_out = c->info.stats.bytes_out;
 		cd->bytes_in_5s_diff = c->info.stats.bytes_in_5s_diff;
 		cd->bytes_out_5s_diff = c->info.stats.bytes_out_5s_diff;
+		cd->memory = li_connection_memory_usage(c);
+		sd->connection_memory += cd->memory;
 
 		cd->ts_started = (guint64)(now - c->ts_started);
 
@@ -446,8 +542,7 @@ static void status_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result
 		return;
 	} else {
 		GString *html;
-		gchar *val;
-		guint uptime, len;
+		guint uptime;
 		guint total_connections = 0;
 		guint connection_count[LI_CON_STATE_LAST+1] = {0};
 
@@ -456,7 +551,8 @@ static void status_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result
 			G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0),
 			G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0),
 			0, 0, {G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0)},
-			G_GUINT64_CONSTANT(0), 0, 0
+			G_GUINT64_CONSTANT(0), 0, 0,
+			G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0)
 		};
 
 		/* clear context so it doesn't get cleaned up anymore */
@@ -475,38 +571,16 @@ static void status_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result
 		for (i = 0; i < result->len; i++) {
 			mod_status_wrk_data *sd = g_ptr_array_index(result, i);
 
-			totals.bytes_out += sd->stats.bytes_out;
-			totals.bytes_in += sd->stats.bytes_in;
-			totals.requests += sd->stats.requests;
-			totals.actions_executed += sd->stats.actions_executed;
+			status_stats_add(&totals, &sd->stats);
 			total_connections += sd->connections->len;
 
-			totals.requests_5s_diff += sd->stats.requests_5s_diff;
-			totals.bytes_in_5s_diff += sd->stats.bytes_in_5s_diff;
-			totals.bytes_out_5s_diff += sd->stats.bytes_out_5s_diff;
-			totals.active_cons_cum += sd->stats.active_cons_cum;
-			totals.active_cons_5s += sd->stats.active_cons_5s;
-
-			totals.peak.bytes_out += sd->stats.peak.bytes_out;
-			totals.peak.bytes_in += sd->stats.peak.bytes_in;
-			totals.peak.requests += sd->stats.peak.requests;
-			totals.peak.active_cons += sd->stats.peak.active_cons;
-
 			for (j = 0; j <= LI_CON_STATE_LAST; ++j) {
 				connection_count[j] += sd->connection_count[j];
 			}
 		}
 
-		if (li_querystring_find(vr->request.uri.query, CONST_STR_LEN("format"), &val, &len) && strncmp(val, "plain", len) == 0) {
-			/* show plain text page */
-			html = status_info_plain(vr, uptime, &totals, total_connections, &connection_count[0]);
-		} else if (li_strncase_equal(vr->request.uri.query, CONST_STR_LEN("auto"))) {
-			/* show auto text page */
-			html = status_info_auto(vr, uptime, &totals, &connection_count[0]);
-		} else {
-			/* show full html page */
-			html = status_info_full(vr, p, short_info, result, uptime, &totals, total_connections, &connection_count[0]);
-		}
+		/* show full html page (plain and auto pages are built from the snapshots, see status_info) */
+		html = status_info_full(vr, p, short_info, result, uptime, &totals, total_connections, &connection_count[0]);
 
 		LI_FORCE_ASSERT(li_vrequest_handle_direct(vr));
 		vr->response.http_status = 200;
@@ -713,6 +787,29 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 	g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
 
 
+	/* object pools and connection memory */
+	if (!short_info) {
+		guint pooled_cons = 0, pooled_vrs = 0, trimmed = 0;
+		guint64 con_mem = 0;
+
+		g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Pools</strong> (unused objects kept for reuse)</div>\n"));
+		g_string_append_len(html, CONST_STR_LEN(html_pools_th));
+		for (i = 0; i < result->len; i++) {
+			mod_status_wrk_data *sd = g_ptr_array_index(result, i);
+			li_counter_format(sd->connection_memory, COUNTER_BYTES, count_mem);
+			g_string_printf(tmpstr, "Worker #%u", i+1);
+			g_string_append_printf(html, html_pools_row, "", tmpstr->str,
+				sd->connections_pooled, sd->vrequests_pooled, sd->connections_trimmed, count_mem->str);
+			pooled_cons += sd->connections_pooled;
+			pooled_vrs += sd->vrequests_pooled;
+			trimmed += sd->connections_trimmed;
+			con_mem += sd->connection_memory;
+		}
+		li_counter_format(con_mem, COUNTER_BYTES, count_mem);
+		g_string_append_printf(html, html_pools_row, "totals", "Total", pooled_cons, pooled_vrs, trimmed, count_mem->str);
+		g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+	}
+
 	/* connection counts */
 	g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Connections</strong> (states, sum)</div>\n"));
 	g_string_append_printf(html, html_connections_sum,
@@ -732,7 +829,7 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 	/* list connections */
 	if (!short_info) {
 		GString *ts_started, *ts_timeout, *bytes_in, *bytes_out, *bytes_in_5s, *bytes_out_5s;
-		GString *req_len, *resp_len;
+		GString *req_len, *resp_len, *memory;
 
 		ts_started = g_string_sized_new(15);
 		ts_timeout = g_string_sized_new(15);
@@ -742,6 +839,7 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 		bytes_out_5s = g_string_sized_new(10);
 		req_len = g_string_sized_new(10);
 		resp_len = g_string_sized_new(10);
+		memory = g_string_sized_new(10);
 
 		g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Active connections</strong></div>\n"));
 		g_string_append_len(html, CONST_STR_LEN(html_connections_th));
@@ -759,6 +857,7 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 				li_counter_format(cd->bytes_out_5s_diff / G_GUINT64_CONSTANT(5), COUNTER_BYTES, bytes_out_5s);
 				li_counter_format(cd->request_size, COUNTER_BYTES, req_len);
 				li_counter_format(cd->response_size, COUNTER_BYTES, resp_len);
+				li_counter_format(cd->memory, COUNTER_BYTES, memory);
 
 				g_string_append_printf(html, html_connections_row,
 					cd->remote_addr_str->str,
@@ -775,7 +874,8 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 					cd->bytes_out_5s_diff / G_GUINT64_CONSTANT(5), bytes_out_5s->str,
 					(cd->state >= LI_CON_STATE_HANDLE_MAINVR) ? li_http_method_string(cd->method, &len) : "",
 					cd->request_size != -1 ? cd->request_size : 0, (cd->state >= LI_CON_STATE_HANDLE_MAINVR && cd->request_size != -1) ? req_len->str : "",
-					cd->response_size, (cd->state >= LI_CON_STATE_HANDLE_MAINVR) ? resp_len->str : ""
+					cd->response_size, (cd->state >= LI_CON_STATE_HANDLE_MAINVR) ? resp_len->str : "",
+					cd->memory, memory->str
 				);
 			}
 		}
@@ -790,6 +890,7 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 		g_string_free(bytes_out_5s, TRUE);
 		g_string_free(req_len, TRUE);
 		g_string_free(resp_len, TRUE);
+		g_string_free(memory, TRUE);
 	}
 
 	g_string_append_len(html, CONST_STR_LEN(
@@ -807,7 +908,9 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 	return html;
 }
 
-static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count) {
+static GString *status_info_plain(liVRequest *vr, guint uptime, const liWorkerSnapshot *sum) {
+	const liStatistics *totals = &sum->stats;
+	const guint *connection_count = sum->connection_count;
 	GString *html;
 
 	html = g_string_sized_new(1024 - 1);
@@ -824,7 +927,23 @@ static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *to
 	g_string_append_len(html, CONST_STR_LEN("\ntraffic_in_abs: "));
 	li_string_append_int(html, totals->bytes_in);
 	g_string_append_len(html, CONST_STR_LEN("\nconnections_abs: "));
-	li_string_append_int(html, total_connections);
+	li_string_append_int(html, sum->connections_active);
+	g_string_append_len(html, CONST_STR_LEN("\nconnections_memory: "));
+	li_string_append_int(html, sum->connection_memory);
+	g_string_append_len(html, CONST_STR_LEN("\nconnections_trimmed: "));
+	li_string_append_int(html, sum->connections_trimmed);
+	g_string_append_len(html, CONST_STR_LEN("\nconnections_pooled: "));
+	li_string_append_int(html, sum->connections_pooled);
+	g_string_append_len(html, CONST_STR_LEN("\nvrequests_pooled: "));
+	li_string_append_int(html, sum->vrequests_pooled);
+	g_string_append_len(html, CONST_STR_LEN("\nbackend_envs_abs: "));
+	li_string_append_int(html, totals->backend_envs);
+	g_string_append_len(html, CONST_STR_LEN("\nbackend_env_bytes_abs: "));
+	li_string_append_int(html, totals->backend_env_bytes);
+	g_string_append_len(html, CONST_STR_LEN("\nbackend_env_bytes_max: "));
+	li_string_append_int(html, totals->backend_env_max);
+	g_string_append_len(html, CONST_STR_LEN("\nbackend_env_headers_filtered: "));
+	li_string_append_int(html, totals->backend_env_headers_filtered);
 	/* average since start */
 	g_string_append_len(html, CONST_STR_LEN("\n\n# Average Values (since start)\nrequests_avg: "));
 	li_string_append_int(html, totals->requests / uptime);
@@ -873,7 +992,9 @@ static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *to
 	return html;
 }
 
-static GString *status_info_auto(liVRequest *vr, guint uptime, liStatistics *totals, guint *connection_count) {
+static GString *status_info_auto(liVRequest *vr, guint uptime, const liWorkerSnapshot *sum) {
+	const liStatistics *totals = &sum->stats;
+	const guint *connection_count = sum->connection_count;
 	GString *html;
 	guint i, j;
 
@@ -932,7 +1053,28 @@ static liHandlerResult status_info(liVRequest *vr, gpointer _param, gpointer *co
 
 	have_mode = li_querystring_find(vr->request.uri.query, CONST_STR_LEN("mode"), &val, &len);
 
-	if (!have_mode) {
+	if (!have_mode && ((li_querystring_find(vr->request.uri.query, CONST_STR_LEN("format"), &val, &len) && strncmp(val, "plain", len) == 0)
+		|| li_strncase_equal(vr->request.uri.query, CONST_STR_LEN("auto")))) {
+		/* plain and auto pages only need aggregated values: answer from the snapshots without waiting for the workers */
+		liWorkerSnapshot sum;
+		GString *html;
+		guint uptime = li_cur_ts(vr->wrk) - vr->wrk->srv->started;
+		if (!uptime)
+			uptime = 1;
+
+		status_snapshot_totals(vr->wrk->srv, &sum);
+
+		if (li_strncase_equal(vr->request.uri.query, CONST_STR_LEN("auto"))) {
+			html = status_info_auto(vr, uptime, &sum);
+		} else {
+			html = status_info_plain(vr, uptime, &sum);
+		}
+
+		LI_FORCE_ASSERT(li_vrequest_handle_direct(vr));
+		vr->response.http_status = 200;
+		li_chunkqueue_append_string(vr->direct_out, html);
+		return LI_HANDLER_GO_ON;
+	} else if (!have_mode) {
 		/* no 'mode' query parameter given */
 		liCollectInfo *ci;
 		mod_status_job *j = g_slice_new(mod_status_job);
@@ -1164,6 +1306,30 @@ static liHandlerResult status_info_runtime(liVRequest *vr, liPlugin *p) {
 		g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
 	}
 
+	/* listening sockets */
+	{
+		liServer *srv = vr->wrk->srv;
+		guint i;
+
+		g_string_append_len(html, CONST_STR_LEN("		<div class=\"title\"><strong>Listening sockets</strong></div>\n"));
+		g_string_append_len(html, CONST_STR_LEN(html_sockets_th));
+
+		for (i = 0; i < srv->sockets->len; i++) {
+			liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+
+			li_sockaddr_to_string(sock->local_addr, tmp_str, TRUE);
+			g_string_truncate(vr->wrk->tmp_str, 0);
+			if (NULL != sock->listen_options) {
+				/* one "key=value" per line */
+				li_string_encode_append(sock->listen_options->str, vr->wrk->tmp_str, LI_ENCODING_HTML);
+				g_strdelimit(vr->wrk->tmp_str->str, "\n", ' ');
+			}
+			g_string_append_printf(html, html_sockets_row, tmp_str->str, vr->wrk->tmp_str->len ? vr->wrk->tmp_str->str : "defaults");
+		}
+
+		g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+	}
+
 	/* list modules */
 	{
 		guint i, col;
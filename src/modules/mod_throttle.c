@@ -17,6 +17,7 @@ typedef struct {
 	guint plugin_id;
 
 	guint rate, burst;
+	GString *name; /* namespace for shared pools; NULL: not shared */
 
 	guint masklen_ipv4, masklen_ipv6;
 	liRadixTree *ipv4_pools; /* <refcounted_pool_entry> */
@@ -52,6 +53,45 @@ static gboolean sanity_check(liServer *srv, guint64 rate, guint64 burst) {
 	return TRUE;
 }
 
+/* pools are only shared between processes if the user gives them a name, which identifies them in
+ * all processes, after a restart and for the copies created for each worker (lua.handler) */
+static GString* throttle_pool_name(liServer *srv, const gchar *action, GString *name) {
+	GString *result;
+
+	if (NULL == name) return NULL;
+
+	result = g_string_sized_new(31);
+	g_string_printf(result, "%s:%s", action, name->str);
+	g_atomic_int_set(&srv->shm_counters_wanted, 1);
+
+	return result;
+}
+
+/* parses "rate" or ("rate", "name"); *name is NULL if not given */
+static gboolean throttle_parse_rate_name(liServer *srv, const gchar *action, liValue *val, gint64 *rate, GString **name) {
+	val = li_value_get_single_argument(val);
+	*name = NULL;
+
+	if (LI_VALUE_LIST == li_value_type(val) && li_value_list_has_len(val, 2)
+			&& LI_VALUE_NUMBER == li_value_list_type_at(val, 0)
+			&& LI_VALUE_STRING == li_value_list_type_at(val, 1)) {
+		*name = li_value_list_at(val, 1)->data.string;
+		val = li_value_list_at(val, 0);
+		if (0 == (*name)->len) {
+			ERROR(srv, "'%s' action: the name must not be empty", action);
+			return FALSE;
+		}
+	}
+
+	if (LI_VALUE_NUMBER != li_value_type(val)) {
+		ERROR(srv, "'%s' action expects a number or a list (number, name) as parameter, %s given", action, li_value_type_string(val));
+		return FALSE;
+	}
+
+	*rate = val->data.number;
+	return TRUE;
+}
+
 static liThrottleState* vr_get_throttle_out_state(liVRequest *vr) {
 	return vr->coninfo->callbacks->throttle_out(vr);
 }
@@ -61,7 +101,7 @@ static liThrottleState* vr_get_throttle_out_state(liVRequest *vr) {
 /*   manage pool per CIDR block                              */
 /*************************************************************/
 
-static throttle_ip_pools *ip_pools_new(guint plugin_id, guint rate, guint burst, guint masklen_ipv4, guint masklen_ipv6) {
+static throttle_ip_pools *ip_pools_new(guint plugin_id, guint rate, guint burst, guint masklen_ipv4, guint masklen_ipv6, GString *name) {
 	throttle_ip_pools *pools = g_slice_new0(throttle_ip_pools);
 	pools->refcount = 1;
 	pools->lock = g_mutex_new();
@@ -70,6 +110,7 @@ static throttle_ip_pools *ip_pools_new(guint plugin_id, guint rate, guint burst,
 	pools->burst = burst;
 	pools->masklen_ipv4 = masklen_ipv4;
 	pools->masklen_ipv6 = masklen_ipv6;
+	pools->name = name;
 	pools->ipv4_pools = li_radixtree_new();
 	pools->ipv6_pools = li_radixtree_new();
 	return pools;
@@ -81,6 +122,7 @@ static void ip_pools_free(throttle_ip_pools *pools) {
 	if (g_atomic_int_dec_and_test(&pools->refcount)) {
 		g_mutex_free(pools->lock);
 		pools->lock = NULL;
+		if (NULL != pools->name) g_string_free(pools->name, TRUE);
 
 		/* entries keep references, so radix trees must be empty */
 		li_radixtree_free(pools->ipv4_pools, NULL, NULL);
@@ -89,6 +131,17 @@ static void ip_pools_free(throttle_ip_pools *pools) {
 	}
 }
 
+/* key of the CIDR block addr/masklen in the shared counters */
+static gsize ip_pool_shared_key(throttle_ip_pools *pools, gconstpointer addr, guint masklen) {
+	guchar masked[16];
+	guint bytes = (masklen + 7) / 8;
+
+	memcpy(masked, addr, bytes);
+	if (0 != (masklen % 8)) masked[bytes - 1] &= (guchar) (0xff << (8 - (masklen % 8)));
+
+	return li_shm_counters_key(GSTR_LEN(pools->name), masked, bytes);
+}
+
 static refcounted_pool_entry* create_ip_pool(liServer *srv, throttle_ip_pools *pools, liSocketAddress *remote_addr) {
 	refcounted_pool_entry *result;
 
@@ -116,8 +169,10 @@ static refcounted_pool_entry* create_ip_pool(liServer *srv, throttle_ip_pools *p
 
 			if (remote_addr->addr->plain.sa_family == AF_INET) {
 				li_radixtree_insert(pools->ipv4_pools, &remote_addr->addr->ipv4.sin_addr.s_addr, pools->masklen_ipv4, result);
+				if (NULL != pools->name) li_throttle_pool_share(result->pool, ip_pool_shared_key(pools, &remote_addr->addr->ipv4.sin_addr.s_addr, pools->masklen_ipv4));
 			} else {
 				li_radixtree_insert(pools->ipv6_pools, &remote_addr->addr->ipv6.sin6_addr.s6_addr, pools->masklen_ipv6, result);
+				if (NULL != pools->name) li_throttle_pool_share(result->pool, ip_pool_shared_key(pools, &remote_addr->addr->ipv6.sin6_addr.s6_addr, pools->masklen_ipv6));
 			}
 		} else {
 			LI_FORCE_ASSERT(g_atomic_int_get(&result->refcount) > 0);
@@ -187,21 +242,21 @@ static liHandlerResult core_handle_throttle_pool(liVRequest *vr, gpointer param,
 static liAction* core_throttle_pool(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
 	liThrottlePool *pool = NULL;
 	gint64 rate, burst;
+	GString *name;
 	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
 
-	val = li_value_get_single_argument(val);
-
-	if (LI_VALUE_NUMBER != li_value_type(val)) {
-		ERROR(srv, "'io.throttle_pool' action expects a number as parameter, %s given", li_value_type_string(val));
-		return NULL;
-	}
+	if (!throttle_parse_rate_name(srv, "io.throttle_pool", val, &rate, &name)) return NULL;
 
-	rate = val->data.number;
 	burst = rate;
 	if (!sanity_check(srv, rate, burst)) return NULL;
 
 	pool = li_throttle_pool_new(srv, rate, burst);
 
+	if (NULL != (name = throttle_pool_name(srv, "io.throttle_pool", name))) {
+		li_throttle_pool_share(pool, li_shm_counters_key(GSTR_LEN(name), NULL, 0));
+		g_string_free(name, TRUE);
+	}
+
 	return li_action_new_function(core_handle_throttle_pool, NULL, core_throttle_pool_free, pool);
 }
 
@@ -251,20 +306,15 @@ static liAction* core_throttle_ip(liServer *srv, liWorker *wrk, liPlugin* p, liV
 	gint64 rate, burst = 0;
 	guint masklen_ipv4 = 32, masklen_ipv6 = 56;
 	throttle_ip_pools *pools;
+	GString *name;
 	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
 
-	val = li_value_get_single_argument(val);
-
-	if (LI_VALUE_NUMBER != li_value_type(val)) {
-		ERROR(srv, "'io.throttle_ip' action expects a positiv integer as parameter, %s given", li_value_type_string(val));
-		return NULL;
-	}
+	if (!throttle_parse_rate_name(srv, "io.throttle_ip", val, &rate, &name)) return NULL;
 
-	rate = val->data.number;
 	burst = rate;
 	if (!sanity_check(srv, rate, burst)) return NULL;
 
-	pools = ip_pools_new(p->id, rate, burst, masklen_ipv4, masklen_ipv6);
+	pools = ip_pools_new(p->id, rate, burst, masklen_ipv4, masklen_ipv6, throttle_pool_name(srv, "io.throttle_ip", name));
 
 	return li_action_new_function(core_handle_throttle_ip, NULL, core_throttle_ip_free, pools);
 }
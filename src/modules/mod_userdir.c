@@ -29,14 +29,28 @@ struct userdir_part {
 };
 typedef struct userdir_part userdir_part;
 
+struct userdir_config {
+	GArray *parts; /* userdir_part */
+	guint cache_id; /* homedir based docroots are cached per worker */
+};
+typedef struct userdir_config userdir_config;
+
+static void userdir_cache_key(GString *key, userdir_config *uc, const gchar *username, guint username_len) {
+	g_string_truncate(key, 0);
+	li_string_append_int(key, uc->cache_id);
+	g_string_append_c(key, ':');
+	g_string_append_len(key, username, username_len);
+}
+
 static liHandlerResult userdir(liVRequest *vr, gpointer param, gpointer *context) {
 	userdir_part *part;
 	gchar *c;
 	guint i;
-	GArray *parts = param;
+	userdir_config *uc = param;
+	GArray *parts = uc->parts;
 	gchar *username;
 	guint username_len = 0;
-	gboolean has_username;
+	gboolean has_username, cache = FALSE;
 
 	UNUSED(context);
 
@@ -68,6 +82,7 @@ static liHandlerResult userdir(liVRequest *vr, gpointer param, gpointer *context
 		struct passwd pwd;
 		struct passwd *result;
 		gchar c_orig = *(username+username_len);
+		GString *cached;
 
 		/* do not allow root user */
 		if (username_len == 4 && username[0] == 'r' && username[1] == 'o' && username[2] == 'o' && username[3] == 't') {
@@ -78,6 +93,12 @@ static liHandlerResult userdir(liVRequest *vr, gpointer param, gpointer *context
 			return LI_HANDLER_GO_ON;
 		}
 
+		userdir_cache_key(vr->wrk->tmp_str, uc, username, username_len);
+		if (NULL != (cached = li_worker_docroot_cache_lookup(vr->wrk, vr->wrk->tmp_str))) {
+			g_string_append_len(vr->physical.doc_root, GSTR_LEN(cached));
+			goto build_path;
+		}
+
 		*(username+username_len) = '\0';
 		while (EINTR == getpwnam_r(username, &pwd, vr->wrk->tmp_str->str, vr->wrk->tmp_str->allocated_len, &result)) {
 		}
@@ -95,6 +116,7 @@ static liHandlerResult userdir(liVRequest *vr, gpointer param, gpointer *context
 		g_string_append(vr->physical.doc_root, pwd.pw_dir);
 		g_string_append_c(vr->physical.doc_root, G_DIR_SEPARATOR);
 		has_username = TRUE;
+		cache = TRUE;
 	} else {
 		has_username = FALSE;
 	}
@@ -127,6 +149,12 @@ static liHandlerResult userdir(liVRequest *vr, gpointer param, gpointer *context
 	if (vr->physical.doc_root->str[vr->physical.doc_root->len-1] != G_DIR_SEPARATOR)
 		g_string_append_c(vr->physical.doc_root, G_DIR_SEPARATOR);
 
+	if (cache) {
+		userdir_cache_key(vr->wrk->tmp_str, uc, username, username_len);
+		li_worker_docroot_cache_insert(vr->wrk, vr->wrk->tmp_str, vr->physical.doc_root);
+	}
+
+build_path:
 	/* build physical path: docroot + uri.path */
 	g_string_truncate(vr->physical.path, 0);
 	g_string_append_len(vr->physical.path, GSTR_LEN(vr->physical.doc_root));
@@ -145,7 +173,8 @@ static liHandlerResult userdir(liVRequest *vr, gpointer param, gpointer *context
 }
 
 static void userdir_free(liServer *srv, gpointer param) {
-	GArray *parts = param;
+	userdir_config *uc = param;
+	GArray *parts = uc->parts;
 	guint i;
 
 	UNUSED(srv);
@@ -158,6 +187,7 @@ static void userdir_free(liServer *srv, gpointer param) {
 	}
 
 	g_array_free(parts, TRUE);
+	g_slice_free(userdir_config, uc);
 }
 
 static liAction* userdir_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
@@ -165,6 +195,7 @@ static liAction* userdir_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 	gchar *c, *c_last;
 	GArray *parts;
 	userdir_part part;
+	userdir_config *uc;
 	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
 
 	val = li_value_get_single_argument(val);
@@ -220,7 +251,11 @@ static liAction* userdir_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 		g_array_append_val(parts, part);
 	}
 
-	return li_action_new_function(userdir, NULL, userdir_free, parts);
+	uc = g_slice_new(userdir_config);
+	uc->parts = parts;
+	uc->cache_id = li_worker_docroot_cache_id();
+
+	return li_action_new_function(userdir, NULL, userdir_free, uc);
 }
 
 static const liPluginAction actions[] = {
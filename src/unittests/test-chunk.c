@@ -50,10 +50,59 @@ static void test_filter_chunked_decode(void) {
 	li_chunkqueue_free(cq2);
 }
 
+static void test_filter_chunked_decode_extensions(void) {
+	liChunkQueue *cq = li_chunkqueue_new(), *cq2 = li_chunkqueue_new();
+	liFilterChunkedDecodeState decode_state;
+
+	cq_load_str(cq, CONST_STR_LEN(
+		"1A;name=value\r\n"
+		"01234567890123456789abcdef" "\r\n"
+		"0\r\n\r\n"
+	));
+	cq->is_closed = TRUE;
+	memset(&decode_state, 0, sizeof(decode_state));
+	li_chunkqueue_reset(cq2);
+	g_assert(li_filter_chunked_decode(NULL, cq2, cq, &decode_state));
+	g_assert(26 == cq2->length);
+	cq_assert_eq(cq2, CONST_STR_LEN(
+		"01234567890123456789abcdef"
+	));
+	g_assert(cq2->is_closed);
+
+	li_chunkqueue_free(cq);
+	li_chunkqueue_free(cq2);
+}
+
+static void test_filter_chunked_encode(void) {
+	liChunkQueue *cq = li_chunkqueue_new(), *cq2 = li_chunkqueue_new();
+
+	cq_load_str(cq, CONST_STR_LEN("01234567890123456789"));
+	li_filter_chunked_encode(NULL, cq2, cq);
+	g_assert(0 == cq->length);
+
+	li_chunkqueue_append_mem(cq, CONST_STR_LEN("x"));
+	cq->is_closed = TRUE;
+	li_filter_chunked_encode(NULL, cq2, cq);
+	g_assert(cq2->is_closed);
+
+	cq_assert_eq(cq2, CONST_STR_LEN(
+		"14\r\n"
+		"01234567890123456789" "\r\n"
+		"1\r\n"
+		"x" "\r\n"
+		"0\r\n\r\n"
+	));
+
+	li_chunkqueue_free(cq);
+	li_chunkqueue_free(cq2);
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add_func("/chunk/filter_chunked_decode", test_filter_chunked_decode);
+	g_test_add_func("/chunk/filter_chunked_decode_extensions", test_filter_chunked_decode_extensions);
+	g_test_add_func("/chunk/filter_chunked_encode", test_filter_chunked_encode);
 
 	return g_test_run();
 }
@@ -0,0 +1,104 @@
+
+#include <lighttpd/base.h>
+
+#define assert_pass(filter, name) \
+	g_assert(li_environment_header_filter_pass(filter, CONST_STR_LEN(name)))
+#define assert_filtered(filter, name) \
+	g_assert(!li_environment_header_filter_pass(filter, CONST_STR_LEN(name)))
+
+static void test_filter_default(void) {
+	/* no "backend.headers" option: everything passes */
+	assert_pass(NULL, "Host");
+	assert_pass(NULL, "Cookie");
+	assert_pass(NULL, "X-Anything");
+}
+
+static void test_filter_deny(void) {
+	liEnvironmentHeaderFilter *filter = li_environment_header_filter_new();
+
+	li_environment_header_filter_add(filter, FALSE, CONST_STR_LEN("Cookie"));
+	li_environment_header_filter_add(filter, FALSE, CONST_STR_LEN("X-Debug-*"));
+
+	assert_filtered(filter, "Cookie");
+	assert_filtered(filter, "cOOKIE");
+	assert_pass(filter, "Cookie2");
+	assert_pass(filter, "Cooki");
+	assert_filtered(filter, "X-Debug-");
+	assert_filtered(filter, "x-debug-token");
+	assert_pass(filter, "X-Debug");
+	/* no allow entries: everything else passes */
+	assert_pass(filter, "Host");
+
+	li_environment_header_filter_free(filter);
+}
+
+static void test_filter_allow(void) {
+	liEnvironmentHeaderFilter *filter = li_environment_header_filter_new();
+
+	li_environment_header_filter_add(filter, TRUE, CONST_STR_LEN("Host"));
+	li_environment_header_filter_add(filter, TRUE, CONST_STR_LEN("X-*"));
+	li_environment_header_filter_add(filter, FALSE, CONST_STR_LEN("X-Forwarded-For"));
+
+	assert_pass(filter, "Host");
+	assert_pass(filter, "HOST");
+	assert_pass(filter, "X-Requested-With");
+	assert_filtered(filter, "Cookie");
+	assert_filtered(filter, "Hostname");
+	/* deny wins */
+	assert_filtered(filter, "x-forwarded-for");
+
+	li_environment_header_filter_free(filter);
+}
+
+static void test_filter_wildcard(void) {
+	liEnvironmentHeaderFilter *filter = li_environment_header_filter_new();
+
+	li_environment_header_filter_add(filter, FALSE, CONST_STR_LEN("*"));
+
+	assert_filtered(filter, "Host");
+	assert_filtered(filter, "");
+
+	li_environment_header_filter_free(filter);
+}
+
+#define assert_cgi_name(tmp, name, expected) do { \
+		guint cgi_len; \
+		const gchar *cgi = li_environment_cgi_header_name(tmp, CONST_STR_LEN(name), &cgi_len); \
+		g_assert_cmpuint(cgi_len, ==, sizeof(expected) - 1); \
+		g_assert(0 == memcmp(cgi, expected, cgi_len)); \
+	} while (0)
+
+static void test_cgi_header_names(void) {
+	GString *tmp = g_string_sized_new(0);
+
+	/* precomputed names, looked up case-insensitive */
+	assert_cgi_name(tmp, "TE", "HTTP_TE");
+	assert_cgi_name(tmp, "Host", "HTTP_HOST");
+	assert_cgi_name(tmp, "host", "HTTP_HOST");
+	assert_cgi_name(tmp, "Content-Type", "CONTENT_TYPE");
+	assert_cgi_name(tmp, "CONTENT-TYPE", "CONTENT_TYPE");
+	assert_cgi_name(tmp, "Content-Length", "HTTP_CONTENT_LENGTH");
+	assert_cgi_name(tmp, "accept-charset", "HTTP_ACCEPT_CHARSET");
+	assert_cgi_name(tmp, "If-Modified-Since", "HTTP_IF_MODIFIED_SINCE");
+	assert_cgi_name(tmp, "x-forwarded-proto", "HTTP_X_FORWARDED_PROTO");
+	assert_cgi_name(tmp, "Upgrade-Insecure-Requests", "HTTP_UPGRADE_INSECURE_REQUESTS");
+
+	/* built names */
+	assert_cgi_name(tmp, "X-Custom-1.2", "HTTP_X_CUSTOM_1_2");
+	assert_cgi_name(tmp, "x", "HTTP_X");
+	assert_cgi_name(tmp, "Content-Typ", "HTTP_CONTENT_TYP");
+
+	g_string_free(tmp, TRUE);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/environment/filter-default", test_filter_default);
+	g_test_add_func("/environment/filter-deny", test_filter_deny);
+	g_test_add_func("/environment/filter-allow", test_filter_allow);
+	g_test_add_func("/environment/filter-wildcard", test_filter_wildcard);
+	g_test_add_func("/environment/cgi-header-names", test_cgi_header_names);
+
+	return g_test_run();
+}
@@ -0,0 +1,65 @@
+
+#include <lighttpd/base.h>
+
+static liMimetypeTable* test_table(void) {
+	liMimetypeTable *table = li_mimetype_table_new(g_string_new("application/octet-stream"));
+	GString suffix;
+
+	suffix = li_const_gstring(CONST_STR_LEN(".gz"));
+	li_mimetype_table_insert(table, &suffix, g_string_new("application/gzip"));
+	suffix = li_const_gstring(CONST_STR_LEN(".tar.gz"));
+	li_mimetype_table_insert(table, &suffix, g_string_new("application/x-tgz"));
+	suffix = li_const_gstring(CONST_STR_LEN(".txt"));
+	li_mimetype_table_insert(table, &suffix, g_string_new("text/plain"));
+	suffix = li_const_gstring(CONST_STR_LEN("README"));
+	li_mimetype_table_insert(table, &suffix, g_string_new("text/x-readme"));
+	/* override */
+	suffix = li_const_gstring(CONST_STR_LEN(".txt"));
+	li_mimetype_table_insert(table, &suffix, g_string_new("text/plain; charset=utf-8"));
+
+	return li_mimetype_table_compile(table);
+}
+
+#define assert_mimetype(table, filename, expected) \
+	g_assert_cmpstr(li_mimetype_table_lookup(table, CONST_STR_LEN(filename))->str, ==, expected)
+
+static void test_mimetype_lookup(void) {
+	liMimetypeTable *table = test_table();
+
+	assert_mimetype(table, "/a/b.txt", "text/plain; charset=utf-8");
+	assert_mimetype(table, "b.gz", "application/gzip");
+	assert_mimetype(table, "b.tar.gz", "application/x-tgz");
+	assert_mimetype(table, "/doc/README", "text/x-readme");
+	assert_mimetype(table, "txt", "application/octet-stream");
+	assert_mimetype(table, "", "application/octet-stream");
+	assert_mimetype(table, "b.html", "application/octet-stream");
+
+	li_mimetype_table_release(table);
+}
+
+static void test_mimetype_shared(void) {
+	liMimetypeTable *table1 = test_table(), *table2 = test_table(), *table3;
+	GString suffix = li_const_gstring(CONST_STR_LEN(".html"));
+
+	g_assert(table1 == table2);
+
+	table3 = li_mimetype_table_new(g_string_new("application/octet-stream"));
+	li_mimetype_table_insert(table3, &suffix, g_string_new("text/html"));
+	table3 = li_mimetype_table_compile(table3);
+	g_assert(table1 != table3);
+	assert_mimetype(table3, "b.html", "text/html");
+
+	li_mimetype_table_release(table1);
+	assert_mimetype(table2, "b.gz", "application/gzip");
+	li_mimetype_table_release(table2);
+	li_mimetype_table_release(table3);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/mimetype/lookup", test_mimetype_lookup);
+	g_test_add_func("/mimetype/shared", test_mimetype_shared);
+
+	return g_test_run();
+}
@@ -147,6 +147,54 @@ class TestSimplePattern1(CurlRequest):
 respond 403 => "%{req.header[X-Select]}";
 """
 
+class TestRangeSingle(CurlRequest):
+	URL = "/test.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT[4:8]
+	EXPECT_RESPONSE_CODE = 206
+	EXPECT_RESPONSE_HEADERS = [("Content-Range", "bytes 4-7/%i" % len(TEST_TXT))]
+	REQUEST_HEADERS = ["Range: bytes=4-7"]
+	ACCEPT_ENCODING = None
+
+class TestRangeCoalesce(CurlRequest):
+	# overlapping ranges are merged into a single part
+	URL = "/test.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT[4:10]
+	EXPECT_RESPONSE_CODE = 206
+	EXPECT_RESPONSE_HEADERS = [("Content-Range", "bytes 4-9/%i" % len(TEST_TXT))]
+	REQUEST_HEADERS = ["Range: bytes=6-9,4-7"]
+	ACCEPT_ENCODING = None
+
+class TestRangeIfRangeMismatch(CurlRequest):
+	URL = "/test.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT
+	EXPECT_RESPONSE_CODE = 200
+	REQUEST_HEADERS = ["Range: bytes=4-7", "If-Range: \"no-match\""]
+	ACCEPT_ENCODING = None
+
+# ifrange.txt gets a fixed mtime (see Prepare): a wednesday, to catch "Wed," being taken for a weak ETag
+IF_RANGE_MTIME = 1577836800
+IF_RANGE_DATE = "Wed, 01 Jan 2020 00:00:00 GMT"
+IF_RANGE_ETAG = "\"3006132869\"" # li_etag_mutate of the mtime with etag.use ("mtime")
+
+class TestRangeIfRangeETag(CurlRequest):
+	URL = "/ifrange.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT[4:8]
+	EXPECT_RESPONSE_CODE = 206
+	REQUEST_HEADERS = ["Range: bytes=4-7", "If-Range: " + IF_RANGE_ETAG]
+	ACCEPT_ENCODING = None
+	config = """
+etag.use ("mtime");
+defaultaction;
+"""
+
+class TestRangeIfRangeDate(CurlRequest):
+	URL = "/ifrange.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT[4:8]
+	EXPECT_RESPONSE_CODE = 206
+	EXPECT_RESPONSE_HEADERS = [("Last-Modified", IF_RANGE_DATE)]
+	REQUEST_HEADERS = ["Range: bytes=4-7", "If-Range: " + IF_RANGE_DATE]
+	ACCEPT_ENCODING = None
+
 class ProvideStatus(TestBase):
 	runnable = False
 	vhost = "status"
@@ -172,12 +220,19 @@ class Test(GroupTest):
 		TestConditionalHeader1,
 		TestConditionalHeader2,
 		TestSimplePattern1,
+		TestRangeSingle,
+		TestRangeCoalesce,
+		TestRangeIfRangeMismatch,
+		TestRangeIfRangeETag,
+		TestRangeIfRangeDate,
 		ProvideStatus
 	]
 
 	def Prepare(self):
 		self.PrepareFile("www/default/test.txt", TEST_TXT)
 		self.PrepareFile("www/default/test.php", "")
+		ifrange = self.PrepareFile("www/default/ifrange.txt", TEST_TXT)
+		os.utime(ifrange, (IF_RANGE_MTIME, IF_RANGE_MTIME))
 		show_env_info_lua = self.PrepareFile("lua/show_env_info.lua", LUA_SHOW_ENV_INFO)
 		self.plain_config = """
 show_env_info = {{
@@ -70,6 +70,35 @@ show_env_info;
 	EXPECT_RESPONSE_BODY = "%?$%{req.path}"
 	EXPECT_RESPONSE_CODE = 200
 
+class TestPatternLiteral(CurlRequest):
+	config = """
+env.set "INFO" => "no placeholders";
+show_env_info;
+"""
+	URL = "/abc"
+	EXPECT_RESPONSE_BODY = "no placeholders"
+	EXPECT_RESPONSE_CODE = 200
+
+class TestPatternLiteralEscape(CurlRequest):
+	# escapes only, still a literal pattern
+	config = """
+env.set "INFO" => "a\\\\$b\\\\\\\\c\\\\%";
+show_env_info;
+"""
+	URL = "/abc"
+	EXPECT_RESPONSE_BODY = "a$b\\c%"
+	EXPECT_RESPONSE_CODE = 200
+
+class TestPatternGrow(CurlRequest):
+	# result is longer than the initial size hint (and its upper limit)
+	config = """
+env.set "INFO" => "<%{req.query}|%{req.query}>";
+show_env_info;
+"""
+	URL = "/abc?" + ("x" * 3000)
+	EXPECT_RESPONSE_BODY = "<" + ("x" * 3000) + "|" + ("x" * 3000) + ">"
+	EXPECT_RESPONSE_CODE = 200
+
 
 class Test(GroupTest):
 	group = [
@@ -79,4 +108,7 @@ class Test(GroupTest):
 		TestPatternEncodingPath,
 		TestPatternCombine,
 		TestPatternEscape,
+		TestPatternLiteral,
+		TestPatternLiteralEscape,
+		TestPatternGrow,
 	]
@@ -40,6 +40,33 @@ class TestTryEtag1(CurlRequest):
 			raise CurlRequestException("Response unexpected etag header response header '%s' (wanted '%s')" % (etag, retrieved_etag1))
 		return super(TestTryEtag1, self).CheckResponse()
 
+class TestTryEtagList1(CurlRequest):
+	URL = "/test.txt"
+	EXPECT_RESPONSE_BODY = ""
+	EXPECT_RESPONSE_CODE = 304
+	ACCEPT_ENCODING = None
+
+	def PrepareRequest(self, reqheaders):
+		global retrieved_etag1
+		if retrieved_etag1 == None:
+			raise CurlRequestException("Don't have a etag value to request")
+		c = self.curl
+		c.setopt(c.HTTPHEADER, reqheaders + ["If-None-Match: \"other\", W/" + retrieved_etag1])
+
+class TestTryEtagPrefix1(CurlRequest):
+	# a prefix of the etag must not match
+	URL = "/test.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT
+	EXPECT_RESPONSE_CODE = 200
+	ACCEPT_ENCODING = None
+
+	def PrepareRequest(self, reqheaders):
+		global retrieved_etag1
+		if retrieved_etag1 == None:
+			raise CurlRequestException("Don't have a etag value to request")
+		c = self.curl
+		c.setopt(c.HTTPHEADER, reqheaders + ["If-None-Match: " + retrieved_etag1[:-2] + '"'])
+
 
 retrieved_etag2 = None
 
@@ -80,4 +107,4 @@ class TestTryEtag2(CurlRequest):
 		return super(TestTryEtag2, self).CheckResponse()
 
 class Test(GroupTest):
-	group = [TestGetEtag1, TestTryEtag1, TestGetEtag2, TestTryEtag2]
+	group = [TestGetEtag1, TestTryEtag1, TestTryEtagList1, TestTryEtagPrefix1, TestGetEtag2, TestTryEtag2]